@@ -0,0 +1,908 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "effect_cache.hpp"
+#include <cstdio> // fclose, fwrite, std::snprintf
+#include <cassert>
+#include <cstddef> // offsetof
+#include <cstdlib> // std::strtoull
+#include <cstring> // std::memcmp, std::memcpy
+#include <chrono>
+#include <vector>
+#include <algorithm> // std::max, std::sort
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/file.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#else
+	#include <Windows.h>
+#endif
+
+// The cache file only consists of this header, which names the data file that is current
+struct version_header
+{
+	char magic[8];
+	uint32_t format_version;
+	uint32_t reserved;
+	uint64_t version;
+};
+// Data files start with this header, followed by a sequence of records
+struct file_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	// Set when a compacted version of the file was written, so that other processes that still have it open know to open the new one instead
+	uint64_t superseded;
+	uint64_t reserved2;
+};
+struct record_header
+{
+	uint32_t magic;
+	uint32_t key_size;
+	uint64_t data_size;
+	// Time in seconds since epoch the record was last looked up, which is the only field that is ever written to after the record was appended
+	uint64_t last_used;
+	uint64_t reserved;
+	reshadefx::hash128 key_hash;
+	reshadefx::hash128 data_hash;
+};
+
+static_assert(sizeof(version_header) == 24);
+static_assert(sizeof(file_header) == 32);
+static_assert(sizeof(record_header) == 64);
+
+static constexpr char version_magic[8] = { 'R', 'S', 'F', 'X', 'C', 'V', 'E', 'R' };
+static constexpr char file_magic[8] = { 'R', 'S', 'F', 'X', 'C', 'A', 'C', 'H' };
+static constexpr uint32_t file_version = 1;
+static constexpr uint32_t record_magic = 0x52435846; // "FXCR"
+// Keys are short identifiers, so anything longer than this indicates a corrupted record
+static constexpr uint32_t max_key_size = 4096;
+
+static uint64_t record_size(uint64_t key_size, uint64_t data_size)
+{
+	// Keep records aligned, so that the record headers can be accessed directly in the mapped file
+	return (sizeof(record_header) + key_size + data_size + 7) & ~uint64_t(7);
+}
+
+static uint64_t current_time()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+static void *open_file_handle(const std::filesystem::path &path)
+{
+#ifndef _WIN32
+	const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return nullptr;
+	return reinterpret_cast<void *>(static_cast<intptr_t>(fd) + 1);
+#else
+	// Allow other processes to delete the file while it is open, so that outdated data files can be removed as soon as the last process closes them
+	const HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	return file;
+#endif
+}
+static void close_file_handle(void *file)
+{
+#ifndef _WIN32
+	::close(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1));
+#else
+	CloseHandle(file);
+#endif
+}
+
+static bool query_file_size(void *file, uint64_t &size)
+{
+#ifndef _WIN32
+	struct stat stats;
+	if (fstat(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1), &stats) != 0)
+		return false;
+	size = static_cast<uint64_t>(stats.st_size);
+#else
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size))
+		return false;
+	size = static_cast<uint64_t>(file_size.QuadPart);
+#endif
+	return true;
+}
+static bool resize_file(void *file, uint64_t size)
+{
+#ifndef _WIN32
+	return ftruncate(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1), static_cast<off_t>(size)) == 0;
+#else
+	LARGE_INTEGER file_size;
+	file_size.QuadPart = static_cast<LONGLONG>(size);
+	return SetFilePointerEx(file, file_size, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+#endif
+}
+
+static bool read_file(void *file, uint64_t offset, void *data, size_t size)
+{
+	uint8_t *bytes = static_cast<uint8_t *>(data);
+
+	while (size != 0)
+	{
+#ifndef _WIN32
+		const ssize_t size_read = pread(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1), bytes, size, static_cast<off_t>(offset));
+		if (size_read <= 0)
+			return false;
+#else
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+		DWORD size_read = 0;
+		if (!ReadFile(file, bytes, size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size), &size_read, &overlapped) || size_read == 0)
+			return false;
+#endif
+
+		bytes += size_read;
+		size -= static_cast<size_t>(size_read);
+		offset += static_cast<uint64_t>(size_read);
+	}
+
+	return true;
+}
+static bool write_file(void *file, uint64_t offset, const void *data, size_t size)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+	while (size != 0)
+	{
+#ifndef _WIN32
+		const ssize_t size_written = pwrite(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1), bytes, size, static_cast<off_t>(offset));
+		if (size_written <= 0)
+			return false;
+#else
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+		DWORD size_written = 0;
+		if (!WriteFile(file, bytes, size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size), &size_written, &overlapped) || size_written == 0)
+			return false;
+#endif
+
+		bytes += size_written;
+		size -= static_cast<size_t>(size_written);
+		offset += static_cast<uint64_t>(size_written);
+	}
+
+	return true;
+}
+
+static bool lock_file(void *file)
+{
+	// This lock is shared with other processes, appending and compacting is serialized through it (while reading never blocks)
+#ifndef _WIN32
+	return flock(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1), LOCK_EX) == 0;
+#else
+	// Lock a byte far past the end of the file, so that the lock does not prevent reading from the file
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = 0xFFFFFFFE;
+	overlapped.OffsetHigh = 0x7FFFFFFF;
+	return LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped) != FALSE;
+#endif
+}
+static void unlock_file(void *file)
+{
+#ifndef _WIN32
+	flock(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1), LOCK_UN);
+#else
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = 0xFFFFFFFE;
+	overlapped.OffsetHigh = 0x7FFFFFFF;
+	UnlockFileEx(file, 0, 1, 0, &overlapped);
+#endif
+}
+
+static bool read_version_header(void *file, version_header &header)
+{
+	uint64_t size = 0;
+	return query_file_size(file, size) && size >= sizeof(header) && read_file(file, 0, &header, sizeof(header)) &&
+		std::memcmp(header.magic, version_magic, sizeof(header.magic)) == 0 && header.format_version == file_version && header.version != 0;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+static inline uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+std::string reshadefx::hash128::to_string() const
+{
+	char buffer[33];
+	std::snprintf(buffer, sizeof(buffer), "%016llx%016llx", static_cast<unsigned long long>(high), static_cast<unsigned long long>(low));
+	return std::string(buffer, 32);
+}
+bool reshadefx::hash128::from_string(std::string_view string, hash128 &value)
+{
+	if (string.size() != 32)
+		return false;
+
+	value = {};
+	for (size_t i = 0; i < 32; ++i)
+	{
+		const char c = string[i];
+		uint64_t digit;
+		if (c >= '0' && c <= '9')
+			digit = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			digit = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			digit = c - 'A' + 10;
+		else
+			return false;
+
+		uint64_t &half = i < 16 ? value.high : value.low;
+		half = (half << 4) | digit;
+	}
+
+	return true;
+}
+
+reshadefx::hash128 reshadefx::compute_hash128(const void *data, size_t size, uint64_t seed)
+{
+	const uint8_t *const bytes = static_cast<const uint8_t *>(data);
+	const size_t num_blocks = size / 16;
+
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+
+	constexpr uint64_t c1 = 0x87c37b91114253d5ull;
+	constexpr uint64_t c2 = 0x4cf5ad432745937full;
+
+	for (size_t i = 0; i < num_blocks; ++i)
+	{
+		uint64_t k1, k2;
+		std::memcpy(&k1, bytes + i * 16, 8);
+		std::memcpy(&k2, bytes + i * 16 + 8, 8);
+
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	const uint8_t *const tail = bytes + num_blocks * 16;
+
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+
+	switch (size & 15)
+	{
+	case 15: k2 ^= static_cast<uint64_t>(tail[14]) << 48; [[fallthrough]];
+	case 14: k2 ^= static_cast<uint64_t>(tail[13]) << 40; [[fallthrough]];
+	case 13: k2 ^= static_cast<uint64_t>(tail[12]) << 32; [[fallthrough]];
+	case 12: k2 ^= static_cast<uint64_t>(tail[11]) << 24; [[fallthrough]];
+	case 11: k2 ^= static_cast<uint64_t>(tail[10]) << 16; [[fallthrough]];
+	case 10: k2 ^= static_cast<uint64_t>(tail[9]) << 8; [[fallthrough]];
+	case 9: k2 ^= static_cast<uint64_t>(tail[8]);
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		[[fallthrough]];
+	case 8: k1 ^= static_cast<uint64_t>(tail[7]) << 56; [[fallthrough]];
+	case 7: k1 ^= static_cast<uint64_t>(tail[6]) << 48; [[fallthrough]];
+	case 6: k1 ^= static_cast<uint64_t>(tail[5]) << 40; [[fallthrough]];
+	case 5: k1 ^= static_cast<uint64_t>(tail[4]) << 32; [[fallthrough]];
+	case 4: k1 ^= static_cast<uint64_t>(tail[3]) << 24; [[fallthrough]];
+	case 3: k1 ^= static_cast<uint64_t>(tail[2]) << 16; [[fallthrough]];
+	case 2: k1 ^= static_cast<uint64_t>(tail[1]) << 8; [[fallthrough]];
+	case 1: k1 ^= static_cast<uint64_t>(tail[0]);
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= static_cast<uint64_t>(size);
+	h2 ^= static_cast<uint64_t>(size);
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	return { h1, h2 };
+}
+
+reshadefx::effect_cache::effect_cache()
+{
+}
+reshadefx::effect_cache::~effect_cache()
+{
+	close();
+}
+
+bool reshadefx::effect_cache::open(const std::filesystem::path &path, uint64_t max_size)
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	close_file();
+
+	_path = path;
+	_max_size = max_size;
+
+	return open_file() && refresh();
+}
+void reshadefx::effect_cache::close()
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	close_file();
+
+	_path.clear();
+}
+
+bool reshadefx::effect_cache::load(std::string_view key, std::string &data)
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_file == nullptr || !refresh())
+		return false;
+
+	const auto it = _entries.find(compute_hash128(key));
+	if (it == _entries.end())
+		return false;
+
+	std::string buffer;
+	const uint8_t *const record = read_data(it->second.offset, it->second.size, buffer);
+	if (record == nullptr)
+		return false;
+
+	record_header header;
+	std::memcpy(&header, record, sizeof(header));
+	const char *const record_key = reinterpret_cast<const char *>(record + sizeof(header));
+
+	// Compare the actual key as well, so that a hash collision can never return the wrong data
+	if (header.key_size != key.size() || std::memcmp(record_key, key.data(), key.size()) != 0)
+		return false;
+
+	data.assign(record_key + header.key_size, static_cast<size_t>(header.data_size));
+
+	// Keep track of when the entry was last used for eviction, but do not bother writing that more than once a minute
+	if (const uint64_t now = current_time();
+		now >= it->second.last_used + 60)
+	{
+		if (write_file(_file, it->second.offset + offsetof(record_header, last_used), &now, sizeof(now)))
+			it->second.last_used = now;
+	}
+
+	return true;
+}
+bool reshadefx::effect_cache::save(std::string_view key, std::string_view data)
+{
+	if (key.size() > max_key_size)
+		return false;
+
+	// Build the record before taking any locks
+	record_header header = {};
+	header.magic = record_magic;
+	header.key_size = static_cast<uint32_t>(key.size());
+	header.data_size = data.size();
+	header.last_used = current_time();
+	header.key_hash = compute_hash128(key);
+	header.data_hash = compute_hash128(data);
+
+	std::string record(static_cast<size_t>(record_size(key.size(), data.size())), '\0');
+	std::memcpy(record.data(), &header, sizeof(header));
+	std::memcpy(record.data() + sizeof(header), key.data(), key.size());
+	std::memcpy(record.data() + sizeof(header) + key.size(), data.data(), data.size());
+
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	// Entries that do not fit into the size the data file is shrunk to when it grows too large would be evicted again right away, so do not write them in the first place
+	if (_max_size != 0 && sizeof(file_header) + record.size() > _max_size - _max_size / 4)
+		return false;
+
+	if (_file == nullptr || !lock_and_refresh())
+		return false;
+
+	// Records are only ever appended after the last complete record, which overwrites whatever remains of a record that was not completely written (e.g. because the process writing it crashed)
+	const uint64_t offset = _valid_size;
+	const bool written = write_file(_file, offset, record.data(), record.size());
+	if (written)
+	{
+		entry &entry = _entries[header.key_hash];
+		if (entry.size != 0)
+			_used_size -= entry.size;
+		entry.offset = offset;
+		entry.size = record.size();
+		entry.last_used = header.last_used;
+
+		_used_size += record.size();
+		_valid_size += record.size();
+	}
+
+	unlock_file(_version_file);
+
+	// Evict entries once the file grows too large, and then some more, so that this does not need to happen again on the next append already
+	if (written && _max_size != 0 && _valid_size > _max_size)
+		compact_locked(_max_size - _max_size / 4);
+
+	return written;
+}
+
+bool reshadefx::effect_cache::clear()
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	// No record fits into a file of just the header size, so this evicts all of them
+	return _file != nullptr && compact_locked(sizeof(file_header));
+}
+bool reshadefx::effect_cache::compact(uint64_t max_size)
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	return _file != nullptr && compact_locked(max_size);
+}
+
+size_t reshadefx::effect_cache::num_entries()
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_file == nullptr || !refresh())
+		return 0;
+
+	return _entries.size();
+}
+uint64_t reshadefx::effect_cache::file_size()
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	uint64_t size = 0;
+	if (_file == nullptr || !refresh() || !query_file_size(_file, size))
+		return 0;
+
+	return size;
+}
+uint64_t reshadefx::effect_cache::used_size()
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_file == nullptr || !refresh())
+		return 0;
+
+	return _used_size;
+}
+
+bool reshadefx::effect_cache::refresh()
+{
+	assert(_file != nullptr);
+
+	// Switch over to the new data file if another process compacted the cache
+	if (is_superseded())
+	{
+		if (!lock_file(_version_file))
+			return false;
+		const bool opened = open_data_file_locked();
+		unlock_file(_version_file);
+		if (!opened)
+			return false;
+	}
+
+	uint64_t size = 0;
+	if (!query_file_size(_file, size) || size < sizeof(file_header))
+		return false;
+
+	if (size == _valid_size)
+		return true; // Nothing was appended since the last time
+
+	// Map the file again once it grew well past the current view
+	// If that fails (e.g. because a 32-bit process cannot find enough contiguous address space), keep using the current view and read everything past it from the file directly
+	if (size > _mapped_size && size >= _remap_size)
+		map_file(size);
+
+	// Walk through all records that were appended since the last time
+	// Stop at the first one that is incomplete or damaged, since it is not possible to tell where the next record would start after it (and records are only ever appended after the last valid one anyway)
+	std::string buffer;
+	uint64_t offset = _valid_size;
+	while (offset + sizeof(record_header) <= size)
+	{
+		const uint8_t *const header_data = read_data(offset, sizeof(record_header), buffer);
+		if (header_data == nullptr)
+			break;
+
+		record_header header;
+		std::memcpy(&header, header_data, sizeof(header));
+
+		if (header.magic != record_magic || header.key_size > max_key_size || header.data_size > size - offset)
+			break;
+
+		const uint64_t total_size = record_size(header.key_size, header.data_size);
+		if (total_size > size - offset)
+			break;
+
+		const uint8_t *const key = read_data(offset + sizeof(header), header.key_size + header.data_size, buffer);
+		if (key == nullptr ||
+			compute_hash128(key, header.key_size) != header.key_hash ||
+			compute_hash128(key + header.key_size, static_cast<size_t>(header.data_size)) != header.data_hash)
+			break;
+
+		// Later records replace earlier ones with the same key
+		entry &entry = _entries[header.key_hash];
+		if (entry.size != 0)
+			_used_size -= entry.size;
+		entry.offset = offset;
+		entry.size = total_size;
+		entry.last_used = header.last_used;
+
+		_used_size += total_size;
+
+		offset += total_size;
+	}
+
+	_valid_size = offset;
+
+	return true;
+}
+
+bool reshadefx::effect_cache::lock_and_refresh()
+{
+	if (!lock_file(_version_file))
+		return false;
+
+	// Another process may have compacted the cache while waiting for the lock, in which case have to continue with the new data file
+	if (is_superseded() && !open_data_file_locked())
+	{
+		unlock_file(_version_file);
+		return false;
+	}
+
+	// Pick up records other processes appended while waiting for the lock
+	if (!refresh())
+	{
+		unlock_file(_version_file);
+		return false;
+	}
+
+	return true;
+}
+
+bool reshadefx::effect_cache::compact_locked(uint64_t max_size)
+{
+	if (!lock_and_refresh())
+		return false;
+
+	// Keep the most recently used entries, up to the size limit
+	std::vector<entry> entries;
+	entries.reserve(_entries.size());
+	for (const std::pair<const hash128, entry> &entry : _entries)
+		entries.push_back(entry.second);
+
+	std::sort(entries.begin(), entries.end(),
+		[](const entry &lhs, const entry &rhs) {
+			return lhs.last_used != rhs.last_used ? lhs.last_used > rhs.last_used : lhs.offset > rhs.offset;
+		});
+
+	// Write a new version of the data file next to the current one, since mapped files can neither be shrunk in place nor be replaced (other processes may have the current one mapped too)
+	const uint64_t new_version = _version + 1;
+	const std::filesystem::path new_path = data_file_path(new_version);
+
+#ifndef _WIN32
+	FILE *const new_file = fopen(new_path.c_str(), "wb");
+#else
+	FILE *const new_file = _wfsopen(new_path.c_str(), L"wb", SH_DENYWR);
+#endif
+	if (new_file == nullptr)
+	{
+		unlock_file(_version_file);
+		return false;
+	}
+
+	file_header header = {};
+	std::memcpy(header.magic, file_magic, sizeof(header.magic));
+	header.version = file_version;
+
+	bool written = fwrite(&header, sizeof(header), 1, new_file) == 1;
+
+	uint64_t size = sizeof(header);
+	std::vector<entry> kept_entries;
+	for (const entry &entry : entries)
+	{
+		// Skip entries that do not fit anymore, but keep going, since less recently used ones that are smaller may still fit
+		if (max_size != 0 && size + entry.size > max_size)
+			continue;
+
+		kept_entries.push_back(entry);
+		size += entry.size;
+	}
+
+	// Write the least recently used entries first, so that the order of records still breaks ties between entries that were last used at the same time
+	std::string buffer;
+	for (auto it = kept_entries.crbegin(); it != kept_entries.crend() && written; ++it)
+	{
+		const uint8_t *const record = read_data(it->offset, it->size, buffer);
+		written = record != nullptr && fwrite(record, 1, static_cast<size_t>(it->size), new_file) == it->size;
+	}
+
+	written = (fclose(new_file) == 0) && written;
+
+	// Only switch to the new data file once it was completely written
+	version_header version = {};
+	std::memcpy(version.magic, version_magic, sizeof(version.magic));
+	version.format_version = file_version;
+	version.version = new_version;
+
+	if (!written || !write_file(_version_file, 0, &version, sizeof(version)))
+	{
+		std::error_code ec;
+		std::filesystem::remove(new_path, ec);
+		unlock_file(_version_file);
+		return false;
+	}
+
+	// Let other processes know that the data file they may still have open was superseded
+	const uint64_t superseded = 1;
+	write_file(_file, offsetof(file_header, superseded), &superseded, sizeof(superseded));
+
+	// This unmaps and closes the old data file before it is removed
+	const bool opened = open_data_file_locked();
+
+	unlock_file(_version_file);
+
+	return opened && refresh();
+}
+
+std::filesystem::path reshadefx::effect_cache::data_file_path(uint64_t version) const
+{
+	std::filesystem::path path = _path;
+	path += '.' + std::to_string(version);
+	return path;
+}
+
+bool reshadefx::effect_cache::is_superseded() const
+{
+	if (_mapped_data != nullptr)
+		return reinterpret_cast<const volatile file_header *>(_mapped_data)->superseded != 0;
+
+	uint64_t superseded = 0;
+	return _file != nullptr && read_file(_file, offsetof(file_header, superseded), &superseded, sizeof(superseded)) && superseded != 0;
+}
+
+bool reshadefx::effect_cache::open_file()
+{
+	assert(_version_file == nullptr && _file == nullptr);
+
+	_version_file = open_file_handle(_path);
+	if (_version_file == nullptr)
+		return false;
+
+	if (!lock_file(_version_file))
+	{
+		close_file();
+		return false;
+	}
+
+	const bool opened = open_data_file_locked();
+
+	unlock_file(_version_file);
+
+	if (!opened)
+		close_file();
+	return opened;
+}
+void reshadefx::effect_cache::close_file()
+{
+	const bool superseded = is_superseded();
+
+	close_data_file();
+
+	if (_version_file == nullptr)
+		return;
+
+	// Remove the data file that was just closed if it is outdated, in case this was the last process to have it open
+	if (superseded && lock_file(_version_file))
+	{
+		if (version_header version;
+			read_version_header(_version_file, version))
+			remove_old_data_files_locked(version.version);
+		unlock_file(_version_file);
+	}
+
+	close_file_handle(_version_file);
+	_version_file = nullptr;
+	_version = 0;
+}
+
+bool reshadefx::effect_cache::open_data_file_locked()
+{
+	assert(_version_file != nullptr);
+
+	close_data_file();
+
+	_entries.clear();
+	_valid_size = sizeof(file_header);
+	_used_size = sizeof(file_header);
+
+	// Find out which version of the data file is current, initializing the cache file if it was not written yet
+	version_header version;
+	if (!read_version_header(_version_file, version))
+	{
+		version = {};
+		std::memcpy(version.magic, version_magic, sizeof(version.magic));
+		version.format_version = file_version;
+		version.version = 1;
+
+		if (!write_file(_version_file, 0, &version, sizeof(version)))
+			return false;
+
+		// Drop anything that follows the header, like data written by versions that stored entries in this file directly
+		resize_file(_version_file, sizeof(version));
+	}
+
+	_version = version.version;
+
+	_file = open_file_handle(data_file_path(_version));
+	if (_file == nullptr)
+		return false;
+
+	// Initialize new files and start over with files that were written by an incompatible version
+	// Any records that follow are not recognized anymore after that and are overwritten by new ones over time
+	file_header header = {};
+	uint64_t size = 0;
+	if (!query_file_size(_file, size))
+	{
+		close_data_file();
+		return false;
+	}
+
+	bool valid = false;
+	if (size >= sizeof(header) && read_file(_file, 0, &header, sizeof(header)))
+	{
+		// A data file that is current cannot have been superseded, so something went wrong while compacting, but since records are still intact, just keep using it
+		valid = std::memcmp(header.magic, file_magic, sizeof(header.magic)) == 0 && header.version == file_version && header.superseded == 0;
+	}
+
+	if (!valid)
+	{
+		const bool keep_records = std::memcmp(header.magic, file_magic, sizeof(header.magic)) == 0 && header.version == file_version;
+
+		header = {};
+		std::memcpy(header.magic, file_magic, sizeof(header.magic));
+		header.version = file_version;
+
+		if (!write_file(_file, 0, &header, sizeof(header)))
+		{
+			close_data_file();
+			return false;
+		}
+
+		if (!keep_records)
+			resize_file(_file, sizeof(header));
+	}
+
+	remove_old_data_files_locked(_version);
+
+	return true;
+}
+void reshadefx::effect_cache::close_data_file()
+{
+	if (_file == nullptr)
+		return;
+
+#ifndef _WIN32
+	if (_mapped_data != nullptr)
+		munmap(const_cast<uint8_t *>(_mapped_data), static_cast<size_t>(_mapped_size));
+#else
+	if (_mapped_data != nullptr)
+		UnmapViewOfFile(_mapped_data);
+	if (_file_mapping != nullptr)
+		CloseHandle(_file_mapping);
+#endif
+	close_file_handle(_file);
+
+	_file = nullptr;
+	_file_mapping = nullptr;
+	_mapped_data = nullptr;
+	_mapped_size = 0;
+	_remap_size = 0;
+
+	_entries.clear();
+	_valid_size = 0;
+	_used_size = 0;
+}
+
+void reshadefx::effect_cache::remove_old_data_files_locked(uint64_t current_version)
+{
+	std::error_code ec;
+	const std::string prefix = _path.filename().u8string() + '.';
+
+	// New data files are only written while holding the lock, so any data file other than the current one is outdated
+	// Removing those fails while other processes still have them open (on Windows), in which case it is tried again later, when they are closed or the next time the cache is compacted
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(_path.has_parent_path() ? _path.parent_path() : std::filesystem::path("."), std::filesystem::directory_options::skip_permission_denied, ec))
+	{
+		const std::string filename = entry.path().filename().u8string();
+		if (filename.size() <= prefix.size() || filename.compare(0, prefix.size(), prefix) != 0 ||
+			filename.find_first_not_of("0123456789", prefix.size()) != std::string::npos)
+			continue;
+
+		if (std::strtoull(filename.c_str() + prefix.size(), nullptr, 10) != current_version)
+			std::filesystem::remove(entry.path(), ec);
+	}
+}
+
+bool reshadefx::effect_cache::map_file(uint64_t size)
+{
+	assert(_file != nullptr && size != 0);
+
+	// Do not try again before the file grew by a good amount, regardless of whether mapping it succeeds, so that appending records does not cause it to be mapped again every time
+	const uint64_t headroom = std::max(size / 2, static_cast<uint64_t>(4 * 1024 * 1024));
+	_remap_size = size + headroom;
+
+	if (static_cast<uint64_t>(static_cast<size_t>(size)) != size)
+		return false; // File does not fit into the address space
+
+	// Map the new view before unmapping the old one, so that the old one can continue to be used if this fails
+#ifndef _WIN32
+	// Views may extend past the end of the file, which lets appended records be read through this view too without mapping it again
+	// Only the part that is covered by the file is ever accessed (anything else would raise a bus error)
+	uint64_t view_size = size + headroom;
+	void *mapped_data = MAP_FAILED;
+	if (static_cast<uint64_t>(static_cast<size_t>(view_size)) == view_size)
+		mapped_data = mmap(nullptr, static_cast<size_t>(view_size), PROT_READ, MAP_SHARED, static_cast<int>(reinterpret_cast<intptr_t>(_file) - 1), 0);
+	if (mapped_data == MAP_FAILED)
+		mapped_data = mmap(nullptr, static_cast<size_t>(view_size = size), PROT_READ, MAP_SHARED, static_cast<int>(reinterpret_cast<intptr_t>(_file) - 1), 0);
+	if (mapped_data == MAP_FAILED)
+		return false;
+
+	if (_mapped_data != nullptr)
+		munmap(const_cast<uint8_t *>(_mapped_data), static_cast<size_t>(_mapped_size));
+#else
+	// Read-only views cannot extend past the end of the file, so records appended after this are read from the file directly until it is mapped again
+	const uint64_t view_size = size;
+
+	const HANDLE file_mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, static_cast<DWORD>(view_size >> 32), static_cast<DWORD>(view_size), nullptr);
+	if (file_mapping == nullptr)
+		return false;
+
+	void *const mapped_data = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(view_size));
+	if (mapped_data == nullptr)
+	{
+		CloseHandle(file_mapping);
+		return false;
+	}
+
+	if (_mapped_data != nullptr)
+		UnmapViewOfFile(_mapped_data);
+	if (_file_mapping != nullptr)
+		CloseHandle(_file_mapping);
+	_file_mapping = file_mapping;
+#endif
+
+	_mapped_data = static_cast<const uint8_t *>(mapped_data);
+	_mapped_size = view_size;
+	return true;
+}
+const uint8_t *reshadefx::effect_cache::read_data(uint64_t offset, uint64_t size, std::string &buffer) const
+{
+	if (_mapped_data != nullptr && offset + size <= _mapped_size)
+		return _mapped_data + offset;
+
+	// Fall back to reading from the file directly for anything that is not covered by the mapped view
+	if (static_cast<uint64_t>(static_cast<size_t>(size)) != size)
+		return nullptr;
+
+	buffer.resize(static_cast<size_t>(size));
+	if (!read_file(_file, offset, buffer.data(), buffer.size()))
+		return nullptr;
+
+	return reinterpret_cast<const uint8_t *>(buffer.data());
+}
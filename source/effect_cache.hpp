@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <unordered_map>
+
+namespace reshadefx
+{
+	/// <summary>
+	/// A 128-bit hash value.
+	/// </summary>
+	struct hash128
+	{
+		uint64_t low = 0;
+		uint64_t high = 0;
+
+		bool operator==(const hash128 &other) const { return low == other.low && high == other.high; }
+		bool operator!=(const hash128 &other) const { return low != other.low || high != other.high; }
+
+		/// <summary>
+		/// Formats the hash value as a string of 32 hexadecimal digits.
+		/// </summary>
+		std::string to_string() const;
+		/// <summary>
+		/// Parses a hash value formatted with <see cref="to_string"/>.
+		/// </summary>
+		/// <returns><see langword="true"/> if the string consisted of exactly 32 hexadecimal digits, <see langword="false"/> otherwise.</returns>
+		static bool from_string(std::string_view string, hash128 &value);
+	};
+
+	/// <summary>
+	/// Computes a 128-bit hash of the specified data (using the x64 128-bit variant of MurmurHash3).
+	/// </summary>
+	hash128 compute_hash128(const void *data, size_t size, uint64_t seed = 0);
+	inline hash128 compute_hash128(std::string_view data, uint64_t seed = 0) { return compute_hash128(data.data(), data.size(), seed); }
+
+	/// <summary>
+	/// A persistent key-value store for effect compilation results, which packs all entries into a single data file.
+	/// The data file is a sequence of records that are only ever appended to, each consisting of a header, the key and the data, so the index of entries is rebuilt by walking the record headers when the file is opened.
+	/// The data file is memory-mapped for reading (records appended past the mapped view are read from the file directly until it is mapped again), can be shared by multiple processes and is bounded in size by evicting the least recently used entries when it grows too large.
+	/// Evicting entries writes a new version of the data file next to the old one (named after the cache file with the version number appended), since files that are mapped cannot be replaced.
+	/// The cache file itself only names the version that is current and is locked to serialize changes across processes.
+	/// </summary>
+	class effect_cache
+	{
+	public:
+		effect_cache();
+		~effect_cache();
+
+		effect_cache(const effect_cache &) = delete;
+		effect_cache &operator=(const effect_cache &) = delete;
+
+		/// <summary>
+		/// Opens the cache file at the specified <paramref name="path"/>, creating it if it does not exist yet.
+		/// </summary>
+		/// <param name="path">Path to the cache file.</param>
+		/// <param name="max_size">Size in bytes the cache file may grow to before the least recently used entries are evicted, or zero to let it grow without bounds.</param>
+		bool open(const std::filesystem::path &path, uint64_t max_size);
+		/// <summary>
+		/// Closes the cache file.
+		/// </summary>
+		void close();
+
+		/// <summary>
+		/// Gets the path to the currently open cache file.
+		/// </summary>
+		const std::filesystem::path &path() const { return _path; }
+		/// <summary>
+		/// Gets the size in bytes the cache file may grow to before entries are evicted.
+		/// </summary>
+		uint64_t max_size() const { return _max_size; }
+
+		/// <summary>
+		/// Looks up the data stored under the specified <paramref name="key"/>.
+		/// </summary>
+		bool load(std::string_view key, std::string &data);
+		/// <summary>
+		/// Stores the specified <paramref name="data"/> under the specified <paramref name="key"/>, replacing any data previously stored under it.
+		/// </summary>
+		bool save(std::string_view key, std::string_view data);
+
+		/// <summary>
+		/// Removes all entries from the cache.
+		/// </summary>
+		bool clear();
+		/// <summary>
+		/// Rewrites the cache file to only contain the most recent data of every key, evicting the least recently used entries until the file fits into <paramref name="max_size"/> bytes.
+		/// </summary>
+		/// <param name="max_size">Size in bytes the cache file may have afterwards, or zero to keep all entries.</param>
+		bool compact(uint64_t max_size);
+
+		/// <summary>
+		/// Gets the number of entries in the cache.
+		/// </summary>
+		size_t num_entries();
+		/// <summary>
+		/// Gets the current size of the data file in bytes.
+		/// </summary>
+		uint64_t file_size();
+		/// <summary>
+		/// Gets the number of bytes in the data file that are still in use, i.e. what the data file would shrink to when compacted without evicting entries.
+		/// </summary>
+		uint64_t used_size();
+
+	private:
+		struct hash128_hash
+		{
+			size_t operator()(const hash128 &value) const { return static_cast<size_t>(value.low); }
+		};
+		struct entry
+		{
+			uint64_t offset;
+			uint64_t size;
+			uint64_t last_used;
+		};
+
+		bool open_file();
+		void close_file();
+		bool open_data_file_locked();
+		void close_data_file();
+		void remove_old_data_files_locked(uint64_t current_version);
+		bool map_file(uint64_t size);
+		const uint8_t *read_data(uint64_t offset, uint64_t size, std::string &buffer) const;
+
+		std::filesystem::path data_file_path(uint64_t version) const;
+
+		bool is_superseded() const;
+		bool refresh();
+		bool lock_and_refresh();
+		bool compact_locked(uint64_t max_size);
+
+		std::mutex _mutex;
+		std::filesystem::path _path;
+		uint64_t _max_size = 0;
+
+		// The cache file, which holds the version of the data file that is current
+		void *_version_file = nullptr;
+		uint64_t _version = 0;
+
+		void *_file = nullptr;
+		void *_file_mapping = nullptr;
+		const uint8_t *_mapped_data = nullptr;
+		uint64_t _mapped_size = 0;
+		// File size at which the view is mapped again
+		uint64_t _remap_size = 0;
+
+		// End of the last complete record, which is where the next one is appended
+		uint64_t _valid_size = 0;
+		uint64_t _used_size = 0;
+		std::unordered_map<hash128, entry, hash128_hash> _entries;
+	};
+}
@@ -17,8 +17,14 @@ namespace reshadefx
 	class codegen
 	{
 		friend class parser;
+		friend class codegen_fanout;
 
 	public:
+		codegen()
+		{
+			// Reserve the first source file index for locations without a source file
+			_source_files.intern({});
+		}
 		/// <summary>
 		/// Virtual destructor to guarantee that memory of the implementations deriving from this interface is properly destroyed.
 		/// </summary>
@@ -35,6 +41,7 @@ namespace reshadefx
 		virtual std::basic_string<char> finalize_code() const = 0;
 		/// <summary>
 		/// Finalizes and returns the generated code for the specified entry point (and no other entry points).
+		/// This does not modify the code generator, so may be called for different entry points from multiple threads at the same time.
 		/// </summary>
 		/// <param name="entry_point_name">Name of the entry point function to generate code for.</param>
 		virtual std::basic_string<char> finalize_code_for_entry_point(const std::string &entry_point_name) const = 0;
@@ -374,6 +381,7 @@ namespace reshadefx
 		id make_id() { return _next_id++; }
 
 		effect_module _module;
+		string_table _source_files;
 		std::vector<struct_type> _structs;
 		std::vector<std::unique_ptr<function>> _functions;
 
@@ -391,14 +399,16 @@ namespace reshadefx
 	/// <param name="uniforms_to_spec_constants">Whether to convert uniform variables to specialization constants.</param>
 	/// <param name="enable_16bit_types">Use real 16-bit types for the minimum precision types "min16int", "min16uint" and "min16float".</param>
 	/// <param name="flip_vert_y">Insert code to flip the Y component of the output position in vertex shaders.</param>
-	codegen *create_codegen_glsl(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types = false, bool flip_vert_y = false);
+	/// <param name="optimize">Fold constant operations and reuse the results of identical operations before passing them on to the back-end.</param>
+	codegen *create_codegen_glsl(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types = false, bool flip_vert_y = false, bool optimize = false);
 	/// <summary>
 	/// Creates a back-end implementation for HLSL code generation.
 	/// </summary>
 	/// <param name="shader_model">The HLSL shader model version (e.g. 30, 41, 50, 60, ...)</param>
 	/// <param name="debug_info">Whether to append debug information like line directives to the generated code.</param>
 	/// <param name="uniforms_to_spec_constants">Whether to convert uniform variables to specialization constants.</param>
-	codegen *create_codegen_hlsl(unsigned int shader_model, bool debug_info, bool uniforms_to_spec_constants);
+	/// <param name="optimize">Fold constant operations and reuse the results of identical operations before passing them on to the back-end.</param>
+	codegen *create_codegen_hlsl(unsigned int shader_model, bool debug_info, bool uniforms_to_spec_constants, bool optimize = false);
 	/// <summary>
 	/// Creates a back-end implementation for SPIR-V code generation.
 	/// </summary>
@@ -407,5 +417,13 @@ namespace reshadefx
 	/// <param name="uniforms_to_spec_constants">Whether to convert uniform variables to specialization constants.</param>
 	/// <param name="enable_16bit_types">Use real 16-bit types for the minimum precision types "min16int", "min16uint" and "min16float".</param>
 	/// <param name="flip_vert_y">Insert code to flip the Y component of the output position in vertex shaders.</param>
-	codegen *create_codegen_spirv(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types = false, bool flip_vert_y = false);
+	/// <param name="optimize">Fold constant operations and reuse the results of identical operations before passing them on to the back-end.</param>
+	codegen *create_codegen_spirv(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types = false, bool flip_vert_y = false, bool optimize = false);
+
+	/// <summary>
+	/// Creates a code generator that passes everything on to multiple back-end implementations, so that code for all of them is generated from a single parse.
+	/// The module and code returned by the code generator itself are those of the first back-end.
+	/// </summary>
+	/// <param name="targets">The back-end implementations to generate code with. These are not owned by the returned code generator and have to outlive it.</param>
+	codegen *create_codegen_fanout(const std::vector<codegen *> &targets);
 }
@@ -0,0 +1,637 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "effect_parser.hpp"
+#include "effect_codegen.hpp"
+#include <cassert>
+#include <unordered_map>
+
+using namespace reshadefx;
+
+namespace reshadefx
+{
+	/// <summary>
+	/// A code generator that forwards everything the parser emits to multiple other code generators, so that code for several targets can be generated from a single parse.
+	/// Every target allocates its own IDs, so this keeps a mapping from the IDs handed out to the parser to those of each target.
+	/// </summary>
+	class codegen_fanout final : public codegen
+	{
+	public:
+		explicit codegen_fanout(const std::vector<codegen *> &targets) :
+			_targets(targets),
+			_id_maps(targets.size(), std::vector<id>(1)),
+			_pending_functions(targets.size()),
+			_entry_point_names(targets.size()),
+			_results(targets.size())
+		{
+			assert(!targets.empty());
+		}
+
+		std::basic_string<char> finalize_code() const override
+		{
+			return _targets[0]->finalize_code();
+		}
+		std::basic_string<char> finalize_code_for_entry_point(const std::string &entry_point_name) const override
+		{
+			return _targets[0]->finalize_code_for_entry_point(entry_point_name);
+		}
+
+	private:
+		std::vector<codegen *> _targets;
+		// Maps every ID handed out to the parser to the matching ID in each target (indexed by the former)
+		std::vector<std::vector<id>> _id_maps;
+		// Maps IDs of the first target back to the ones handed out to the parser
+		std::unordered_map<id, id> _reverse_id_map;
+		// Copies of the function currently being declared by the parser, before it was defined
+		std::vector<function> _pending_functions;
+		const function *_synced_function = nullptr;
+		// Targets may rename entry points, so keep track of the names each of them chose
+		std::vector<std::unordered_map<std::string, std::string>> _entry_point_names;
+		std::vector<id> _results;
+
+		id translate(size_t target, id id) const
+		{
+			assert(id < _id_maps[target].size());
+			return _id_maps[target][id];
+		}
+		type translate(size_t target, type type) const
+		{
+			if (type.is_struct())
+				type.struct_definition = translate(target, type.struct_definition);
+			return type;
+		}
+		expression translate(size_t target, expression exp) const
+		{
+			exp.base = translate(target, exp.base);
+			exp.type = translate(target, exp.type);
+			for (expression::operation &op : exp.chain)
+			{
+				op.from = translate(target, op.from);
+				op.to = translate(target, op.to);
+				if (op.op == expression::operation::op_dynamic_index)
+					op.index = translate(target, op.index);
+			}
+			return exp;
+		}
+		std::vector<expression> translate(size_t target, const std::vector<expression> &args) const
+		{
+			std::vector<expression> result;
+			result.reserve(args.size());
+			for (const expression &arg : args)
+				result.push_back(translate(target, arg));
+			return result;
+		}
+		void translate_references(size_t target, const function &func, function &result) const
+		{
+			result.referenced_samplers.clear();
+			for (const id sampler : func.referenced_samplers)
+				result.referenced_samplers.push_back(translate(target, sampler));
+			result.referenced_storages.clear();
+			for (const id storage : func.referenced_storages)
+				result.referenced_storages.push_back(translate(target, storage));
+			result.referenced_functions.clear();
+			for (const id function : func.referenced_functions)
+				result.referenced_functions.push_back(translate(target, function));
+		}
+		function translate(size_t target, const function &func) const
+		{
+			function result = func;
+			result.id = translate(target, func.id);
+			result.return_type = translate(target, func.return_type);
+			for (member_type &param : result.parameter_list)
+			{
+				param.id = translate(target, param.id);
+				param.type = translate(target, param.type);
+			}
+			translate_references(target, func, result);
+			return result;
+		}
+
+		/// <summary>
+		/// Combines the IDs the targets returned for the same operation (in <see cref="_results"/>) into a single ID to hand out to the parser.
+		/// </summary>
+		id map_results()
+		{
+			// Reuse an existing ID if all targets returned the one they returned for it before (e.g. when a constant variable was replaced with its initializer)
+			if (const auto it = _reverse_id_map.find(_results[0]);
+				_results[0] == 0 || it != _reverse_id_map.end())
+			{
+				const id existing = _results[0] == 0 ? 0 : it->second;
+
+				bool matches = true;
+				for (size_t target = 1; target < _targets.size() && matches; ++target)
+					matches = _id_maps[target][existing] == _results[target];
+
+				if (matches)
+					return existing;
+			}
+
+			const id res = make_id();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				_id_maps[target].resize(res + 1);
+				_id_maps[target][res] = _results[target];
+			}
+
+			_reverse_id_map.emplace(_results[0], res);
+
+			return res;
+		}
+
+		/// <summary>
+		/// Updates state the parser modifies directly in this code generator in all targets as well.
+		/// </summary>
+		void sync_targets()
+		{
+			for (codegen *const target : _targets)
+				for (uint32_t index = static_cast<uint32_t>(target->_source_files.size()); index < _source_files.size(); ++index)
+					target->_source_files.intern(_source_files.name(index));
+
+			if (_current_function != _synced_function || (_current_function != nullptr && _current_function->id == 0))
+			{
+				_synced_function = _current_function;
+
+				// The parser points this to a function that is still being declared before it is defined, so forward a copy of that
+				if (_current_function != nullptr && _current_function->id == 0)
+				{
+					for (size_t target = 0; target < _targets.size(); ++target)
+					{
+						_pending_functions[target] = translate(target, *_current_function);
+						_targets[target]->_current_function = &_pending_functions[target];
+					}
+				}
+			}
+		}
+		void sync_blocks()
+		{
+			// Targets may create blocks internally (e.g. when defining a function), so these are mapped like any other result
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->_current_block;
+			_current_block = map_results();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->_last_block;
+			_last_block = map_results();
+		}
+
+		id   define_struct(const location &loc, struct_type &info) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				struct_type target_info = info;
+				for (member_type &member : target_info.member_list)
+					member.type = translate(target, member.type);
+
+				_results[target] = _targets[target]->define_struct(loc, target_info);
+			}
+
+			const id res = info.id = map_results();
+
+			_structs.push_back(info);
+
+			return res;
+		}
+		id   define_texture(const location &loc, texture &info) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				texture target_info = info;
+				_results[target] = _targets[target]->define_texture(loc, target_info);
+			}
+
+			const id res = info.id = map_results();
+
+			_module.textures.push_back(info);
+
+			return res;
+		}
+		id   define_sampler(const location &loc, const texture &tex_info, sampler &info) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				texture target_tex_info = tex_info;
+				target_tex_info.id = translate(target, tex_info.id);
+				sampler target_info = info;
+				_results[target] = _targets[target]->define_sampler(loc, target_tex_info, target_info);
+			}
+
+			const id res = info.id = map_results();
+
+			_module.samplers.push_back(info);
+
+			return res;
+		}
+		id   define_storage(const location &loc, const texture &tex_info, storage &info) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				texture target_tex_info = tex_info;
+				target_tex_info.id = translate(target, tex_info.id);
+				storage target_info = info;
+				_results[target] = _targets[target]->define_storage(loc, target_tex_info, target_info);
+			}
+
+			const id res = info.id = map_results();
+
+			_module.storages.push_back(info);
+
+			return res;
+		}
+		id   define_uniform(const location &loc, uniform &info) override
+		{
+			sync_targets();
+
+			uniform first_target_info;
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				uniform target_info = info;
+				target_info.type = translate(target, info.type);
+				_results[target] = _targets[target]->define_uniform(loc, target_info);
+
+				if (target == 0)
+					first_target_info = std::move(target_info);
+			}
+
+			// Layout information depends on the target, so report the one of the first target back
+			first_target_info.type = info.type;
+			info = std::move(first_target_info);
+
+			return map_results();
+		}
+		id   define_variable(const location &loc, const type &type, std::string name, bool global, id initializer_value) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->define_variable(loc, translate(target, type), name, global, translate(target, initializer_value));
+
+			return map_results();
+		}
+		id   define_function(const location &loc, function &info) override
+		{
+			sync_targets();
+
+			std::vector<function> target_infos;
+			target_infos.reserve(_targets.size());
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				function &target_info = target_infos.emplace_back(translate(target, info));
+				_results[target] = _targets[target]->define_function(loc, target_info);
+			}
+
+			const id res = info.id = map_results();
+
+			// Back-ends may escape the name, so report the one of the first target back (same as for entry points below)
+			info.unique_name = target_infos[0].unique_name;
+
+			for (size_t i = 0; i < info.parameter_list.size(); ++i)
+			{
+				for (size_t target = 0; target < _targets.size(); ++target)
+					_results[target] = target_infos[target].parameter_list[i].id;
+
+				info.parameter_list[i].id = map_results();
+			}
+
+			_functions.push_back(std::make_unique<function>(info));
+			_current_function = _functions.back().get();
+			_synced_function = _current_function;
+
+			sync_blocks();
+
+			return res;
+		}
+
+		void define_entry_point(function &func) override
+		{
+			sync_targets();
+
+			std::string first_target_name;
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				function target_func = translate(target, func);
+				target_func.unique_name = _targets[target]->get_function(target_func.id).unique_name;
+				_targets[target]->define_entry_point(target_func);
+
+				if (target == 0)
+					first_target_name = target_func.unique_name;
+				_entry_point_names[target][first_target_name] = target_func.unique_name;
+			}
+
+			func.unique_name = std::move(first_target_name);
+		}
+
+		id   emit_load(const expression &chain, bool force_new_id) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_load(translate(target, chain), force_new_id);
+
+			return map_results();
+		}
+		void emit_store(const expression &chain, id value) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_targets[target]->emit_store(translate(target, chain), translate(target, value));
+		}
+		id   emit_access_chain(const expression &chain, size_t &chain_index) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				size_t target_chain_index = 0;
+				_results[target] = _targets[target]->emit_access_chain(translate(target, chain), target_chain_index);
+
+				// All targets have to consume the same part of the access chain, since the parser continues from there
+				if (target == 0)
+					chain_index = target_chain_index;
+				else
+					assert(target_chain_index == chain_index);
+			}
+
+			return map_results();
+		}
+
+		id   emit_constant(const type &type, const constant &data) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_constant(translate(target, type), data);
+
+			return map_results();
+		}
+
+		id   emit_unary_op(const location &loc, tokenid op, const type &type, id val) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_unary_op(loc, op, translate(target, type), translate(target, val));
+
+			return map_results();
+		}
+		id   emit_binary_op(const location &loc, tokenid op, const type &res_type, const type &type, id lhs, id rhs) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_binary_op(loc, op, translate(target, res_type), translate(target, type), translate(target, lhs), translate(target, rhs));
+
+			return map_results();
+		}
+		id   emit_ternary_op(const location &loc, tokenid op, const type &type, id condition, id true_value, id false_value) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_ternary_op(loc, op, translate(target, type), translate(target, condition), translate(target, true_value), translate(target, false_value));
+
+			return map_results();
+		}
+		id   emit_call(const location &loc, id function, const type &res_type, const std::vector<expression> &args) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_call(loc, translate(target, function), translate(target, res_type), translate(target, args));
+
+			return map_results();
+		}
+		id   emit_call_intrinsic(const location &loc, id intrinsic, const type &res_type, const std::vector<expression> &args) override
+		{
+			sync_targets();
+
+			// The intrinsic is an index into the intrinsic table and not an ID, so it is passed on as is
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_call_intrinsic(loc, intrinsic, translate(target, res_type), translate(target, args));
+
+			return map_results();
+		}
+		id   emit_construct(const location &loc, const type &type, const std::vector<expression> &args) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_construct(loc, translate(target, type), translate(target, args));
+
+			return map_results();
+		}
+
+		void emit_if(const location &loc, id condition_value, id condition_block, id true_statement_block, id false_statement_block, unsigned int flags) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_targets[target]->emit_if(loc, translate(target, condition_value), translate(target, condition_block), translate(target, true_statement_block), translate(target, false_statement_block), flags);
+
+			sync_blocks();
+		}
+		id   emit_phi(const location &loc, id condition_value, id condition_block, id true_value, id true_statement_block, id false_value, id false_statement_block, const type &type) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->emit_phi(loc, translate(target, condition_value), translate(target, condition_block), translate(target, true_value), translate(target, true_statement_block), translate(target, false_value), translate(target, false_statement_block), translate(target, type));
+
+			const id res = map_results();
+			sync_blocks();
+			return res;
+		}
+		void emit_loop(const location &loc, id condition_value, id prev_block, id header_block, id condition_block, id loop_block, id continue_block, unsigned int flags) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_targets[target]->emit_loop(loc, translate(target, condition_value), translate(target, prev_block), translate(target, header_block), translate(target, condition_block), translate(target, loop_block), translate(target, continue_block), flags);
+
+			sync_blocks();
+		}
+		void emit_switch(const location &loc, id selector_value, id selector_block, id default_label, id default_block, const std::vector<id> &case_literal_and_labels, const std::vector<id> &case_blocks, unsigned int flags) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				// Every other entry is a case literal value rather than an ID
+				std::vector<id> target_case_literal_and_labels = case_literal_and_labels;
+				for (size_t i = 1; i < target_case_literal_and_labels.size(); i += 2)
+					target_case_literal_and_labels[i] = translate(target, target_case_literal_and_labels[i]);
+
+				std::vector<id> target_case_blocks = case_blocks;
+				for (id &block : target_case_blocks)
+					block = translate(target, block);
+
+				_targets[target]->emit_switch(loc, translate(target, selector_value), translate(target, selector_block), translate(target, default_label), translate(target, default_block), target_case_literal_and_labels, target_case_blocks, flags);
+			}
+
+			sync_blocks();
+		}
+
+		id   create_block() override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->create_block();
+
+			return map_results();
+		}
+		id   set_block(id id) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->set_block(translate(target, id));
+
+			const codegen::id res = map_results();
+			sync_blocks();
+			return res;
+		}
+		void enter_block(id id) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_targets[target]->enter_block(translate(target, id));
+
+			sync_blocks();
+		}
+		id   leave_block_and_kill() override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->leave_block_and_kill();
+
+			const id res = map_results();
+			sync_blocks();
+			return res;
+		}
+		id   leave_block_and_return(id value) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->leave_block_and_return(translate(target, value));
+
+			const id res = map_results();
+			sync_blocks();
+			return res;
+		}
+		id   leave_block_and_switch(id value, id default_target) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->leave_block_and_switch(translate(target, value), translate(target, default_target));
+
+			const id res = map_results();
+			sync_blocks();
+			return res;
+		}
+		id   leave_block_and_branch(id branch_target, unsigned int loop_flow) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->leave_block_and_branch(translate(target, branch_target), loop_flow);
+
+			const id res = map_results();
+			sync_blocks();
+			return res;
+		}
+		id   leave_block_and_branch_conditional(id condition, id true_target, id false_target) override
+		{
+			sync_targets();
+
+			for (size_t target = 0; target < _targets.size(); ++target)
+				_results[target] = _targets[target]->leave_block_and_branch_conditional(translate(target, condition), translate(target, true_target), translate(target, false_target));
+
+			const id res = map_results();
+			sync_blocks();
+			return res;
+		}
+		void leave_function() override
+		{
+			sync_targets();
+
+			assert(_current_function != nullptr);
+
+			// The parser collects references of the current function directly, so pass them on before the targets finish it
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				assert(_targets[target]->_current_function != nullptr);
+				translate_references(target, *_current_function, *_targets[target]->_current_function);
+
+				_targets[target]->leave_function();
+			}
+
+			_current_function = nullptr;
+			_synced_function = nullptr;
+			sync_blocks();
+		}
+
+		void optimize_bindings() override
+		{
+			for (size_t target = 0; target < _targets.size(); ++target)
+			{
+				effect_module &target_module = _targets[target]->_module;
+
+				// The parser marks textures that are used as render targets or storages after they were defined
+				assert(target_module.textures.size() == _module.textures.size());
+				for (size_t i = 0; i < _module.textures.size(); ++i)
+				{
+					target_module.textures[i].render_target = _module.textures[i].render_target;
+					target_module.textures[i].storage_access = _module.textures[i].storage_access;
+				}
+
+				// Techniques are added to the module directly, so copy them over with the entry point names chosen by the target
+				for (technique tech : _module.techniques)
+				{
+					for (pass &pass : tech.passes)
+					{
+						for (std::string *const entry_point_name : { &pass.vs_entry_point, &pass.ps_entry_point, &pass.cs_entry_point })
+							if (const auto it = _entry_point_names[target].find(*entry_point_name);
+								it != _entry_point_names[target].end())
+								*entry_point_name = it->second;
+					}
+
+					target_module.techniques.push_back(std::move(tech));
+				}
+
+				_targets[target]->optimize_bindings();
+			}
+
+			// Report the module of the first target (which includes target specific information like bindings and uniform layouts), but keep the IDs handed out to the parser
+			effect_module module = _targets[0]->_module;
+			for (size_t i = 0; i < module.textures.size(); ++i)
+				module.textures[i].id = _module.textures[i].id;
+			for (size_t i = 0; i < module.samplers.size(); ++i)
+				module.samplers[i].id = _module.samplers[i].id;
+			for (size_t i = 0; i < module.storages.size(); ++i)
+				module.storages[i].id = _module.storages[i].id;
+			_module = std::move(module);
+		}
+	};
+}
+
+codegen *reshadefx::create_codegen_fanout(const std::vector<codegen *> &targets)
+{
+	return new codegen_fanout(targets);
+}
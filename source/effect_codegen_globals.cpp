@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "effect_codegen_globals.hpp"
+#include <cctype> // std::isalnum, std::isalpha, std::isdigit
+#include <algorithm> // std::sort, std::unique
+#include <string_view>
+
+using namespace reshadefx;
+
+template <typename F>
+static void enumerate_identifiers(const std::string &code, size_t offset, size_t length, F callback)
+{
+	for (size_t i = offset, end = offset + length; i < end;)
+	{
+		const unsigned char c = code[i];
+		if (std::isalpha(c) || c == '_')
+		{
+			const size_t identifier_offset = i;
+			while (++i < end && (std::isalnum(static_cast<unsigned char>(code[i])) || code[i] == '_'))
+				continue;
+			callback(std::string_view(code.data() + identifier_offset, i - identifier_offset));
+		}
+		else if (std::isdigit(c))
+		{
+			// Skip numeric literals, so that suffixes and exponents are not mistaken for identifiers
+			while (++i < end && (std::isalnum(static_cast<unsigned char>(code[i])) || code[i] == '.'))
+				continue;
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+void reshadefx::global_fragment_list::add(std::string name, size_t offset, size_t end)
+{
+	fragment &fragment = _fragments.emplace_back();
+	fragment.name = std::move(name);
+	fragment.offset = offset;
+	fragment.length = end - offset;
+}
+
+void reshadefx::global_fragment_list::prepare(const std::unordered_map<uint32_t, std::string> &blocks, const std::string &uniform_block, const effect_module &module, const std::vector<std::unique_ptr<function>> &functions)
+{
+	std::unordered_multimap<std::string_view, uint32_t> fragment_lookup;
+	for (uint32_t index = 0; index < _fragments.size(); ++index)
+		fragment_lookup.emplace(_fragments[index].name, index);
+
+	const auto collect_references =
+		[&fragment_lookup](const std::string &code, size_t offset, size_t length, std::vector<uint32_t> &references) {
+			enumerate_identifiers(code, offset, length, [&fragment_lookup, &references](std::string_view identifier) {
+				const auto range = fragment_lookup.equal_range(identifier);
+				for (auto it = range.first; it != range.second; ++it)
+					references.push_back(it->second);
+			});
+			std::sort(references.begin(), references.end());
+			references.erase(std::unique(references.begin(), references.end()), references.end());
+		};
+
+	const std::string &global_block = blocks.at(0);
+
+	for (fragment &fragment : _fragments)
+		collect_references(global_block, fragment.offset, fragment.length, fragment.references);
+
+	// Any code in the global block that is not part of a tracked declaration is always included, as is the uniform block
+	std::vector<uint32_t> &global_references = _block_references[0];
+	size_t offset = 0;
+	for (const fragment &fragment : _fragments)
+	{
+		collect_references(global_block, offset, fragment.offset - offset, global_references);
+		offset = fragment.offset + fragment.length;
+	}
+	collect_references(global_block, offset, global_block.size() - offset, global_references);
+	collect_references(uniform_block, 0, uniform_block.size(), global_references);
+
+	const auto collect_block_references =
+		[&blocks, &collect_references, this](uint32_t id) {
+			const std::string &code = blocks.at(id);
+			collect_references(code, 0, code.size(), _block_references[id]);
+		};
+
+	for (const sampler &info : module.samplers)
+		collect_block_references(info.id);
+	for (const storage &info : module.storages)
+		collect_block_references(info.id);
+	for (const std::unique_ptr<function> &func : functions)
+		collect_block_references(func->id);
+
+	_prepared = true;
+}
+
+void reshadefx::global_fragment_list::write(std::string &code, const std::string &global_block, const function &entry_point) const
+{
+	if (!_prepared)
+	{
+		code += global_block;
+		return;
+	}
+
+	// Find all global declarations that are reachable from the code of this entry point
+	std::vector<bool> referenced(_fragments.size());
+	std::vector<uint32_t> worklist;
+
+	const auto add_references =
+		[&referenced, &worklist](const std::vector<uint32_t> &references) {
+			for (const uint32_t index : references)
+			{
+				if (referenced[index])
+					continue;
+				referenced[index] = true;
+				worklist.push_back(index);
+			}
+		};
+	const auto add_block_references =
+		[this, &add_references](uint32_t block) {
+			if (const auto it = _block_references.find(block);
+				it != _block_references.end())
+				add_references(it->second);
+		};
+
+	add_block_references(0);
+	add_block_references(entry_point.id);
+	for (const uint32_t sampler : entry_point.referenced_samplers)
+		if (sampler != 0)
+			add_block_references(sampler);
+	for (const uint32_t storage : entry_point.referenced_storages)
+		if (storage != 0)
+			add_block_references(storage);
+	for (const uint32_t func : entry_point.referenced_functions)
+		add_block_references(func);
+
+	while (!worklist.empty())
+	{
+		const uint32_t index = worklist.back();
+		worklist.pop_back();
+
+		add_references(_fragments[index].references);
+	}
+
+	// Copy the global block in as few pieces as possible, skipping unreferenced declarations
+	size_t offset = 0;
+	for (uint32_t index = 0; index < _fragments.size(); ++index)
+	{
+		if (referenced[index])
+			continue;
+
+		const fragment &fragment = _fragments[index];
+		code.append(global_block, offset, fragment.offset - offset);
+		offset = fragment.offset + fragment.length;
+	}
+	code.append(global_block, offset, std::string::npos);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "effect_module.hpp"
+#include <memory> // std::unique_ptr
+#include <unordered_map>
+
+namespace reshadefx
+{
+	/// <summary>
+	/// Tracks the declarations a text-based code generation back-end writes to its global block (struct types, global variables, sampler state declarations, ...), so that the code generated for an entry point only needs to include the ones it actually references.
+	/// References are found by scanning the generated code for the names of declarations, so a declaration is kept whenever its name appears in code that is reachable from the entry point.
+	/// </summary>
+	class global_fragment_list
+	{
+	public:
+		/// <summary>
+		/// Marks the code in the global block between <paramref name="offset"/> and <paramref name="end"/> as the declaration of <paramref name="name"/>.
+		/// </summary>
+		void add(std::string name, size_t offset, size_t end);
+
+		/// <summary>
+		/// Resolves the declarations referenced by each declaration, by code in the global block outside of any declaration, by the uniform block and by the code blocks of all samplers, storages and functions.
+		/// This has to be called after all code was generated and before <see cref="write"/> can skip any declarations.
+		/// </summary>
+		/// <param name="blocks">Code blocks of the back-end, with the global block at index zero.</param>
+		/// <param name="uniform_block">Code of the uniform block, which is always included.</param>
+		void prepare(const std::unordered_map<uint32_t, std::string> &blocks, const std::string &uniform_block, const effect_module &module, const std::vector<std::unique_ptr<function>> &functions);
+		bool prepared() const { return _prepared; }
+
+		/// <summary>
+		/// Appends all declarations of the global block that are reachable from the specified entry point to <paramref name="code"/>, or the whole global block if the references were not resolved yet.
+		/// </summary>
+		void write(std::string &code, const std::string &global_block, const function &entry_point) const;
+
+	private:
+		struct fragment
+		{
+			std::string name;
+			size_t offset = 0;
+			size_t length = 0;
+			std::vector<uint32_t> references;
+		};
+
+		std::vector<fragment> _fragments;
+		// Declarations referenced by code outside the global block, indexed by the identifier of the block that code is in (or zero for code that is always included)
+		std::unordered_map<uint32_t, std::vector<uint32_t>> _block_references;
+		bool _prepared = false;
+	};
+}
@@ -5,6 +5,8 @@
 
 #include "effect_parser.hpp"
 #include "effect_codegen.hpp"
+#include "effect_codegen_globals.hpp"
+#include "effect_codegen_optimizer.hpp"
 #include <cmath> // std::isinf, std::isnan, std::signbit
 #include <cassert>
 #include <cstring> // std::memcmp
@@ -26,7 +28,7 @@ inline uint32_t align_up(uint32_t size, uint32_t alignment)
 	return ((size + alignment) & ~alignment);
 }
 
-class codegen_glsl final : public codegen
+class codegen_glsl : public codegen
 {
 public:
 	codegen_glsl(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types, bool flip_vert_y) :
@@ -41,7 +43,7 @@ public:
 		block.reserve(8192);
 	}
 
-private:
+protected:
 	enum class naming
 	{
 		// After escaping, name should already be unique, so no additional steps are taken
@@ -70,6 +72,11 @@ private:
 	std::unordered_map<std::string, uint32_t> _semantic_to_location;
 	std::vector<std::tuple<type, constant, id>> _constant_lookup;
 
+	// Declarations in the global block, so that entry points only need to include the ones they actually reference
+	global_fragment_list _global_fragments;
+	// Code shared by all entry points, which is built once after parsing completed
+	std::string _preamble;
+
 	// Only write compatibility intrinsics to result if they are actually in use
 	bool _uses_fmod = false;
 	bool _uses_componentwise_or = false;
@@ -78,6 +85,26 @@ private:
 	bool _uses_control_flow_attributes = false;
 	bool _uses_derivative_control = false;
 
+	void optimize_bindings() override
+	{
+		codegen::optimize_bindings();
+
+		// All code was generated at this point, so can build the parts shared between entry points now
+		prepare_shared_code();
+	}
+
+	void prepare_shared_code()
+	{
+		_preamble = finalize_preamble();
+
+		_global_fragments.prepare(_blocks, _ubo_block, _module, _functions);
+	}
+
+	void add_global_fragment(std::string name, size_t offset)
+	{
+		_global_fragments.add(std::move(name), offset, _blocks.at(0).size());
+	}
+
 	std::string finalize_preamble() const
 	{
 		std::string preamble = "#version 430\n";
@@ -134,7 +161,7 @@ private:
 
 	std::string finalize_code() const override
 	{
-		std::string code = finalize_preamble();
+		std::string code = _global_fragments.prepared() ? _preamble : finalize_preamble();
 
 		// Add sampler definitions
 		for (const sampler &info : _module.samplers)
@@ -169,7 +196,20 @@ private:
 		if (entry_point == nullptr)
 			return {};
 
-		std::string code = finalize_preamble();
+		std::string code;
+		// Reserve enough memory up front to avoid reallocations while appending the individual pieces below
+		size_t code_size = _preamble.size() + _blocks.at(0).size();
+		for (const id sampler : entry_point->referenced_samplers)
+			if (sampler != 0)
+				code_size += _blocks.at(sampler).size();
+		for (const id storage : entry_point->referenced_storages)
+			if (storage != 0)
+				code_size += _blocks.at(storage).size();
+		for (const id func : entry_point->referenced_functions)
+			code_size += _blocks.at(func).size();
+		code.reserve(code_size + _blocks.at(entry_point->id).size());
+
+		code += _global_fragments.prepared() ? _preamble : finalize_preamble();
 
 		if (entry_point->type != shader_type::pixel)
 			code +=
@@ -226,8 +266,8 @@ private:
 			code += block_code;
 		}
 
-		// Add global definitions (struct types, global variables, ...)
-		code += _blocks.at(0);
+		// Add referenced global definitions (struct types, global variables, ...)
+		_global_fragments.write(code, _blocks.at(0), *entry_point);
 
 		// Add referenced function definitions
 		for (const std::unique_ptr<function> &func : _functions)
@@ -513,7 +553,7 @@ private:
 	}
 	void write_location(std::string &s, const location &loc) const
 	{
-		if (loc.source.empty() || !_debug_info)
+		if (loc.source == 0 || !_debug_info)
 			return;
 
 		s += "#line " + std::to_string(loc.line) + '\n';
@@ -722,6 +762,7 @@ private:
 		_structs.push_back(info);
 
 		std::string &code = _blocks.at(_current_block);
+		const size_t fragment_offset = code.size();
 
 		write_location(code, loc);
 
@@ -743,6 +784,9 @@ private:
 
 		code += "};\n";
 
+		if (_current_block == 0)
+			add_global_fragment(id_to_name(res), fragment_offset);
+
 		return res;
 	}
 	id   define_texture(const location &, texture &info) override
@@ -808,6 +852,7 @@ private:
 				info.size *= info.type.array_length;
 
 			std::string &code = _blocks.at(_current_block);
+			const size_t fragment_offset = code.size();
 
 			write_location(code, loc);
 
@@ -820,6 +865,9 @@ private:
 				write_type<false, false>(code, info.type);
 			code += "(SPEC_CONSTANT_" + info.name + ");\n";
 
+			if (_current_block == 0)
+				add_global_fragment(id_to_name(res), fragment_offset);
+
 			_module.spec_constants.push_back(info);
 		}
 		else
@@ -891,6 +939,7 @@ private:
 			define_name<naming::general>(res, name);
 
 		std::string &code = _blocks.at(_current_block);
+		const size_t fragment_offset = code.size();
 
 		write_location(code, loc);
 
@@ -908,6 +957,9 @@ private:
 
 		code += ";\n";
 
+		if (global && _current_block == 0)
+			add_global_fragment(id_to_name(res), fragment_offset);
+
 		return res;
 	}
 	id   define_function(const location &loc, function &info) override
@@ -1626,6 +1678,7 @@ private:
 
 			// Put constant variable into global scope, so that it can be reused in different blocks
 			std::string &code = _blocks.at(0);
+			const size_t fragment_offset = code.size();
 
 			// GLSL requires constants to be initialized, but struct initialization is not supported right now
 			if (!data_type.is_struct())
@@ -1645,6 +1698,8 @@ private:
 			}
 
 			code += ";\n";
+
+			add_global_fragment(id_to_name(res), fragment_offset);
 			return res;
 		}
 
@@ -2336,7 +2391,10 @@ private:
 	}
 };
 
-codegen *reshadefx::create_codegen_glsl(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types, bool flip_vert_y)
+codegen *reshadefx::create_codegen_glsl(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types, bool flip_vert_y, bool optimize)
 {
+	if (optimize)
+		return new codegen_optimizer<codegen_glsl>(vulkan_semantics, debug_info, uniforms_to_spec_constants, enable_16bit_types, flip_vert_y);
+
 	return new codegen_glsl(vulkan_semantics, debug_info, uniforms_to_spec_constants, enable_16bit_types, flip_vert_y);
 }
@@ -5,6 +5,8 @@
 
 #include "effect_parser.hpp"
 #include "effect_codegen.hpp"
+#include "effect_codegen_globals.hpp"
+#include "effect_codegen_optimizer.hpp"
 #include <cmath> // std::isinf, std::isnan, std::signbit
 #include <cctype> // std::tolower
 #include <cassert>
@@ -26,7 +28,7 @@ inline uint32_t align_up(uint32_t size, uint32_t alignment, uint32_t elements)
 	return ((size + alignment) & ~alignment) * (elements - 1) + size;
 }
 
-class codegen_hlsl final : public codegen
+class codegen_hlsl : public codegen
 {
 public:
 	codegen_hlsl(unsigned int shader_model, bool debug_info, bool uniforms_to_spec_constants) :
@@ -39,7 +41,7 @@ public:
 		block.reserve(8192);
 	}
 
-private:
+protected:
 	enum class naming
 	{
 		// Name should already be unique, so no additional steps are taken
@@ -57,13 +59,18 @@ private:
 	std::unordered_map<id, std::string> _names;
 	std::unordered_map<id, std::string> _blocks;
 	std::string _cbuffer_block;
-	std::string _current_location;
+	uint32_t _current_location = 0;
 	std::string _current_function_declaration;
 
 	std::string _remapped_semantics[15];
 	std::vector<std::tuple<type, constant, id>> _constant_lookup;
 	std::vector<sampler_binding> _sampler_lookup;
 
+	// Declarations in the global block, so that entry points only need to include the ones they actually reference
+	global_fragment_list _global_fragments;
+	// Code shared by all entry points, which is built once after parsing completed
+	std::string _preamble;
+
 	// Only write compatibility intrinsics to result if they are actually in use
 	bool _uses_bitwise_cast = false;
 	bool _uses_bitwise_intrinsics = false;
@@ -72,6 +79,9 @@ private:
 	{
 		codegen::optimize_bindings();
 
+		// All code was generated at this point, so can build the parts shared between entry points now
+		prepare_shared_code();
+
 		if (_shader_model < 40)
 			return;
 
@@ -80,6 +90,18 @@ private:
 				pass.sampler_bindings.assign(_sampler_lookup.begin(), _sampler_lookup.end());
 	}
 
+	void prepare_shared_code()
+	{
+		_preamble = finalize_preamble();
+
+		_global_fragments.prepare(_blocks, _cbuffer_block, _module, _functions);
+	}
+
+	void add_global_fragment(std::string name, size_t offset)
+	{
+		_global_fragments.add(std::move(name), offset, _blocks.at(0).size());
+	}
+
 	std::string finalize_preamble() const
 	{
 		std::string preamble;
@@ -276,7 +298,7 @@ private:
 
 	std::string finalize_code() const override
 	{
-		std::string code = finalize_preamble();
+		std::string code = _global_fragments.prepared() ? _preamble : finalize_preamble();
 
 		// Add global definitions (struct types, global variables, sampler state declarations, ...)
 		code += _blocks.at(0);
@@ -301,14 +323,27 @@ private:
 		if (entry_point == nullptr)
 			return {};
 
-		std::string code = finalize_preamble();
+		std::string code;
+		// Reserve enough memory up front to avoid reallocations while appending the individual pieces below
+		size_t code_size = _preamble.size() + _blocks.at(0).size();
+		for (const id sampler : entry_point->referenced_samplers)
+			if (sampler != 0)
+				code_size += _blocks.at(sampler).size();
+		for (const id storage : entry_point->referenced_storages)
+			if (storage != 0)
+				code_size += _blocks.at(storage).size();
+		for (const id func : entry_point->referenced_functions)
+			code_size += _blocks.at(func).size();
+		code.reserve(code_size + _blocks.at(entry_point->id).size());
+
+		code += _global_fragments.prepared() ? _preamble : finalize_preamble();
 
 		if (_shader_model < 40 && entry_point->type == shader_type::pixel)
 			// Overwrite position semantic in pixel shaders
 			code += "#define POSITION VPOS\n";
 
-		// Add global definitions (struct types, global variables, sampler state declarations, ...)
-		code += _blocks.at(0);
+		// Add referenced global definitions (struct types, global variables, sampler state declarations, ...)
+		_global_fragments.write(code, _blocks.at(0), *entry_point);
 
 		const auto replace_binding =
 			[](std::string &code, uint32_t binding) {
@@ -589,7 +624,7 @@ private:
 	template <bool force_source = false>
 	void write_location(std::string &s, const location &loc)
 	{
-		if (loc.source.empty() || !_debug_info)
+		if (loc.source == 0 || !_debug_info)
 			return;
 
 		s += "#line " + std::to_string(loc.line);
@@ -599,11 +634,15 @@ private:
 		// Avoid writing the file name every time to reduce output text size
 		if constexpr (force_source)
 		{
-			s += " \"" + loc.source + '\"';
+			s += " \"";
+			s += _source_files.name(loc.source);
+			s += '\"';
 		}
 		else if (loc.source != _current_location)
 		{
-			s += " \"" + loc.source + '\"';
+			s += " \"";
+			s += _source_files.name(loc.source);
+			s += '\"';
 
 			_current_location = loc.source;
 		}
@@ -778,6 +817,7 @@ private:
 		_structs.push_back(info);
 
 		std::string &code = _blocks.at(_current_block);
+		const size_t fragment_offset = code.size();
 
 		write_location(code, loc);
 
@@ -800,6 +840,9 @@ private:
 
 		code += "};\n";
 
+		if (_current_block == 0)
+			add_global_fragment(id_to_name(res), fragment_offset);
+
 		return res;
 	}
 	id   define_texture(const location &, texture &info) override
@@ -849,10 +892,14 @@ private:
 				s.entry_point_binding = sampler_state_binding;
 				_sampler_lookup.push_back(std::move(s));
 
+				const size_t fragment_offset = _blocks.at(0).size();
+
 				if (_shader_model >= 60)
 					_blocks.at(0) += "[[vk::binding(" + std::to_string(sampler_state_binding) + ", 1)]] "; // Descriptor set 1
 
 				_blocks.at(0) += "SamplerState __s" + std::to_string(sampler_state_binding) + " : register(s" + std::to_string(sampler_state_binding) + ");\n";
+
+				add_global_fragment("__s" + std::to_string(sampler_state_binding), fragment_offset);
 			}
 
 			if (_shader_model >= 60)
@@ -942,6 +989,7 @@ private:
 				info.size *= info.type.array_length;
 
 			std::string &code = _blocks.at(_current_block);
+			const size_t fragment_offset = code.size();
 
 			write_location(code, loc);
 
@@ -954,6 +1002,9 @@ private:
 				write_type<false, false>(code, info.type);
 			code += "(SPEC_CONSTANT_" + info.name + ");\n";
 
+			if (_current_block == 0)
+				add_global_fragment(id_to_name(res), fragment_offset);
+
 			_module.spec_constants.push_back(info);
 		}
 		else
@@ -1033,6 +1084,7 @@ private:
 			define_name<naming::general>(res, name);
 
 		std::string &code = _blocks.at(_current_block);
+		const size_t fragment_offset = code.size();
 
 		write_location(code, loc);
 
@@ -1050,6 +1102,9 @@ private:
 
 		code += ";\n";
 
+		if (global && _current_block == 0)
+			add_global_fragment(id_to_name(res), fragment_offset);
+
 		return res;
 	}
 	id   define_function(const location &loc, function &info) override
@@ -1394,6 +1449,7 @@ private:
 
 			// Put constant variable into global scope, so that it can be reused in different blocks
 			std::string &code = _blocks.at(0);
+			const size_t fragment_offset = code.size();
 
 			// Array constants need to be stored in a constant variable as they cannot be used in-place
 			code += "static const ";
@@ -1403,6 +1459,8 @@ private:
 			code += " = ";
 			write_constant(code, data_type, data);
 			code += ";\n";
+
+			add_global_fragment(id_to_name(res), fragment_offset);
 			return res;
 		}
 
@@ -2117,7 +2175,10 @@ private:
 	}
 };
 
-codegen *reshadefx::create_codegen_hlsl(unsigned int shader_model, bool debug_info, bool uniforms_to_spec_constants)
+codegen *reshadefx::create_codegen_hlsl(unsigned int shader_model, bool debug_info, bool uniforms_to_spec_constants, bool optimize)
 {
+	if (optimize)
+		return new codegen_optimizer<codegen_hlsl>(shader_model, debug_info, uniforms_to_spec_constants);
+
 	return new codegen_hlsl(shader_model, debug_info, uniforms_to_spec_constants);
 }
@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "effect_codegen.hpp"
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace reshadefx
+{
+	/// <summary>
+	/// Optional optimization layer that sits between the parser and a code generation back-end.
+	/// It folds operations on constant values and reuses the result of identical operations within a basic block (common subexpression elimination), so that neither is passed on to the back-end.
+	/// </summary>
+	/// <typeparam name="backend">Code generation back-end implementation to pass all remaining operations to.</typeparam>
+	template <typename backend>
+	class codegen_optimizer final : public backend
+	{
+	public:
+		using backend::backend;
+
+	private:
+		using typename backend::id;
+		using backend::_current_block;
+
+		/// <summary>
+		/// Kinds of operations that can be reused.
+		/// </summary>
+		enum class value_kind : uint32_t
+		{
+			load,
+			unary_op,
+			binary_op,
+			ternary_op,
+			construct,
+			call_intrinsic,
+		};
+
+		/// <summary>
+		/// A previously emitted operation that can be reused.
+		/// </summary>
+		struct value_entry
+		{
+			id result;
+			// Set if the result depends on memory that may be written to by a store or function call
+			bool reads_memory;
+		};
+
+		struct value_key_hash
+		{
+			size_t operator()(const std::vector<uint32_t> &key) const
+			{
+				size_t hash = key.size();
+				for (const uint32_t word : key)
+					hash ^= word + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+				return hash;
+			}
+		};
+
+		id   emit_load(const expression &exp, bool force_new_id) override
+		{
+			// Constant expressions are already deduplicated by the back-end and l-value loads requiring a new ID may not be shared
+			if (exp.is_constant || force_new_id || !this->is_in_block())
+				return backend::emit_load(exp, force_new_id);
+
+			// Evaluate access chains on values that were folded into a constant, since back-ends cannot apply swizzles or casts to inline constants
+			if (const auto it = _constant_values.find(exp.base); it != _constant_values.end() && !exp.is_lvalue &&
+				it->second.first == (exp.chain.empty() ? exp.type : exp.chain.front().from))
+			{
+				expression folded;
+				folded.reset_to_rvalue_constant(exp.location, it->second.second, it->second.first);
+
+				size_t i = 0;
+				for (; i < exp.chain.size(); ++i)
+				{
+					const expression::operation &op = exp.chain[i];
+
+					if (op.op == expression::operation::op_cast && (!op.to.is_boolean() || op.from.is_boolean()))
+						folded.add_cast_operation(op.to);
+					else if (op.op == expression::operation::op_constant_index)
+						folded.add_constant_index_access(op.index);
+					else if (op.op == expression::operation::op_swizzle && !op.from.is_matrix())
+						folded.add_swizzle_access(op.swizzle, op.to.rows);
+					else
+						break; // Leave dynamic indexing and matrix swizzles to the back-end
+				}
+
+				if (i == exp.chain.size())
+					return backend::emit_load(folded, force_new_id);
+			}
+
+			// Objects, uniforms and constants cannot be written to, so loading from them always returns the same value
+			const type &base_type = exp.chain.empty() ? exp.type : exp.chain.front().from;
+			bool reads_memory = exp.is_lvalue && !base_type.is_object() && !base_type.has(type::q_uniform) && !base_type.has(type::q_const);
+
+			begin_key(value_kind::load, 0, exp.type);
+			add_operand(exp.base, reads_memory);
+			for (const expression::operation &op : exp.chain)
+			{
+				_key.push_back(static_cast<uint32_t>(op.op));
+				add_type(op.from);
+				add_type(op.to);
+				if (op.op == expression::operation::op_dynamic_index)
+					add_operand(op.index, reads_memory);
+				else
+					_key.push_back(op.index);
+				_key.push_back(
+					static_cast<uint8_t>(op.swizzle[0]) | (static_cast<uint8_t>(op.swizzle[1]) << 8) |
+					(static_cast<uint8_t>(op.swizzle[2]) << 16) | (static_cast<uint32_t>(static_cast<uint8_t>(op.swizzle[3])) << 24));
+			}
+
+			if (const auto it = find_value(); it != _values.end())
+				return it->second.result;
+
+			const id res = backend::emit_load(exp, force_new_id);
+
+			// The back-end may refer to the variable directly instead of copying its current value, so anything using this result has to be invalidated by writes too
+			if (reads_memory)
+				_memory_values.insert(res);
+
+			_values.emplace(_key, value_entry { res, reads_memory });
+			return res;
+		}
+		void emit_store(const expression &exp, id value) override
+		{
+			invalidate_memory_values();
+
+			backend::emit_store(exp, value);
+		}
+
+		id   emit_constant(const type &data_type, const constant &data) override
+		{
+			const id res = backend::emit_constant(data_type, data);
+
+			// Keep track of constant values, so that operations on them can be evaluated
+			if (data_type.is_numeric() && !data_type.is_array())
+				_constant_values.emplace(res, std::make_pair(data_type, data));
+
+			return res;
+		}
+
+		id   emit_unary_op(const location &loc, tokenid op, const type &res_type, id val) override
+		{
+			if (const auto it = _constant_values.find(val); it != _constant_values.end() && it->second.first == res_type)
+			{
+				switch (op)
+				{
+				case tokenid::exclaim:
+				case tokenid::minus:
+				case tokenid::tilde:
+				{
+					expression exp;
+					exp.reset_to_rvalue_constant(loc, it->second.second, res_type);
+					exp.evaluate_constant_expression(op);
+					return emit_constant(res_type, exp.constant);
+				}
+				default:
+					break;
+				}
+			}
+
+			if (!this->is_in_block())
+				return backend::emit_unary_op(loc, op, res_type, val);
+
+			begin_key(value_kind::unary_op, static_cast<uint32_t>(op), res_type);
+			bool reads_memory = false;
+			add_operand(val, reads_memory);
+
+			if (const auto it = find_value(); it != _values.end())
+				return it->second.result;
+
+			const id res = backend::emit_unary_op(loc, op, res_type, val);
+			_values.emplace(_key, value_entry { res, reads_memory });
+			return res;
+		}
+		id   emit_binary_op(const location &loc, tokenid op, const type &res_type, const type &type, id lhs, id rhs) override
+		{
+			if (const auto lhs_it = _constant_values.find(lhs), rhs_it = _constant_values.find(rhs);
+				lhs_it != _constant_values.end() && lhs_it->second.first == type &&
+				rhs_it != _constant_values.end() && rhs_it->second.first == type)
+			{
+				switch (op)
+				{
+				case tokenid::percent:
+				case tokenid::star:
+				case tokenid::plus:
+				case tokenid::minus:
+				case tokenid::slash:
+				case tokenid::ampersand:
+				case tokenid::ampersand_ampersand:
+				case tokenid::pipe:
+				case tokenid::pipe_pipe:
+				case tokenid::caret:
+				case tokenid::less:
+				case tokenid::less_equal:
+				case tokenid::greater:
+				case tokenid::greater_equal:
+				case tokenid::equal_equal:
+				case tokenid::exclaim_equal:
+				{
+					expression exp;
+					exp.reset_to_rvalue_constant(loc, lhs_it->second.second, type);
+					// This fails for integer division by zero, in which case the operation is left to the back-end
+					if (exp.evaluate_constant_expression(op, rhs_it->second.second) && exp.type == res_type)
+						return emit_constant(res_type, exp.constant);
+					break;
+				}
+				default:
+					// Shift operations are not folded, since shifting by the bit width or more is undefined on the host
+					break;
+				}
+			}
+
+			if (!this->is_in_block())
+				return backend::emit_binary_op(loc, op, res_type, type, lhs, rhs);
+
+			begin_key(value_kind::binary_op, static_cast<uint32_t>(op), res_type);
+			add_type(type);
+			bool reads_memory = false;
+			add_operand(lhs, reads_memory);
+			add_operand(rhs, reads_memory);
+
+			if (const auto it = find_value(); it != _values.end())
+				return it->second.result;
+
+			const id res = backend::emit_binary_op(loc, op, res_type, type, lhs, rhs);
+			_values.emplace(_key, value_entry { res, reads_memory });
+			return res;
+		}
+		id   emit_ternary_op(const location &loc, tokenid op, const type &res_type, id condition, id true_value, id false_value) override
+		{
+			if (const auto it = _constant_values.find(condition); it != _constant_values.end() && op == tokenid::question)
+			{
+				// Can only select one of the values if the condition is the same for all components
+				const constant &data = it->second.second;
+				const unsigned int components = it->second.first.components();
+
+				unsigned int i = 1;
+				while (i < components && (data.as_uint[i] != 0) == (data.as_uint[0] != 0))
+					++i;
+
+				// The selected value may refer to a variable directly, in which case it has to be copied by the back-end
+				const id value = data.as_uint[0] != 0 ? true_value : false_value;
+				if (i == components && _memory_values.find(value) == _memory_values.end())
+					return value;
+			}
+
+			if (!this->is_in_block())
+				return backend::emit_ternary_op(loc, op, res_type, condition, true_value, false_value);
+
+			begin_key(value_kind::ternary_op, static_cast<uint32_t>(op), res_type);
+			bool reads_memory = false;
+			add_operand(condition, reads_memory);
+			add_operand(true_value, reads_memory);
+			add_operand(false_value, reads_memory);
+
+			if (const auto it = find_value(); it != _values.end())
+				return it->second.result;
+
+			const id res = backend::emit_ternary_op(loc, op, res_type, condition, true_value, false_value);
+			_values.emplace(_key, value_entry { res, reads_memory });
+			return res;
+		}
+		id   emit_call(const location &loc, id function, const type &res_type, const std::vector<expression> &args) override
+		{
+			// Functions may write to global variables and output parameters
+			invalidate_memory_values();
+
+			return backend::emit_call(loc, function, res_type, args);
+		}
+		id   emit_call_intrinsic(const location &loc, id intrinsic, const type &res_type, const std::vector<expression> &args) override
+		{
+			enum
+			{
+			#define IMPLEMENT_INTRINSIC_SPIRV(name, i, code) name##i,
+				#include "effect_symbol_table_intrinsics.inl"
+			};
+
+			switch (intrinsic)
+			{
+			case atomicAdd0:
+			case atomicAdd1:
+			case atomicAnd0:
+			case atomicAnd1:
+			case atomicCompareExchange0:
+			case atomicCompareExchange1:
+			case atomicExchange0:
+			case atomicExchange1:
+			case atomicMax0:
+			case atomicMax1:
+			case atomicMax2:
+			case atomicMax3:
+			case atomicMin0:
+			case atomicMin1:
+			case atomicMin2:
+			case atomicMin3:
+			case atomicOr0:
+			case atomicOr1:
+			case atomicXor0:
+			case atomicXor1:
+			case barrier0:
+			case memoryBarrier0:
+			case groupMemoryBarrier0:
+			case tex1Dstore0:
+			case tex2Dstore0:
+			case tex3Dstore0:
+			case frexp0:
+			case modf0:
+			case sincos0:
+				// These intrinsics write to memory or output parameters, so cannot be reused and invalidate loaded values
+				invalidate_memory_values();
+				return backend::emit_call_intrinsic(loc, intrinsic, res_type, args);
+			}
+
+			if (res_type.is_void() || !this->is_in_block())
+				return backend::emit_call_intrinsic(loc, intrinsic, res_type, args);
+
+			begin_key(value_kind::call_intrinsic, intrinsic, res_type);
+			bool reads_memory = false;
+			for (const expression &arg : args)
+			{
+				add_operand(arg.base, reads_memory);
+				// Storage objects may be written to by other intrinsics
+				reads_memory |= arg.type.is_storage();
+			}
+
+			if (const auto it = find_value(); it != _values.end())
+				return it->second.result;
+
+			const id res = backend::emit_call_intrinsic(loc, intrinsic, res_type, args);
+			_values.emplace(_key, value_entry { res, reads_memory });
+			return res;
+		}
+		id   emit_construct(const location &loc, const type &res_type, const std::vector<expression> &args) override
+		{
+			if (res_type.is_numeric() && !res_type.is_array() && args.size() == res_type.components())
+			{
+				constant data = {};
+
+				size_t i = 0;
+				for (; i < args.size(); ++i)
+				{
+					const auto it = _constant_values.find(args[i].base);
+					if (it == _constant_values.end() || !it->second.first.is_scalar() || it->second.first.base != res_type.base)
+						break;
+					data.as_uint[i] = it->second.second.as_uint[0];
+				}
+
+				if (i == args.size())
+					return emit_constant(res_type, data);
+			}
+
+			if (!this->is_in_block())
+				return backend::emit_construct(loc, res_type, args);
+
+			begin_key(value_kind::construct, 0, res_type);
+			bool reads_memory = false;
+			for (const expression &arg : args)
+				add_operand(arg.base, reads_memory);
+
+			if (const auto it = find_value(); it != _values.end())
+				return it->second.result;
+
+			const id res = backend::emit_construct(loc, res_type, args);
+			_values.emplace(_key, value_entry { res, reads_memory });
+			return res;
+		}
+
+		/// <summary>
+		/// Starts building the lookup key for an operation in the current basic block.
+		/// </summary>
+		void begin_key(value_kind kind, uint32_t op, const type &res_type)
+		{
+			// Values can only be reused within the basic block they were defined in
+			if (_values_block != _current_block)
+			{
+				_values.clear();
+				_values_block = _current_block;
+			}
+
+			_key.clear();
+			_key.push_back(static_cast<uint32_t>(kind));
+			_key.push_back(op);
+			add_type(res_type);
+		}
+		void add_type(const type &type)
+		{
+			_key.push_back(static_cast<uint32_t>(type.base) | (type.rows << 8) | (type.cols << 12));
+			_key.push_back(type.array_length);
+			_key.push_back(type.struct_definition);
+		}
+		void add_operand(id value, bool &reads_memory)
+		{
+			_key.push_back(value);
+			reads_memory |= _memory_values.find(value) != _memory_values.end();
+		}
+
+		auto find_value() const
+		{
+			return _values.find(_key);
+		}
+
+		/// <summary>
+		/// Forgets about all values that depend on memory, after it may have been written to.
+		/// </summary>
+		void invalidate_memory_values()
+		{
+			for (auto it = _values.begin(); it != _values.end();)
+			{
+				if (it->second.reads_memory)
+					it = _values.erase(it);
+				else
+					++it;
+			}
+		}
+
+		id _values_block = 0;
+		std::vector<uint32_t> _key;
+		std::unordered_map<std::vector<uint32_t>, value_entry, value_key_hash> _values;
+		std::unordered_set<id> _memory_values;
+		std::unordered_map<id, std::pair<type, constant>> _constant_values;
+	};
+}
@@ -5,10 +5,12 @@
 
 #include "effect_parser.hpp"
 #include "effect_codegen.hpp"
+#include "effect_codegen_optimizer.hpp"
 #include <cassert>
 #include <cstring> // std::memcmp
 #include <charconv> // std::from_chars
 #include <algorithm> // std::find_if, std::max, std::sort
+#include <optional>
 #include <unordered_set>
 
 // Use the C++ variant of the SPIR-V headers
@@ -25,41 +27,46 @@ inline uint32_t align_up(uint32_t size, uint32_t alignment)
 	return ((size + alignment) & ~alignment);
 }
 
+struct spirv_basic_block;
+
 /// <summary>
-/// A single instruction in a SPIR-V module
+/// A single instruction in a SPIR-V module, which is encoded in place into the word stream of the basic block it was added to
 /// </summary>
 struct spirv_instruction
 {
-	spv::Op op;
-	spv::Id type;
-	spv::Id result;
-	std::vector<spv::Id> operands;
+	spirv_instruction(spirv_basic_block &block, size_t index) : _block(&block), _index(index) {}
+
+	spv::Op op() const;
+	spv::Id type() const;
+	spv::Id result() const;
+	size_t operand_count() const;
+	spv::Id operand(size_t operand_index) const;
 
-	explicit spirv_instruction(spv::Op op = spv::OpNop) : op(op), type(0), result(0) {}
-	spirv_instruction(spv::Op op, spv::Id result) : op(op), type(result), result(0) {}
-	spirv_instruction(spv::Op op, spv::Id type, spv::Id result) : op(op), type(type), result(result) {}
+	/// <summary>
+	/// Set the result type of the instruction, which only works if space for it was reserved when it was added.
+	/// </summary>
+	void set_type(spv::Id type);
+	/// <summary>
+	/// Overwrite an operand of the instruction (e.g. to patch in a forward reference).
+	/// </summary>
+	void set_operand(size_t operand_index, spv::Id operand);
 
 	/// <summary>
 	/// Add a single operand to the instruction.
+	/// This is only possible as long as this is the last instruction of its basic block.
 	/// </summary>
-	spirv_instruction &add(spv::Id operand)
-	{
-		operands.push_back(operand);
-		return *this;
-	}
+	spirv_instruction &add(spv::Id operand);
 
 	/// <summary>
 	/// Add a range of operands to the instruction.
+	/// This is only possible as long as this is the last instruction of its basic block.
 	/// </summary>
 	template <typename It>
-	spirv_instruction &add(It begin, It end)
-	{
-		operands.insert(operands.end(), begin, end);
-		return *this;
-	}
+	spirv_instruction &add(It begin, It end);
 
 	/// <summary>
 	/// Add a null-terminated literal UTF-8 string to the instruction.
+	/// This is only possible as long as this is the last instruction of its basic block.
 	/// </summary>
 	spirv_instruction &add_string(const char *string)
 	{
@@ -73,12 +80,59 @@ struct spirv_instruction
 		return *this;
 	}
 
+	operator uint32_t() const
+	{
+		const spv::Id id = result();
+		assert(id != 0);
+
+		return id;
+	}
+
+private:
+	spirv_basic_block *_block;
+	size_t _index;
+};
+
+/// <summary>
+/// A list of instructions forming a basic block in the SPIR-V module, which are stored as a contiguous stream of words in the same encoding as in the final module.
+/// </summary>
+struct spirv_basic_block
+{
+	/// <summary>
+	/// Position of an instruction in the word stream of a basic block.
+	/// </summary>
+	struct instruction_info
+	{
+		// Index of the first word (the one containing the opcode and word count) of the instruction
+		uint32_t offset : 30;
+		// Whether the instruction has a result type <id> after the first word
+		uint32_t has_type : 1;
+		// Whether the instruction has a result <id> after the first word and optional result type <id>
+		uint32_t has_result : 1;
+	};
+
+	std::vector<uint32_t> words;
+	std::vector<instruction_info> instructions;
+
+	bool empty() const { return instructions.empty(); }
+	size_t size() const { return instructions.size(); }
+
 	/// <summary>
-	/// Write this instruction to a SPIR-V module.
+	/// Add a new instruction to the end of this basic block.
 	/// </summary>
-	/// <param name="output">The output stream to append this instruction to.</param>
-	void write(std::basic_string<char> &output) const
+	/// <param name="op">The opcode of the instruction.</param>
+	/// <param name="type">Optional result type <id> of the instruction.</param>
+	/// <param name="result">Optional result <id> of the instruction.</param>
+	/// <param name="reserve_type">Reserve space for a result type <id> even if <paramref name="type"/> is zero, so that it can be set after adding operands.</param>
+	spirv_instruction add_instruction(spv::Op op, spv::Id type = 0, spv::Id result = 0, bool reserve_type = false)
 	{
+		assert(words.size() < (1u << 30));
+
+		instruction_info &info = instructions.emplace_back();
+		info.offset = static_cast<uint32_t>(words.size());
+		info.has_type = (type != 0 || reserve_type);
+		info.has_result = (result != 0);
+
 		// See https://www.khronos.org/registry/spir-v/specs/unified1/SPIRV.html
 		// 0             | Opcode: The 16 high-order bits are the WordCount of the instruction. The 16 low-order bits are the opcode enumerant.
 		// 1             | Optional instruction type <id>
@@ -87,53 +141,342 @@ struct spirv_instruction
 		// .             | Operand 2 (if needed)
 		// ...           | ...
 		// WordCount - 1 | Operand N (N is determined by WordCount minus the 1 to 3 words used for the opcode, instruction type <id>, and instruction Result <id>).
+		words.push_back(((1u + info.has_type + info.has_result) << spv::WordCountShift) | op);
+		if (info.has_type)
+			words.push_back(type);
+		if (info.has_result)
+			words.push_back(result);
 
-		const uint32_t word_count = 1 + (type != 0) + (result != 0) + static_cast<uint32_t>(operands.size());
-		write_word(output, (word_count << spv::WordCountShift) | op);
+		return spirv_instruction(*this, instructions.size() - 1);
+	}
 
-		// Optional instruction type ID
-		if (type != 0)
-			write_word(output, type);
+	spirv_instruction operator[](size_t index) { assert(index < instructions.size()); return spirv_instruction(*this, index); }
+	spirv_instruction back() { assert(!instructions.empty()); return spirv_instruction(*this, instructions.size() - 1); }
 
-		// Optional instruction result ID
-		if (result != 0)
-			write_word(output, result);
+	spv::Op op(size_t index) const { return static_cast<spv::Op>(words[instructions[index].offset] & spv::OpCodeMask); }
+	spv::Id type(size_t index) const { return instructions[index].has_type ? words[instructions[index].offset + 1] : 0; }
+	spv::Id result(size_t index) const { return instructions[index].has_result ? words[instructions[index].offset + 1 + instructions[index].has_type] : 0; }
 
-		// Write out the operands
-		for (const uint32_t operand : operands)
-			write_word(output, operand);
+	size_t operand_count(size_t index) const
+	{
+		const instruction_info &info = instructions[index];
+		return (words[info.offset] >> spv::WordCountShift) - 1 - info.has_type - info.has_result;
+	}
+	const uint32_t *operands(size_t index) const
+	{
+		const instruction_info &info = instructions[index];
+		return words.data() + info.offset + 1 + info.has_type + info.has_result;
+	}
+	spv::Id operand(size_t index, size_t operand_index) const
+	{
+		assert(operand_index < operand_count(index));
+		return operands(index)[operand_index];
 	}
 
-	static void write_word(std::basic_string<char> &output, uint32_t word)
+	/// <summary>
+	/// Remove the last instruction from this basic block.
+	/// </summary>
+	void pop_back()
 	{
-		output.insert(output.end(), reinterpret_cast<const char *>(&word), reinterpret_cast<const char *>(&word + 1));
+		assert(!instructions.empty());
+		words.resize(instructions.back().offset);
+		instructions.pop_back();
 	}
 
-	operator uint32_t() const
+	/// <summary>
+	/// Move the last instruction of this basic block into a new basic block.
+	/// </summary>
+	spirv_basic_block split_back()
 	{
-		assert(result != 0);
+		assert(!instructions.empty());
 
-		return result;
+		spirv_basic_block block;
+		block.append(*this, instructions.size() - 1, instructions.size());
+		pop_back();
+		return block;
 	}
-};
-
-/// <summary>
-/// A list of instructions forming a basic block in the SPIR-V module
-/// </summary>
-struct spirv_basic_block
-{
-	std::vector<spirv_instruction> instructions;
 
 	/// <summary>
 	/// Append another basic block the end of this one.
 	/// </summary>
 	void append(const spirv_basic_block &block)
 	{
-		instructions.insert(instructions.end(), block.instructions.begin(), block.instructions.end());
+		append(block, 0, block.instructions.size());
+	}
+	/// <summary>
+	/// Append a range of instructions from another basic block to the end of this one.
+	/// </summary>
+	void append(const spirv_basic_block &block, size_t first, size_t last)
+	{
+		assert(&block != this && first <= last && last <= block.instructions.size());
+		if (first == last)
+			return;
+
+		const uint32_t block_offset = block.instructions[first].offset;
+		const uint32_t offset_difference = static_cast<uint32_t>(words.size()) - block_offset;
+
+		words.insert(words.end(), block.words.begin() + block_offset, block.words.begin() + block.word_offset(last));
+
+		for (size_t i = first; i < last; ++i)
+		{
+			instruction_info info = block.instructions[i];
+			info.offset += offset_difference;
+			instructions.push_back(info);
+		}
+	}
+
+	/// <summary>
+	/// Write all instructions of this basic block to a SPIR-V module.
+	/// </summary>
+	/// <param name="output">The output stream to append the instructions to.</param>
+	void write(std::basic_string<char> &output) const
+	{
+		write(output, 0, instructions.size());
+	}
+	/// <summary>
+	/// Write a range of instructions of this basic block to a SPIR-V module.
+	/// </summary>
+	/// <param name="output">The output stream to append the instructions to.</param>
+	void write(std::basic_string<char> &output, size_t first, size_t last) const
+	{
+		assert(first <= last && last <= instructions.size());
+		if (first == last)
+			return;
+
+		const uint32_t *const begin = words.data() + instructions[first].offset;
+		output.append(reinterpret_cast<const char *>(begin), (word_offset(last) - instructions[first].offset) * sizeof(uint32_t));
+	}
+
+	static void write_word(std::basic_string<char> &output, uint32_t word)
+	{
+		output.append(reinterpret_cast<const char *>(&word), sizeof(word));
+	}
+
+private:
+	friend struct spirv_instruction;
+
+	size_t word_offset(size_t index) const
+	{
+		return index < instructions.size() ? instructions[index].offset : words.size();
 	}
 };
 
-class codegen_spirv final : public codegen
+inline spv::Op spirv_instruction::op() const
+{
+	return _block->op(_index);
+}
+inline spv::Id spirv_instruction::type() const
+{
+	return _block->type(_index);
+}
+inline spv::Id spirv_instruction::result() const
+{
+	return _block->result(_index);
+}
+inline size_t spirv_instruction::operand_count() const
+{
+	return _block->operand_count(_index);
+}
+inline spv::Id spirv_instruction::operand(size_t operand_index) const
+{
+	return _block->operand(_index, operand_index);
+}
+
+inline void spirv_instruction::set_type(spv::Id type)
+{
+	assert(_block->instructions[_index].has_type);
+	_block->words[_block->instructions[_index].offset + 1] = type;
+}
+inline void spirv_instruction::set_operand(size_t operand_index, spv::Id operand)
+{
+	assert(operand_index < _block->operand_count(_index));
+
+	const spirv_basic_block::instruction_info &info = _block->instructions[_index];
+	_block->words[info.offset + 1 + info.has_type + info.has_result + operand_index] = operand;
+}
+
+inline spirv_instruction &spirv_instruction::add(spv::Id operand)
+{
+	// Operands can only be added to the last instruction, since they are appended to the end of the word stream
+	assert(_index == _block->instructions.size() - 1);
+
+	_block->words.push_back(operand);
+	_block->words[_block->instructions[_index].offset] += 1u << spv::WordCountShift;
+	return *this;
+}
+template <typename It>
+inline spirv_instruction &spirv_instruction::add(It begin, It end)
+{
+	assert(_index == _block->instructions.size() - 1);
+
+	const size_t prev_size = _block->words.size();
+	_block->words.insert(_block->words.end(), begin, end);
+	_block->words[_block->instructions[_index].offset] += static_cast<uint32_t>(_block->words.size() - prev_size) << spv::WordCountShift;
+	return *this;
+}
+
+/// <summary>
+/// Determines whether an instruction has a result type <id> and a result <id>, for all instructions generated by this code generator.
+/// </summary>
+static void get_instruction_layout(spv::Op op, bool &has_type, bool &has_result)
+{
+	switch (op)
+	{
+	case spv::OpNop:
+	case spv::OpSource:
+	case spv::OpName:
+	case spv::OpMemberName:
+	case spv::OpLine:
+	case spv::OpDecorate:
+	case spv::OpMemberDecorate:
+	case spv::OpMemoryModel:
+	case spv::OpEntryPoint:
+	case spv::OpExecutionMode:
+	case spv::OpCapability:
+	case spv::OpFunctionEnd:
+	case spv::OpStore:
+	case spv::OpImageWrite:
+	case spv::OpControlBarrier:
+	case spv::OpMemoryBarrier:
+	case spv::OpLoopMerge:
+	case spv::OpSelectionMerge:
+	case spv::OpBranch:
+	case spv::OpBranchConditional:
+	case spv::OpSwitch:
+	case spv::OpKill:
+	case spv::OpReturn:
+	case spv::OpReturnValue:
+		has_type = false;
+		has_result = false;
+		break;
+	case spv::OpString:
+	case spv::OpExtInstImport:
+	case spv::OpTypeVoid:
+	case spv::OpTypeBool:
+	case spv::OpTypeInt:
+	case spv::OpTypeFloat:
+	case spv::OpTypeVector:
+	case spv::OpTypeMatrix:
+	case spv::OpTypeImage:
+	case spv::OpTypeSampledImage:
+	case spv::OpTypeArray:
+	case spv::OpTypeStruct:
+	case spv::OpTypePointer:
+	case spv::OpTypeFunction:
+	case spv::OpLabel:
+		has_type = false;
+		has_result = true;
+		break;
+	default:
+		has_type = true;
+		has_result = true;
+		break;
+	}
+}
+
+/// <summary>
+/// Calls the specified function for every operand of an instruction that is an <id> (rather than a literal), for all instructions generated by this code generator.
+/// </summary>
+/// <param name="operands">Pointer to the operands following the result type <id> and result <id> of the instruction.</param>
+/// <param name="operand_count">Number of operand words of the instruction.</param>
+template <typename F>
+static void enumerate_id_operands(spv::Op op, uint32_t *operands, size_t operand_count, F callback)
+{
+	// Range of operands that are all <id>s
+	size_t first = 0, last = operand_count;
+
+	switch (op)
+	{
+	case spv::OpSource:
+	case spv::OpString:
+	case spv::OpExtInstImport:
+	case spv::OpMemoryModel:
+	case spv::OpCapability:
+	case spv::OpTypeInt:
+	case spv::OpTypeFloat:
+	case spv::OpConstant:
+	case spv::OpSpecConstant:
+		return;
+	case spv::OpName:
+	case spv::OpMemberName:
+	case spv::OpLine:
+	case spv::OpDecorate:
+	case spv::OpMemberDecorate:
+	case spv::OpExecutionMode:
+	case spv::OpTypeVector:
+	case spv::OpTypeMatrix:
+	case spv::OpTypeImage:
+	case spv::OpLoad:
+	case spv::OpCompositeExtract:
+	case spv::OpSelectionMerge:
+		last = std::min<size_t>(1, operand_count);
+		break;
+	case spv::OpStore:
+	case spv::OpCompositeInsert:
+	case spv::OpVectorShuffle:
+	case spv::OpLoopMerge:
+		last = std::min<size_t>(2, operand_count);
+		break;
+	case spv::OpBranchConditional:
+		last = std::min<size_t>(3, operand_count); // Followed by optional branch weights
+		break;
+	case spv::OpTypePointer:
+	case spv::OpVariable:
+	case spv::OpFunction:
+		first = 1; // Storage class or function control comes first
+		break;
+	case spv::OpEntryPoint:
+		// Execution model, entry point function, name string and then the interface variables
+		callback(operands[1]);
+		first = 2;
+		while (first < operand_count && (operands[first] & 0xFF000000) != 0)
+			++first;
+		first += 1;
+		break;
+	case spv::OpExtInst:
+		// Extended instruction set, literal instruction number and then the operands
+		callback(operands[0]);
+		first = 2;
+		break;
+	case spv::OpSwitch:
+		// Selector, default label and then pairs of a literal and a label
+		callback(operands[0]);
+		callback(operands[1]);
+		for (size_t i = 3; i < operand_count; i += 2)
+			callback(operands[i]);
+		return;
+	case spv::OpImageSampleImplicitLod:
+	case spv::OpImageSampleExplicitLod:
+	case spv::OpImageFetch:
+	case spv::OpImageRead:
+		// Image and coordinate, followed by an optional image operands mask and its <id> operands
+		if (operand_count > 2)
+		{
+			callback(operands[0]);
+			callback(operands[1]);
+			first = 3;
+		}
+		break;
+	case spv::OpImageGather:
+	case spv::OpImageWrite:
+		// Image, coordinate and component or texel, followed by an optional image operands mask and its <id> operands
+		if (operand_count > 3)
+		{
+			callback(operands[0]);
+			callback(operands[1]);
+			callback(operands[2]);
+			first = 4;
+		}
+		break;
+	default:
+		break;
+	}
+
+	for (size_t i = first; i < last; ++i)
+		callback(operands[i]);
+}
+
+class codegen_spirv : public codegen
 {
 	static_assert(sizeof(id) == sizeof(spv::Id), "unexpected SPIR-V id type size");
 
@@ -148,7 +491,7 @@ public:
 		_glsl_ext = make_id();
 	}
 
-private:
+protected:
 	struct type_lookup
 	{
 		reshadefx::type type;
@@ -161,15 +504,27 @@ private:
 			return lhs.type == rhs.type && lhs.is_ptr == rhs.is_ptr && lhs.array_stride == rhs.array_stride && lhs.storage == rhs.storage;
 		}
 	};
-	struct function_blocks
+	struct constant_lookup
+	{
+		reshadefx::type type;
+		reshadefx::constant data;
+
+		friend bool operator==(const constant_lookup &lhs, const constant_lookup &rhs)
+		{
+			if (!(lhs.type == rhs.type && std::memcmp(&lhs.data.as_uint[0], &rhs.data.as_uint[0], sizeof(uint32_t) * 16) == 0 && lhs.data.array_data.size() == rhs.data.array_data.size()))
+				return false;
+			for (size_t i = 0; i < lhs.data.array_data.size(); ++i)
+				if (std::memcmp(&lhs.data.array_data[i].as_uint[0], &rhs.data.array_data[i].as_uint[0], sizeof(uint32_t) * 16) != 0)
+					return false;
+			return true;
+		}
+	};
+	struct function_type_lookup
 	{
-		spirv_basic_block declaration;
-		spirv_basic_block variables;
-		spirv_basic_block definition;
 		reshadefx::type return_type;
 		std::vector<reshadefx::type> param_types;
 
-		friend bool operator==(const function_blocks &lhs, const function_blocks &rhs)
+		friend bool operator==(const function_type_lookup &lhs, const function_type_lookup &rhs)
 		{
 			if (lhs.param_types.size() != rhs.param_types.size())
 				return false;
@@ -180,6 +535,67 @@ private:
 		}
 	};
 
+	/// <summary>
+	/// Hash functions for the lookup tables above, which only consider the fields that are compared by their equality operators.
+	/// </summary>
+	struct lookup_hash
+	{
+		static void hash_combine(size_t &seed, uint32_t v)
+		{
+			seed ^= std::hash<uint32_t>()(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+		}
+		static void hash_combine(size_t &seed, const reshadefx::type &type)
+		{
+			hash_combine(seed, type.base);
+			hash_combine(seed, (type.rows << 4) | type.cols);
+			hash_combine(seed, type.array_length);
+			hash_combine(seed, type.struct_definition);
+		}
+		static void hash_combine(size_t &seed, const reshadefx::constant &data)
+		{
+			for (const uint32_t value : data.as_uint)
+				hash_combine(seed, value);
+		}
+
+		size_t operator()(const type_lookup &lookup) const
+		{
+			size_t hash = 0;
+			hash_combine(hash, lookup.type);
+			hash_combine(hash, lookup.is_ptr);
+			hash_combine(hash, lookup.array_stride);
+			hash_combine(hash, lookup.storage.first);
+			hash_combine(hash, lookup.storage.second);
+			return hash;
+		}
+		size_t operator()(const constant_lookup &lookup) const
+		{
+			size_t hash = 0;
+			hash_combine(hash, lookup.type);
+			hash_combine(hash, lookup.data);
+			hash_combine(hash, static_cast<uint32_t>(lookup.data.array_data.size()));
+			for (const constant &element : lookup.data.array_data)
+				hash_combine(hash, element);
+			return hash;
+		}
+		size_t operator()(const function_type_lookup &lookup) const
+		{
+			size_t hash = 0;
+			hash_combine(hash, lookup.return_type);
+			for (const reshadefx::type &param_type : lookup.param_types)
+				hash_combine(hash, param_type);
+			return hash;
+		}
+	};
+
+	struct function_blocks
+	{
+		spirv_basic_block declaration;
+		spirv_basic_block variables;
+		spirv_basic_block definition;
+		reshadefx::type return_type;
+		std::vector<reshadefx::type> param_types;
+	};
+
 	bool _debug_info = false;
 	bool _vulkan_semantics = false;
 	bool _uniforms_to_spec_constants = false;
@@ -204,10 +620,10 @@ private:
 	std::vector<spv::Id> _global_ubo_types;
 	function_blocks *_current_function_blocks = nullptr;
 
-	std::vector<std::pair<type_lookup, spv::Id>> _type_lookup;
-	std::vector<std::tuple<type, constant, spv::Id>> _constant_lookup;
-	std::vector<std::pair<function_blocks, spv::Id>> _function_type_lookup;
-	std::unordered_map<std::string, spv::Id> _string_lookup;
+	std::unordered_map<type_lookup, spv::Id, lookup_hash> _type_lookup;
+	std::unordered_map<constant_lookup, spv::Id, lookup_hash> _constant_lookup;
+	std::unordered_map<function_type_lookup, spv::Id, lookup_hash> _function_type_lookup;
+	std::unordered_map<uint32_t, spv::Id> _string_lookup;
 	std::unordered_map<spv::Id, std::pair<spv::StorageClass, spv::ImageFormat>> _storage_lookup;
 	std::unordered_map<std::string, uint32_t> _semantic_to_location;
 
@@ -216,7 +632,7 @@ private:
 
 	void add_location(const location &loc, spirv_basic_block &block)
 	{
-		if (loc.source.empty() || !_debug_info)
+		if (loc.source == 0 || !_debug_info)
 			return;
 
 		spv::Id file;
@@ -230,7 +646,7 @@ private:
 		{
 			file =
 				add_instruction(spv::OpString, 0, _debug_a)
-					.add_string(loc.source.c_str());
+					.add_string(std::string(_source_files.name(loc.source)).c_str());
 			_string_lookup.emplace(loc.source, file);
 		}
 
@@ -240,79 +656,76 @@ private:
 			.add(loc.line)
 			.add(loc.column);
 	}
-	spirv_instruction &add_instruction(spv::Op op, spv::Id type = 0)
+	spirv_instruction add_instruction(spv::Op op, spv::Id type = 0)
 	{
 		assert(is_in_function() && is_in_block());
 
-		return add_instruction(op, type, *_current_block_data);
+		// All instructions with a result inside functions have a result type, so always reserve space for it, in case it is only set later (e.g. for access chains)
+		return _current_block_data->add_instruction(op, type, make_id(), true);
 	}
-	spirv_instruction &add_instruction(spv::Op op, spv::Id type, spirv_basic_block &block)
+	spirv_instruction add_instruction(spv::Op op, spv::Id type, spirv_basic_block &block)
 	{
-		spirv_instruction &instruction = add_instruction_without_result(op, block);
-		instruction.type = type;
-		instruction.result = make_id();
-		return instruction;
+		return block.add_instruction(op, type, make_id());
 	}
-	spirv_instruction &add_instruction_without_result(spv::Op op)
+	spirv_instruction add_instruction_without_result(spv::Op op)
 	{
 		assert(is_in_function() && is_in_block());
 
 		return add_instruction_without_result(op, *_current_block_data);
 	}
-	spirv_instruction &add_instruction_without_result(spv::Op op, spirv_basic_block &block)
+	spirv_instruction add_instruction_without_result(spv::Op op, spirv_basic_block &block)
 	{
-		return block.instructions.emplace_back(op);
+		return block.add_instruction(op);
 	}
 
 	void finalize_header_section(std::basic_string<char> &spirv) const
 	{
 		// Write SPIRV header info
-		spirv_instruction::write_word(spirv, spv::MagicNumber);
-		spirv_instruction::write_word(spirv, 0x10300); // Force SPIR-V 1.3
-		spirv_instruction::write_word(spirv, 0u); // Generator magic number, see https://www.khronos.org/registry/spir-v/api/spir-v.xml
-		spirv_instruction::write_word(spirv, _next_id); // Maximum ID
-		spirv_instruction::write_word(spirv, 0u); // Reserved for instruction schema
+		spirv_basic_block::write_word(spirv, spv::MagicNumber);
+		spirv_basic_block::write_word(spirv, 0x10300); // Force SPIR-V 1.3
+		spirv_basic_block::write_word(spirv, 0u); // Generator magic number, see https://www.khronos.org/registry/spir-v/api/spir-v.xml
+		spirv_basic_block::write_word(spirv, _next_id); // Maximum ID
+		spirv_basic_block::write_word(spirv, 0u); // Reserved for instruction schema
+
+		spirv_basic_block header;
 
 		// All capabilities
-		spirv_instruction(spv::OpCapability)
-			.add(spv::CapabilityShader) // Implicitly declares the Matrix capability too
-			.write(spirv);
+		header.add_instruction(spv::OpCapability)
+			.add(spv::CapabilityShader); // Implicitly declares the Matrix capability too
 
 		for (const spv::Capability capability : _capabilities)
-			spirv_instruction(spv::OpCapability)
-				.add(capability)
-				.write(spirv);
+			header.add_instruction(spv::OpCapability)
+				.add(capability);
 
 		// Optional extension instructions
-		spirv_instruction(spv::OpExtInstImport, _glsl_ext)
-			.add_string("GLSL.std.450") // Import GLSL extension
-			.write(spirv);
+		header.add_instruction(spv::OpExtInstImport, 0, _glsl_ext)
+			.add_string("GLSL.std.450"); // Import GLSL extension
 
 		// Single required memory model instruction
-		spirv_instruction(spv::OpMemoryModel)
+		header.add_instruction(spv::OpMemoryModel)
 			.add(spv::AddressingModelLogical)
-			.add(spv::MemoryModelGLSL450)
-			.write(spirv);
+			.add(spv::MemoryModelGLSL450);
+
+		header.write(spirv);
 	}
 	void finalize_debug_info_section(std::basic_string<char> &spirv) const
 	{
-		spirv_instruction(spv::OpSource)
+		spirv_basic_block source;
+		source.add_instruction(spv::OpSource)
 			.add(spv::SourceLanguageUnknown) // ReShade FX is not a reserved token at the moment
-			.add(0) // Language version, TODO: Maybe fill in ReShade version here?
-			.write(spirv);
+			.add(0); // Language version, TODO: Maybe fill in ReShade version here?
+		source.write(spirv);
 
 		if (_debug_info)
 		{
 			// All debug instructions
-			for (const spirv_instruction &inst : _debug_a.instructions)
-				inst.write(spirv);
+			_debug_a.write(spirv);
 		}
 	}
 	void finalize_type_and_constants_section(std::basic_string<char> &spirv) const
 	{
 		// All type declarations
-		for (const spirv_instruction &inst : _types_and_constants.instructions)
-			inst.write(spirv);
+		_types_and_constants.write(spirv);
 
 		// Initialize the UBO type now that all member types are known
 		if (_global_ubo_type == 0 || _global_ubo_variable == 0)
@@ -320,17 +733,196 @@ private:
 
 		const id global_ubo_type_ptr = _global_ubo_type + 1;
 
-		spirv_instruction(spv::OpTypeStruct, _global_ubo_type)
-			.add(_global_ubo_types.begin(), _global_ubo_types.end())
-			.write(spirv);
-		spirv_instruction(spv::OpTypePointer, global_ubo_type_ptr)
+		spirv_basic_block global_ubo;
+		global_ubo.add_instruction(spv::OpTypeStruct, 0, _global_ubo_type)
+			.add(_global_ubo_types.begin(), _global_ubo_types.end());
+		global_ubo.add_instruction(spv::OpTypePointer, 0, global_ubo_type_ptr)
 			.add(spv::StorageClassUniform)
-			.add(_global_ubo_type)
-			.write(spirv);
+			.add(_global_ubo_type);
 
-		spirv_instruction(spv::OpVariable, global_ubo_type_ptr, _global_ubo_variable)
-			.add(spv::StorageClassUniform)
-			.write(spirv);
+		global_ubo.add_instruction(spv::OpVariable, global_ubo_type_ptr, _global_ubo_variable)
+			.add(spv::StorageClassUniform);
+		global_ubo.write(spirv);
+	}
+	void finalize_function_section(std::basic_string<char> &spirv, const function_blocks &func) const
+	{
+		func.declaration.write(spirv);
+
+		// Grab first label and move it in front of variable declarations
+		assert(func.definition.op(0) == spv::OpLabel);
+		func.definition.write(spirv, 0, 1);
+
+		func.variables.write(spirv);
+		func.definition.write(spirv, 1, func.definition.size());
+	}
+	/// <summary>
+	/// Removes all declarations and functions not referenced by any of the entry points in the module (together with their names and decorations) and renumbers the remaining IDs densely.
+	/// </summary>
+	void finalize_compact_module(std::basic_string<char> &spirv) const
+	{
+		assert(spirv.size() % sizeof(uint32_t) == 0 && spirv.size() >= 5 * sizeof(uint32_t));
+
+		std::vector<uint32_t> words(spirv.size() / sizeof(uint32_t));
+		std::memcpy(words.data(), spirv.data(), spirv.size());
+
+		const uint32_t bound = words[3];
+
+		struct instruction_info
+		{
+			size_t offset;
+			spv::Op op;
+			bool has_type;
+			bool has_result;
+			bool is_global;
+
+			uint32_t *operands(std::vector<uint32_t> &words) const { return words.data() + offset + 1 + has_type + has_result; }
+			size_t operand_count(const std::vector<uint32_t> &words) const { return (words[offset] >> spv::WordCountShift) - 1 - has_type - has_result; }
+		};
+
+		std::vector<instruction_info> instructions;
+		// Index of the instruction defining each global <id> (or zero for <id>s defined inside functions)
+		std::vector<size_t> definitions(bound);
+
+		bool is_global = true;
+		for (size_t offset = 5; offset < words.size(); offset += words[offset] >> spv::WordCountShift)
+		{
+			assert((words[offset] >> spv::WordCountShift) != 0);
+
+			instruction_info &info = instructions.emplace_back();
+			info.offset = offset;
+			info.op = static_cast<spv::Op>(words[offset] & spv::OpCodeMask);
+			get_instruction_layout(info.op, info.has_type, info.has_result);
+
+			if (info.op == spv::OpFunction)
+				is_global = false;
+			info.is_global = is_global || info.op == spv::OpFunction;
+			if (info.op == spv::OpFunctionEnd)
+				is_global = true;
+
+			if (info.has_result && info.is_global)
+				definitions[words[offset + 1 + info.has_type]] = instructions.size() - 1;
+		}
+
+		std::vector<bool> keep(instructions.size());
+		std::vector<bool> live_ids(bound);
+		std::vector<uint32_t> worklist;
+
+		const auto mark_referenced_ids = [&](size_t index) {
+			const instruction_info &info = instructions[index];
+			const auto mark_live = [&](uint32_t id) {
+				assert(id < bound);
+				if (!live_ids[id])
+					live_ids[id] = true,
+					worklist.push_back(id);
+			};
+
+			if (info.has_type)
+				mark_live(words[info.offset + 1]);
+			enumerate_id_operands(info.op, info.operands(words), info.operand_count(words), mark_live);
+		};
+
+		// Entry points and module level declarations are always kept, everything else only if it is referenced from them
+		for (size_t i = 0; i < instructions.size() && instructions[i].op != spv::OpFunction; ++i)
+		{
+			switch (instructions[i].op)
+			{
+			case spv::OpCapability:
+			case spv::OpMemoryModel:
+			case spv::OpEntryPoint:
+			case spv::OpExecutionMode:
+			case spv::OpSource:
+				keep[i] = true;
+				mark_referenced_ids(i);
+				break;
+			default:
+				break;
+			}
+		}
+
+		while (!worklist.empty())
+		{
+			const uint32_t id = worklist.back();
+			worklist.pop_back();
+
+			size_t index = definitions[id];
+			if (index == 0 || keep[index])
+				continue;
+
+			if (instructions[index].op == spv::OpFunction)
+			{
+				// Keep the whole function body
+				for (; instructions[index].op != spv::OpFunctionEnd; ++index)
+				{
+					keep[index] = true;
+					mark_referenced_ids(index);
+
+					// Consider all values defined in the function referenced, so that their names and decorations are kept too
+					if (instructions[index].has_result)
+						live_ids[words[instructions[index].offset + 1 + instructions[index].has_type]] = true;
+				}
+			}
+
+			keep[index] = true;
+			mark_referenced_ids(index);
+		}
+
+		// Names and decorations are only kept for targets that are still referenced, and line information only for instructions that are
+		for (size_t i = instructions.size(); i-- > 0;)
+		{
+			instruction_info &info = instructions[i];
+			if (keep[i] || !info.is_global)
+				continue;
+
+			switch (info.op)
+			{
+			case spv::OpName:
+			case spv::OpMemberName:
+				keep[i] = _debug_info && live_ids[info.operands(words)[0]];
+				break;
+			case spv::OpDecorate:
+			case spv::OpMemberDecorate:
+				keep[i] = live_ids[info.operands(words)[0]];
+				break;
+			case spv::OpLine:
+				if (i + 1 < instructions.size() && keep[i + 1])
+					keep[i] = true,
+					keep[definitions[info.operands(words)[0]]] = true;
+				break;
+			default:
+				break;
+			}
+		}
+
+		// Assign new IDs to all remaining definitions in the order they appear in
+		std::vector<uint32_t> new_ids(bound);
+		uint32_t next_id = 1;
+		for (size_t i = 0; i < instructions.size(); ++i)
+			if (keep[i] && instructions[i].has_result)
+				new_ids[words[instructions[i].offset + 1 + instructions[i].has_type]] = next_id++;
+
+		const auto remap_id = [&new_ids](uint32_t &id) {
+			assert(new_ids[id] != 0);
+			id = new_ids[id];
+		};
+
+		spirv.resize(5 * sizeof(uint32_t));
+		words[3] = next_id;
+		std::memcpy(spirv.data(), words.data(), 5 * sizeof(uint32_t));
+
+		for (size_t i = 0; i < instructions.size(); ++i)
+		{
+			if (!keep[i])
+				continue;
+
+			const instruction_info &info = instructions[i];
+			if (info.has_type)
+				remap_id(words[info.offset + 1]);
+			if (info.has_result)
+				remap_id(words[info.offset + 1 + info.has_type]);
+			enumerate_id_operands(info.op, info.operands(words), info.operand_count(words), remap_id);
+
+			spirv.append(reinterpret_cast<const char *>(words.data() + info.offset), (words[info.offset] >> spv::WordCountShift) * sizeof(uint32_t));
+		}
 	}
 
 	std::basic_string<char> finalize_code() const override
@@ -339,46 +931,33 @@ private:
 		finalize_header_section(spirv);
 
 		// All entry point declarations
-		for (const spirv_instruction &inst : _entries.instructions)
-			inst.write(spirv);
+		_entries.write(spirv);
 
 		// All execution mode declarations
-		for (const spirv_instruction &inst : _execution_modes.instructions)
-			inst.write(spirv);
+		_execution_modes.write(spirv);
 
 		finalize_debug_info_section(spirv);
 
-		for (const spirv_instruction &inst : _debug_b.instructions)
-			inst.write(spirv);
+		_debug_b.write(spirv);
 
 		// All annotation instructions
-		for (const spirv_instruction &inst : _annotations.instructions)
-			inst.write(spirv);
+		_annotations.write(spirv);
 
 		finalize_type_and_constants_section(spirv);
 
-		for (const spirv_instruction &inst : _variables.instructions)
-			inst.write(spirv);
+		_variables.write(spirv);
 
 		// All function definitions
 		for (const function_blocks &func : _functions_blocks)
 		{
-			if (func.definition.instructions.empty())
+			if (func.definition.empty())
 				continue;
 
-			for (const spirv_instruction &inst : func.declaration.instructions)
-				inst.write(spirv);
-
-			// Grab first label and move it in front of variable declarations
-			func.definition.instructions.front().write(spirv);
-			assert(func.definition.instructions.front().op == spv::OpLabel);
-
-			for (const spirv_instruction &inst : func.variables.instructions)
-				inst.write(spirv);
-			for (auto inst_it = func.definition.instructions.begin() + 1; inst_it != func.definition.instructions.end(); ++inst_it)
-				inst_it->write(spirv);
+			finalize_function_section(spirv, func);
 		}
 
+		finalize_compact_module(spirv);
+
 		return spirv;
 	}
 	std::basic_string<char> finalize_code_for_entry_point(const std::string &entry_point_name) const override
@@ -395,109 +974,114 @@ private:
 		finalize_header_section(spirv);
 
 		// The entry point and execution mode declaration
-		for (const spirv_instruction &inst : _entries.instructions)
+		for (size_t i = 0; i < _entries.size(); ++i)
 		{
-			assert(inst.op == spv::OpEntryPoint);
+			assert(_entries.op(i) == spv::OpEntryPoint);
 
 			// Only add the matching entry point
-			if (inst.operands[1] == entry_point->id)
+			if (_entries.operand(i, 1) == entry_point->id)
 			{
-				inst.write(spirv);
+				_entries.write(spirv, i, i + 1);
 			}
 			else
 			{
-				functions_to_remove.push_back(inst.operands[1]);
+				functions_to_remove.push_back(_entries.operand(i, 1));
 
 				// Add interface variables to list of variables to remove
-				for (uint32_t k = 2 + static_cast<uint32_t>((std::strlen(reinterpret_cast<const char *>(&inst.operands[2])) + 4) / 4); k < inst.operands.size(); ++k)
-					variables_to_remove.push_back(inst.operands[k]);
+				const uint32_t *const operands = _entries.operands(i);
+				for (size_t k = 2 + (std::strlen(reinterpret_cast<const char *>(&operands[2])) + 4) / 4; k < _entries.operand_count(i); ++k)
+					variables_to_remove.push_back(operands[k]);
 			}
 		}
 
-		for (const spirv_instruction &inst : _execution_modes.instructions)
+		for (size_t i = 0; i < _execution_modes.size(); ++i)
 		{
-			assert(inst.op == spv::OpExecutionMode);
+			assert(_execution_modes.op(i) == spv::OpExecutionMode);
 
 			// Only add execution mode for the matching entry point
-			if (inst.operands[0] == entry_point->id)
+			if (_execution_modes.operand(i, 0) == entry_point->id)
 			{
-				inst.write(spirv);
+				_execution_modes.write(spirv, i, i + 1);
 			}
 		}
 
 		finalize_debug_info_section(spirv);
 
-		for (const spirv_instruction &inst : _debug_b.instructions)
+		for (size_t i = 0; i < _debug_b.size(); ++i)
 		{
 			// Remove all names of interface variables and functions for non-matching entry points
-			if (std::find(variables_to_remove.begin(), variables_to_remove.end(), inst.operands[0]) != variables_to_remove.end() ||
-				std::find(functions_to_remove.begin(), functions_to_remove.end(), inst.operands[0]) != functions_to_remove.end())
+			if (std::find(variables_to_remove.begin(), variables_to_remove.end(), _debug_b.operand(i, 0)) != variables_to_remove.end() ||
+				std::find(functions_to_remove.begin(), functions_to_remove.end(), _debug_b.operand(i, 0)) != functions_to_remove.end())
 				continue;
 
-			inst.write(spirv);
+			_debug_b.write(spirv, i, i + 1);
 		}
 
 		// All annotation instructions
-		for (spirv_instruction inst : _annotations.instructions)
+		for (size_t i = 0; i < _annotations.size(); ++i)
 		{
-			if (inst.op == spv::OpDecorate)
+			const size_t output_offset = spirv.size();
+
+			if (_annotations.op(i) == spv::OpDecorate)
 			{
+				const spv::Id target = _annotations.operand(i, 0);
+
 				// Remove all decorations targeting any of the interface variables for non-matching entry points
-				if (std::find(variables_to_remove.begin(), variables_to_remove.end(), inst.operands[0]) != variables_to_remove.end())
+				if (std::find(variables_to_remove.begin(), variables_to_remove.end(), target) != variables_to_remove.end())
 					continue;
 
-				// Replace bindings
-				if (inst.operands[1] == spv::DecorationBinding)
+				_annotations.write(spirv, i, i + 1);
+
+				// Replace bindings (directly in the output, where the binding operand follows the opcode, target and decoration words)
+				if (_annotations.operand(i, 1) == spv::DecorationBinding)
 				{
-					if (const auto referenced_sampler_it = std::find(entry_point->referenced_samplers.begin(), entry_point->referenced_samplers.end(), inst.operands[0]);
+					uint32_t binding = _annotations.operand(i, 2);
+
+					if (const auto referenced_sampler_it = std::find(entry_point->referenced_samplers.begin(), entry_point->referenced_samplers.end(), target);
 						referenced_sampler_it != entry_point->referenced_samplers.end())
-						inst.operands[2] = static_cast<uint32_t>(referenced_sampler_it - entry_point->referenced_samplers.begin());
+						binding = static_cast<uint32_t>(referenced_sampler_it - entry_point->referenced_samplers.begin());
 					else
-					if (const auto referenced_storage_it = std::find(entry_point->referenced_storages.begin(), entry_point->referenced_storages.end(), inst.operands[0]);
+					if (const auto referenced_storage_it = std::find(entry_point->referenced_storages.begin(), entry_point->referenced_storages.end(), target);
 						referenced_storage_it != entry_point->referenced_storages.end())
-						inst.operands[2] = static_cast<uint32_t>(referenced_storage_it - entry_point->referenced_storages.begin());
+						binding = static_cast<uint32_t>(referenced_storage_it - entry_point->referenced_storages.begin());
+
+					std::memcpy(spirv.data() + output_offset + 3 * sizeof(uint32_t), &binding, sizeof(binding));
 				}
 			}
-
-			inst.write(spirv);
+			else
+			{
+				_annotations.write(spirv, i, i + 1);
+			}
 		}
 
 		finalize_type_and_constants_section(spirv);
 
-		for (const spirv_instruction &inst : _variables.instructions)
+		for (size_t i = 0; i < _variables.size(); ++i)
 		{
 			// Remove all declarations of the interface variables for non-matching entry points
-			if (inst.op == spv::OpVariable && std::find(variables_to_remove.begin(), variables_to_remove.end(), inst.result) != variables_to_remove.end())
+			if (_variables.op(i) == spv::OpVariable && std::find(variables_to_remove.begin(), variables_to_remove.end(), _variables.result(i)) != variables_to_remove.end())
 				continue;
 
-			inst.write(spirv);
+			_variables.write(spirv, i, i + 1);
 		}
 
 		// All referenced function definitions
-		for (const function_blocks &function : _functions_blocks)
+		for (const function_blocks &func : _functions_blocks)
 		{
-			if (function.definition.instructions.empty())
+			if (func.definition.empty())
 				continue;
 
-			assert(function.declaration.instructions[function.declaration.instructions[0].op != spv::OpFunction ? 1 : 0].op == spv::OpFunction);
-			const spv::Id definition = function.declaration.instructions[function.declaration.instructions[0].op != spv::OpFunction ? 1 : 0].result;
+			assert(func.declaration.op(func.declaration.op(0) != spv::OpFunction ? 1 : 0) == spv::OpFunction);
+			const spv::Id definition = func.declaration.result(func.declaration.op(0) != spv::OpFunction ? 1 : 0);
 
 			if (std::find(functions_to_remove.begin(), functions_to_remove.end(), definition) != functions_to_remove.end())
 				continue;
 
-			for (const spirv_instruction &inst : function.declaration.instructions)
-				inst.write(spirv);
-
-			// Grab first label and move it in front of variable declarations
-			function.definition.instructions.front().write(spirv);
-			assert(function.definition.instructions.front().op == spv::OpLabel);
-
-			for (const spirv_instruction &inst : function.variables.instructions)
-				inst.write(spirv);
-			for (auto inst_it = function.definition.instructions.begin() + 1; inst_it != function.definition.instructions.end(); ++inst_it)
-				inst_it->write(spirv);
+			finalize_function_section(spirv, func);
 		}
 
+		finalize_compact_module(spirv);
+
 		return spirv;
 	}
 
@@ -523,8 +1107,7 @@ private:
 
 		const type_lookup lookup { info, is_ptr, array_stride, { storage, format } };
 
-		if (const auto lookup_it = std::find_if(_type_lookup.begin(), _type_lookup.end(),
-				[&lookup](const std::pair<type_lookup, spv::Id> &lookup_entry) { return lookup_entry.first == lookup; });
+		if (const auto lookup_it = _type_lookup.find(lookup);
 			lookup_it != _type_lookup.end())
 			return lookup_it->second;
 
@@ -689,14 +1272,15 @@ private:
 			}
 		}
 
-		_type_lookup.push_back({ lookup, type_id });
+		_type_lookup.emplace(lookup, type_id);
 
 		return type_id;
 	}
 	spv::Id convert_type(const function_blocks &info)
 	{
-		if (const auto lookup_it = std::find_if(_function_type_lookup.begin(), _function_type_lookup.end(),
-				[&lookup = info](const std::pair<function_blocks, spv::Id> &lookup_entry) { return lookup_entry.first == lookup; });
+		function_type_lookup lookup { info.return_type, info.param_types };
+
+		if (const auto lookup_it = _function_type_lookup.find(lookup);
 			lookup_it != _function_type_lookup.end())
 			return lookup_it->second;
 
@@ -708,11 +1292,11 @@ private:
 		for (const type &param_type : info.param_types)
 			param_type_ids.push_back(convert_type(param_type, true));
 
-		spirv_instruction &inst = add_instruction(spv::OpTypeFunction, 0, _types_and_constants)
+		spirv_instruction inst = add_instruction(spv::OpTypeFunction, 0, _types_and_constants)
 			.add(return_type_id)
 			.add(param_type_ids.begin(), param_type_ids.end());
 
-		_function_type_lookup.push_back({ info, inst });
+		_function_type_lookup.emplace(std::move(lookup), inst);
 
 		return inst;
 	}
@@ -740,8 +1324,7 @@ private:
 			lookup.type.struct_definition = static_cast<uint32_t>(elem_info.base);
 		}
 
-		if (const auto lookup_it = std::find_if(_type_lookup.begin(), _type_lookup.end(),
-				[&lookup](const std::pair<type_lookup, spv::Id> &lookup_entry) { return lookup_entry.first == lookup; });
+		if (const auto lookup_it = _type_lookup.find(lookup);
 			lookup_it != _type_lookup.end())
 			return lookup_it->second;
 
@@ -756,7 +1339,7 @@ private:
 				.add(info.is_storage() ? 2 : 1) // Used with a sampler or as storage
 				.add(format);
 
-		_type_lookup.push_back({ lookup, type_id });
+		_type_lookup.emplace(lookup, type_id);
 
 		return type_id;
 	}
@@ -1007,7 +1590,7 @@ private:
 			add_name(res, info.name.c_str());
 
 			const auto add_spec_constant = [this](const spirv_instruction &inst, const uniform &info, const constant &initializer_value, size_t initializer_offset) {
-				assert(inst.op == spv::OpSpecConstant || inst.op == spv::OpSpecConstantTrue || inst.op == spv::OpSpecConstantFalse);
+				assert(inst.op() == spv::OpSpecConstant || inst.op() == spv::OpSpecConstantTrue || inst.op() == spv::OpSpecConstantFalse);
 
 				const uint32_t spec_id = static_cast<uint32_t>(_module.spec_constants.size());
 				add_decoration(inst, spv::DecorationSpecId, { spec_id });
@@ -1022,8 +1605,15 @@ private:
 
 				_module.spec_constants.push_back(std::move(scalar_info));
 			};
+			const auto find_constant = [this](spv::Id id) {
+				// Search backwards, since the element constants were added right before the composite constant
+				size_t index = _types_and_constants.size();
+				while (index-- > 0 && _types_and_constants.result(index) != id)
+					continue;
+				return _types_and_constants[index];
+			};
 
-			const spirv_instruction &base_inst = _types_and_constants.instructions.back();
+			const spirv_instruction base_inst = _types_and_constants.back();
 			assert(base_inst == res);
 
 			// External specialization constants need to be scalars
@@ -1033,38 +1623,35 @@ private:
 			}
 			else
 			{
-				assert(base_inst.op == spv::OpSpecConstantComposite);
+				assert(base_inst.op() == spv::OpSpecConstantComposite);
 
 				// Add each individual scalar component of the constant as a separate external specialization constant
-				for (size_t i = 0; i < (info.type.is_array() ? base_inst.operands.size() : 1); ++i)
+				for (size_t i = 0; i < (info.type.is_array() ? base_inst.operand_count() : 1); ++i)
 				{
 					constant initializer_value = info.initializer_value;
 					spirv_instruction elem_inst = base_inst;
 
 					if (info.type.is_array())
 					{
-						elem_inst = *std::find_if(_types_and_constants.instructions.rbegin(), _types_and_constants.instructions.rend(),
-							[operand_id = base_inst.operands[i]](const spirv_instruction &inst) { return inst == operand_id; });
+						elem_inst = find_constant(base_inst.operand(i));
 
-						assert(initializer_value.array_data.size() == base_inst.operands.size());
+						assert(initializer_value.array_data.size() == base_inst.operand_count());
 						initializer_value = initializer_value.array_data[i];
 					}
 
-					for (size_t row = 0; row < elem_inst.operands.size(); ++row)
+					for (size_t row = 0; row < elem_inst.operand_count(); ++row)
 					{
-						const spirv_instruction &row_inst = *std::find_if(_types_and_constants.instructions.rbegin(), _types_and_constants.instructions.rend(),
-							[operand_id = elem_inst.operands[row]](const spirv_instruction &inst) { return inst == operand_id; });
+						const spirv_instruction row_inst = find_constant(elem_inst.operand(row));
 
-						if (row_inst.op != spv::OpSpecConstantComposite)
+						if (row_inst.op() != spv::OpSpecConstantComposite)
 						{
 							add_spec_constant(row_inst, info, initializer_value, row);
 							continue;
 						}
 
-						for (size_t col = 0; col < row_inst.operands.size(); ++col)
+						for (size_t col = 0; col < row_inst.operand_count(); ++col)
 						{
-							const spirv_instruction &col_inst = *std::find_if(_types_and_constants.instructions.rbegin(), _types_and_constants.instructions.rend(),
-								[operand_id = row_inst.operands[col]](const spirv_instruction &inst) { return inst == operand_id; });
+							const spirv_instruction col_inst = find_constant(row_inst.operand(col));
 
 							add_spec_constant(col_inst, info, initializer_value, row * info.type.cols + col);
 						}
@@ -1163,10 +1750,10 @@ private:
 		add_location(loc, block);
 
 		// https://www.khronos.org/registry/spir-v/specs/unified1/SPIRV.html#OpVariable
-		spirv_instruction &inst = add_instruction(spv::OpVariable, convert_type(type, true, storage, format), block);
+		spirv_instruction inst = add_instruction(spv::OpVariable, convert_type(type, true, storage, format), block);
 		inst.add(storage);
 
-		const id res = inst.result;
+		const id res = inst;
 
 		if (initializer_value != 0)
 		{
@@ -1587,7 +2174,7 @@ private:
 				it != _storage_lookup.end())
 				storage = it->second;
 
-			spirv_instruction *access_chain = nullptr;
+			std::optional<spirv_instruction> access_chain;
 
 			// Check if this is a uniform variable (see 'define_uniform' function above) and dereference it
 			if (result & 0xF0000000)
@@ -1600,7 +2187,7 @@ private:
 				if (is_uniform_bool)
 					base_type.base = type::t_uint;
 
-				access_chain = &add_instruction(spv::OpAccessChain)
+				access_chain = add_instruction(spv::OpAccessChain)
 					.add(_global_ubo_variable)
 					.add(emit_constant(member_index));
 			}
@@ -1611,12 +2198,12 @@ private:
 				exp.chain[0].op == expression::operation::op_dynamic_index ||
 				exp.chain[0].op == expression::operation::op_constant_index))
 			{
-				// Ensure that 'access_chain' cannot get invalidated by calls to 'emit_constant' or 'convert_type'
+				// Ensure that operands can still be appended to 'access_chain' after calls to 'emit_constant' or 'convert_type'
 				assert(_current_block_data != &_types_and_constants);
 
 				// Use access chain from uniform if possible, otherwise create new one
-				if (access_chain == nullptr) access_chain =
-					&add_instruction(spv::OpAccessChain).add(result); // Base
+				if (!access_chain.has_value()) access_chain =
+					add_instruction(spv::OpAccessChain).add(result); // Base
 
 				// Ignore first index into 1xN matrices, since they were translated to a vector type in SPIR-V
 				if (exp.chain[0].from.rows == 1 && exp.chain[0].from.cols > 1)
@@ -1631,13 +2218,13 @@ private:
 						emit_constant(exp.chain[i].index)); // Indexes
 
 				base_type = exp.chain[i - 1].to;
-				access_chain->type = convert_type(base_type, true, storage.first, storage.second); // Last type is the result
-				result = access_chain->result;
+				access_chain->set_type(convert_type(base_type, true, storage.first, storage.second)); // Last type is the result
+				result = *access_chain;
 			}
-			else if (access_chain != nullptr)
+			else if (access_chain.has_value())
 			{
-				access_chain->type = convert_type(base_type, true, storage.first, storage.second, base_type.is_array() ? 16u : 0u);
-				result = access_chain->result;
+				access_chain->set_type(convert_type(base_type, true, storage.first, storage.second, base_type.is_array() ? 16u : 0u));
+				result = *access_chain;
 			}
 
 			result =
@@ -1777,7 +2364,7 @@ private:
 							scalar_type.rows = 1;
 							scalar_type.cols = 1;
 
-							spirv_instruction &inst = add_instruction(spv::OpCompositeExtract, convert_type(scalar_type));
+							spirv_instruction inst = add_instruction(spv::OpCompositeExtract, convert_type(scalar_type));
 							inst.add(result);
 							if (op.from.rows > 1) // Matrix types with a single row are actually vectors, so they don't need the extra index
 								inst.add(row);
@@ -1786,14 +2373,14 @@ private:
 							components[c] = inst;
 						}
 
-						spirv_instruction &inst = add_instruction(spv::OpCompositeConstruct, convert_type(op.to));
+						spirv_instruction inst = add_instruction(spv::OpCompositeConstruct, convert_type(op.to));
 						for (int c = 0; c < 4 && op.swizzle[c] >= 0; ++c)
 							inst.add(components[c]);
 						result = inst;
 					}
 					else if (op.from.is_vector())
 					{
-						spirv_instruction &inst = add_instruction(spv::OpVectorShuffle, convert_type(op.to));
+						spirv_instruction inst = add_instruction(spv::OpVectorShuffle, convert_type(op.to));
 						inst.add(result); // Vector 1
 						inst.add(result); // Vector 2
 						for (int c = 0; c < 4 && op.swizzle[c] >= 0; ++c)
@@ -1802,7 +2389,7 @@ private:
 					}
 					else
 					{
-						spirv_instruction &inst = add_instruction(spv::OpCompositeConstruct, convert_type(op.to));
+						spirv_instruction inst = add_instruction(spv::OpCompositeConstruct, convert_type(op.to));
 						for (unsigned int c = 0; c < op.to.rows; ++c)
 							inst.add(result);
 						result = inst;
@@ -1813,7 +2400,7 @@ private:
 				{
 					assert(op.swizzle[1] < 0);
 
-					spirv_instruction &inst = add_instruction(spv::OpCompositeExtract, convert_type(op.to));
+					spirv_instruction inst = add_instruction(spv::OpCompositeExtract, convert_type(op.to));
 					inst.add(result); // Composite
 					if (op.from.rows > 1)
 					{
@@ -1873,7 +2460,7 @@ private:
 
 					if (base_type.is_vector())
 					{
-						spirv_instruction &inst = add_instruction(spv::OpVectorShuffle, convert_type(base_type));
+						spirv_instruction inst = add_instruction(spv::OpVectorShuffle, convert_type(base_type));
 						inst.add(result); // Vector 1
 						inst.add(value); // Vector 2
 
@@ -1890,7 +2477,7 @@ private:
 					{
 						assert(op.swizzle[1] < 0);
 
-						spirv_instruction &inst = add_instruction(spv::OpCompositeInsert, convert_type(base_type));
+						spirv_instruction inst = add_instruction(spv::OpCompositeInsert, convert_type(base_type));
 						inst.add(value); // Object
 						inst.add(result); // Composite
 
@@ -1939,11 +2526,11 @@ private:
 			it != _storage_lookup.end())
 			storage = it->second;
 
-		// Ensure that 'access_chain' cannot get invalidated by calls to 'emit_constant' or 'convert_type'
+		// Ensure that operands can still be appended to 'access_chain' after calls to 'emit_constant' or 'convert_type'
 		assert(_current_block_data != &_types_and_constants);
 
-		spirv_instruction *access_chain =
-			&add_instruction(spv::OpAccessChain).add(exp.base); // Base
+		spirv_instruction access_chain =
+			add_instruction(spv::OpAccessChain).add(exp.base); // Base
 
 		// Ignore first index into 1xN matrices, since they were translated to a vector type in SPIR-V
 		if (exp.chain[0].from.rows == 1 && exp.chain[0].from.cols > 1)
@@ -1953,12 +2540,12 @@ private:
 			exp.chain[i].op == expression::operation::op_member ||
 			exp.chain[i].op == expression::operation::op_dynamic_index ||
 			exp.chain[i].op == expression::operation::op_constant_index); ++i)
-			access_chain->add(exp.chain[i].op == expression::operation::op_dynamic_index ?
+			access_chain.add(exp.chain[i].op == expression::operation::op_dynamic_index ?
 				exp.chain[i].index :
 				emit_constant(exp.chain[i].index)); // Indexes
 
-		access_chain->type = convert_type(exp.chain[i - 1].to, true, storage.first, storage.second); // Last type is the result
-		return access_chain->result;
+		access_chain.set_type(convert_type(exp.chain[i - 1].to, true, storage.first, storage.second)); // Last type is the result
+		return access_chain;
 	}
 
 	using codegen::emit_constant;
@@ -1974,17 +2561,9 @@ private:
 	{
 		if (!spec_constant) // Specialization constants cannot reuse other constants
 		{
-			if (const auto it = std::find_if(_constant_lookup.begin(), _constant_lookup.end(),
-					[&data_type, &data](std::tuple<type, constant, spv::Id> &x) {
-						if (!(std::get<0>(x) == data_type && std::memcmp(&std::get<1>(x).as_uint[0], &data.as_uint[0], sizeof(uint32_t) * 16) == 0 && std::get<1>(x).array_data.size() == data.array_data.size()))
-							return false;
-						for (size_t i = 0; i < data.array_data.size(); ++i)
-							if (std::memcmp(&std::get<1>(x).array_data[i].as_uint[0], &data.array_data[i].as_uint[0], sizeof(uint32_t) * 16) != 0)
-								return false;
-						return true;
-					});
+			if (const auto it = _constant_lookup.find({ data_type, data });
 				it != _constant_lookup.end())
-				return std::get<2>(*it); // Reuse existing constant instead of duplicating the definition
+				return it->second; // Reuse existing constant instead of duplicating the definition
 		}
 
 		spv::Id result;
@@ -2040,7 +2619,7 @@ private:
 			}
 			else
 			{
-				spirv_instruction &inst = add_instruction(spec_constant ? spv::OpSpecConstantComposite : spv::OpConstantComposite, convert_type(data_type), _types_and_constants);
+				spirv_instruction inst = add_instruction(spec_constant ? spv::OpSpecConstantComposite : spv::OpConstantComposite, convert_type(data_type), _types_and_constants);
 				for (unsigned int i = 0; i < data_type.rows; ++i)
 					inst.add(rows[i]);
 				result = inst;
@@ -2064,7 +2643,7 @@ private:
 		if (spec_constant) // Keep track of all specialization constants
 			_spec_constants.insert(result);
 		else
-			_constant_lookup.push_back({ data_type, data, result });
+			_constant_lookup.emplace(constant_lookup { data_type, data }, result);
 
 		return result;
 	}
@@ -2090,7 +2669,7 @@ private:
 
 		add_location(loc, *_current_block_data);
 
-		spirv_instruction &inst = add_instruction(spv_op, convert_type(res_type));
+		spirv_instruction inst = add_instruction(spv_op, convert_type(res_type));
 		inst.add(val); // Operand
 
 		return inst;
@@ -2198,7 +2777,7 @@ private:
 					.add(rhs)
 					.add(row);
 
-				spirv_instruction &inst = add_instruction(spv_op, convert_type(vector_type));
+				spirv_instruction inst = add_instruction(spv_op, convert_type(vector_type));
 				inst.add(lhs_elem); // Operand 1
 				inst.add(rhs_elem); // Operand 2
 
@@ -2210,14 +2789,14 @@ private:
 				ids.push_back(inst);
 			}
 
-			spirv_instruction &inst = add_instruction(spv::OpCompositeConstruct, convert_type(res_type));
+			spirv_instruction inst = add_instruction(spv::OpCompositeConstruct, convert_type(res_type));
 			inst.add(ids.begin(), ids.end());
 
 			return inst;
 		}
 		else
 		{
-			spirv_instruction &inst = add_instruction(spv_op, convert_type(res_type));
+			spirv_instruction inst = add_instruction(spv_op, convert_type(res_type));
 			inst.add(lhs); // Operand 1
 			inst.add(rhs); // Operand 2
 
@@ -2236,7 +2815,7 @@ private:
 
 		add_location(loc, *_current_block_data);
 
-		spirv_instruction &inst = add_instruction(spv::OpSelect, convert_type(res_type));
+		spirv_instruction inst = add_instruction(spv::OpSelect, convert_type(res_type));
 		inst.add(condition); // Condition
 		inst.add(true_value); // Object 1
 		inst.add(false_value); // Object 2
@@ -2252,7 +2831,7 @@ private:
 		add_location(loc, *_current_block_data);
 
 		// https://www.khronos.org/registry/spir-v/specs/unified1/SPIRV.html#OpFunctionCall
-		spirv_instruction &inst = add_instruction(spv::OpFunctionCall, convert_type(res_type));
+		spirv_instruction inst = add_instruction(spv::OpFunctionCall, convert_type(res_type));
 		inst.add(function); // Function
 		for (const expression &arg : args)
 			inst.add(arg.base); // Arguments
@@ -2302,7 +2881,7 @@ private:
 			// Turn the list of scalar arguments into a list of column vectors
 			for (size_t arg = 0; arg < args.size(); arg += vector_type.rows)
 			{
-				spirv_instruction &inst = add_instruction(spv::OpCompositeConstruct, convert_type(vector_type));
+				spirv_instruction inst = add_instruction(spv::OpCompositeConstruct, convert_type(vector_type));
 				for (unsigned row = 0; row < vector_type.rows; ++row)
 					inst.add(args[arg + row].base);
 
@@ -2318,7 +2897,7 @@ private:
 				ids.push_back(arg.base);
 		}
 
-		spirv_instruction &inst = add_instruction(spv::OpCompositeConstruct, convert_type(res_type));
+		spirv_instruction inst = add_instruction(spv::OpCompositeConstruct, convert_type(res_type));
 		inst.add(ids.begin(), ids.end());
 
 		return inst;
@@ -2326,16 +2905,15 @@ private:
 
 	void emit_if(const location &loc, id, id condition_block, id true_statement_block, id false_statement_block, unsigned int selection_control) override
 	{
-		spirv_instruction merge_label = _current_block_data->instructions.back();
-		assert(merge_label.op == spv::OpLabel);
-		_current_block_data->instructions.pop_back();
+		assert(_current_block_data->back().op() == spv::OpLabel);
+		const spv::Id merge_label = _current_block_data->back();
+		_current_block_data->pop_back();
 
 		// Add previous block containing the condition value first
 		_current_block_data->append(_block_data[condition_block]);
 
-		spirv_instruction branch_inst = _current_block_data->instructions.back();
-		assert(branch_inst.op == spv::OpBranchConditional);
-		_current_block_data->instructions.pop_back();
+		assert(_current_block_data->back().op() == spv::OpBranchConditional);
+		const spirv_basic_block branch_inst = _current_block_data->split_back();
 
 		// Add structured control flow instruction
 		add_location(loc, *_current_block_data);
@@ -2344,17 +2922,17 @@ private:
 			.add(selection_control & 0x3); // 'SelectionControl' happens to match the flags produced by the parser
 
 		// Append all blocks belonging to the branch
-		_current_block_data->instructions.push_back(branch_inst);
+		_current_block_data->append(branch_inst);
 		_current_block_data->append(_block_data[true_statement_block]);
 		_current_block_data->append(_block_data[false_statement_block]);
 
-		_current_block_data->instructions.push_back(merge_label);
+		_current_block_data->add_instruction(spv::OpLabel, 0, merge_label);
 	}
 	id   emit_phi(const location &loc, id, id condition_block, id true_value, id true_statement_block, id false_value, id false_statement_block, const type &res_type) override
 	{
-		spirv_instruction merge_label = _current_block_data->instructions.back();
-		assert(merge_label.op == spv::OpLabel);
-		_current_block_data->instructions.pop_back();
+		assert(_current_block_data->back().op() == spv::OpLabel);
+		const spv::Id merge_label = _current_block_data->back();
+		_current_block_data->pop_back();
 
 		// Add previous block containing the condition value first
 		_current_block_data->append(_block_data[condition_block]);
@@ -2364,12 +2942,12 @@ private:
 		if (false_statement_block != condition_block)
 			_current_block_data->append(_block_data[false_statement_block]);
 
-		_current_block_data->instructions.push_back(merge_label);
+		_current_block_data->add_instruction(spv::OpLabel, 0, merge_label);
 
 		add_location(loc, *_current_block_data);
 
 		// https://www.khronos.org/registry/spir-v/specs/unified1/SPIRV.html#OpPhi
-		spirv_instruction &inst = add_instruction(spv::OpPhi, convert_type(res_type))
+		spirv_instruction inst = add_instruction(spv::OpPhi, convert_type(res_type))
 			.add(true_value) // Variable 0
 			.add(true_statement_block) // Parent 0
 			.add(false_value) // Variable 1
@@ -2379,17 +2957,18 @@ private:
 	}
 	void emit_loop(const location &loc, id, id prev_block, id header_block, id condition_block, id loop_block, id continue_block, unsigned int loop_control) override
 	{
-		spirv_instruction merge_label = _current_block_data->instructions.back();
-		assert(merge_label.op == spv::OpLabel);
-		_current_block_data->instructions.pop_back();
+		assert(_current_block_data->back().op() == spv::OpLabel);
+		const spv::Id merge_label = _current_block_data->back();
+		_current_block_data->pop_back();
 
 		// Add previous block first
 		_current_block_data->append(_block_data[prev_block]);
 
 		// Fill header block
-		assert(_block_data[header_block].instructions.size() == 2);
-		_current_block_data->instructions.push_back(_block_data[header_block].instructions[0]);
-		assert(_current_block_data->instructions.back().op == spv::OpLabel);
+		const spirv_basic_block &header_block_data = _block_data[header_block];
+		assert(header_block_data.size() == 2);
+		_current_block_data->append(header_block_data, 0, 1);
+		assert(_current_block_data->back().op() == spv::OpLabel);
 
 		// Add structured control flow instruction
 		add_location(loc, *_current_block_data);
@@ -2398,8 +2977,8 @@ private:
 			.add(continue_block)
 			.add(loop_control & 0x3); // 'LoopControl' happens to match the flags produced by the parser
 
-		_current_block_data->instructions.push_back(_block_data[header_block].instructions[1]);
-		assert(_current_block_data->instructions.back().op == spv::OpBranch);
+		_current_block_data->append(header_block_data, 1, 2);
+		assert(_current_block_data->back().op() == spv::OpBranch);
 
 		// Add condition block if it exists
 		if (condition_block != 0)
@@ -2409,22 +2988,21 @@ private:
 		_current_block_data->append(_block_data[loop_block]);
 		_current_block_data->append(_block_data[continue_block]);
 
-		_current_block_data->instructions.push_back(merge_label);
+		_current_block_data->add_instruction(spv::OpLabel, 0, merge_label);
 	}
 	void emit_switch(const location &loc, id, id selector_block, id default_label, id default_block, const std::vector<id> &case_literal_and_labels, const std::vector<id> &case_blocks, unsigned int selection_control) override
 	{
 		assert(case_blocks.size() == case_literal_and_labels.size() / 2);
 
-		spirv_instruction merge_label = _current_block_data->instructions.back();
-		assert(merge_label.op == spv::OpLabel);
-		_current_block_data->instructions.pop_back();
+		assert(_current_block_data->back().op() == spv::OpLabel);
+		const spv::Id merge_label = _current_block_data->back();
+		_current_block_data->pop_back();
 
 		// Add previous block containing the selector value first
 		_current_block_data->append(_block_data[selector_block]);
 
-		spirv_instruction switch_inst = _current_block_data->instructions.back();
-		assert(switch_inst.op == spv::OpSwitch);
-		_current_block_data->instructions.pop_back();
+		assert(_current_block_data->back().op() == spv::OpSwitch);
+		spirv_basic_block switch_inst = _current_block_data->split_back();
 
 		// Add structured control flow instruction
 		add_location(loc, *_current_block_data);
@@ -2433,11 +3011,11 @@ private:
 			.add(selection_control & 0x3); // 'SelectionControl' happens to match the flags produced by the parser
 
 		// Update switch instruction to contain all case labels
-		switch_inst.operands[1] = default_label;
-		switch_inst.add(case_literal_and_labels.begin(), case_literal_and_labels.end());
+		switch_inst.back().set_operand(1, default_label);
+		switch_inst.back().add(case_literal_and_labels.begin(), case_literal_and_labels.end());
 
 		// Append all blocks belonging to the switch
-		_current_block_data->instructions.push_back(switch_inst);
+		_current_block_data->append(switch_inst);
 
 		std::vector<id> blocks = case_blocks;
 		if (default_label != merge_label)
@@ -2448,7 +3026,7 @@ private:
 		for (const id case_block : blocks)
 			_current_block_data->append(_block_data[case_block]);
 
-		_current_block_data->instructions.push_back(merge_label);
+		_current_block_data->add_instruction(spv::OpLabel, 0, merge_label);
 	}
 
 	bool is_in_function() const { return _current_function_blocks != nullptr; }
@@ -2469,7 +3047,8 @@ private:
 
 		set_block(id);
 
-		add_instruction_without_result(spv::OpLabel).result = id;
+		assert(is_in_function() && is_in_block());
+		_current_block_data->add_instruction(spv::OpLabel, 0, id);
 	}
 	id   leave_block_and_kill() override
 	{
@@ -2560,7 +3139,10 @@ private:
 	}
 };
 
-codegen *reshadefx::create_codegen_spirv(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types, bool flip_vert_y)
+codegen *reshadefx::create_codegen_spirv(bool vulkan_semantics, bool debug_info, bool uniforms_to_spec_constants, bool enable_16bit_types, bool flip_vert_y, bool optimize)
 {
+	if (optimize)
+		return new codegen_optimizer<codegen_spirv>(vulkan_semantics, debug_info, uniforms_to_spec_constants, enable_16bit_types, flip_vert_y);
+
 	return new codegen_spirv(vulkan_semantics, debug_info, uniforms_to_spec_constants, enable_16bit_types, flip_vert_y);
 }
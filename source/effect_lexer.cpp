@@ -4,10 +4,21 @@
  */
 
 #include "effect_lexer.hpp"
+#include "effect_perfect_hash.hpp"
 #include <cassert>
 #include <string_view>
 #include <unordered_map> // Used for static lookup tables
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define RESHADEFX_LEXER_SSE2 1
+	#include <emmintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h> // _BitScanForward
+	#endif
+#else
+	#define RESHADEFX_LEXER_SSE2 0
+#endif
+
 using namespace reshadefx;
 
 enum token_type
@@ -34,6 +45,84 @@ static const unsigned int s_type_lookup[256] = {
 	IDENT, IDENT, IDENT,   '{',   '|',   '}',   '~',  0x00,  0x00,  0x00,
 };
 
+#if RESHADEFX_LEXER_SSE2
+static inline unsigned int find_first_set_bit(unsigned int mask)
+{
+	assert(mask != 0);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Finds the first character in the range [cur, end) that matches any of the specified characters, 16 characters at a time where possible
+template <char... chars>
+static const char *find_first_of(const char *cur, const char *end)
+{
+#if RESHADEFX_LEXER_SSE2
+	for (; end - cur >= 16; cur += 16)
+	{
+		const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur));
+		__m128i match = _mm_setzero_si128();
+		((match = _mm_or_si128(match, _mm_cmpeq_epi8(data, _mm_set1_epi8(chars)))), ...);
+
+		if (const unsigned int mask = _mm_movemask_epi8(match); mask != 0)
+			return cur + find_first_set_bit(mask);
+	}
+#endif
+	while (cur < end && !((*cur == chars) || ...))
+		cur++;
+	return cur;
+}
+// Finds the first character in the range [cur, end) that does not match any of the specified characters, 16 characters at a time where possible
+template <char... chars>
+static const char *find_first_not_of(const char *cur, const char *end)
+{
+#if RESHADEFX_LEXER_SSE2
+	for (; end - cur >= 16; cur += 16)
+	{
+		const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur));
+		__m128i match = _mm_setzero_si128();
+		((match = _mm_or_si128(match, _mm_cmpeq_epi8(data, _mm_set1_epi8(chars)))), ...);
+
+		if (const unsigned int mask = _mm_movemask_epi8(match) ^ 0xFFFF; mask != 0)
+			return cur + find_first_set_bit(mask);
+	}
+#endif
+	while (cur < end && ((*cur == chars) || ...))
+		cur++;
+	return cur;
+}
+// Finds the end of a sequence of identifier characters ('A'-'Z', 'a'-'z', '0'-'9' and '_') starting at the specified position
+static const char *find_identifier_end(const char *cur, const char *end)
+{
+#if RESHADEFX_LEXER_SSE2
+	for (; end - cur >= 16; cur += 16)
+	{
+		const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur));
+		// Unsigned range checks of the form 'x - lower <= upper - lower', with the letter case folded away first
+		const __m128i alpha = _mm_sub_epi8(_mm_or_si128(data, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		const __m128i digit = _mm_sub_epi8(data, _mm_set1_epi8('0'));
+		const __m128i match = _mm_or_si128(
+			_mm_or_si128(
+				_mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8('z' - 'a')), alpha),
+				_mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8('9' - '0')), digit)),
+			_mm_cmpeq_epi8(data, _mm_set1_epi8('_')));
+
+		if (const unsigned int mask = _mm_movemask_epi8(match) ^ 0xFFFF; mask != 0)
+			return cur + find_first_set_bit(mask);
+	}
+#endif
+	// Do not check against the end pointer here, since the input string is always null-terminated
+	while (s_type_lookup[uint8_t(*cur)] == IDENT || s_type_lookup[uint8_t(*cur)] == DIGIT)
+		cur++;
+	return cur;
+}
+
 // Lookup tables which translate a given string literal to a token and backwards
 static const std::unordered_map<tokenid, std::string_view> s_token_lookup = {
 	{ tokenid::end_of_file, "end of file" },
@@ -205,7 +294,7 @@ static const std::unordered_map<tokenid, std::string_view> s_token_lookup = {
 	{ tokenid::storage2d, "storage2D" },
 	{ tokenid::storage3d, "storage3D" },
 };
-static const std::unordered_map<std::string_view, tokenid> s_keyword_lookup = {
+static constexpr std::pair<std::string_view, tokenid> s_keyword_entries[] = {
 	{ "asm", tokenid::reserved },
 	{ "asm_fragment", tokenid::reserved },
 	{ "auto", tokenid::reserved },
@@ -439,7 +528,7 @@ static const std::unordered_map<std::string_view, tokenid> s_keyword_lookup = {
 	{ "volatile", tokenid::volatile_ },
 	{ "while", tokenid::while_ }
 };
-static const std::unordered_map<std::string_view, tokenid> s_pp_directive_lookup = {
+static constexpr std::pair<std::string_view, tokenid> s_pp_directive_entries[] = {
 	{ "define", tokenid::hash_def },
 	{ "undef", tokenid::hash_undef },
 	{ "if", tokenid::hash_if },
@@ -454,6 +543,12 @@ static const std::unordered_map<std::string_view, tokenid> s_pp_directive_lookup
 	{ "include", tokenid::hash_include },
 };
 
+// Perfect hash tables built from the above at compile time, so that each identifier lookup costs one hash and one string comparison
+static constexpr auto s_keyword_lookup = make_perfect_hash_map(s_keyword_entries);
+static_assert(s_keyword_lookup.valid());
+static constexpr auto s_pp_directive_lookup = make_perfect_hash_map(s_pp_directive_entries);
+static_assert(s_pp_directive_lookup.valid());
+
 static bool is_octal_digit(char c)
 {
 	return static_cast<unsigned>(c - '0') < 8;
@@ -657,6 +752,11 @@ next_token:
 		{
 			while (_cur < _end)
 			{
+				// Skip ahead to the next character that can end the comment or starts a new line
+				skip(find_first_of<'*', '\n'>(_cur, _end) - _cur);
+				if (_cur >= _end)
+					break;
+
 				if (*_cur == '\n')
 				{
 					_cur_location.line++;
@@ -794,7 +894,7 @@ void reshadefx::lexer::skip(size_t length)
 }
 void reshadefx::lexer::skip_space()
 {
-	// Skip each character until a space is found
+	// Skip each character until a non-space character is found
 	while (_cur < _end)
 	{
 		if (_cur[0] == '\\' && (_cur[1] == '\n' || (_cur[1] == '\r' && _cur[2] == '\n')))
@@ -805,72 +905,189 @@ void reshadefx::lexer::skip_space()
 			continue;
 		}
 
-		if (s_type_lookup[uint8_t(*_cur)] == SPACE)
-			skip(1);
-		else
+		// These are all characters classified as 'SPACE' in the type lookup table
+		const char *const next = find_first_not_of<' ', '\t', '\v', '\f', '\r'>(_cur, _end);
+		if (next == _cur)
 			break;
+
+		skip(next - _cur);
 	}
 }
 void reshadefx::lexer::skip_to_next_line()
 {
-	// Skip each character until a new line feed is found
-	while (*_cur != '\n' && _cur < _end)
+	// Skip all characters until a new line feed is found
+	skip(find_first_of<'\n'>(_cur, _end) - _cur);
+}
+void reshadefx::lexer::skip_to_next_pp_directive()
+{
+	assert(_cur_location.column <= 1);
+
+	const char *cur = _cur;
+	uint32_t line = _cur_location.line;
+	// The last position lexing can safely be resumed at (the beginning of a line that is not inside a comment or string literal)
+	const char *resume = cur;
+	uint32_t resume_line = line;
+
+	while (cur < _end)
 	{
-#if 0
-		if (_cur[0] == '\\' && (_cur[1] == '\n' || (_cur[1] == '\r' && _cur[2] == '\n')))
+		// Any line that begins with a '#' may be a directive, so stop there
+		// Lines beginning with a multi-line comment or a line continuation are left to the lexer too, since those keep the following characters at the beginning of the line
+		resume = cur;
+		resume_line = line;
+		cur = find_first_not_of<' ', '\t', '\v', '\f', '\r'>(cur, _end);
+		if (cur[0] == '#' || cur[0] == '\\' || (cur[0] == '/' && cur[1] == '*'))
+			goto resume_lexing;
+
+		// Skip over the rest of the line
+		while (true)
 		{
-			skip(_cur[1] == '\r' ? 3 : 2);
-			_cur_location.line++;
-			_cur_location.column = 1;
-			continue;
+			cur = find_first_of<'\n', '"', '/', '\\', '\0'>(cur, _end);
+			if (cur >= _end)
+				break;
+
+			if (cur[0] == '\n')
+			{
+				cur++;
+				line++;
+				break;
+			}
+
+			switch (cur[0])
+			{
+			case '"':
+				for (cur++; (cur = find_first_of<'"', '\\', '\n'>(cur, _end)) < _end && cur[0] != '\n';)
+				{
+					if (cur[0] == '"')
+					{
+						cur++;
+						break;
+					}
+
+					// Escape character found at end of line, the string literal continues on to the next line
+					if (cur[1] == '\n' || (cur[1] == '\r' && cur[2] == '\n'))
+						cur += cur[1] == '\r' ? 3 : 2,
+						line++;
+					else
+						cur += _escape_string_literals ? 2 : 1;
+				}
+				break;
+			case '/':
+				if (cur[1] == '/')
+				{
+					cur = find_first_of<'\n'>(cur, _end);
+				}
+				else if (cur[1] == '*')
+				{
+					// Start looking for the end right at the '*', since the lexer treats '/*/' as a complete comment as well
+					for (cur++; (cur = find_first_of<'*', '\n'>(cur, _end)) < _end; cur++)
+					{
+						if (cur[0] == '\n')
+						{
+							line++;
+						}
+						else if (cur[1] == '/')
+						{
+							cur += 2;
+							break;
+						}
+					}
+				}
+				else
+				{
+					cur++;
+				}
+				break;
+			case '\\':
+				if (cur[1] == '\n' || (cur[1] == '\r' && cur[2] == '\n'))
+				{
+					cur += cur[1] == '\r' ? 3 : 2;
+					line++;
+
+					// The lexer continues at the beginning of the next line after a line continuation, so a directive may follow right away
+					if (cur[0] == '#' || cur[0] == '\\' || (cur[0] == '/' && cur[1] == '*'))
+					{
+						resume = cur;
+						resume_line = line;
+						goto resume_lexing;
+					}
+				}
+				else
+				{
+					cur++;
+				}
+				break;
+			case '\0':
+				// The lexer stops at a null character, so let it handle this line
+				goto resume_lexing;
+			}
 		}
-#endif
+	}
 
-		skip(1);
+	if (cur >= _end)
+	{
+		resume = _end;
+		resume_line = line;
 	}
+
+resume_lexing:
+	_cur = resume;
+	_cur_location.line = resume_line;
+	_cur_location.column = 1;
 }
 
 void reshadefx::lexer::reset_to_offset(size_t offset)
 {
-	assert(offset < _input.size());
-	_cur = _input.data() + offset;
+	assert(offset < _input->size());
+	_cur = _input->data() + offset;
 }
 
-void reshadefx::lexer::parse_identifier(token &tok) const
+size_t reshadefx::lexer::scan_identifier() const
 {
-	auto *const begin = _cur, *end = begin;
-
 	// Skip to the end of the identifier sequence
-	while (s_type_lookup[uint8_t(*end)] == IDENT || s_type_lookup[uint8_t(*end)] == DIGIT)
-		end++;
-
+	return find_identifier_end(_cur, _end) - _cur;
+}
+void reshadefx::lexer::parse_identifier(token &tok) const
+{
 	tok.id = tokenid::identifier;
 	tok.offset = input_offset();
-	tok.length = end - begin;
-	tok.literal_as_string.assign(begin, end);
+	tok.length = scan_identifier();
 
-	if (_ignore_keywords)
-		return;
+	const std::string_view name(_cur, tok.length);
 
-	if (const auto it = s_keyword_lookup.find(tok.literal_as_string);
-		it != s_keyword_lookup.end())
-		tok.id = it->second;
+	if (!_ignore_keywords)
+	{
+		if (const tokenid *const keyword = s_keyword_lookup.find(name))
+		{
+			tok.id = *keyword;
+			return;
+		}
+	}
+
+	// Avoid a string allocation for every identifier if they are interned into an identifier table
+	if (_identifiers != nullptr)
+		tok.literal_as_identifier = _identifiers->intern(name);
+	else
+		tok.literal_as_string.assign(name);
 }
 bool reshadefx::lexer::parse_pp_directive(token &tok)
 {
 	skip(1); // Skip the '#'
 	skip_space(); // Skip any space between the '#' and directive
-	parse_identifier(tok);
 
-	if (const auto it = s_pp_directive_lookup.find(tok.literal_as_string);
-		it != s_pp_directive_lookup.end())
+	tok.id = tokenid::identifier;
+	tok.offset = input_offset();
+	tok.length = scan_identifier();
+
+	const std::string_view directive(_cur, tok.length);
+
+	if (const tokenid *const directive_id = s_pp_directive_lookup.find(directive))
 	{
-		tok.id = it->second;
+		tok.id = *directive_id;
 		return true;
 	}
-	else if (!_ignore_line_directives && tok.literal_as_string == "line") // The #line directive needs special handling
+	else if (!_ignore_line_directives && directive == "line") // The #line directive needs special handling
 	{
-		skip(tok.length); // The 'parse_identifier' does not update the pointer to the current character, so do that now
+		skip(tok.length); // The 'scan_identifier' does not update the pointer to the current character, so do that now
 		skip_space();
 		parse_numeric_literal(tok);
 		skip(tok.length);
@@ -889,7 +1106,8 @@ bool reshadefx::lexer::parse_pp_directive(token &tok)
 			token temptok;
 			parse_string_literal(temptok, false);
 
-			_cur_location.source = std::move(temptok.literal_as_string);
+			if (_source_files != nullptr)
+				_cur_location.source = _source_files->intern(temptok.literal_as_string);
 		}
 
 		// Do not return the #line directive as token to the caller
@@ -897,6 +1115,7 @@ bool reshadefx::lexer::parse_pp_directive(token &tok)
 	}
 
 	tok.id = tokenid::hash_unknown;
+	tok.literal_as_string.assign(directive);
 
 	return true;
 }
@@ -906,6 +1125,13 @@ void reshadefx::lexer::parse_string_literal(token &tok, bool escape)
 
 	for (auto c = *end; c != '"'; c = *++end)
 	{
+		// Copy runs of characters that need no special handling in one go, leaving the last one of the run to the code below
+		if (const char *const run_end = find_first_of<'"', '\\', '\n', '\r'>(end, _end); run_end - end > 1)
+		{
+			tok.literal_as_string.append(end, run_end - 1);
+			c = *(end = run_end - 1);
+		}
+
 		if (c == '\n' || end >= _end)
 		{
 			// Line feed reached, the string literal is done (technically this should be an error, but the lexer does not report errors, so ignore it)
@@ -6,6 +6,7 @@
 #pragma once
 
 #include "effect_token.hpp"
+#include <memory> // std::shared_ptr
 
 namespace reshadefx
 {
@@ -24,7 +25,28 @@ namespace reshadefx
 			bool ignore_keywords = false,
 			bool escape_string_literals = true,
 			const location &start_location = location()) :
+			lexer(std::make_shared<const std::string>(std::move(input)), nullptr, nullptr, ignore_comments, ignore_whitespace, ignore_pp_directives, ignore_line_directives, ignore_keywords, escape_string_literals, start_location)
+		{
+		}
+		/// <summary>
+		/// Constructs a lexical analyzer that borrows a shared, immutable input string instead of copying it.
+		/// If an <paramref name="identifiers"/> table is provided, identifier tokens only reference their name in that table through <see cref="token::literal_as_identifier"/> and <see cref="token::literal_as_string"/> is left empty.
+		/// File names in #line directives are added to the <paramref name="source_files"/> table and referenced by index in token locations.
+		/// </summary>
+		explicit lexer(
+			std::shared_ptr<const std::string> input,
+			string_table *identifiers,
+			string_table *source_files,
+			bool ignore_comments = true,
+			bool ignore_whitespace = true,
+			bool ignore_pp_directives = true,
+			bool ignore_line_directives = false,
+			bool ignore_keywords = false,
+			bool escape_string_literals = true,
+			const location &start_location = location()) :
 			_input(std::move(input)),
+			_identifiers(identifiers),
+			_source_files(source_files),
 			_cur_location(start_location),
 			_ignore_comments(ignore_comments),
 			_ignore_whitespace(ignore_whitespace),
@@ -33,17 +55,20 @@ namespace reshadefx
 			_ignore_keywords(ignore_keywords),
 			_escape_string_literals(escape_string_literals)
 		{
-			_cur = _input.data();
-			_end = _cur + _input.size();
+			_cur = _input->data();
+			_end = _cur + _input->size();
 		}
 
 		lexer(const lexer &lexer) { operator=(lexer); }
 		lexer &operator=(const lexer &lexer)
 		{
+			// The input string is immutable, so it can be shared instead of copied
 			_input = lexer._input;
+			_identifiers = lexer._identifiers;
+			_source_files = lexer._source_files;
 			_cur_location = lexer._cur_location;
-			reset_to_offset(lexer._cur - lexer._input.data());
-			_end = _input.data() + _input.size();
+			reset_to_offset(lexer._cur - lexer._input->data());
+			_end = _input->data() + _input->size();
 			_ignore_comments = lexer._ignore_comments;
 			_ignore_whitespace = lexer._ignore_whitespace;
 			_ignore_pp_directives = lexer._ignore_pp_directives;
@@ -57,13 +82,22 @@ namespace reshadefx
 		/// <summary>
 		/// Gets the current position in the input string.
 		/// </summary>
-		size_t input_offset() const { return _cur - _input.data(); }
+		size_t input_offset() const { return _cur - _input->data(); }
 
 		/// <summary>
 		/// Gets the input string this lexical analyzer works on.
 		/// </summary>
 		/// <returns>Constant reference to the input string.</returns>
-		const std::string &input_string() const { return _input; }
+		const std::string &input_string() const { return *_input; }
+		/// <summary>
+		/// Gets the shared input string this lexical analyzer works on.
+		/// </summary>
+		const std::shared_ptr<const std::string> &input_buffer() const { return _input; }
+
+		/// <summary>
+		/// Gets the raw text of the specified <paramref name="tok"/> in the input string, without copying it.
+		/// </summary>
+		std::string_view token_string(const token &tok) const { return std::string_view(*_input).substr(tok.offset, tok.length); }
 
 		/// <summary>
 		/// Performs lexical analysis on the input string and return the next token in sequence.
@@ -79,6 +113,11 @@ namespace reshadefx
 		/// Advances to the next new line, ignoring all tokens.
 		/// </summary>
 		void skip_to_next_line();
+		/// <summary>
+		/// Advances from the beginning of a line to the beginning of the next line that may contain a preprocessor directive, without producing any tokens.
+		/// This is used to skip over disabled conditional blocks. Comments, string literals and line continuations are still taken into account and line numbers are kept up to date.
+		/// </summary>
+		void skip_to_next_pp_directive();
 
 		/// <summary>
 		/// Resets position to the specified <paramref name="offset"/>.
@@ -93,12 +132,15 @@ namespace reshadefx
 		/// <param name="length">Number of input characters to skip.</param>
 		void skip(size_t length);
 
+		size_t scan_identifier() const;
 		void parse_identifier(token &tok) const;
 		bool parse_pp_directive(token &tok);
 		void parse_string_literal(token &tok, bool escape);
 		void parse_numeric_literal(token &tok) const;
 
-		std::string _input;
+		std::shared_ptr<const std::string> _input;
+		string_table *_identifiers = nullptr;
+		string_table *_source_files = nullptr;
 		location _cur_location;
 		const std::string::value_type *_cur, *_end;
 
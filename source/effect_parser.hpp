@@ -85,5 +85,8 @@ namespace reshadefx
 
 		std::vector<uint32_t> _loop_break_target_stack;
 		std::vector<uint32_t> _loop_continue_target_stack;
+
+		// Previously used temporary expression lists (for call arguments, constructor arguments and initializer elements), which are reused to avoid reallocating them for every expression and released in one go at the end of parsing
+		std::vector<std::vector<expression>> _expression_list_pool;
 	};
 }
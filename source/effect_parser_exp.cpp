@@ -12,6 +12,31 @@
 
 #define RESHADEFX_SHORT_CIRCUIT 0
 
+/// <summary>
+/// Temporary expression list that takes its storage from a pool and returns it there again when going out of scope, so that the memory is reused for the next list.
+/// </summary>
+struct pooled_expression_list
+{
+	explicit pooled_expression_list(std::vector<std::vector<reshadefx::expression>> &pool) : pool(pool)
+	{
+		if (!pool.empty())
+		{
+			list = std::move(pool.back());
+			pool.pop_back();
+		}
+	}
+	~pooled_expression_list()
+	{
+		list.clear();
+		pool.push_back(std::move(list));
+	}
+
+	std::vector<reshadefx::expression> list;
+
+private:
+	std::vector<std::vector<reshadefx::expression>> &pool;
+};
+
 reshadefx::parser::parser()
 {
 }
@@ -21,7 +46,8 @@ reshadefx::parser::~parser()
 
 void reshadefx::parser::error(const location &location, unsigned int code, const std::string &message)
 {
-	_errors += location.source;
+	if (_codegen != nullptr)
+		_errors += _codegen->_source_files.name(location.source);
 	_errors += '(' + std::to_string(location.line) + ", " + std::to_string(location.column) + ')';
 	_errors += ": error";
 	if (code != 0)
@@ -32,7 +58,8 @@ void reshadefx::parser::error(const location &location, unsigned int code, const
 }
 void reshadefx::parser::warning(const location &location, unsigned int code, const std::string &message)
 {
-	_errors += location.source;
+	if (_codegen != nullptr)
+		_errors += _codegen->_source_files.name(location.source);
 	_errors += '(' + std::to_string(location.line) + ", " + std::to_string(location.column) + ')';
 	_errors += ": warning";
 	if (code != 0)
@@ -714,7 +741,8 @@ bool reshadefx::parser::parse_expression_unary(expression &exp)
 	else if (accept('{'))
 	{
 		bool is_constant = true;
-		std::vector<expression> elements;
+		pooled_expression_list pooled_elements(_expression_list_pool);
+		std::vector<expression> &elements = pooled_elements.list;
 		type composite_type = { type::t_void, 1, 1 };
 
 		while (!peek('}'))
@@ -846,7 +874,8 @@ bool reshadefx::parser::parse_expression_unary(expression &exp)
 		// Parse entire argument expression list
 		bool is_constant = true;
 		unsigned int num_components = 0;
-		std::vector<expression> arguments;
+		pooled_expression_list pooled_arguments(_expression_list_pool);
+		std::vector<expression> &arguments = pooled_arguments.list;
 
 		while (!peek(')'))
 		{
@@ -900,37 +929,31 @@ bool reshadefx::parser::parse_expression_unary(expression &exp)
 		}
 		else if (arguments.size() > 1)
 		{
-			// Flatten all arguments to a list of scalars
-			for (auto it = arguments.begin(); it != arguments.end();)
+			// Flatten all arguments to a list of scalars (appending them to a separate list, rather than inserting them in place, which would move all following arguments every time)
+			pooled_expression_list pooled_scalar_arguments(_expression_list_pool);
+			std::vector<expression> &scalar_arguments = pooled_scalar_arguments.list;
+			scalar_arguments.reserve(num_components);
+
+			for (expression &argument_exp : arguments)
 			{
-				// Argument is a scalar already, so only need to cast it
-				if (it->type.is_scalar())
+				for (unsigned int i = 0, num_argument_components = argument_exp.type.components(); i < num_argument_components; ++i)
 				{
-					expression &argument_exp = *it++;
-
-					struct type scalar_type = argument_exp.type;
+					// Argument is a scalar already, so only need to cast it, otherwise convert to a scalar value first (indexing matrices by row and then by column)
+					expression &argument_scalar_exp = scalar_arguments.emplace_back(argument_exp);
+					if (argument_exp.type.is_matrix())
+						argument_scalar_exp.add_constant_index_access(i / argument_exp.type.cols);
+					if (!argument_scalar_exp.type.is_scalar())
+						argument_scalar_exp.add_constant_index_access(argument_exp.type.is_matrix() ? i % argument_exp.type.cols : i);
+
+					struct type scalar_type = argument_scalar_exp.type;
 					scalar_type.base = type.base;
-					argument_exp.add_cast_operation(scalar_type);
-
-					argument_exp.reset_to_rvalue(argument_exp.location, _codegen->emit_load(argument_exp), scalar_type);
-				}
-				else
-				{
-					const expression argument_exp = std::move(*it);
-					it = arguments.erase(it);
+					argument_scalar_exp.add_cast_operation(scalar_type);
 
-					// Convert to a scalar value and re-enter the loop in the next iteration (in case a cast is necessary too)
-					for (unsigned int i = argument_exp.type.components(); i > 0; --i)
-					{
-						expression argument_scalar_exp = argument_exp;
-						argument_scalar_exp.add_constant_index_access(i - 1);
-
-						it = arguments.insert(it, argument_scalar_exp);
-					}
+					argument_scalar_exp.reset_to_rvalue(argument_scalar_exp.location, _codegen->emit_load(argument_scalar_exp), scalar_type);
 				}
 			}
 
-			const codegen::id result = _codegen->emit_construct(location, type, arguments);
+			const codegen::id result = _codegen->emit_construct(location, type, scalar_arguments);
 
 			exp.reset_to_rvalue(location, result, type);
 		}
@@ -961,7 +984,8 @@ bool reshadefx::parser::parse_expression_unary(expression &exp)
 			}
 
 			// Parse entire argument expression list
-			std::vector<expression> arguments;
+			pooled_expression_list pooled_arguments(_expression_list_pool);
+			std::vector<expression> &arguments = pooled_arguments.list;
 
 			while (!peek(')'))
 			{
@@ -1003,7 +1027,9 @@ bool reshadefx::parser::parse_expression_unary(expression &exp)
 
 			assert(symbol.function != nullptr);
 
-			std::vector<expression> parameters(symbol.function->parameter_list.size());
+			pooled_expression_list pooled_parameters(_expression_list_pool);
+			std::vector<expression> &parameters = pooled_parameters.list;
+			parameters.resize(symbol.function->parameter_list.size());
 
 			// We need to allocate some temporary variables to pass in and load results from pointer parameters
 			for (size_t i = 0; i < arguments.size(); ++i)
@@ -25,12 +25,16 @@ private:
 
 bool reshadefx::parser::parse(std::string input, codegen *backend)
 {
-	_lexer = std::make_unique<lexer>(std::move(input));
-
 	// Set backend for subsequent code-generation
 	_codegen = backend;
 	assert(backend != nullptr);
 
+	// Source file names are stored in the backend, so that it can resolve them when writing debug information
+	_lexer = std::make_unique<lexer>(
+		std::make_shared<const std::string>(std::move(input)),
+		nullptr,
+		&backend->_source_files);
+
 	consume();
 
 	bool parse_success = true;
@@ -39,11 +43,17 @@ bool reshadefx::parser::parse(std::string input, codegen *backend)
 	while (!peek(tokenid::end_of_file))
 	{
 		if (!parse_top(current_success))
-			return false;
+		{
+			parse_success = false;
+			break;
+		}
 		if (!current_success)
 			parse_success = false;
 	}
 
+	// Free all temporary expression lists that were kept around during parsing
+	_expression_list_pool = {};
+
 	if (parse_success)
 		backend->optimize_bindings();
 
@@ -181,7 +191,7 @@ bool reshadefx::parser::parse_top(bool &parse_success)
 			}
 			else
 			{
-				if (!attribute_location.source.empty())
+				if (attribute_location.source != 0)
 				{
 					error(attribute_location, 0, "attribute is valid only on functions");
 					parse_success = false;
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <utility> // std::pair
+#include <string_view>
+
+namespace reshadefx
+{
+	/// <summary>
+	/// A constant map from strings to values that is built at compile time as a perfect hash table (using the "hash, displace and compress" scheme).
+	/// Every key is assigned its own slot, so a lookup costs exactly one hash and at most one string comparison, without any probing.
+	/// </summary>
+	template <typename T, size_t N>
+	class perfect_hash_map
+	{
+		static constexpr size_t next_power_of_two(size_t value)
+		{
+			size_t result = 1;
+			while (result < value)
+				result <<= 1;
+			return result;
+		}
+
+		// Keep the table at most half full, with four keys per bucket on average
+		static constexpr size_t num_slots = next_power_of_two(2 * N);
+		static constexpr size_t num_buckets = next_power_of_two((N + 3) / 4);
+
+		// 64-bit FNV-1a hash, the lower bits select the bucket and the upper bits the slot
+		static constexpr uint64_t hash(std::string_view key)
+		{
+			uint64_t h = 14695981039346656037ull;
+			for (const char *c = key.data(), *const end = c + key.size(); c != end; ++c)
+				h = (h ^ static_cast<uint8_t>(*c)) * 1099511628211ull;
+			return h;
+		}
+		static constexpr size_t slot_index(uint64_t h, uint32_t displacement)
+		{
+			return static_cast<size_t>((h >> 32) + displacement * ((h >> 16) | 1)) & (num_slots - 1);
+		}
+
+	public:
+		/// <summary>
+		/// Builds the hash table from the specified key-value pairs. Keys have to be unique.
+		/// </summary>
+		constexpr explicit perfect_hash_map(const std::pair<std::string_view, T>(&entries)[N])
+		{
+			uint64_t hashes[N] = {};
+			size_t bucket_sizes[num_buckets] = {};
+			size_t max_bucket_size = 0;
+			for (size_t i = 0; i < N; ++i)
+			{
+				hashes[i] = hash(entries[i].first);
+				if (const size_t size = ++bucket_sizes[hashes[i] & (num_buckets - 1)]; size > max_bucket_size)
+					max_bucket_size = size;
+			}
+
+			// Sort keys by bucket, so that the keys of each bucket are stored contiguously
+			size_t bucket_offsets[num_buckets + 1] = {};
+			for (size_t b = 0; b < num_buckets; ++b)
+				bucket_offsets[b + 1] = bucket_offsets[b] + bucket_sizes[b];
+			size_t sorted[N] = {};
+			size_t bucket_fill[num_buckets] = {};
+			for (size_t i = 0; i < N; ++i)
+			{
+				const size_t b = hashes[i] & (num_buckets - 1);
+				sorted[bucket_offsets[b] + bucket_fill[b]++] = i;
+			}
+
+			// Place the largest buckets first while the table is still mostly empty, searching for a displacement that moves all keys of a bucket into free slots
+			for (size_t size = max_bucket_size; size != 0; --size)
+			{
+				for (size_t b = 0; b < num_buckets; ++b)
+				{
+					if (bucket_sizes[b] != size)
+						continue;
+
+					const size_t offset = bucket_offsets[b];
+
+					bool placed = false;
+					for (uint32_t displacement = 0; displacement <= UINT16_MAX && !placed; ++displacement)
+					{
+						// Keys in the same bucket must not end up in the same slot either
+						bool collision = false;
+						for (size_t k = 0; k < size && !collision; ++k)
+						{
+							const size_t slot = slot_index(hashes[sorted[offset + k]], displacement);
+							collision = _used[slot];
+							for (size_t j = 0; j < k && !collision; ++j)
+								collision = slot == slot_index(hashes[sorted[offset + j]], displacement);
+						}
+
+						if (collision)
+							continue;
+
+						_displacements[b] = static_cast<uint16_t>(displacement);
+						for (size_t k = 0; k < size; ++k)
+						{
+							const size_t i = sorted[offset + k];
+							const size_t slot = slot_index(hashes[i], displacement);
+							_keys[slot] = entries[i].first;
+							_values[slot] = entries[i].second;
+							_used[slot] = true;
+						}
+
+						placed = true;
+					}
+
+					if (!placed)
+						return; // Leave the table in an invalid state, which is caught by the 'valid' check
+				}
+			}
+
+			_valid = true;
+		}
+
+		/// <summary>
+		/// Returns whether all keys could be placed into the table. Check this in a <c>static_assert</c> on the table.
+		/// </summary>
+		constexpr bool valid() const { return _valid; }
+
+		/// <summary>
+		/// Looks up the value associated with the specified <paramref name="key"/>.
+		/// </summary>
+		/// <returns>A pointer to the value, or <see langword="nullptr"/> if the key is not in the table.</returns>
+		constexpr const T *find(std::string_view key) const
+		{
+			const uint64_t h = hash(key);
+			const size_t slot = slot_index(h, _displacements[h & (num_buckets - 1)]);
+			return _used[slot] && _keys[slot] == key ? &_values[slot] : nullptr;
+		}
+
+	private:
+		bool _valid = false;
+		bool _used[num_slots] = {};
+		uint16_t _displacements[num_buckets] = {};
+		std::string_view _keys[num_slots] = {};
+		T _values[num_slots] = {};
+	};
+
+	/// <summary>
+	/// Builds a <see cref="perfect_hash_map"/> from an array of key-value pairs at compile time.
+	/// </summary>
+	template <typename T, size_t N>
+	constexpr perfect_hash_map<T, N> make_perfect_hash_map(const std::pair<std::string_view, T>(&entries)[N])
+	{
+		return perfect_hash_map<T, N>(entries);
+	}
+}
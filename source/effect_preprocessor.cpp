@@ -7,7 +7,10 @@
 #include "effect_preprocessor.hpp"
 #include <cstdio> // fclose, fopen, fread, fseek
 #include <cassert>
-#include <algorithm> // std::find_if
+#include <cstring> // std::memcmp
+#include <atomic>
+#include <mutex>
+#include <algorithm> // std::find_if, std::none_of
 
 #ifndef _WIN32
 	// On Linux systems the native path encoding is UTF-8 already, so no conversion necessary
@@ -52,6 +55,22 @@ enum macro_replacement
 	macro_replacement_stringize = '\xFE',
 };
 
+// Identifiers which are interned into the identifier table first, so that they always have these fixed indices
+// Index zero is reserved, since that is what 'literal_as_identifier' reads as for tokens that are not identifiers
+enum builtin_identifier : uint32_t
+{
+	id_none,
+	id_defined,
+	id_exists,
+	id_va_args,
+	id_line,
+	id_file,
+	id_file_stem,
+	id_file_stem_hash,
+	id_file_name,
+	id_file_name_hash,
+};
+
 static const int s_precedence_lookup[] = {
 	0, 1, 2, 3, 4, // bitwise operators
 	5, 6, 7, 7, 7, 7, // logical operators
@@ -98,6 +117,56 @@ static bool read_file(const std::filesystem::path &path, std::string &file_data)
 	return true;
 }
 
+// Cache of file contents shared by all preprocessor instances in the process, so that common headers are only read once when loading effects in parallel
+struct shared_file
+{
+	std::filesystem::file_time_type last_write_time;
+	uintmax_t file_size;
+	std::shared_ptr<const std::string> data;
+};
+static std::mutex s_shared_file_cache_mutex;
+static std::unordered_map<std::string, shared_file> s_shared_file_cache;
+static std::atomic<size_t> s_shared_file_cache_hits = 0;
+static std::atomic<size_t> s_shared_file_cache_misses = 0;
+
+static std::shared_ptr<const std::string> read_file_shared(const std::filesystem::path &path, const std::string &path_string)
+{
+	// Use modification time and size to detect whether the file changed since it was last read
+	std::error_code ec;
+	const std::filesystem::file_time_type last_write_time = std::filesystem::last_write_time(path, ec);
+	const uintmax_t file_size = ec ? 0 : std::filesystem::file_size(path, ec);
+
+	if (!ec)
+	{
+		const std::lock_guard<std::mutex> lock(s_shared_file_cache_mutex);
+
+		if (const auto it = s_shared_file_cache.find(path_string);
+			it != s_shared_file_cache.end() && it->second.last_write_time == last_write_time && it->second.file_size == file_size)
+		{
+			s_shared_file_cache_hits++;
+			return it->second.data;
+		}
+	}
+
+	// Read file outside the lock, so that other threads are not blocked by file I/O
+	std::string file_data;
+	if (!read_file(path, file_data))
+		return nullptr;
+
+	s_shared_file_cache_misses++;
+
+	auto data = std::make_shared<const std::string>(std::move(file_data));
+
+	if (!ec)
+	{
+		const std::lock_guard<std::mutex> lock(s_shared_file_cache_mutex);
+
+		s_shared_file_cache[path_string] = { last_write_time, file_size, data };
+	}
+
+	return data;
+}
+
 template <char ESCAPE_CHAR = '\\'>
 static std::string escape_string(std::string s)
 {
@@ -106,13 +175,246 @@ static std::string escape_string(std::string s)
 	return '\"' + s + '\"';
 }
 
+static bool is_identifier_char(char c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Checks whether the lexer would still end the specified token at the same position if it was directly followed by the 'next' character
+static bool is_token_boundary_stable(reshadefx::tokenid id, std::string_view data, char next)
+{
+	using namespace reshadefx;
+
+	switch (id)
+	{
+	case tokenid::space:
+		return true;
+	case tokenid::identifier:
+		return !is_identifier_char(next);
+	case tokenid::int_literal:
+	case tokenid::uint_literal:
+	case tokenid::float_literal:
+	case tokenid::double_literal:
+		return !is_identifier_char(next) && next != '.';
+	case tokenid::string_literal:
+		// Unterminated string literals would continue into the following text
+		return data.size() > 1 && data.back() == '\"';
+	default:
+		break;
+	}
+
+	// Operators which could form a longer operator together with the following character
+	switch (data.back())
+	{
+	case '!':
+	case '%':
+	case '*':
+	case '=':
+	case '^':
+		return next != '=';
+	case '&':
+		return next != '&' && next != '=';
+	case '+':
+		return next != '+' && next != '=';
+	case '-':
+		return next != '-' && next != '=' && next != '>';
+	case '|':
+		return next != '|' && next != '=';
+	case '<':
+		return next != '<' && next != '=';
+	case '>':
+		return next != '>' && next != '=';
+	case ':':
+		return next != ':';
+	case '.':
+		return next != '.' && !(next >= '0' && next <= '9');
+	case '/':
+		return next != '/' && next != '*' && next != '=';
+	case '\\':
+		return next != '\n' && next != '\r';
+	default:
+		return true;
+	}
+}
+
+void reshadefx::preprocessor::lexed_text::append(const token &tok, std::string_view data)
+{
+	lexed_token new_tok;
+	new_tok.id = tok.id;
+	std::memcpy(&new_tok.literal_as_double, &tok.literal_as_double, sizeof(double));
+
+	append(new_tok, data);
+}
+void reshadefx::preprocessor::lexed_text::append(const lexed_token &tok, std::string_view data)
+{
+	if (tokens_valid)
+	{
+		if (data.empty() || tok.id == tokenid::end_of_line || tok.id == tokenid::end_of_file || (tok.id >= tokenid::hash_def && tok.id <= tokenid::hash_unknown) ||
+			// Tokens spanning multiple lines would shift the line number of all following tokens (only whitespace with line continuations and string literals can do that)
+			((tok.id == tokenid::space || tok.id == tokenid::string_literal) && data.find('\n') != std::string_view::npos))
+		{
+			tokens_valid = false;
+			tokens.clear();
+		}
+		else if (!tokens.empty() && tokens.back().offset + tokens.back().length == text.size())
+		{
+			lexed_token &prev = tokens.back();
+
+			// The lexer combines consecutive whitespace into a single token
+			if (tok.id == tokenid::space && prev.id == tokenid::space)
+			{
+				prev.length += static_cast<uint32_t>(data.size());
+				text += data;
+				return;
+			}
+
+			if (!is_token_boundary_stable(prev.id, std::string_view(text).substr(prev.offset, prev.length), data[0]))
+			{
+				tokens_valid = false;
+				tokens.clear();
+			}
+		}
+
+		if (tokens_valid)
+		{
+			lexed_token &new_tok = tokens.emplace_back(tok);
+			new_tok.offset = static_cast<uint32_t>(text.size());
+			new_tok.length = static_cast<uint32_t>(data.size());
+		}
+	}
+
+	text += data;
+}
+void reshadefx::preprocessor::lexed_text::append(std::string_view source, size_t begin, size_t end, const lexed_token *first_tok, const lexed_token *last_tok)
+{
+	if (first_tok == last_tok)
+		return append_untokenized(source.substr(begin, end - begin));
+
+	if (first_tok->offset > begin)
+		append_untokenized(source.substr(begin, first_tok->offset - begin));
+	append(*first_tok, source.substr(first_tok->offset, first_tok->length));
+
+	// All following tokens were lexed from the same source text, so only the boundary to the first one had to be checked
+	const size_t first_tok_end = first_tok->offset + first_tok->length;
+	if (tokens_valid)
+	{
+		for (const lexed_token *tok = first_tok + 1; tok != last_tok; ++tok)
+			tokens.emplace_back(*tok).offset = static_cast<uint32_t>(text.size() + (tok->offset - first_tok_end));
+	}
+
+	text += source.substr(first_tok_end, end - first_tok_end);
+}
+void reshadefx::preprocessor::lexed_text::append_untokenized(std::string_view data)
+{
+	if (tokens_valid && !data.empty())
+	{
+		if (data.find('\n') != std::string_view::npos ||
+			(!tokens.empty() && tokens.back().offset + tokens.back().length == text.size() &&
+			 !is_token_boundary_stable(tokens.back().id, std::string_view(text).substr(tokens.back().offset, tokens.back().length), data[0])))
+		{
+			tokens_valid = false;
+			tokens.clear();
+		}
+	}
+
+	text += data;
+}
+
 reshadefx::preprocessor::preprocessor()
 {
+	// Keep these in the same order as the 'builtin_identifier' enumeration
+	for (const std::string_view name : { "", "defined", "exists", "__VA_ARGS__", "__LINE__", "__FILE__", "__FILE_STEM__", "__FILE_STEM_HASH__", "__FILE_NAME__", "__FILE_NAME_HASH__" })
+		_identifiers.intern(name);
+	assert(_identifiers.name(id_file_name_hash) == "__FILE_NAME_HASH__");
+
+	// Reserve the first source file index for unnamed input
+	_source_files.intern({});
 }
+reshadefx::preprocessor::preprocessor(const preprocessor &other) :
+	_output(other._output),
+	_errors(other._errors),
+	_next_input_index(other._next_input_index),
+	_current_input_index(other._current_input_index),
+	_token(other._token),
+	_current_token_raw_data(other._current_token_raw_data),
+	_last_input_data(other._last_input_data),
+	_output_location(other._output_location),
+	_if_stack(other._if_stack),
+	_recursion_count(other._recursion_count),
+	_identifiers(other._identifiers),
+	_source_files(other._source_files),
+	_used_macros(other._used_macros),
+	_macros(other._macros),
+	_include_paths(other._include_paths),
+	_file_cache(other._file_cache),
+	_looked_up_files(other._looked_up_files),
+	_include_guards(other._include_guards),
+	_skipped_include_count(other._skipped_include_count),
+	_used_pragmas(other._used_pragmas)
+{
+	// The input stack holds lexers, which cannot be copied, but it is empty again after all input was processed
+	assert(other._input_stack.empty());
+}
+reshadefx::preprocessor::preprocessor(preprocessor &&other) = default;
 reshadefx::preprocessor::~preprocessor()
 {
 }
 
+reshadefx::preprocessor &reshadefx::preprocessor::operator=(preprocessor &&other) = default;
+
+void reshadefx::preprocessor::get_shared_file_cache_statistics(size_t &hits, size_t &misses)
+{
+	hits = s_shared_file_cache_hits;
+	misses = s_shared_file_cache_misses;
+}
+
+bool reshadefx::preprocessor::read_file_split_leading_includes(const std::filesystem::path &path, std::string &source_code, std::string &leading_includes)
+{
+	if (!read_file(path, source_code))
+		return false;
+
+	leading_includes.clear();
+
+	lexer lexer(
+		source_code,
+		true  /* ignore_comments */,
+		false /* ignore_whitespace */,
+		false /* ignore_pp_directives */,
+		true  /* ignore_line_directives */,
+		true  /* ignore_keywords */,
+		false /* escape_string_literals */);
+
+	// Only directives with a string literal file name are moved, since macros in the directive could be defined differently by the time it is processed
+	for (token tok = lexer.lex(); tok == tokenid::space || tok == tokenid::end_of_line || tok == tokenid::hash_include; tok = lexer.lex())
+	{
+		if (tok != tokenid::hash_include)
+			continue;
+
+		const size_t directive_begin = source_code.rfind('#', tok.offset);
+
+		do
+			tok = lexer.lex();
+		while (tok == tokenid::space);
+		if (tok != tokenid::string_literal || tok.length < 2 || source_code[tok.offset + tok.length - 1] != '\"')
+			break;
+
+		const size_t directive_end = tok.offset + tok.length;
+
+		do
+			tok = lexer.lex();
+		while (tok == tokenid::space);
+		if (tok != tokenid::end_of_line)
+			break;
+
+		leading_includes.append(source_code, directive_begin, directive_end - directive_begin);
+		leading_includes += '\n';
+
+		source_code.replace(directive_begin, directive_end - directive_begin, directive_end - directive_begin, ' ');
+	}
+
+	return true;
+}
+
 void reshadefx::preprocessor::add_include_path(const std::filesystem::path &path)
 {
 	assert(!path.empty());
@@ -121,7 +423,10 @@ void reshadefx::preprocessor::add_include_path(const std::filesystem::path &path
 bool reshadefx::preprocessor::add_macro_definition(const std::string &name, const macro &macro)
 {
 	assert(!name.empty());
-	return _macros.emplace(name, macro).second;
+	const auto insert = _macros.emplace(_identifiers.intern(name), macro);
+	if (insert.second)
+		create_macro_replacement_tokens(insert.first->second);
+	return insert.second;
 }
 
 bool reshadefx::preprocessor::append_file(const std::filesystem::path &path)
@@ -153,25 +458,33 @@ std::vector<std::filesystem::path> reshadefx::preprocessor::included_files() con
 {
 	std::vector<std::filesystem::path> files;
 	files.reserve(_file_cache.size());
-	for (const std::pair<std::string, std::string> &cache_entry : _file_cache)
+	for (const auto &cache_entry : _file_cache)
 		files.push_back(std::filesystem::u8path(cache_entry.first));
 	return files;
 }
+std::vector<std::pair<std::filesystem::path, bool>> reshadefx::preprocessor::looked_up_files() const
+{
+	std::vector<std::pair<std::filesystem::path, bool>> files;
+	files.reserve(_looked_up_files.size());
+	for (const std::pair<const std::string, bool> &lookup : _looked_up_files)
+		files.emplace_back(std::filesystem::u8path(lookup.first), lookup.second);
+	return files;
+}
 std::vector<std::pair<std::string, std::string>> reshadefx::preprocessor::used_macro_definitions() const
 {
 	std::vector<std::pair<std::string, std::string>> defines;
 	defines.reserve(_used_macros.size());
-	for (const std::string &name : _used_macros)
+	for (const uint32_t name : _used_macros)
 		if (const auto it = _macros.find(name);
 			// Do not include function-like macros, since they are more likely to contain a complex replacement list
 			it != _macros.end() && !it->second.is_function_like)
-			defines.emplace_back(name, it->second.replacement_list);
+			defines.emplace_back(_identifiers.name(name), it->second.replacement_list);
 	return defines;
 }
 
 void reshadefx::preprocessor::error(const location &location, const std::string &message)
 {
-	_errors += location.source;
+	_errors += _source_files.name(location.source);
 	_errors += '(' + std::to_string(location.line) + ", " + std::to_string(location.column) + ')';
 	_errors += ": preprocessor error: ";
 	_errors += message;
@@ -179,7 +492,7 @@ void reshadefx::preprocessor::error(const location &location, const std::string
 }
 void reshadefx::preprocessor::warning(const location &location, const std::string &message)
 {
-	_errors += location.source;
+	_errors += _source_files.name(location.source);
 	_errors += '(' + std::to_string(location.line) + ", " + std::to_string(location.column) + ')';
 	_errors += ": preprocessor warning: ";
 	_errors += message;
@@ -188,15 +501,23 @@ void reshadefx::preprocessor::warning(const location &location, const std::strin
 
 void reshadefx::preprocessor::push(std::string input, const std::string &name)
 {
-	location start_location = !name.empty() ?
+	push(std::make_shared<const std::string>(std::move(input)), name);
+}
+void reshadefx::preprocessor::push(std::shared_ptr<const std::string> input, const std::string &name)
+{
+	const uint32_t source = _source_files.intern(name);
+
+	location start_location = source != 0 ?
 		// Start at the beginning of the file when pushing a new file
-		location(name, 1) :
+		location(source, 1, 1) :
 		// Start with last known token location when pushing an unnamed string
 		_token.location;
 
-	input_level level = { name };
+	input_level level = { source };
 	level.lexer.reset(new lexer(
 		std::move(input),
+		&_identifiers,
+		&_source_files,
 		true  /* ignore_comments */,
 		false /* ignore_whitespace */,
 		false /* ignore_pp_directives */,
@@ -207,9 +528,51 @@ void reshadefx::preprocessor::push(std::string input, const std::string &name)
 	level.next_token.id = tokenid::unknown;
 	level.next_token.location = start_location; // This is used in 'consume' to initialize the output location
 
-	// Inherit hidden macros from parent
-	if (!_input_stack.empty())
-		level.hidden_macros = _input_stack.back().hidden_macros;
+	_input_stack.push_back(std::move(level));
+	_next_input_index = _input_stack.size() - 1;
+
+	// Advance into the input stack to update next token
+	consume();
+}
+void reshadefx::preprocessor::push(lexed_text input)
+{
+	// Start with last known token location, like when pushing an unnamed string
+	const location start_location = _token.location;
+
+	if (input.tokens_valid && start_location.column <= 1)
+	{
+		// The lexer skips whitespace and parses directives at the beginning of a line, so have it handle input starting with a '#' and drop leading whitespace otherwise
+		const auto it = std::find_if(input.tokens.begin(), input.tokens.end(), [](const lexed_token &tok) { return tok.id != tokenid::space; });
+		if (it != input.tokens.end() && input.text[it->offset] == '#')
+			input.tokens_valid = false;
+		else
+			input.tokens.erase(input.tokens.begin(), it);
+	}
+
+	if (!input.tokens_valid)
+		return push(std::move(input.text));
+
+	input_level level = { 0 };
+	level.tokens_input = std::make_shared<const std::string>(std::move(input.text));
+	level.tokens = std::move(input.tokens);
+	level.tokens_location = start_location;
+
+#ifndef NDEBUG
+	// Verify that lexing the input would indeed result in the same tokens
+	lexer lexer(level.tokens_input, &_identifiers, &_source_files, true, false, false, false, true, false, start_location);
+	for (size_t i = 0; i <= level.tokens.size(); ++i)
+	{
+		const token tok = lex_token_input(level);
+		const token expected = lexer.lex();
+		assert(tok.id == expected.id && tok.offset == expected.offset && tok.length == expected.length);
+		assert(tok.location.line == expected.location.line && tok.location.column == expected.location.column);
+		assert(tok.literal_as_string == expected.literal_as_string && std::memcmp(&tok.literal_as_double, &expected.literal_as_double, sizeof(double)) == 0);
+	}
+	level.next_token_index = 0;
+#endif
+
+	level.next_token.id = tokenid::unknown;
+	level.next_token.location = start_location;
 
 	_input_stack.push_back(std::move(level));
 	_next_input_index = _input_stack.size() - 1;
@@ -218,6 +581,52 @@ void reshadefx::preprocessor::push(std::string input, const std::string &name)
 	consume();
 }
 
+std::string_view reshadefx::preprocessor::token_string(const input_level &input, const token &tok) const
+{
+	if (input.lexer != nullptr)
+		return input.lexer->token_string(tok);
+	else
+		return std::string_view(*input.tokens_input).substr(tok.offset, tok.length);
+}
+reshadefx::token reshadefx::preprocessor::lex_token_input(input_level &input) const
+{
+	const std::string_view data = *input.tokens_input;
+
+	token tok;
+	// Locations are the same as the lexer would produce, since the input does not span multiple lines
+	tok.location = input.tokens_location;
+
+	if (input.next_token_index >= input.tokens.size())
+	{
+		tok.id = tokenid::end_of_file;
+		tok.location.column += static_cast<uint32_t>(data.size());
+		tok.offset = data.size();
+		tok.length = 1;
+		tok.literal_as_double = 0;
+		return tok;
+	}
+
+	const lexed_token &input_tok = input.tokens[input.next_token_index++];
+	tok.id = input_tok.id;
+	tok.location.column += input_tok.offset;
+	tok.offset = input_tok.offset;
+	tok.length = input_tok.length;
+	std::memcpy(&tok.literal_as_double, &input_tok.literal_as_double, sizeof(double));
+
+	if (tok.id == tokenid::string_literal)
+	{
+		// Recreate the string value from the raw data, removing the quotes (the closing one may be missing) and any carriage return characters, like the lexer does without escaping
+		std::string_view value = data.substr(tok.offset + 1, tok.length - 1);
+		if (tok.length > 1 && value.back() == '\"')
+			value.remove_suffix(1);
+		for (const char c : value)
+			if (c != '\r')
+				tok.literal_as_string += c;
+	}
+
+	return tok;
+}
+
 bool reshadefx::preprocessor::peek(tokenid tokid) const
 {
 	if (_input_stack.empty())
@@ -242,20 +651,29 @@ void reshadefx::preprocessor::consume()
 
 	// Update location information after switching input levels
 	input_level &input = _input_stack[_current_input_index];
-	if (!input.name.empty() && input.name != _output_location.source)
+	if (input.source != 0 && input.source != _output_location.source)
 	{
-		_output += "#line " + std::to_string(input.next_token.location.line) + " \"" + input.name + "\"\n";
+		_output += "#line " + std::to_string(input.next_token.location.line) + " \"";
+		_output += _source_files.name(input.source);
+		_output += "\"\n";
 		// Line number is increased before checking against next token in 'tokenid::end_of_line' handling in 'parse' function below, so compensate for that here
 		_output_location.line = input.next_token.location.line - 1;
-		_output_location.source = input.name;
+		_output_location.source = input.source;
 	}
 
 	// Set current token
 	_token = std::move(input.next_token);
-	_current_token_raw_data = input.lexer->input_string().substr(_token.offset, _token.length);
+	_current_token_raw_data = token_string(input, _token);
+
+	// Jump straight to the next line that may contain a directive while inside a disabled conditional block, since all tokens in between would be ignored anyway
+	if (_token == tokenid::end_of_line && !_if_stack.empty() && _if_stack.back().skipping && _if_stack.back().input_index == _current_input_index && input.lexer != nullptr)
+		input.lexer->skip_to_next_pp_directive();
 
 	// Get the next token
-	input.next_token = input.lexer->lex();
+	if (input.lexer != nullptr)
+		input.next_token = input.lexer->lex();
+	else
+		input.next_token = lex_token_input(input);
 
 	// Verify string literals (since the lexer cannot throw errors itself)
 	if (_token == tokenid::string_literal && _current_token_raw_data.back() != '\"')
@@ -269,9 +687,16 @@ void reshadefx::preprocessor::consume()
 		for (; !_if_stack.empty() && _if_stack.back().input_index >= _next_input_index; _if_stack.pop_back())
 			error(_if_stack.back().pp_token.location, "unterminated #if");
 
+		// Remember the include guard of the file that ended, so that it can be skipped entirely when it is included again
+		if (const input_level &input = _input_stack[_next_input_index];
+			input.include_guard == include_guard_state::after_endif)
+			_include_guards.emplace(input.source, input.include_guard_macro);
+
 		if (_next_input_index == 0)
 		{
 			// End of input has been reached, so cannot pop further and this is the last token
+			// Keep the input data alive however, since the raw data of the current token still references it
+			_last_input_data = _input_stack.back().lexer != nullptr ? _input_stack.back().lexer->input_buffer() : _input_stack.back().tokens_input;
 			_input_stack.pop_back();
 			return;
 		}
@@ -321,7 +746,7 @@ bool reshadefx::preprocessor::expect(tokenid tokid)
 			error(actual_token.location, "syntax error: unexpected new line");
 		else
 			error(actual_token.location, "syntax error: unexpected token '" +
-				_input_stack[_next_input_index].lexer->input_string().substr(actual_token.offset, actual_token.length) + '\'');
+				std::string(token_string(_input_stack[_next_input_index], actual_token)) + '\'');
 
 		return false;
 	}
@@ -340,6 +765,15 @@ void reshadefx::preprocessor::parse()
 
 		_recursion_count = 0;
 
+		// Any content before the opening #ifndef or after the closing #endif means the file is not wrapped in an include guard
+		if (_current_input_index < _input_stack.size() && _token != tokenid::space && _token != tokenid::end_of_line && _token != tokenid::end_of_file)
+		{
+			input_level &input = _input_stack[_current_input_index];
+			if ((input.include_guard == include_guard_state::expect_ifndef && _token != tokenid::hash_ifndef) ||
+				input.include_guard == include_guard_state::after_endif)
+				input.include_guard = include_guard_state::invalid;
+		}
+
 		const bool skip = !_if_stack.empty() && _if_stack.back().skipping;
 
 		switch (_token)
@@ -452,12 +886,12 @@ void reshadefx::preprocessor::parse_def()
 {
 	if (!expect(tokenid::identifier))
 		return;
-	if (_token.literal_as_string == "defined")
+	if (_token.literal_as_identifier == id_defined)
 		return warning(_token.location, "macro name 'defined' is reserved");
 
 	macro m;
 	const location location = std::move(_token.location);
-	const std::string macro_name = std::move(_token.literal_as_string);
+	const uint32_t macro_name = _token.literal_as_identifier;
 
 	// Only create function-like macro if the parenthesis follows the macro name without any whitespace between
 	if (accept(tokenid::parenthesis_open, false))
@@ -466,7 +900,7 @@ void reshadefx::preprocessor::parse_def()
 
 		while (accept(tokenid::identifier))
 		{
-			m.parameters.push_back(_token.literal_as_string);
+			m.parameters.emplace_back(_identifiers.name(_token.literal_as_identifier));
 
 			if (!accept(tokenid::comma))
 				break;
@@ -480,18 +914,19 @@ void reshadefx::preprocessor::parse_def()
 	}
 
 	create_macro_replacement_list(m);
+	create_macro_replacement_tokens(m);
 
-	if (!add_macro_definition(macro_name, m))
-		return error(location, "redefinition of '" + macro_name + "'");
+	if (!_macros.emplace(macro_name, std::move(m)).second)
+		return error(location, "redefinition of '" + std::string(_identifiers.name(macro_name)) + "'");
 }
 void reshadefx::preprocessor::parse_undef()
 {
 	if (!expect(tokenid::identifier))
 		return;
-	if (_token.literal_as_string == "defined")
+	if (_token.literal_as_identifier == id_defined)
 		return warning(_token.location, "macro name 'defined' is reserved");
 
-	_macros.erase(_token.literal_as_string);
+	_macros.erase(_token.literal_as_identifier);
 }
 
 void reshadefx::preprocessor::parse_if()
@@ -532,12 +967,12 @@ void reshadefx::preprocessor::parse_ifdef()
 	}
 	else
 	{
-		level.value = is_defined(_token.literal_as_string);
+		level.value = is_defined(_token.literal_as_identifier);
 		level.skipping = !level.value;
 
 		// Only add to used macro list if this #ifdef is active and the macro was not defined before
-		if (const auto it = _macros.find(_token.literal_as_string); it == _macros.end() || it->second.is_predefined)
-			_used_macros.emplace(_token.literal_as_string);
+		if (const auto it = _macros.find(_token.literal_as_identifier); it == _macros.end() || it->second.is_predefined)
+			_used_macros.emplace(_token.literal_as_identifier);
 	}
 
 	_if_stack.push_back(std::move(level));
@@ -559,12 +994,21 @@ void reshadefx::preprocessor::parse_ifndef()
 	}
 	else
 	{
-		level.value = !is_defined(_token.literal_as_string);
+		level.value = !is_defined(_token.literal_as_identifier);
 		level.skipping = !level.value;
 
 		// Only add to used macro list if this #ifndef is active and the macro was not defined before
-		if (const auto it = _macros.find(_token.literal_as_string); it == _macros.end() || it->second.is_predefined)
-			_used_macros.emplace(_token.literal_as_string);
+		if (const auto it = _macros.find(_token.literal_as_identifier); it == _macros.end() || it->second.is_predefined)
+			_used_macros.emplace(_token.literal_as_identifier);
+	}
+
+	// This may be the start of an include guard if it is the first directive in the file
+	if (input_level &input = _input_stack[level.input_index];
+		input.include_guard == include_guard_state::expect_ifndef)
+	{
+		input.include_guard = include_guard_state::inside;
+		input.include_guard_macro = _token.literal_as_identifier;
+		input.include_guard_if_index = _if_stack.size();
 	}
 
 	_if_stack.push_back(std::move(level));
@@ -578,6 +1022,11 @@ void reshadefx::preprocessor::parse_elif()
 	if (level.pp_token == tokenid::hash_else)
 		return error(_token.location, "#elif is not allowed after #else");
 
+	// An include guard cannot have alternative branches
+	if (input_level &input = _input_stack[level.input_index];
+		input.include_guard == include_guard_state::inside && input.include_guard_if_index == _if_stack.size() - 1)
+		input.include_guard = include_guard_state::invalid;
+
 	// Update 'pp_token' before evaluating expression, so that it points at the beginning # token
 	level.pp_token = _token;
 	level.input_index = _current_input_index;
@@ -606,6 +1055,11 @@ void reshadefx::preprocessor::parse_else()
 	if (level.pp_token == tokenid::hash_else)
 		return error(_token.location, "#else is not allowed after #else");
 
+	// An include guard cannot have alternative branches
+	if (input_level &input = _input_stack[level.input_index];
+		input.include_guard == include_guard_state::inside && input.include_guard_if_index == _if_stack.size() - 1)
+		input.include_guard = include_guard_state::invalid;
+
 	level.pp_token = _token;
 	level.input_index = _current_input_index;
 
@@ -628,6 +1082,11 @@ void reshadefx::preprocessor::parse_endif()
 	if (_if_stack.empty())
 		return error(_token.location, "missing #if for #endif");
 
+	// Closing the include guard block, which has to happen in the same file it was opened in
+	if (input_level &input = _input_stack[_if_stack.back().input_index];
+		input.include_guard == include_guard_state::inside && input.include_guard_if_index == _if_stack.size() - 1)
+		input.include_guard = _current_input_index == _if_stack.back().input_index ? include_guard_state::after_endif : include_guard_state::invalid;
+
 	_if_stack.pop_back();
 }
 
@@ -657,7 +1116,7 @@ void reshadefx::preprocessor::parse_pragma()
 	if (!expect(tokenid::identifier))
 		return;
 
-	std::string pragma = std::move(_token.literal_as_string);
+	std::string pragma(_identifiers.name(_token.literal_as_identifier));
 	std::string pragma_args;
 
 	// Ignore whitespace preceding the argument list
@@ -680,8 +1139,8 @@ void reshadefx::preprocessor::parse_pragma()
 	if (pragma == "once")
 	{
 		// Clear file contents, so that future include statements simply push an empty string instead of these file contents again
-		if (const auto it = _file_cache.find(_output_location.source); it != _file_cache.end())
-			it->second.clear();
+		if (const auto it = _file_cache.find(std::string(_source_files.name(_output_location.source))); it != _file_cache.end())
+			it->second = std::make_shared<const std::string>();
 		return;
 	}
 
@@ -714,31 +1173,45 @@ void reshadefx::preprocessor::parse_include()
 		return;
 	}
 
-	std::filesystem::path file_name = std::filesystem::u8path(_token.literal_as_string);
-	std::filesystem::path file_path = std::filesystem::u8path(_output_location.source);
-	file_path.replace_filename(file_name);
-
-	std::error_code ec;
-	if (!std::filesystem::exists(file_path, ec))
-		for (const std::filesystem::path &include_path : _include_paths)
-			if (std::filesystem::exists(file_path = include_path / file_name, ec))
-				break;
+	const std::filesystem::path file_name = std::filesystem::u8path(_token.literal_as_string);
+	std::filesystem::path file_path;
+	resolve_include_path(file_name, file_path);
 
 	const std::string file_path_string = file_path.u8string();
 
+	const uint32_t file_source = _source_files.intern(file_path_string);
+
+	// Skip files that were included before and are protected by an include guard that is still defined, since all their contents would be skipped anyway
+	if (const auto it = _include_guards.find(file_source);
+		it != _include_guards.end() && is_defined(it->second))
+	{
+		// Keep track of the guard macro as used, the same way evaluating the #ifndef would
+		if (const auto macro_it = _macros.find(it->second); macro_it != _macros.end() && macro_it->second.is_predefined)
+			_used_macros.emplace(it->second);
+
+		_skipped_include_count++;
+
+		if (!expect(tokenid::end_of_line))
+			consume_until(tokenid::end_of_line);
+		return;
+	}
+
 	// Detect recursive include and abort to avoid infinite loop
 	if (std::find_if(_input_stack.begin(), _input_stack.end(),
-			[&file_path_string](const input_level &level) { return level.name == file_path_string; }) != _input_stack.end())
+			[file_source](const input_level &level) { return level.source == file_source; }) != _input_stack.end())
 		return error(_token.location, "recursive #include");
 
-	std::string input;
+	// Share file contents between the cache and the lexer, instead of copying them for every include
+	std::shared_ptr<const std::string> input;
 	if (const auto it = _file_cache.find(file_path_string); it != _file_cache.end())
 	{
 		input = it->second;
 	}
 	else
 	{
-		if (!read_file(file_path, input))
+		// Files included by other preprocessor instances are shared too, as long as they did not change on disk in the meantime
+		input = read_file_shared(file_path, file_path_string);
+		if (input == nullptr)
 			return error(keyword_location, "could not open included file '" + file_name.u8string() + '\'');
 
 		_file_cache.emplace(file_path_string, input);
@@ -748,11 +1221,43 @@ void reshadefx::preprocessor::parse_include()
 	if (!expect(tokenid::end_of_line))
 		consume_until(tokenid::end_of_line);
 
+	// Files marked with #pragma once have their contents cleared, so there is nothing to push
+	if (input->empty())
+	{
+		_skipped_include_count++;
+		return;
+	}
+
 	// Clear out input stack before pushing include, so that hidden macros do not bleed into the include
 	while (_input_stack.size() > (_next_input_index + 1))
 		_input_stack.pop_back();
 
 	push(std::move(input), file_path_string);
+
+	// Start looking for an include guard in the newly pushed file
+	_input_stack.back().include_guard = include_guard_state::expect_ifndef;
+}
+
+bool reshadefx::preprocessor::resolve_include_path(const std::filesystem::path &file_name, std::filesystem::path &file_path)
+{
+	const auto exists = [this](const std::filesystem::path &path) {
+		std::error_code ec;
+		const bool file_exists = std::filesystem::exists(path, ec);
+		_looked_up_files.emplace(path.u8string(), file_exists);
+		return file_exists;
+	};
+
+	// Look next to the current file first, then in all include paths in order
+	file_path = std::filesystem::u8path(_source_files.name(_output_location.source));
+	file_path.replace_filename(file_name);
+	if (exists(file_path))
+		return true;
+
+	for (const std::filesystem::path &include_path : _include_paths)
+		if (exists(file_path = include_path / file_name))
+			return true;
+
+	return false;
 }
 
 bool reshadefx::preprocessor::evaluate_expression()
@@ -891,7 +1396,8 @@ bool reshadefx::preprocessor::evaluate_expression()
 			if (evaluate_identifier_as_macro())
 				continue;
 
-			if (_token.literal_as_string == "exists")
+			// A function-like macro used without arguments leaves the token following its name in '_token', so check that this is still an identifier
+			if (_token == tokenid::identifier && _token.literal_as_identifier == id_exists)
 			{
 				const bool has_parentheses = accept(tokenid::parenthesis_open);
 
@@ -907,30 +1413,24 @@ bool reshadefx::preprocessor::evaluate_expression()
 				if (!expect(tokenid::string_literal))
 					return false;
 
-				std::filesystem::path file_name = std::filesystem::u8path(_token.literal_as_string);
-				std::filesystem::path file_path = std::filesystem::u8path(_output_location.source);
-				file_path.replace_filename(file_name);
+				const std::filesystem::path file_name = std::filesystem::u8path(_token.literal_as_string);
+				std::filesystem::path file_path;
+				const bool file_exists = resolve_include_path(file_name, file_path);
 
 				if (has_parentheses && !expect(tokenid::parenthesis_close))
 					return false;
 
-				std::error_code ec;
-				if (!std::filesystem::exists(file_path, ec))
-					for (const std::filesystem::path &include_path : _include_paths)
-						if (std::filesystem::exists(file_path = include_path / file_name, ec))
-							break;
-
-				rpn[rpn_index++] = { std::filesystem::exists(file_path, ec) ? 1 : 0, false };
+				rpn[rpn_index++] = { file_exists ? 1 : 0, false };
 				continue;
 			}
-			if (_token.literal_as_string == "defined")
+			if (_token == tokenid::identifier && _token.literal_as_identifier == id_defined)
 			{
 				const bool has_parentheses = accept(tokenid::parenthesis_open);
 
 				if (!expect(tokenid::identifier))
 					return false;
 
-				const std::string macro_name = std::move(_token.literal_as_string);
+				const uint32_t macro_name = _token.literal_as_identifier;
 
 				if (has_parentheses && !expect(tokenid::parenthesis_close))
 					return false;
@@ -1086,66 +1586,70 @@ bool reshadefx::preprocessor::evaluate_expression()
 
 bool reshadefx::preprocessor::evaluate_identifier_as_macro()
 {
-	if (_token.literal_as_string == "__LINE__")
+	if (_token.literal_as_identifier == id_line)
 	{
 		push(std::to_string(_token.location.line));
 		return true;
 	}
-	if (_token.literal_as_string == "__FILE__")
+	if (_token.literal_as_identifier == id_file)
 	{
-		push(escape_string(_token.location.source));
+		push(escape_string(std::string(_source_files.name(_token.location.source))));
 		return true;
 	}
-	if (_token.literal_as_string == "__FILE_STEM__")
+	if (_token.literal_as_identifier == id_file_stem)
 	{
-		const std::filesystem::path file_stem = std::filesystem::u8path(_token.location.source).stem();
+		const std::filesystem::path file_stem = std::filesystem::u8path(_source_files.name(_token.location.source)).stem();
 		push(escape_string(file_stem.u8string()));
 		return true;
 	}
-	if (_token.literal_as_string == "__FILE_STEM_HASH__")
+	if (_token.literal_as_identifier == id_file_stem_hash)
 	{
-		const std::filesystem::path file_stem = std::filesystem::u8path(_token.location.source).stem();
+		const std::filesystem::path file_stem = std::filesystem::u8path(_source_files.name(_token.location.source)).stem();
 		push(std::to_string(std::hash<std::string>()(file_stem.u8string()) & 0xFFFFFFFF));
 		return true;
 	}
-	if (_token.literal_as_string == "__FILE_NAME__")
+	if (_token.literal_as_identifier == id_file_name)
 	{
-		const std::filesystem::path file_name = std::filesystem::u8path(_token.location.source).filename();
+		const std::filesystem::path file_name = std::filesystem::u8path(_source_files.name(_token.location.source)).filename();
 		push(escape_string(file_name.u8string()));
 		return true;
 	}
-	if (_token.literal_as_string == "__FILE_NAME_HASH__")
+	if (_token.literal_as_identifier == id_file_name_hash)
 	{
-		const std::filesystem::path file_name = std::filesystem::u8path(_token.location.source).filename();
+		const std::filesystem::path file_name = std::filesystem::u8path(_source_files.name(_token.location.source)).filename();
 		push(std::to_string(std::hash<std::string>()(file_name.u8string()) & 0xFFFFFFFF));
 		return true;
 	}
 
-	const auto it = _macros.find(_token.literal_as_string);
+	const auto it = _macros.find(_token.literal_as_identifier);
 	if (it == _macros.end())
 		return false;
 
 	if (!_input_stack.empty())
 	{
-		const std::unordered_set<std::string> &hidden_macros = _input_stack[_current_input_index].hidden_macros;
-		if (hidden_macros.find(_token.literal_as_string) != hidden_macros.end())
-			return false;
+		// Hidden macros are inherited from all parent input levels
+		for (size_t input_index = 0; input_index <= _current_input_index; ++input_index)
+			if (const std::vector<uint32_t> &hidden_macros = _input_stack[input_index].hidden_macros;
+				std::find(hidden_macros.begin(), hidden_macros.end(), _token.literal_as_identifier) != hidden_macros.end())
+				return false;
 	}
 
 	const location macro_location = _token.location;
 	if (_recursion_count++ >= 256)
 		return error(macro_location, "macro recursion too high"), false;
 
-	std::vector<std::string> arguments;
+	std::vector<lexed_text> arguments;
 	if (it->second.is_function_like)
 	{
+		arguments.reserve(it->second.parameters.size());
+
 		if (!accept(tokenid::parenthesis_open))
 			return false; // Function like macro used without arguments, handle that like a normal identifier instead
 
 		while (true)
 		{
 			int parentheses_level = 0;
-			std::string argument;
+			lexed_text argument;
 
 			// Ignore whitespace preceding the argument
 			accept(tokenid::space);
@@ -1170,14 +1674,19 @@ bool reshadefx::preprocessor::evaluate_identifier_as_macro()
 
 				// Collapse all whitespace down to a single space
 				if (_token == tokenid::space)
-					argument += ' ';
+					argument.append(_token, " ");
 				else
-					argument += _current_token_raw_data;
+					argument.append(_token, _current_token_raw_data);
 			}
 
 			// Trim whitespace following the argument
-			if (argument.size() && argument.back() == ' ')
-				argument.pop_back();
+			if (argument.text.size() && argument.text.back() == ' ')
+			{
+				argument.text.pop_back();
+
+				if (argument.tokens_valid && --argument.tokens.back().length == 0)
+					argument.tokens.pop_back();
+			}
 
 			arguments.push_back(std::move(argument));
 
@@ -1191,87 +1700,154 @@ bool reshadefx::preprocessor::evaluate_identifier_as_macro()
 	return true;
 }
 
-bool reshadefx::preprocessor::is_defined(const std::string &name) const
+bool reshadefx::preprocessor::is_defined(uint32_t name) const
 {
 	return _macros.find(name) != _macros.end() ||
 		// Check built-in macros as well
-		name == "__LINE__" ||
-		name == "__FILE__" ||
-		name == "__FILE_NAME__" ||
-		name == "__FILE_STEM__";
+		name == id_line ||
+		name == id_file ||
+		name == id_file_name ||
+		name == id_file_stem;
 }
 
-void reshadefx::preprocessor::expand_macro(const std::string &name, const macro &macro, const std::vector<std::string> &arguments)
+void reshadefx::preprocessor::expand_macro(uint32_t name, const macro &macro, const std::vector<lexed_text> &arguments)
 {
 	if (macro.replacement_list.empty())
 		return;
 
 	// Verify argument count for function-like macros
 	if (arguments.size() < macro.parameters.size())
-		return warning(_token.location, "not enough arguments for function-like macro invocation '" + name + "'");
+		return warning(_token.location, "not enough arguments for function-like macro invocation '" + std::string(_identifiers.name(name)) + "'");
 	if (arguments.size() > macro.parameters.size() && !macro.is_variadic)
-		return warning(_token.location, "too many arguments for function-like macro invocation '" + name + "'");
+		return warning(_token.location, "too many arguments for function-like macro invocation '" + std::string(_identifiers.name(name)) + "'");
 
-	std::string input;
-	input.reserve(macro.replacement_list.size());
+	// Reserve space for the arguments too, so that appending their expansion does not have to grow the buffers repeatedly
+	size_t text_size = macro.replacement_list.size();
+	size_t num_tokens = macro.replacement_tokens.size() + 1;
+	for (const lexed_text &argument : arguments)
+		text_size += argument.text.size(),
+		num_tokens += argument.tokens.size();
 
-	for (size_t offset = 0; offset < macro.replacement_list.size(); ++offset)
+	lexed_text input;
+	input.text.reserve(text_size);
+	input.tokens.reserve(num_tokens);
+
+	if (!macro.replacement_tokens.empty())
 	{
-		if (macro.replacement_list[offset] != macro_replacement_start)
+		// Build the expansion from the tokens of the replacement list, so that the result does not have to be lexed again
+		// Any text the lexer skipped over (e.g. comments in predefined macros) is kept, so that the expansion text is the same as when working on the replacement list directly
+		size_t offset = 0;
+		const lexed_token *first_tok = macro.replacement_tokens.data();
+		for (const lexed_token &tok : macro.replacement_tokens)
 		{
-			input += macro.replacement_list[offset];
-			continue;
+			if (tok.id != tokenid::unknown || macro.replacement_list[tok.offset] != macro_replacement_start)
+				continue;
+
+			input.append(macro.replacement_list, offset, tok.offset, first_tok, &tok);
+			offset = tok.offset + tok.length;
+			first_tok = &tok + 1;
+
+			// This is a special replacement sequence, which can only be an argument here (see 'create_macro_replacement_tokens')
+			if (tok.literal_as_int >= 0 && static_cast<size_t>(tok.literal_as_int) < arguments.size())
+				expand_macro_argument(arguments[tok.literal_as_int], input);
 		}
 
-		// This is a special replacement sequence
-		const char type = macro.replacement_list[++offset];
-		const char index = macro.replacement_list[++offset];
-		if (static_cast<size_t>(index) >= arguments.size())
+		input.append(macro.replacement_list, offset, macro.replacement_list.size(), first_tok, macro.replacement_tokens.data() + macro.replacement_tokens.size());
+	}
+	else
+	{
+		// Concatenation and stringizing work on the text of the arguments, so the result has to be lexed again
+		input.tokens_valid = false;
+
+		for (size_t offset = 0; offset < macro.replacement_list.size(); ++offset)
 		{
-			if (macro.is_variadic)
+			if (macro.replacement_list[offset] != macro_replacement_start)
 			{
-				// The concatenation operator has a special meaning when placed between a comma and a variable argument, deleting the preceding comma
-				if (type == macro_replacement_concat && input.back() == ',')
-					input.pop_back();
-				if (type == macro_replacement_stringize)
-					input += "\"\"";
+				input.text += macro.replacement_list[offset];
+				continue;
 			}
-			continue;
-		}
 
-		switch (type)
-		{
-		case macro_replacement_argument:
-			// Argument prescan
-			push(arguments[index] + static_cast<char>(macro_replacement_argument));
-			while (true)
+			// This is a special replacement sequence
+			const char type = macro.replacement_list[++offset];
+			const char index = macro.replacement_list[++offset];
+			if (static_cast<size_t>(index) >= arguments.size())
 			{
-				// Consume all tokens of the argument (until the end marker is reached)
-				consume();
-
-				if (_token == tokenid::unknown) // 'macro_replacement_argument' is 'tokenid::unknown'
-					break;
-				if (_token == tokenid::identifier && evaluate_identifier_as_macro())
-					continue;
+				if (macro.is_variadic)
+				{
+					// The concatenation operator has a special meaning when placed between a comma and a variable argument, deleting the preceding comma
+					if (type == macro_replacement_concat && input.text.back() == ',')
+						input.text.pop_back();
+					if (type == macro_replacement_stringize)
+						input.text += "\"\"";
+				}
+				continue;
+			}
 
-				input += _current_token_raw_data;
+			switch (type)
+			{
+			case macro_replacement_argument:
+				expand_macro_argument(arguments[index], input);
+				break;
+			case macro_replacement_concat:
+				input.text += arguments[index].text;
+				break;
+			case macro_replacement_stringize:
+				// Adds backslashes to escape quotes
+				input.text += escape_string<'\"'>(arguments[index].text);
+				break;
 			}
-			assert(_current_token_raw_data[0] == macro_replacement_argument);
-			break;
-		case macro_replacement_concat:
-			input += arguments[index];
-			break;
-		case macro_replacement_stringize:
-			// Adds backslashes to escape quotes
-			input += escape_string<'\"'>(arguments[index]);
-			break;
 		}
 	}
 
 	push(std::move(input));
 
 	// Avoid expanding macros again that are referencing themselves
-	_input_stack[_current_input_index].hidden_macros.insert(name);
+	_input_stack[_current_input_index].hidden_macros.push_back(name);
+}
+void reshadefx::preprocessor::expand_macro_argument(const lexed_text &argument, lexed_text &output)
+{
+	// Skip the prescan if it cannot change the argument, which is the case when it does not reference any macros
+	if (argument.tokens_valid && std::none_of(argument.tokens.begin(), argument.tokens.end(),
+			[this](const lexed_token &tok) {
+				// Also let the prescan handle tokens that produce errors or behave differently when lexed again at the start of a line
+				return (tok.id == tokenid::identifier && (tok.literal_as_identifier <= id_file_name_hash || _macros.find(tok.literal_as_identifier) != _macros.end())) ||
+					tok.id == tokenid::string_literal || tok.id == tokenid::hash || tok.id == tokenid::unknown;
+			}))
+	{
+		output.append(argument.text, 0, argument.text.size(), argument.tokens.data(), argument.tokens.data() + argument.tokens.size());
+
+		// Advance the location past the argument like the prescan does, since the expansion continues at the location of the last token
+		_token.location.column += static_cast<uint32_t>(argument.text.size());
+		return;
+	}
+
+	// Argument prescan, which expands all macros in the argument before it is substituted
+	lexed_text input;
+	input.text = argument.text;
+	input.tokens_valid = argument.tokens_valid;
+	// Reserve space for the end marker and the end of file token added in 'push' too
+	input.tokens.reserve(argument.tokens.size() + 2);
+	input.tokens.insert(input.tokens.end(), argument.tokens.begin(), argument.tokens.end());
+
+	token end_marker = {};
+	end_marker.id = tokenid::unknown; // 'macro_replacement_argument' is 'tokenid::unknown'
+	const char end_marker_data = static_cast<char>(macro_replacement_argument);
+	input.append(end_marker, std::string_view(&end_marker_data, 1));
+
+	push(std::move(input));
+	while (true)
+	{
+		// Consume all tokens of the argument (until the end marker is reached)
+		consume();
+
+		if (_token == tokenid::unknown)
+			break;
+		if (_token == tokenid::identifier && evaluate_identifier_as_macro())
+			continue;
+
+		output.append(_token, _current_token_raw_data);
+	}
+	assert(_current_token_raw_data[0] == macro_replacement_argument);
 }
 
 void reshadefx::preprocessor::create_macro_replacement_list(macro &macro)
@@ -1315,8 +1891,8 @@ void reshadefx::preprocessor::create_macro_replacement_list(macro &macro)
 				if (!expect(tokenid::identifier))
 					return;
 
-				const auto it = std::find(macro.parameters.begin(), macro.parameters.end(), _token.literal_as_string);
-				if (it == macro.parameters.end() && !(macro.is_variadic && _token.literal_as_string == "__VA_ARGS__"))
+				const auto it = std::find(macro.parameters.begin(), macro.parameters.end(), _identifiers.name(_token.literal_as_identifier));
+				if (it == macro.parameters.end() && !(macro.is_variadic && _token.literal_as_identifier == id_va_args))
 					return error(_token.location, "# must be followed by parameter name");
 
 				// Start a # stringize operator
@@ -1337,8 +1913,8 @@ void reshadefx::preprocessor::create_macro_replacement_list(macro &macro)
 				macro.replacement_list += ' ';
 			break;
 		case tokenid::identifier:
-			if (const auto it = std::find(macro.parameters.begin(), macro.parameters.end(), _token.literal_as_string);
-				it != macro.parameters.end() || (macro.is_variadic && _token.literal_as_string == "__VA_ARGS__"))
+			if (const auto it = std::find(macro.parameters.begin(), macro.parameters.end(), _identifiers.name(_token.literal_as_identifier));
+				it != macro.parameters.end() || (macro.is_variadic && _token.literal_as_identifier == id_va_args))
 			{
 				macro.replacement_list += macro_replacement_start;
 				macro.replacement_list += static_cast<char>(next_concat ? macro_replacement_concat : macro_replacement_argument);
@@ -1360,3 +1936,67 @@ void reshadefx::preprocessor::create_macro_replacement_list(macro &macro)
 	if (macro.replacement_list.size() && macro.replacement_list.back() == ' ')
 		macro.replacement_list.pop_back();
 }
+void reshadefx::preprocessor::create_macro_replacement_tokens(macro &macro)
+{
+	macro.replacement_tokens.clear();
+
+	// Line breaks would change the line number of all following tokens, so leave replacement lists containing those to the lexer
+	if (macro.replacement_list.empty() || macro.replacement_list.find('\n') != std::string::npos)
+		return;
+
+	const std::string_view replacement_list = macro.replacement_list;
+
+	// Start past the first column, since whether the expansion begins a new line is only known when it is expanded (see 'push')
+	lexer lexer(
+		std::make_shared<const std::string>(macro.replacement_list),
+		&_identifiers,
+		&_source_files,
+		true  /* ignore_comments */,
+		false /* ignore_whitespace */,
+		false /* ignore_pp_directives */,
+		false /* ignore_line_directives */,
+		true  /* ignore_keywords */,
+		false /* escape_string_literals */,
+		location(1, 2));
+
+	std::vector<lexed_token> tokens;
+	while (true)
+	{
+		const token tok = lexer.lex();
+
+		if (tok == tokenid::end_of_file)
+		{
+			if (tok.offset >= replacement_list.size())
+				break;
+
+			// The lexer stops at the null character that begins a special replacement sequence, so have to skip over those manually
+			// Concatenation and stringizing operate on the text of an argument and therefore always require lexing the result again
+			if (replacement_list[tok.offset] != macro_replacement_start || tok.offset + 2 >= replacement_list.size() || replacement_list[tok.offset + 1] != macro_replacement_argument)
+				return;
+
+			lexed_token &argument_tok = tokens.emplace_back();
+			argument_tok.id = tokenid::unknown;
+			argument_tok.offset = static_cast<uint32_t>(tok.offset);
+			argument_tok.length = 3;
+			argument_tok.literal_as_int = replacement_list[tok.offset + 2]; // Index of the argument
+
+			const size_t next_offset = tok.offset + argument_tok.length;
+			if (next_offset >= replacement_list.size())
+				break;
+			lexer.reset_to_offset(next_offset);
+			continue;
+		}
+
+		// String literals are not terminated by a null character, so make sure they do not run into a replacement sequence
+		if (replacement_list.substr(tok.offset, tok.length).find(static_cast<char>(macro_replacement_start)) != std::string_view::npos)
+			return;
+
+		lexed_token &new_tok = tokens.emplace_back();
+		new_tok.id = tok.id;
+		new_tok.offset = static_cast<uint32_t>(tok.offset);
+		new_tok.length = static_cast<uint32_t>(tok.length);
+		std::memcpy(&new_tok.literal_as_double, &tok.literal_as_double, sizeof(double));
+	}
+
+	macro.replacement_tokens = std::move(tokens);
+}
@@ -6,7 +6,7 @@
 #pragma once
 
 #include "effect_token.hpp"
-#include <memory> // std::unique_ptr
+#include <memory> // std::unique_ptr, std::shared_ptr
 #include <filesystem>
 #include <unordered_map>
 #include <unordered_set>
@@ -19,6 +19,21 @@ namespace reshadefx
 	class preprocessor
 	{
 	public:
+		// Compact form of a token, whose raw data and location are derived from the input it is part of
+		struct lexed_token
+		{
+			tokenid id;
+			uint32_t offset, length;
+			union
+			{
+				int literal_as_int;
+				unsigned int literal_as_uint;
+				float literal_as_float;
+				double literal_as_double;
+				uint32_t literal_as_identifier;
+			};
+		};
+
 		struct macro
 		{
 			std::string replacement_list;
@@ -26,12 +41,42 @@ namespace reshadefx
 			bool is_predefined = false;
 			bool is_variadic = false;
 			bool is_function_like = false;
+			// Replacement list split into tokens when the macro is defined, so that expanding it does not require lexing it again (empty if that is not possible)
+			std::vector<lexed_token> replacement_tokens;
 		};
 
 		// Define constructor explicitly because lexer class is not included here
 		preprocessor();
+		/// <summary>
+		/// Creates a copy of the state of another preprocessor, including its macro definitions and output.
+		/// This can be used to take a snapshot after processing a prefix that is common to several inputs and continue from that for each of them, instead of processing the prefix again every time.
+		/// Only valid between calls to <see cref="append_file"/> or <see cref="append_string"/>, not while input is being processed.
+		/// </summary>
+		preprocessor(const preprocessor &other);
+		preprocessor(preprocessor &&other);
 		~preprocessor();
 
+		preprocessor &operator=(const preprocessor &) = delete;
+		preprocessor &operator=(preprocessor &&other);
+
+		/// <summary>
+		/// Gets statistics about the file cache that is shared by all preprocessor instances in the process.
+		/// </summary>
+		/// <param name="hits">Number of included files that were already in memory.</param>
+		/// <param name="misses">Number of included files that had to be read from disk.</param>
+		static void get_shared_file_cache_statistics(size_t &hits, size_t &misses);
+
+		/// <summary>
+		/// Reads the specified file and moves the #include directives at its beginning (before any other directive or code) into a separate string.
+		/// They are replaced with whitespace in the source code, so that the locations of everything else in it do not change.
+		/// The result of processing the directives only depends on the state of the preprocessor before them, so a snapshot taken after them can be shared between files that begin with the same ones.
+		/// </summary>
+		/// <param name="path">Path to the file to read.</param>
+		/// <param name="source_code">Receives the contents of the file without the #include directives at its beginning.</param>
+		/// <param name="leading_includes">Receives the #include directives at the beginning of the file, each on its own line.</param>
+		/// <returns><see langword="true"/> if the file could be read, <see langword="false"/> otherwise.</returns>
+		static bool read_file_split_leading_includes(const std::filesystem::path &path, std::string &source_code, std::string &leading_includes);
+
 		/// <summary>
 		/// Adds an include directory to the list of search paths used when resolving #include directives.
 		/// </summary>
@@ -83,6 +128,10 @@ namespace reshadefx
 		/// Gets a list of all included files.
 		/// </summary>
 		std::vector<std::filesystem::path> included_files() const;
+		/// <summary>
+		/// Gets a list of all paths that were looked up while resolving #include directives and 'exists' expressions, together with whether a file existed at each of them.
+		/// </summary>
+		std::vector<std::pair<std::filesystem::path, bool>> looked_up_files() const;
 
 		/// <summary>
 		/// Gets a list of all defines that were used in #ifdef and #ifndef lines.
@@ -94,6 +143,11 @@ namespace reshadefx
 		/// </summary>
 		std::vector<std::pair<std::string, std::string>> used_pragma_directives() const { return _used_pragmas; }
 
+		/// <summary>
+		/// Gets the number of #include directives that were skipped without reading the file again, because it is protected by an include guard or #pragma once.
+		/// </summary>
+		size_t skipped_include_count() const { return _skipped_include_count; }
+
 	private:
 		struct if_level
 		{
@@ -102,18 +156,53 @@ namespace reshadefx
 			token pp_token;
 			size_t input_index;
 		};
+		enum class include_guard_state
+		{
+			invalid,
+			expect_ifndef,
+			inside,
+			after_endif,
+		};
 		struct input_level
 		{
-			std::string name;
+			uint32_t source;
 			std::unique_ptr<class lexer> lexer;
+			// Input of a macro expansion that was already split into tokens, which is used instead of a lexer
+			std::shared_ptr<const std::string> tokens_input;
+			std::vector<lexed_token> tokens;
+			size_t next_token_index = 0;
+			location tokens_location;
 			token next_token;
-			std::unordered_set<std::string> hidden_macros;
+			// Macros that are not expanded in this input level and all levels above it (so they do not have to be copied into every new level)
+			std::vector<uint32_t> hidden_macros;
+			// State used to detect whether all contents of an included file are wrapped in a single #ifndef/#endif block
+			include_guard_state include_guard = include_guard_state::invalid;
+			uint32_t include_guard_macro = 0;
+			size_t include_guard_if_index = 0;
+		};
+
+		struct lexed_text
+		{
+			std::string text;
+			// Tokens of the text, which are only valid as long as lexing the text again would result in the exact same tokens
+			std::vector<lexed_token> tokens;
+			bool tokens_valid = true;
+
+			void append(const token &tok, std::string_view data);
+			void append(const lexed_token &tok, std::string_view data);
+			void append(std::string_view source, size_t begin, size_t end, const lexed_token *first_tok, const lexed_token *last_tok);
+			void append_untokenized(std::string_view data);
 		};
 
 		void error(const location &location, const std::string &message);
 		void warning(const location &location, const std::string &message);
 
 		void push(std::string input, const std::string &name = std::string());
+		void push(std::shared_ptr<const std::string> input, const std::string &name = std::string());
+		void push(lexed_text input);
+
+		std::string_view token_string(const input_level &input, const token &tok) const;
+		token lex_token_input(input_level &input) const;
 
 		bool peek(tokenid tokid) const;
 		void consume();
@@ -135,12 +224,16 @@ namespace reshadefx
 		void parse_pragma();
 		void parse_include();
 
+		bool resolve_include_path(const std::filesystem::path &file_name, std::filesystem::path &file_path);
+
 		bool evaluate_expression();
 		bool evaluate_identifier_as_macro();
 
-		bool is_defined(const std::string &name) const;
-		void expand_macro(const std::string &name, const macro &macro, const std::vector<std::string> &arguments);
+		bool is_defined(uint32_t name) const;
+		void expand_macro(uint32_t name, const macro &macro, const std::vector<lexed_text> &arguments);
+		void expand_macro_argument(const lexed_text &argument, lexed_text &output);
 		void create_macro_replacement_list(macro &macro);
+		void create_macro_replacement_tokens(macro &macro);
 
 		std::string _output, _errors;
 
@@ -148,17 +241,25 @@ namespace reshadefx
 		size_t _next_input_index = 0;
 		size_t _current_input_index = 0;
 		reshadefx::token _token;
-		std::string _current_token_raw_data;
+		std::string_view _current_token_raw_data;
+		std::shared_ptr<const std::string> _last_input_data;
 		reshadefx::location _output_location;
 
 		std::vector<if_level> _if_stack;
 
 		unsigned short _recursion_count = 0;
-		std::unordered_set<std::string> _used_macros;
-		std::unordered_map<std::string, macro> _macros;
+		string_table _identifiers;
+		string_table _source_files;
+		std::unordered_set<uint32_t> _used_macros;
+		std::unordered_map<uint32_t, macro> _macros;
 
 		std::vector<std::filesystem::path> _include_paths;
-		std::unordered_map<std::string, std::string> _file_cache;
+		std::unordered_map<std::string, std::shared_ptr<const std::string>> _file_cache;
+		// Every path that was tried when resolving include file names, since a file appearing or disappearing at one of them changes which file is found
+		std::unordered_map<std::string, bool> _looked_up_files;
+		// Lookup table from source file index to the macro that guards the file against multiple inclusion
+		std::unordered_map<uint32_t, uint32_t> _include_guards;
+		size_t _skipped_include_count = 0;
 
 		std::vector<std::pair<std::string, std::string>> _used_pragmas;
 	};
@@ -4,10 +4,12 @@
  */
 
 #include "effect_symbol_table.hpp"
+#include "effect_perfect_hash.hpp"
 #include <cassert>
 #include <malloc.h> // alloca
-#include <algorithm> // std::upper_bound, std::sort
+#include <algorithm> // std::upper_bound, std::sort, std::remove_if
 #include <functional> // std::greater
+#include <iterator> // std::size
 
 enum class intrinsic_id
 {
@@ -28,6 +30,38 @@ struct intrinsic : reshadefx::function
 	}
 };
 
+// Names of all intrinsic function overloads, in the same order as the intrinsic definitions below
+static constexpr std::string_view s_intrinsic_names[] =
+{
+#define DEFINE_INTRINSIC(name, i, ret_type, ...) #name,
+	#include "effect_symbol_table_intrinsics.inl"
+};
+
+static constexpr size_t count_unique_intrinsic_names()
+{
+	// Overloads of the same intrinsic are defined next to each other, so only need to compare with the previous entry
+	size_t count = 0;
+	for (size_t i = 0; i < std::size(s_intrinsic_names); ++i)
+		if (i == 0 || s_intrinsic_names[i] != s_intrinsic_names[i - 1])
+			++count;
+	return count;
+}
+
+// Perfect hash table mapping each intrinsic name to the index of its first overload, so that overload resolution only has to look at overloads with a matching name
+static constexpr auto s_intrinsic_lookup = []() {
+	std::pair<std::string_view, uint16_t> entries[count_unique_intrinsic_names()] = {};
+	for (size_t i = 0, count = 0; i < std::size(s_intrinsic_names); ++i)
+	{
+		if (i != 0 && s_intrinsic_names[i] == s_intrinsic_names[i - 1])
+			continue;
+		entries[count].first = s_intrinsic_names[i];
+		entries[count].second = static_cast<uint16_t>(i);
+		++count;
+	}
+	return reshadefx::make_perfect_hash_map(entries);
+}();
+static_assert(s_intrinsic_lookup.valid(), "intrinsic overloads with the same name have to be defined next to each other");
+
 #define void { reshadefx::type::t_void }
 #define bool { reshadefx::type::t_bool, 1, 1 }
 #define bool2 { reshadefx::type::t_bool, 2, 1 }
@@ -190,22 +224,28 @@ void reshadefx::symbol_table::leave_scope()
 {
 	assert(_current_scope.level > 0);
 
-	for (auto &symbol : _symbol_stack)
+	// Only the symbol lists that had symbols added in this scope need to be updated, which are recorded in the undo log
+	while (!_scope_undo_log.empty() && _scope_undo_log.back().first >= _current_scope.level)
 	{
-		std::vector<scoped_symbol> &scope_list = symbol.second;
+		const std::string &name = _scope_undo_log.back().second->first;
+		std::vector<scoped_symbol> &scope_list = _scope_undo_log.back().second->second;
+
+		bool removed_function = false;
+		scope_list.erase(std::remove_if(scope_list.begin(), scope_list.end(),
+			[this, &removed_function](const scoped_symbol &symbol) {
+				if (symbol.scope.level > symbol.scope.namespace_level &&
+					symbol.scope.level >= _current_scope.level)
+				{
+					removed_function |= symbol.op == symbol_type::function;
+					return true;
+				}
+				return false;
+			}), scope_list.end());
 
-		for (auto scope_it = scope_list.begin(); scope_it != scope_list.end();)
-		{
-			if (scope_it->scope.level > scope_it->scope.namespace_level &&
-				scope_it->scope.level >= _current_scope.level)
-			{
-				scope_it = scope_list.erase(scope_it);
-			}
-			else
-			{
-				++scope_it;
-			}
-		}
+		if (removed_function)
+			_resolved_calls.erase(name);
+
+		_scope_undo_log.pop_back();
 	}
 
 	_current_scope.level--;
@@ -252,6 +292,10 @@ bool reshadefx::symbol_table::insert_symbol(const std::string &name, const symbo
 			// Insert symbol into this scope
 			insert_sorted(_symbol_stack[previous_scope_name + name], scoped_symbol { symbol, scope });
 
+			// A new overload may change the result of previously resolved calls
+			if (symbol.op == symbol_type::function)
+				_resolved_calls.erase(previous_scope_name + name);
+
 			// Continue walking up the scope chain
 			scope.level = ++scope.namespace_level;
 		}
@@ -259,7 +303,15 @@ bool reshadefx::symbol_table::insert_symbol(const std::string &name, const symbo
 	else
 	{
 		// This is a local symbol so it's sufficient to update the symbol stack with just the current scope
-		insert_sorted(_symbol_stack[name], scoped_symbol { symbol, _current_scope });
+		auto &symbol_list = *_symbol_stack.try_emplace(name).first;
+		insert_sorted(symbol_list.second, scoped_symbol { symbol, _current_scope });
+
+		if (symbol.op == symbol_type::function)
+			_resolved_calls.erase(name);
+
+		// Remember to remove the symbol again when leaving this scope (symbols declared directly in a namespace are kept)
+		if (_current_scope.level > _current_scope.namespace_level)
+			_scope_undo_log.emplace_back(_current_scope.level, &symbol_list);
 	}
 
 	return true;
@@ -348,6 +400,57 @@ static int compare_functions(const std::vector<reshadefx::expression> &arguments
 }
 
 bool reshadefx::symbol_table::resolve_function_call(const std::string &name, const std::vector<expression> &arguments, const scope &scope, symbol &out_data, bool &is_ambiguous) const
+{
+	std::vector<resolved_call> &resolved_calls = _resolved_calls[name];
+
+	auto it = std::find_if(resolved_calls.begin(), resolved_calls.end(),
+		[&arguments, &scope](const resolved_call &call) {
+			return call.scope.level == scope.level && call.scope.namespace_level == scope.namespace_level && call.scope.name == scope.name &&
+				std::equal(call.argument_types.begin(), call.argument_types.end(), arguments.begin(), arguments.end(),
+					[](const type &argument_type, const expression &argument) { return argument_type == argument.type; });
+		});
+
+	if (it == resolved_calls.end())
+	{
+		resolved_call &call = resolved_calls.emplace_back();
+		call.scope = scope;
+		call.argument_types.reserve(arguments.size());
+		for (const expression &argument : arguments)
+			call.argument_types.push_back(argument.type);
+
+		symbol data = {};
+		call.result = resolve_function_call_uncached(name, arguments, scope, data, call.ambiguous);
+		call.op = data.op;
+		call.id = data.id;
+		call.result_type = data.type;
+		call.function = data.function;
+
+		it = resolved_calls.end() - 1;
+	}
+#ifndef NDEBUG
+	else
+	{
+		// Verify that the cached result matches what a full overload resolution would return
+		symbol data = {};
+		bool ambiguous = false;
+		assert(resolve_function_call_uncached(name, arguments, scope, data, ambiguous) == it->result);
+		assert(ambiguous == it->ambiguous && data.op == it->op && data.function == it->function && (data.function == nullptr || (data.id == it->id && data.type == it->result_type)));
+	}
+#endif
+
+	out_data.op = it->op;
+	// Only update the symbol if a candidate was found, same as the full overload resolution does
+	if (it->function != nullptr)
+	{
+		out_data.id = it->id;
+		out_data.type = it->result_type;
+		out_data.function = it->function;
+	}
+	is_ambiguous = it->ambiguous;
+
+	return it->result;
+}
+bool reshadefx::symbol_table::resolve_function_call_uncached(const std::string &name, const std::vector<expression> &arguments, const scope &scope, symbol &out_data, bool &is_ambiguous) const
 {
 	out_data.op = symbol_type::function;
 
@@ -414,9 +517,14 @@ bool reshadefx::symbol_table::resolve_function_call(const std::string &name, con
 	// Try matching against intrinsic functions if no matching user-defined function was found up to this point
 	if (num_overloads == 0)
 	{
-		for (const intrinsic &intrinsic : s_intrinsics)
+		const uint16_t *const first_overload = s_intrinsic_lookup.find(name);
+
+		for (size_t i = first_overload != nullptr ? *first_overload : std::size(s_intrinsics);
+			i < std::size(s_intrinsics) && s_intrinsics[i].name == name; ++i)
 		{
-			if (intrinsic.name != name || intrinsic.parameter_list.size() != arguments.size())
+			const intrinsic &intrinsic = s_intrinsics[i];
+
+			if (intrinsic.parameter_list.size() != arguments.size())
 				continue;
 
 			// A new possibly-matching intrinsic function was found, compare it against the current result
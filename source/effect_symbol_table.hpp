@@ -96,8 +96,30 @@ namespace reshadefx
 		bool resolve_function_call(const std::string &name, const std::vector<expression> &args, const scope &scope, symbol &data, bool &ambiguous) const;
 
 	private:
+		bool resolve_function_call_uncached(const std::string &name, const std::vector<expression> &args, const scope &scope, symbol &data, bool &ambiguous) const;
+
+		/// <summary>
+		/// A previous result of <see cref="resolve_function_call"/> for a specific scope and list of argument types.
+		/// </summary>
+		struct resolved_call
+		{
+			struct scope scope;
+			std::vector<type> argument_types;
+			symbol_type op;
+			uint32_t id;
+			reshadefx::type result_type;
+			const reshadefx::function *function;
+			bool ambiguous;
+			bool result;
+		};
+
 		scope _current_scope;
 		// Lookup table from name to matching symbols
+		// This is keyed by string rather than by interned identifier index (like the preprocessor uses), since the parser lexes the preprocessed text again and builds namespace-qualified names by concatenation
 		std::unordered_map<std::string, std::vector<scoped_symbol>> _symbol_stack;
+		// List of symbol lists that had local symbols added to them, together with the scope level they were added at, so that leaving a scope only has to touch those
+		std::vector<std::pair<uint32_t, std::pair<const std::string, std::vector<scoped_symbol>> *>> _scope_undo_log;
+		// Cache of overload resolution results by function name, which is cleared for a name whenever a function symbol with that name is added or removed
+		mutable std::unordered_map<std::string, std::vector<resolved_call>> _resolved_calls;
 	};
 }
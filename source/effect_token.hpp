@@ -5,22 +5,72 @@
 
 #pragma once
 
+#include <deque>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstdint>
+#include <unordered_map>
 
 namespace reshadefx
 {
+	/// <summary>
+	/// A table of unique strings (like identifier names or source file paths), so that they can be referenced and compared by a small index instead of by string.
+	/// Strings are stored only once and are never moved, so views returned by <see cref="name"/> stay valid for the lifetime of the table.
+	/// </summary>
+	class string_table
+	{
+	public:
+		string_table() = default;
+		string_table(const string_table &other) : _names(other._names)
+		{
+			// The lookup table references the strings in this table, so it cannot be copied
+			_lookup.reserve(_names.size());
+			for (size_t index = 0; index < _names.size(); ++index)
+				_lookup.emplace(_names[index], static_cast<uint32_t>(index));
+		}
+		string_table(string_table &&) = default;
+		string_table &operator=(const string_table &other) { return *this = string_table(other); }
+		string_table &operator=(string_table &&) = default;
+
+		/// <summary>
+		/// Gets the index of the specified string, adding it to the table if it does not exist yet.
+		/// </summary>
+		uint32_t intern(std::string_view name)
+		{
+			if (const auto it = _lookup.find(name); it != _lookup.end())
+				return it->second;
+
+			const uint32_t index = static_cast<uint32_t>(_names.size());
+			_lookup.emplace(_names.emplace_back(name), index);
+			return index;
+		}
+
+		/// <summary>
+		/// Gets the string with the specified <paramref name="index"/>.
+		/// </summary>
+		std::string_view name(uint32_t index) const { return _names[index]; }
+		/// <summary>
+		/// Gets the number of strings in this table.
+		/// </summary>
+		uint32_t size() const { return static_cast<uint32_t>(_names.size()); }
+
+	private:
+		std::deque<std::string> _names;
+		std::unordered_map<std::string_view, uint32_t> _lookup;
+	};
+
 	/// <summary>
 	/// Structure which keeps track of a code location.
 	/// </summary>
 	struct location
 	{
-		location() : line(1), column(1) {}
-		explicit location(uint32_t line, uint32_t column = 1) : line(line), column(column) {}
-		explicit location(std::string source, uint32_t line, uint32_t column = 1) : source(std::move(source)), line(line), column(column) {}
+		location() : source(0), line(1), column(1) {}
+		explicit location(uint32_t line, uint32_t column = 1) : source(0), line(line), column(column) {}
+		explicit location(uint32_t source, uint32_t line, uint32_t column) : source(source), line(line), column(column) {}
 
-		std::string source;
+		// Index of the source file path in the source file table of the lexer, or zero if the source file is unknown
+		uint32_t source;
 		uint32_t line, column;
 	};
 
@@ -243,6 +293,8 @@ namespace reshadefx
 			unsigned int literal_as_uint;
 			float literal_as_float;
 			double literal_as_double;
+			// Index of the identifier name in the identifier table of the lexer (only set for identifiers when the lexer was created with an identifier table)
+			uint32_t literal_as_identifier;
 		};
 		std::string literal_as_string;
 
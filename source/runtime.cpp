@@ -8,6 +8,7 @@
 #include "effect_parser.hpp"
 #include "effect_codegen.hpp"
 #include "effect_preprocessor.hpp"
+#include "effect_cache.hpp"
 #include "version.h"
 #include "dll_log.hpp"
 #include "dll_resources.hpp"
@@ -17,6 +18,7 @@
 #include "input_gamepad.hpp"
 #include "com_ptr.hpp"
 #include "platform_utils.hpp"
+#include "thread_pool.hpp"
 #include "reshade_api_object_impl.hpp"
 #include <set>
 #include <thread>
@@ -24,7 +26,7 @@
 #include <cctype> // std::toupper
 #include <cwctype> // std::towlower
 #include <cstdio> // std::snprintf
-#include <cstdlib> // std::malloc, std::rand, std::strtod, std::strtol
+#include <cstdlib> // std::malloc, std::rand, std::strtod, std::strtol, std::strtoll, std::strtoull
 #include <cstring> // std::memcpy, std::memset, std::strlen
 #include <charconv> // std::to_chars
 #include <algorithm> // std::all_of, std::copy_n, std::equal, std::fill_n, std::find, std::find_if, std::for_each, std::max, std::min, std::replace, std::remove, std::remove_if, std::reverse, std::search, std::sort, std::stable_sort, std::swap, std::transform
@@ -34,6 +36,7 @@
 #include <stb_image_write.h>
 #include <stb_image_resize2.h>
 #include <d3dcompiler.h>
+#include <psapi.h> // K32GetProcessMemoryInfo
 
 bool resolve_path(std::filesystem::path &path, std::error_code &ec)
 {
@@ -123,10 +126,39 @@ static bool find_file(const std::vector<std::filesystem::path> &search_paths, st
 
 	return false;
 }
-static std::vector<std::filesystem::path> find_files(const std::vector<std::filesystem::path> &search_paths, std::initializer_list<std::filesystem::path> extensions)
+static size_t get_max_compile_threads()
+{
+	// Compilation is memory hungry, but how many effects are loaded in parallel is limited by the memory budget (see 'submit_effect_loads'), so the thread count does not need to be limited further
+	return static_cast<size_t>(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+}
+// Memory assumed to be needed to load an effect, unless loading it the last time was measured to need more
+static const uint64_t s_min_effect_load_memory_usage = 128ull * 1024 * 1024;
+
+struct process_memory_usage
+{
+	uint64_t current;
+	uint64_t peak;
+};
+static process_memory_usage get_process_memory_usage()
+{
+	// Use the commit charge rather than the working set, since it covers all memory that was allocated, regardless of whether it was paged in yet
+	PROCESS_MEMORY_COUNTERS_EX counters = { sizeof(counters) };
+	if (!K32GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS *>(&counters), sizeof(counters)))
+		return {};
+	return { counters.PrivateUsage, counters.PeakPagefileUsage };
+}
+static uint64_t get_available_memory()
+{
+	MEMORYSTATUSEX status = { sizeof(status) };
+	if (!GlobalMemoryStatusEx(&status))
+		return std::numeric_limits<uint64_t>::max();
+	// The available address space is what limits 32-bit processes, so take that into account too
+	return std::min(status.ullAvailPhys, status.ullAvailVirtual);
+}
+
+static std::shared_ptr<const reshade::effect_search_paths_snapshot> create_search_paths_snapshot(const std::vector<std::filesystem::path> &search_paths)
 {
 	std::error_code ec;
-	std::vector<std::filesystem::path> files;
 	std::vector<std::pair<std::filesystem::path, bool>> resolved_search_paths;
 
 	// First resolve all search paths and ensure they are all unique
@@ -153,25 +185,195 @@ static std::vector<std::filesystem::path> find_files(const std::vector<std::file
 		}
 	}
 
-	// Then iterate through all files in those search paths and add those with a matching extension
-	const auto check_and_add_file = [&extensions, &ec, &files](const std::filesystem::directory_entry &entry) {
-		if (!entry.is_directory(ec) &&
-			std::find(extensions.begin(), extensions.end(), entry.path().extension()) != extensions.end())
-			files.emplace_back(entry); // Construct path from directory entry in-place
+	const auto snapshot = std::make_shared<reshade::effect_search_paths_snapshot>();
+
+	// Then iterate through all directories and files in those search paths once
+	// The directory entries already carry the modification time and size of the files from the directory enumeration, so this does not need additional file system calls
+	const auto add_entry = [&ec, &snapshot](const std::filesystem::directory_entry &entry, bool recursive_search) {
+		if (entry.is_directory(ec))
+		{
+			if (recursive_search)
+				snapshot->directories.emplace(entry);
+			return;
+		}
+
+		reshade::effect_search_paths_snapshot::file_info &info = snapshot->file_infos[entry.path()];
+		info.last_write_time = entry.last_write_time(ec);
+		info.file_size = entry.file_size(ec);
+
+		snapshot->files.push_back(entry.path());
 	};
 
 	for (const std::pair<std::filesystem::path, bool> &resolved_search_path : resolved_search_paths)
 	{
+		snapshot->directories.emplace(resolved_search_path.first);
+
 		if (resolved_search_path.second)
 			for (const std::filesystem::directory_entry &entry : std::filesystem::recursive_directory_iterator(resolved_search_path.first, std::filesystem::directory_options::skip_permission_denied, ec))
-				check_and_add_file(entry);
+				add_entry(entry, true);
 		else
 			for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(resolved_search_path.first, std::filesystem::directory_options::skip_permission_denied, ec))
-				check_and_add_file(entry);
+				add_entry(entry, false);
 	}
 
+	return snapshot;
+}
+
+static std::vector<std::filesystem::path> find_files(const reshade::effect_search_paths_snapshot &snapshot, std::initializer_list<std::filesystem::path> extensions)
+{
+	std::vector<std::filesystem::path> files;
+	for (const std::filesystem::path &file : snapshot.files)
+		if (std::find(extensions.begin(), extensions.end(), file.extension()) != extensions.end())
+			files.push_back(file);
 	return files;
 }
+
+static bool get_file_info(const reshade::effect_search_paths_snapshot &snapshot, const std::filesystem::path &path, std::filesystem::file_time_type &last_write_time, uintmax_t &file_size)
+{
+	// Files in the search paths were already queried when the snapshot was taken, so only need to ask the file system about others (like files included via relative paths)
+	if (const auto it = snapshot.file_infos.find(path);
+		it != snapshot.file_infos.end())
+	{
+		last_write_time = it->second.last_write_time;
+		file_size = it->second.file_size;
+		return true;
+	}
+
+	std::error_code ec;
+	last_write_time = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return false;
+	file_size = std::filesystem::file_size(path, ec);
+	return !ec;
+}
+
+static bool hash_file_contents(const std::filesystem::path &path, reshadefx::hash128 &hash)
+{
+	FILE *const file = _wfsopen(path.c_str(), L"rb", SH_DENYNO);
+	if (file == nullptr)
+		return false;
+
+	const long file_size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+	if (file_size < 0 || fseek(file, 0, SEEK_SET) != 0)
+	{
+		fclose(file);
+		return false;
+	}
+
+	std::string data(static_cast<size_t>(file_size), '\0');
+	const size_t file_size_read = fread(data.data(), 1, data.size(), file);
+	fclose(file);
+	if (file_size_read != data.size())
+		return false;
+
+	// Use a hash function with a fixed definition, since the hash is written to the effect cache and compared again in later sessions
+	hash = reshadefx::compute_hash128(data);
+	return true;
+}
+static bool read_effect_dependency(const std::filesystem::path &path, reshade::effect::dependency &dependency)
+{
+	std::error_code ec;
+	dependency.path = path;
+	dependency.last_write_time = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return false;
+	dependency.file_size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return false;
+	return hash_file_contents(path, dependency.content_hash);
+}
+static bool check_effect_dependency(const reshade::effect_search_paths_snapshot &snapshot, reshade::effect::dependency &dependency, bool &last_write_time_updated)
+{
+	std::filesystem::file_time_type last_write_time;
+	uintmax_t file_size = 0;
+	if (!get_file_info(snapshot, dependency.path, last_write_time, file_size) || file_size != dependency.file_size)
+		return false;
+	if (last_write_time == dependency.last_write_time)
+		return true;
+
+	// The file was written to, but that does not necessarily mean its contents changed, so compare those too before throwing away the cached result
+	reshadefx::hash128 content_hash;
+	if (!hash_file_contents(dependency.path, content_hash) || content_hash != dependency.content_hash)
+		return false;
+
+	// Remember the new modification time, so that the contents do not have to be hashed again every time the effect is loaded
+	dependency.last_write_time = last_write_time;
+	last_write_time_updated = true;
+	return true;
+}
+static bool check_effect_looked_up_file(const reshade::effect_search_paths_snapshot &snapshot, const std::pair<std::filesystem::path, bool> &looked_up_file)
+{
+	if (snapshot.file_infos.find(looked_up_file.first) != snapshot.file_infos.end())
+		return looked_up_file.second;
+
+	std::error_code ec;
+	return std::filesystem::exists(looked_up_file.first, ec) == looked_up_file.second;
+}
+static bool parse_effect_dependencies(const std::string &data, std::vector<reshade::effect::dependency> &dependencies, std::vector<std::pair<std::filesystem::path, bool>> &looked_up_files)
+{
+	// Each line has the format "<content hash> <file size> <last write time> <path>", or "+ <path>" and "- <path>" for paths that were looked up and where a file did or did not exist (see 'format_effect_dependencies')
+	for (size_t offset = 0, next; offset < data.size(); offset = next + 1)
+	{
+		next = data.find('\n', offset);
+		if (next == std::string::npos)
+			return false;
+
+		if ((data[offset] == '+' || data[offset] == '-') && offset + 1 < next && data[offset + 1] == ' ')
+		{
+			looked_up_files.emplace_back(std::filesystem::u8path(data.c_str() + offset + 2, data.c_str() + next), data[offset] == '+');
+			continue;
+		}
+
+		reshade::effect::dependency &dependency = dependencies.emplace_back();
+
+		const size_t hash_end = data.find(' ', offset);
+		if (hash_end >= next || !reshadefx::hash128::from_string(std::string_view(data).substr(offset, hash_end - offset), dependency.content_hash))
+			return false;
+
+		char *end = const_cast<char *>(data.c_str() + hash_end);
+		dependency.file_size = std::strtoull(end + 1, &end, 10);
+		if (*end != ' ')
+			return false;
+		dependency.last_write_time = std::filesystem::file_time_type(std::filesystem::file_time_type::duration(std::strtoll(end + 1, &end, 10)));
+		if (*end != ' ')
+			return false;
+		dependency.path = std::filesystem::u8path(end + 1, data.c_str() + next);
+	}
+
+	return !dependencies.empty();
+}
+static std::string format_effect_dependencies(const std::vector<reshade::effect::dependency> &dependencies, const std::vector<std::pair<std::filesystem::path, bool>> &looked_up_files)
+{
+	std::string data;
+	for (const reshade::effect::dependency &dependency : dependencies)
+	{
+		data += dependency.content_hash.to_string();
+		data += ' ';
+		data += std::to_string(dependency.file_size);
+		data += ' ';
+		data += std::to_string(dependency.last_write_time.time_since_epoch().count());
+		data += ' ';
+		data += dependency.path.u8string();
+		data += '\n';
+	}
+	for (const std::pair<std::filesystem::path, bool> &looked_up_file : looked_up_files)
+	{
+		data += looked_up_file.second ? '+' : '-';
+		data += ' ';
+		data += looked_up_file.first.u8string();
+		data += '\n';
+	}
+	return data;
+}
+static void update_effect_included_files(reshade::effect &effect)
+{
+	// The first dependency is always the source file itself, the remaining ones are the included files
+	// This builds the list the same way regardless of whether the effect was preprocessed just now or its preprocessed source was loaded from the cache
+	effect.included_files.clear();
+	for (size_t i = 1; i < effect.dependencies.size(); ++i)
+		effect.included_files.push_back(effect.dependencies[i].path);
+	std::sort(effect.included_files.begin(), effect.included_files.end()); // Sort file names alphabetically
+}
 #endif
 
 reshade::runtime::runtime(api::swapchain *swapchain, api::command_queue *graphics_queue, const std::filesystem::path &config_path, bool is_vr) :
@@ -979,13 +1181,16 @@ void reshade::runtime::load_config()
 	config_get("GENERAL", "NoDebugInfo", _no_debug_info);
 	config_get("GENERAL", "NoEffectCache", _no_effect_cache);
 	config_get("GENERAL", "NoReloadOnInit", _no_reload_on_init);
+	config_get("GENERAL", "OptimizeEffectCode", _optimize_effect_code);
 
 	config_get("GENERAL", "EffectSearchPaths", _effect_search_paths);
 	config_get("GENERAL", "PerformanceMode", _performance_mode);
 	config_get("GENERAL", "PreprocessorDefinitions", _global_preprocessor_definitions);
 	config_get("GENERAL", "SkipLoadingDisabledEffects", _effect_load_skipping);
+	config_get("GENERAL", "EffectLoadMemoryBudget", _effect_load_memory_budget);
 	config_get("GENERAL", "TextureSearchPaths", _texture_search_paths);
 	config_get("GENERAL", "IntermediateCachePath", _effect_cache_path);
+	config_get("GENERAL", "IntermediateCacheSizeLimit", _effect_cache_size_limit);
 
 	config_get("GENERAL", "StartupPresetPath", _startup_preset_path);
 	config_get("GENERAL", "PresetPath", _current_preset_path);
@@ -1066,13 +1271,16 @@ void reshade::runtime::save_config() const
 	config.set("GENERAL", "NoDebugInfo", _no_debug_info);
 	config.set("GENERAL", "NoEffectCache", _no_effect_cache);
 	config.set("GENERAL", "NoReloadOnInit", _no_reload_on_init);
+	config.set("GENERAL", "OptimizeEffectCode", _optimize_effect_code);
 
 	config.set("GENERAL", "EffectSearchPaths", _effect_search_paths);
 	config.set("GENERAL", "PerformanceMode", _performance_mode);
 	config.set("GENERAL", "PreprocessorDefinitions", _global_preprocessor_definitions);
 	config.set("GENERAL", "SkipLoadingDisabledEffects", _effect_load_skipping);
+	config.set("GENERAL", "EffectLoadMemoryBudget", _effect_load_memory_budget);
 	config.set("GENERAL", "TextureSearchPaths", _texture_search_paths);
 	config.set("GENERAL", "IntermediateCachePath", _effect_cache_path);
+	config.set("GENERAL", "IntermediateCacheSizeLimit", _effect_cache_size_limit);
 
 	config.set("GENERAL", "StartupPresetPath", make_relative_path(_startup_preset_path));
 	config.set("GENERAL", "PresetPath", make_relative_path(_current_preset_path));
@@ -1470,10 +1678,23 @@ bool reshade::runtime::switch_to_next_preset(std::filesystem::path filter_path,
 	return true;
 }
 
-bool reshade::runtime::load_effect(const std::filesystem::path &source_file, const ini_file &preset, size_t effect_index, bool force_load, bool preprocess_required)
+bool reshade::runtime::load_effect(const std::filesystem::path &source_file, const ini_file &preset, size_t effect_index, const std::shared_ptr<const effect_search_paths_snapshot> &search_paths, bool force_load, bool preprocess_required)
 {
 	const std::chrono::high_resolution_clock::time_point time_load_started = std::chrono::high_resolution_clock::now();
 
+	// Keep track of how much memory loading this effect takes at its peak, by sampling the commit charge of the process after each stage
+	// Most memory is freed again by the time a stage returns (especially in D3DCompile), so the peak commit charge of the process is taken into account too, but that only covers the moment in between if it set a new peak
+	// This means a sample can easily miss the actual peak and underestimate, which is why the stored estimate is never lowered and never used below 's_min_effect_load_memory_usage' (see 'load_effects')
+	const process_memory_usage memory_usage_started = get_process_memory_usage();
+	std::atomic<uint64_t> peak_memory_usage = memory_usage_started.current;
+	const auto update_peak_memory_usage = [&peak_memory_usage, &memory_usage_started]() {
+		const process_memory_usage memory_usage = get_process_memory_usage();
+		// The peak commit charge of the process only changes when it is exceeded, so if it did, that happened while this effect was loading
+		const uint64_t sample = memory_usage.peak > memory_usage_started.peak ? std::max(memory_usage.current, memory_usage.peak) : memory_usage.current;
+		for (uint64_t prev_peak_memory_usage = peak_memory_usage; prev_peak_memory_usage < sample && !peak_memory_usage.compare_exchange_weak(prev_peak_memory_usage, sample);)
+			continue;
+	};
+
 	// Generate a unique string identifying this effect
 	std::string attributes;
 	attributes += "app=" + g_target_executable_path.stem().u8string() + ';';
@@ -1517,55 +1738,32 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 	for (const std::pair<std::string, std::string> &definition : preprocessor_definitions)
 		attributes += definition.first + '=' + definition.second + ';';
 
-	std::error_code ec;
-	std::set<std::filesystem::path> include_paths;
-	if (source_file.is_absolute())
-		include_paths.emplace(source_file.parent_path());
-	for (std::filesystem::path include_path : _effect_search_paths)
-	{
-		const bool recursive_search = include_path.filename() == L"**";
-		if (recursive_search)
-			include_path.remove_filename();
+	// Everything that affects the predefined macros is part of the attributes up to this point
+	std::string prefix_key = attributes;
+	prefix_key += "renderer=" + std::to_string(_renderer_id) + ';';
+	prefix_key += "color_format=" + std::to_string(static_cast<uint32_t>(_effect_color_format)) + ';';
 
-		if (resolve_path(include_path, ec))
-		{
-			include_paths.emplace(include_path);
+	assert(search_paths != nullptr);
 
-			if (recursive_search)
-			{
-				for (const std::filesystem::directory_entry &entry : std::filesystem::recursive_directory_iterator(include_path, std::filesystem::directory_options::skip_permission_denied, ec))
-					if (entry.is_directory(ec))
-						include_paths.emplace(entry);
-			}
-		}
-	}
+	std::set<std::filesystem::path> include_paths = search_paths->directories;
+	if (source_file.is_absolute())
+		include_paths.emplace(source_file.parent_path());
 
 	attributes += effect_name;
-	attributes += '?';
-	attributes += std::to_string(std::filesystem::last_write_time(source_file, ec).time_since_epoch().count());
 	attributes += ';';
 
-	// The actual included files are not known at this point, so detect changes to any ".fxh" files in the search paths
-	for (const std::filesystem::path &include_path : include_paths)
-	{
-		for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(include_path, std::filesystem::directory_options::skip_permission_denied, ec))
-		{
-			if (entry.path().extension() == L".fxh")
-			{
-				attributes += entry.path().filename().u8string();
-				attributes += '?';
-				attributes += std::to_string(entry.last_write_time(ec).time_since_epoch().count());
-				attributes += ';';
-			}
-		}
-	}
-
+	// Changes to the source file and the files it includes are not part of the hash, those are instead detected by checking the dependencies recorded when the effect was last preprocessed
 	effect &effect = _effects[effect_index];
 
 	const size_t source_hash = std::hash<std::string>()(attributes);
-	if (source_file != effect.source_file || source_hash != effect.source_hash)
+	bool last_write_time_updated = false;
+	if (source_file != effect.source_file || source_hash != effect.source_hash ||
+		!std::all_of(effect.dependencies.begin(), effect.dependencies.end(),
+			[&search_paths, &last_write_time_updated](effect::dependency &dependency) { return check_effect_dependency(*search_paths, dependency, last_write_time_updated); }) ||
+		!std::all_of(effect.looked_up_files.cbegin(), effect.looked_up_files.cend(),
+			[&search_paths](const std::pair<std::filesystem::path, bool> &looked_up_file) { return check_effect_looked_up_file(*search_paths, looked_up_file); }))
 	{
-		// Source hash has changed, reset effect and load from scratch, rather than updating
+		// Source hash or one of the dependencies has changed, reset effect and load from scratch, rather than updating
 		effect = {};
 		effect.source_file = source_file;
 		effect.source_hash = source_hash;
@@ -1595,54 +1793,164 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 	std::string code_preamble;
 	std::string errors;
 
+	const std::string source_cache_id = source_file.stem().u8string() + '-' + std::to_string(_renderer_id) + '-' + reshadefx::compute_hash128(attributes).to_string();
+
 	bool source_cached = false;
 	std::string source;
-	if (!effect.preprocessed && (preprocess_required || (source_cached = load_effect_cache(source_file.stem().u8string() + '-' + std::to_string(_renderer_id) + '-' + std::to_string(source_hash), "i", source)) == false))
-	{
-		reshadefx::preprocessor pp;
-		pp.add_macro_definition("__RESHADE__", std::to_string(VERSION_MAJOR * 10000 + VERSION_MINOR * 100 + VERSION_REVISION));
-		pp.add_macro_definition("__RESHADE_PERFORMANCE_MODE__", _performance_mode ? "1" : "0");
-		pp.add_macro_definition("__VENDOR__", std::to_string(_vendor_id));
-		pp.add_macro_definition("__DEVICE__", std::to_string(_device_id));
-		pp.add_macro_definition("__RENDERER__", std::to_string(_renderer_id));
-		pp.add_macro_definition("__APPLICATION__", std::to_string( // Truncate hash to 32-bit, since lexer currently only supports 32-bit numbers anyway
-			std::hash<std::string>()(g_target_executable_path.stem().u8string()) & 0xFFFFFFFF));
-		pp.add_macro_definition("BUFFER_WIDTH", std::to_string(_effect_width));
-		pp.add_macro_definition("BUFFER_HEIGHT", std::to_string(_effect_height));
-		pp.add_macro_definition("BUFFER_RCP_WIDTH", "(1.0 / BUFFER_WIDTH)");
-		pp.add_macro_definition("BUFFER_RCP_HEIGHT", "(1.0 / BUFFER_HEIGHT)");
-		pp.add_macro_definition("BUFFER_COLOR_SPACE", std::to_string(static_cast<uint32_t>(_back_buffer_color_space)));
-		pp.add_macro_definition("BUFFER_COLOR_FORMAT", std::to_string(static_cast<uint32_t>(_effect_color_format)));
-		pp.add_macro_definition("BUFFER_COLOR_BIT_DEPTH", std::to_string(api::format_bit_depth(_effect_color_format)));
-
-		for (const std::pair<std::string, std::string> &definition : preprocessor_definitions)
+	if (!effect.preprocessed && !preprocess_required)
+	{
+		// Only use the cached source if none of the files it was preprocessed from changed since it was written and all include lookups would still find the same files
+		std::vector<effect::dependency> dependencies;
+		std::vector<std::pair<std::filesystem::path, bool>> looked_up_files;
+		if (std::string dependencies_data;
+			load_effect_cache(source_cache_id, "deps", dependencies_data) &&
+			parse_effect_dependencies(dependencies_data, dependencies, looked_up_files) &&
+			std::all_of(dependencies.begin(), dependencies.end(),
+				[&search_paths, &last_write_time_updated](effect::dependency &dependency) { return check_effect_dependency(*search_paths, dependency, last_write_time_updated); }) &&
+			std::all_of(looked_up_files.cbegin(), looked_up_files.cend(),
+				[&search_paths](const std::pair<std::filesystem::path, bool> &looked_up_file) { return check_effect_looked_up_file(*search_paths, looked_up_file); }) &&
+			load_effect_cache(source_cache_id, "i", source))
 		{
-			if (definition.first.empty())
-				continue; // Skip invalid definitions
+			source_cached = true;
 
-			pp.add_macro_definition(definition.first, definition.second.empty() ? "1" : definition.second);
+			effect.dependencies = std::move(dependencies);
+			effect.looked_up_files = std::move(looked_up_files);
+
+			// Keep track of included files
+			update_effect_included_files(effect);
 		}
+	}
+
+	// Only record load statistics if every stage ran during this load, rather than being skipped thanks to a cached result, since they are used to estimate the cost of loading the effect from scratch
+	std::atomic<bool> load_stats_complete = !effect.preprocessed && !source_cached;
+
+	// Write back modification times of files that were written to without changing their contents, so that they are not hashed again on every load
+	if (last_write_time_updated && (effect.preprocessed || source_cached))
+		save_effect_cache(source_cache_id, "deps", format_effect_dependencies(effect.dependencies, effect.looked_up_files));
+
+	reshadefx::preprocessor pp;
+	if (!effect.preprocessed && !source_cached)
+	{
+		// Split off the #include directives at the beginning of the effect file, since most effect files begin with the same ones (like '#include "ReShade.fxh"')
+		// The preprocessor state after these and the predefined macros is then only created once and a snapshot of it is shared by all effect files with the same prefix
+		std::string effect_source, leading_includes;
+		const bool effect_source_read = reshadefx::preprocessor::read_file_split_leading_includes(source_file, effect_source, leading_includes);
 
+		// Relative includes are resolved against the directory of the effect file, so the prefix depends on that too
 		for (const std::filesystem::path &include_path : include_paths)
-			pp.add_include_path(include_path);
-
-		// Add some conversion macros for compatibility with older versions of ReShade
-		pp.append_string(
-			"#define tex2Doffset(s, coords, offset) tex2D(s, coords, offset)\n"
-			"#define tex2Dlodoffset(s, coords, offset) tex2Dlod(s, coords, offset)\n"
-			"#define tex2Dgather(s, t, c) tex2Dgather##c(s, t)\n"
-			"#define tex2Dgatheroffset(s, t, o, c) tex2Dgather##c(s, t, o)\n"
-			"#define tex2Dgather0 tex2DgatherR\n"
-			"#define tex2Dgather1 tex2DgatherG\n"
-			"#define tex2Dgather2 tex2DgatherB\n"
-			"#define tex2Dgather3 tex2DgatherA\n");
+			prefix_key += include_path.u8string() + ';';
+		prefix_key += source_file.parent_path().u8string() + ';';
+		prefix_key += leading_includes;
+
+		bool prefix_processed = false;
+		if (effect_source_read)
+		{
+			std::shared_ptr<const reshadefx::preprocessor> snapshot;
+			std::vector<std::pair<std::filesystem::path, std::filesystem::file_time_type>> included_files;
+			std::vector<std::pair<std::filesystem::path, bool>> looked_up_files;
+			{
+				const std::shared_lock<std::shared_mutex> lock(_effect_prefix_mutex);
+
+				if (const auto it = _effect_prefixes.find(prefix_key); it != _effect_prefixes.end())
+				{
+					snapshot = it->second.snapshot;
+					included_files = it->second.included_files;
+					looked_up_files = it->second.looked_up_files;
+				}
+			}
+
+			// Only use the snapshot if none of the files included by the prefix changed since it was taken and its includes would still resolve to the same files
+			if (snapshot != nullptr && std::all_of(included_files.cbegin(), included_files.cend(),
+					[&search_paths](const std::pair<std::filesystem::path, std::filesystem::file_time_type> &file) {
+						std::filesystem::file_time_type last_write_time;
+						uintmax_t file_size = 0;
+						return get_file_info(*search_paths, file.first, last_write_time, file_size) && last_write_time == file.second;
+					}) &&
+				std::all_of(looked_up_files.cbegin(), looked_up_files.cend(),
+					[&search_paths](const std::pair<std::filesystem::path, bool> &looked_up_file) { return check_effect_looked_up_file(*search_paths, looked_up_file); }))
+			{
+				pp = reshadefx::preprocessor(*snapshot);
+				prefix_processed = true;
+			}
+		}
+
+		if (!prefix_processed)
+		{
+			pp.add_macro_definition("__RESHADE__", std::to_string(VERSION_MAJOR * 10000 + VERSION_MINOR * 100 + VERSION_REVISION));
+			pp.add_macro_definition("__RESHADE_PERFORMANCE_MODE__", _performance_mode ? "1" : "0");
+			pp.add_macro_definition("__VENDOR__", std::to_string(_vendor_id));
+			pp.add_macro_definition("__DEVICE__", std::to_string(_device_id));
+			pp.add_macro_definition("__RENDERER__", std::to_string(_renderer_id));
+			pp.add_macro_definition("__APPLICATION__", std::to_string( // Truncate hash to 32-bit, since lexer currently only supports 32-bit numbers anyway
+				std::hash<std::string>()(g_target_executable_path.stem().u8string()) & 0xFFFFFFFF));
+			pp.add_macro_definition("BUFFER_WIDTH", std::to_string(_effect_width));
+			pp.add_macro_definition("BUFFER_HEIGHT", std::to_string(_effect_height));
+			pp.add_macro_definition("BUFFER_RCP_WIDTH", "(1.0 / BUFFER_WIDTH)");
+			pp.add_macro_definition("BUFFER_RCP_HEIGHT", "(1.0 / BUFFER_HEIGHT)");
+			pp.add_macro_definition("BUFFER_COLOR_SPACE", std::to_string(static_cast<uint32_t>(_back_buffer_color_space)));
+			pp.add_macro_definition("BUFFER_COLOR_FORMAT", std::to_string(static_cast<uint32_t>(_effect_color_format)));
+			pp.add_macro_definition("BUFFER_COLOR_BIT_DEPTH", std::to_string(api::format_bit_depth(_effect_color_format)));
+
+			for (const std::pair<std::string, std::string> &definition : preprocessor_definitions)
+			{
+				if (definition.first.empty())
+					continue; // Skip invalid definitions
+
+				pp.add_macro_definition(definition.first, definition.second.empty() ? "1" : definition.second);
+			}
+
+			for (const std::filesystem::path &include_path : include_paths)
+				pp.add_include_path(include_path);
+
+			// Add some conversion macros for compatibility with older versions of ReShade
+			pp.append_string(
+				"#define tex2Doffset(s, coords, offset) tex2D(s, coords, offset)\n"
+				"#define tex2Dlodoffset(s, coords, offset) tex2Dlod(s, coords, offset)\n"
+				"#define tex2Dgather(s, t, c) tex2Dgather##c(s, t)\n"
+				"#define tex2Dgatheroffset(s, t, o, c) tex2Dgather##c(s, t, o)\n"
+				"#define tex2Dgather0 tex2DgatherR\n"
+				"#define tex2Dgather1 tex2DgatherG\n"
+				"#define tex2Dgather2 tex2DgatherB\n"
+				"#define tex2Dgather3 tex2DgatherA\n");
+
+			if (effect_source_read)
+			{
+				// Process the prefix in a copy, so that the source file can still be processed normally if it fails (which reports errors at their actual location in the source file)
+				// It is named after the directory of the source file, so that relative includes in it are resolved the same way as in the source file
+				reshadefx::preprocessor prefix(pp);
+				if (leading_includes.empty() || prefix.append_string(leading_includes, source_file.parent_path() / std::filesystem::path()))
+				{
+					effect_prefix cached_prefix;
+					cached_prefix.snapshot = std::make_shared<const reshadefx::preprocessor>(prefix);
+					for (std::filesystem::path &included_file : prefix.included_files())
+					{
+						std::filesystem::file_time_type last_write_time;
+						uintmax_t file_size = 0;
+						get_file_info(*search_paths, included_file, last_write_time, file_size);
+						cached_prefix.included_files.emplace_back(std::move(included_file), last_write_time);
+					}
+					cached_prefix.looked_up_files = prefix.looked_up_files();
+
+					pp = std::move(prefix);
+					prefix_processed = true;
+
+					const std::unique_lock<std::shared_mutex> lock(_effect_prefix_mutex);
+					_effect_prefixes[prefix_key] = std::move(cached_prefix);
+				}
+			}
+		}
 
 		// Load and preprocess the source file
-		effect.preprocessed = pp.append_file(source_file);
+		if (prefix_processed)
+			effect.preprocessed = pp.append_string(std::move(effect_source), source_file);
+		else
+			effect.preprocessed = pp.append_file(source_file);
 
 		// Append preprocessor errors to the error list
 		errors += pp.errors();
 
+		update_peak_memory_usage();
+
 		if (effect.preprocessed)
 		{
 			source = pp.output();
@@ -1683,12 +1991,29 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 
 			// Do not cache if any special pragma directives were used, to ensure they are read again next time
 			if (!skip_optimization)
-				source_cached = save_effect_cache(source_file.stem().u8string() + '-' + std::to_string(_renderer_id) + '-' + std::to_string(source_hash), "i", source);
+				source_cached = save_effect_cache(source_cache_id, "i", source);
 		}
 
+		// Record the exact files the effect was preprocessed from, so that only changes to those cause it to be preprocessed again
+		// The source file itself always comes first and is not listed again should the effect include itself
+		std::vector<std::filesystem::path> included_files = pp.included_files();
+		std::sort(included_files.begin(), included_files.end());
+
+		bool dependencies_read = true;
+		effect.dependencies.clear();
+		effect.dependencies.reserve(1 + included_files.size());
+		dependencies_read &= read_effect_dependency(source_file, effect.dependencies.emplace_back());
+		for (const std::filesystem::path &included_file : included_files)
+			if (included_file != source_file)
+				dependencies_read &= read_effect_dependency(included_file, effect.dependencies.emplace_back());
+		effect.looked_up_files = pp.looked_up_files();
+
 		// Keep track of included files
-		effect.included_files = pp.included_files();
-		std::sort(effect.included_files.begin(), effect.included_files.end()); // Sort file names alphabetically
+		update_effect_included_files(effect);
+
+		// Without a complete list of dependencies there is no way to tell whether the cached source is still valid, so only write it alongside one
+		if (source_cached && dependencies_read)
+			source_cached = save_effect_cache(source_cache_id, "deps", format_effect_dependencies(effect.dependencies, effect.looked_up_files));
 	}
 	else
 	{
@@ -1720,7 +2045,11 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 	}
 
 	std::unique_ptr<reshadefx::codegen> codegen;
-	if (!effect.compiled && !source.empty())
+	if (effect.compiled || source.empty())
+	{
+		load_stats_complete = false;
+	}
+	else
 	{
 		unsigned shader_model;
 		if (_renderer_id == 0x9000)
@@ -1735,11 +2064,11 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 			shader_model = 51; // D3D12
 
 		if ((_renderer_id & 0xF0000) == 0)
-			codegen.reset(reshadefx::create_codegen_hlsl(shader_model, !_no_debug_info, _performance_mode));
+			codegen.reset(reshadefx::create_codegen_hlsl(shader_model, !_no_debug_info, _performance_mode, _optimize_effect_code));
 		else if (_renderer_id < 0x20000)
-			codegen.reset(reshadefx::create_codegen_glsl(false, !_no_debug_info, _performance_mode, false, true));
+			codegen.reset(reshadefx::create_codegen_glsl(false, !_no_debug_info, _performance_mode, false, true, _optimize_effect_code));
 		else // Vulkan uses SPIR-V input
-			codegen.reset(reshadefx::create_codegen_spirv(true, !_no_debug_info, _performance_mode, false, false));
+			codegen.reset(reshadefx::create_codegen_spirv(true, !_no_debug_info, _performance_mode, false, false, _optimize_effect_code));
 
 		reshadefx::parser parser;
 
@@ -1754,6 +2083,8 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 		if (_device->get_api() != api::device_api::vulkan)
 			effect.generated_code = codegen->finalize_code();
 
+		update_peak_memory_usage();
+
 		if (effect.compiled)
 		{
 			effect.uniforms.clear();
@@ -1874,7 +2205,7 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 		{
 			assert(!preprocess_required);
 
-			return load_effect(source_file, preset, effect_index, force_load, true);
+			return load_effect(source_file, preset, effect_index, search_paths, force_load, true);
 		}
 	}
 
@@ -1885,7 +2216,6 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 	{
 		if (effect.assembly.empty())
 		{
-			// Compile shader modules
 			for (const std::pair<std::string, reshadefx::shader_type> &entry_point : effect.module.entry_points)
 			{
 				if (entry_point.second == reshadefx::shader_type::compute && !_device->check_capability(api::device_caps::compute_shader))
@@ -1894,39 +2224,62 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 					effect.compiled = false;
 					break;
 				}
+			}
+		}
+
+		if (effect.compiled && effect.assembly.empty())
+		{
+			// Build the part of the HLSL code that is the same for every entry point only once
+			std::string hlsl_preamble;
+			if ((_renderer_id & 0xF0000) == 0)
+			{
+				assert(_d3d_compiler_module != nullptr);
 
-				std::string &cso = effect.assembly[entry_point.first];
-				std::string &cso_text = effect.assembly_text[entry_point.first];
+				hlsl_preamble = code_preamble;
 
-				if ((_renderer_id & 0xF0000) == 0)
+				if (_renderer_id == 0x9000)
 				{
-					assert(_d3d_compiler_module != nullptr);
+					// Create SEMANTIC_PIXEL_SIZE constants
+					hlsl_preamble += "#define COLOR_PIXEL_SIZE 1.0 / " + std::to_string(_effect_width) + ", 1.0 / " + std::to_string(_effect_height) + '\n';
 
-					// Copy string, since this has to be repeated for every entry point
-					std::string hlsl = code_preamble;
-
-					if (_renderer_id == 0x9000)
+					uint32_t semantic_index = 0;
+					for (const reshadefx::texture &tex : effect.module.textures)
 					{
-						// Create SEMANTIC_PIXEL_SIZE constants
-						hlsl += "#define COLOR_PIXEL_SIZE 1.0 / " + std::to_string(_effect_width) + ", 1.0 / " + std::to_string(_effect_height) + '\n';
-
-						uint32_t semantic_index = 0;
-						for (const reshadefx::texture &tex : effect.module.textures)
-						{
-							if (tex.semantic.empty() || tex.semantic == "COLOR")
-								continue;
+						if (tex.semantic.empty() || tex.semantic == "COLOR")
+							continue;
 
-							semantic_index++;
-							assert((effect.uniform_data_storage.size() / 16) <= (255 - semantic_index));
+						semantic_index++;
+						assert((effect.uniform_data_storage.size() / 16) <= (255 - semantic_index));
 
-							// Avoid duplicate declarations if the semantic was used multiple times
-							if (hlsl.find(tex.semantic + "_PIXEL_SIZE") == std::string::npos)
-								hlsl += "uniform float2 " + tex.semantic + "_PIXEL_SIZE : register(c" + std::to_string(255 - semantic_index) + ");\n";
-						}
+						// Avoid duplicate declarations if the semantic was used multiple times
+						if (hlsl_preamble.find(tex.semantic + "_PIXEL_SIZE") == std::string::npos)
+							hlsl_preamble += "uniform float2 " + tex.semantic + "_PIXEL_SIZE : register(c" + std::to_string(255 - semantic_index) + ");\n";
 					}
+				}
+
+				hlsl_preamble += "#line 1\n"; // Reset line number, so it matches what is shown when viewing the generated code
+			}
 
-					hlsl += "#line 1\n"; // Reset line number, so it matches what is shown when viewing the generated code
-					hlsl += codegen->finalize_code_for_entry_point(entry_point.first);
+			struct entry_point_result
+			{
+				std::string *cso = nullptr;
+				std::string *cso_text = nullptr;
+				std::string errors;
+				bool success = true;
+			};
+
+			// Create the output entries up front, so that entry points can be compiled independently of each other below
+			std::vector<entry_point_result> entry_point_results(effect.module.entry_points.size());
+			for (size_t i = 0; i < effect.module.entry_points.size(); ++i)
+			{
+				entry_point_results[i].cso = &effect.assembly[effect.module.entry_points[i].first];
+				entry_point_results[i].cso_text = &effect.assembly_text[effect.module.entry_points[i].first];
+			}
+
+			const auto compile_entry_point = [&](const std::pair<std::string, reshadefx::shader_type> &entry_point, std::string &cso, std::string &cso_text, std::string &entry_point_errors) -> bool {
+				if ((_renderer_id & 0xF0000) == 0)
+				{
+					const std::string hlsl = hlsl_preamble + codegen->finalize_code_for_entry_point(entry_point.first);
 
 					std::string profile;
 					switch (entry_point.second)
@@ -1984,7 +2337,7 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 
 					const std::string cache_id =
 						effect.source_file.stem().u8string() + '-' + entry_point.first + '-' + std::to_string(_renderer_id) + '-' +
-						std::to_string(std::hash<std::string_view>()(hlsl_attributes) ^ std::hash<std::string_view>()(hlsl));
+						reshadefx::compute_hash128(hlsl_attributes + hlsl).to_string();
 
 					if (!load_effect_cache(cache_id, "cso", cso))
 					{
@@ -2000,6 +2353,8 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 							compile_flags, 0,
 							&d3d_compiled, &d3d_errors);
 
+						update_peak_memory_usage();
+
 						std::string d3d_errors_string;
 						if (d3d_errors != nullptr) // Append warnings to the output error string as well
 							d3d_errors_string.assign(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1); // Subtracting one to not append the null-terminator as well
@@ -2033,16 +2388,15 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 						{
 							// Add a prefix with the offending entry point name for generic error messages like an out of memory notification
 							if (d3d_errors_string.find("error") == std::string::npos)
-								effect.errors += "error: " + entry_point.first + ": ";
+								entry_point_errors += "error: " + entry_point.first + ": ";
 
-							effect.errors += d3d_errors_string;
-							effect.compiled = false;
-							break;
+							entry_point_errors += d3d_errors_string;
+							return false;
 						}
 						else
 						{
 							// Append warnings
-							effect.errors += d3d_errors_string;
+							entry_point_errors += d3d_errors_string;
 						}
 
 						cso.resize(d3d_compiled->GetBufferSize());
@@ -2050,6 +2404,10 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 
 						save_effect_cache(cache_id, "cso", cso);
 					}
+					else
+					{
+						load_stats_complete = false;
+					}
 
 					if (!load_effect_cache(cache_id, "asm", cso_text))
 					{
@@ -2074,6 +2432,41 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 						cso_text = cso;
 					}
 				}
+
+				return true;
+			};
+
+			// Compile shader modules, letting idle effect loading threads help out with the entry points
+			std::atomic<bool> compile_failed = false;
+
+			const auto compile_entry_points = [&](size_t i) {
+				if (compile_failed)
+					return;
+
+				entry_point_result &result = entry_point_results[i];
+				result.success = compile_entry_point(effect.module.entry_points[i], *result.cso, *result.cso_text, result.errors);
+				if (!result.success)
+					compile_failed = true;
+			};
+
+			if (_effect_load_pool != nullptr)
+				_effect_load_pool->parallel_for(entry_point_results.size(), compile_entry_points);
+			else
+				for (size_t i = 0; i < entry_point_results.size(); ++i)
+					compile_entry_points(i);
+
+			update_peak_memory_usage();
+
+			// Report errors in entry point order and stop at the first failure, same as if the entry points were compiled one after another
+			for (const entry_point_result &result : entry_point_results)
+			{
+				effect.errors += result.errors;
+
+				if (!result.success)
+				{
+					effect.compiled = false;
+					break;
+				}
 			}
 		}
 
@@ -2199,6 +2592,17 @@ bool reshade::runtime::load_effect(const std::filesystem::path &source_file, con
 
 	const std::chrono::high_resolution_clock::time_point time_load_finished = std::chrono::high_resolution_clock::now();
 
+	if (load_stats_complete)
+	{
+		const std::unique_lock<std::shared_mutex> lock(_effect_load_stats_mutex);
+		effect_load_stats &stats = _effect_load_stats[source_file.u8string()];
+		stats.duration = time_load_finished - time_load_started;
+		// Both 'memory_usage_started' and 'peak_memory_usage' are samples of the commit charge of the whole process (including any effects loading at the same time), so this is only a rough estimate of what loading this effect took
+		// A single measurement may have missed the peak entirely, so only ever raise the estimate from a previous load, rather than replacing it
+		const uint64_t measured_memory_usage = peak_memory_usage > memory_usage_started.current ? peak_memory_usage - memory_usage_started.current : 0;
+		stats.peak_memory_usage = std::max(stats.peak_memory_usage, measured_memory_usage);
+	}
+
 	if (_reload_remaining_effects != 0 && _reload_remaining_effects != std::numeric_limits<size_t>::max())
 		_reload_remaining_effects--;
 	else
@@ -3382,9 +3786,13 @@ void reshade::runtime::reorder_techniques(std::vector<size_t> &&technique_indice
 
 void reshade::runtime::load_effects(bool force_load_all)
 {
-	// Build a list of effect files by walking through the effect search paths
+	// Walk through the effect search paths only once per reload and share the result with everything loaded during it
+	// Every load task holds on to its own reference, so that taking a new snapshot for a later reload does not affect effects that are still loading
+	const std::shared_ptr<const effect_search_paths_snapshot> search_paths = create_search_paths_snapshot(_effect_search_paths);
+
+	// Build a list of effect files from the files in the effect search paths
 	const std::vector<std::filesystem::path> effect_files =
-		find_files(_effect_search_paths, { L".fx", L".addonfx" });
+		find_files(*search_paths, { L".fx", L".addonfx" });
 
 	if (effect_files.empty())
 		return; // No effect files found, so nothing more to do
@@ -3416,22 +3824,159 @@ void reshade::runtime::load_effects(bool force_load_all)
 	_effects.resize(offset + effect_files.size());
 	_reload_remaining_effects = effect_files.size();
 
+	// Load the most expensive effects first, so that they do not end up delaying the end of the reload when started last
+	// The cost of an effect is estimated from the time it took to load it the last time, while effects that were not loaded before are started before all others, ordered by file size
+	struct effect_load_cost
+	{
+		size_t index;
+		bool loaded_before;
+		uintmax_t cost;
+		uint64_t memory_usage;
+	};
+
+	open_effect_cache();
+
+	if (!_effect_load_stats_loaded)
+		load_effect_stats();
+
+	std::vector<effect_load_cost> load_order;
+	load_order.reserve(effect_files.size());
+	{
+		const std::shared_lock<std::shared_mutex> lock(_effect_load_stats_mutex);
+
+		for (size_t i = 0; i < effect_files.size(); ++i)
+		{
+			if (const auto it = _effect_load_stats.find(effect_files[i].u8string()); it != _effect_load_stats.end())
+			{
+				load_order.push_back({ i, true, static_cast<uintmax_t>(std::chrono::duration_cast<std::chrono::microseconds>(it->second.duration).count()), std::max(it->second.peak_memory_usage, s_min_effect_load_memory_usage) });
+			}
+			else
+			{
+				const auto info_it = search_paths->file_infos.find(effect_files[i]);
+				load_order.push_back({ i, false, info_it != search_paths->file_infos.end() ? info_it->second.file_size : 0, s_min_effect_load_memory_usage });
+			}
+		}
+	}
+
+	std::stable_sort(load_order.begin(), load_order.end(),
+		[](const effect_load_cost &lhs, const effect_load_cost &rhs) {
+			return lhs.loaded_before != rhs.loaded_before ? !lhs.loaded_before : lhs.cost > rhs.cost;
+		});
+
+	// Only load as many effects in parallel as fit into the memory budget, which by default is half of the memory that is currently available, to leave room for the application
+	{
+		const std::unique_lock<std::mutex> lock(_effect_load_memory_mutex);
+		_effect_load_memory_limit = _effect_load_memory_budget != 0 ? static_cast<uint64_t>(_effect_load_memory_budget) * 1024 * 1024 : get_available_memory() / 2;
+	}
+
 	// Now that we have a list of files, load them in parallel
-	// Split workload into batches instead of launching a thread for every file to avoid launch overhead and stutters due to too many threads being in flight
-	size_t num_splits = std::min(effect_files.size(), static_cast<size_t>(std::max(std::thread::hardware_concurrency(), 2u) - 1));
-#ifndef _WIN64
-	// Limit number of threads in 32-bit due to the limited about of address space being available there and compilation being memory hungry
-	num_splits = std::min(num_splits, static_cast<size_t>(4));
-#endif
+	// Keep the worker threads around between reloads to avoid launch overhead and stutters due to too many threads being in flight
+	if (_effect_load_pool == nullptr)
+		_effect_load_pool = std::make_unique<thread_pool>(get_max_compile_threads());
 
-	// Keep track of the spawned threads, so the runtime cannot be destroyed while they are still running
-	for (size_t n = 0; n < num_splits; ++n)
-		_worker_threads.emplace_back([this, effect_files, offset, num_splits, n, &preset, force_load_all]() {
-			// Abort loading when initialization state changes (indicating that 'on_reset' was called in the meantime)
-			for (size_t i = 0; i < effect_files.size() && _is_initialized; ++i)
-				if (i * num_splits / effect_files.size() == n)
-					load_effect(effect_files[i], preset, offset + i, force_load_all || effect_files[i].extension() == L".addonfx");
+	{
+		const std::unique_lock<std::mutex> lock(_effect_load_memory_mutex);
+
+		for (const effect_load_cost &effect : load_order)
+		{
+			const size_t i = effect.index;
+
+			_effect_load_queue.push_back({ effect.memory_usage, [this, effect_file = effect_files[i], effect_index = offset + i, &preset, search_paths, force_load_all]() {
+				// Abort loading when initialization state changes (indicating that 'on_reset' was called in the meantime)
+				if (!_is_initialized)
+					return;
+
+				load_effect(effect_file, preset, effect_index, search_paths, force_load_all || effect_file.extension() == L".addonfx");
+			} });
+		}
+	}
+
+	submit_effect_loads();
+}
+void reshade::runtime::submit_effect_loads()
+{
+	const std::unique_lock<std::mutex> lock(_effect_load_memory_mutex);
+
+	// Only hand effects to the pool once they fit into the budget, rather than having workers wait for it, so that idle workers remain available to compile the entry points of the effects that are loading
+	// Always let at least one effect through, even if it alone exceeds the budget
+	while (!_effect_load_queue.empty() && (_effect_load_memory_in_use == 0 || _effect_load_memory_in_use + _effect_load_queue.front().memory_usage <= _effect_load_memory_limit))
+	{
+		pending_effect_load effect = std::move(_effect_load_queue.front());
+		_effect_load_queue.pop_front();
+
+		_effect_load_memory_in_use += effect.memory_usage;
+
+		_effect_load_pool->submit([this, memory_usage = effect.memory_usage, load = std::move(effect.load)]() {
+			load();
+			release_effect_load_memory(memory_usage);
 		});
+	}
+}
+void reshade::runtime::release_effect_load_memory(uint64_t size)
+{
+	{
+		const std::unique_lock<std::mutex> lock(_effect_load_memory_mutex);
+		assert(_effect_load_memory_in_use >= size);
+		_effect_load_memory_in_use -= size;
+	}
+
+	// Submit the next effects while this task is still running, so that waiting on the pool covers them too
+	submit_effect_loads();
+}
+void reshade::runtime::load_effect_stats()
+{
+	_effect_load_stats_loaded = true;
+
+	// The stats are kept in their own file next to the effect cache, so that they survive the cache being disabled, cleared or evicted
+	const std::filesystem::path stats_file = g_reshade_base_path / _effect_cache_path / L"reshade-effects.stats";
+
+	std::error_code ec;
+	const uintmax_t file_size = std::filesystem::file_size(stats_file, ec);
+	if (ec)
+		return;
+
+	FILE *const file = _wfsopen(stats_file.c_str(), L"rb", SH_DENYNO);
+	if (file == nullptr)
+		return;
+
+	std::string data(static_cast<size_t>(file_size), '\0');
+	data.resize(fread(data.data(), 1, data.size(), file));
+	fclose(file);
+
+	const std::unique_lock<std::shared_mutex> lock(_effect_load_stats_mutex);
+
+	// Each line has the format "<duration in microseconds> <peak memory usage in bytes> <path>"
+	for (size_t line_offset = 0, next_line_offset; (next_line_offset = data.find('\n', line_offset)) != std::string::npos; line_offset = next_line_offset + 1)
+	{
+		const std::string_view line(data.data() + line_offset, next_line_offset - line_offset);
+
+		char *end = nullptr;
+		const unsigned long long duration = std::strtoull(line.data(), &end, 10);
+		const unsigned long long peak_memory_usage = std::strtoull(end, &end, 10);
+		if (end >= line.data() + line.size() || *end != ' ')
+			continue;
+
+		effect_load_stats &stats = _effect_load_stats[std::string(end + 1, line.data() + line.size())];
+		stats.duration = std::chrono::microseconds(duration);
+		stats.peak_memory_usage = peak_memory_usage;
+	}
+}
+void reshade::runtime::save_effect_stats() const
+{
+	std::string data;
+	{
+		const std::shared_lock<std::shared_mutex> lock(_effect_load_stats_mutex);
+
+		for (const std::pair<const std::string, effect_load_stats> &stats : _effect_load_stats)
+			data += std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(stats.second.duration).count()) + ' ' + std::to_string(stats.second.peak_memory_usage) + ' ' + stats.first + '\n';
+	}
+
+	FILE *const file = _wfsopen((g_reshade_base_path / _effect_cache_path / L"reshade-effects.stats").c_str(), L"wb", SH_DENYWR);
+	if (file == nullptr)
+		return;
+
+	fwrite(data.data(), 1, data.size(), file);
+	fclose(file);
 }
 bool reshade::runtime::reload_effect(size_t effect_index)
 {
@@ -3453,7 +3998,12 @@ bool reshade::runtime::reload_effect(size_t effect_index)
 	// Make sure 'is_loading' is true while loading the effect
 	_reload_remaining_effects = 1;
 
-	return load_effect(source_file, ini_file::load_cache(_current_preset_path), effect_index, true, true);
+	// Take a new snapshot of the search paths, since files may have changed since the last reload (which is usually why an effect is reloaded)
+	const std::shared_ptr<const effect_search_paths_snapshot> search_paths = create_search_paths_snapshot(_effect_search_paths);
+
+	open_effect_cache();
+
+	return load_effect(source_file, ini_file::load_cache(_current_preset_path), effect_index, search_paths, true, true);
 }
 void reshade::runtime::reload_effects(bool force_load_all)
 {
@@ -3477,6 +4027,9 @@ void reshade::runtime::reload_effects(bool force_load_all)
 void reshade::runtime::destroy_effects()
 {
 	// Make sure no threads are still accessing effect data
+	if (_effect_load_pool != nullptr)
+		_effect_load_pool->wait();
+	assert(_effect_load_queue.empty());
 	for (std::thread &thread : _worker_threads)
 		if (thread.joinable())
 			thread.join();
@@ -3489,6 +4042,9 @@ void reshade::runtime::destroy_effects()
 	// Reset the effect creation queue
 	_reload_create_queue.clear();
 
+	// Process the prefix of effect files again on the next reload, so that it picks up any changes made to them in the meantime
+	_effect_prefixes.clear();
+
 	// Make sure no effect resources are currently in use (do this even when the effect list is empty, since it is dependent upon by 'on_reset')
 	_graphics_queue->wait_idle();
 
@@ -3517,44 +4073,60 @@ void reshade::runtime::destroy_effects()
 	_reload_required_effects.clear();
 }
 
-bool reshade::runtime::load_effect_cache(const std::string &id, const std::string &type, std::string &data) const
+void reshade::runtime::open_effect_cache()
 {
 	if (_no_effect_cache)
-		return false;
+	{
+		_effect_cache.reset();
+		return;
+	}
 
-	std::filesystem::path path = g_reshade_base_path / _effect_cache_path;
-	path /= std::filesystem::u8path("reshade-" + id + '.' + type);
+	// All cached data is packed into a single data file (which is named by this file), rather than writing a separate file for every entry
+	const std::filesystem::path cache_file = g_reshade_base_path / _effect_cache_path / L"reshade-effects.cache";
+	const uint64_t max_size = static_cast<uint64_t>(_effect_cache_size_limit) * 1024 * 1024;
 
-	FILE *const file = _wfsopen(path.c_str(), L"rb", SH_DENYNO);
-	if (file == nullptr)
-		return false;
+	if (_effect_cache != nullptr && _effect_cache->path() == cache_file && _effect_cache->max_size() == max_size)
+		return;
 
-	fseek(file, 0, SEEK_END);
-	const size_t file_size = ftell(file);
-	fseek(file, 0, SEEK_SET);
+	std::error_code ec;
+	const bool cache_file_existed = std::filesystem::exists(cache_file, ec);
 
-	data.resize(file_size, '\0');
-	const size_t file_size_read = fread(data.data(), 1, data.size(), file);
-	fclose(file);
-	return file_size_read == data.size();
+	if (_effect_cache == nullptr)
+		_effect_cache = std::make_unique<reshadefx::effect_cache>();
+
+	if (!_effect_cache->open(cache_file, max_size))
+	{
+		log::message(log::level::error, "Failed to open effect cache file '%s'!", cache_file.u8string().c_str());
+		_effect_cache.reset(); // Try again on the next reload
+		return;
+	}
+
+	// Remove files left behind by previous versions, which wrote every entry to a separate file, since those would otherwise never be cleaned up
+	if (!cache_file_existed)
+		clear_effect_cache_files();
 }
-bool reshade::runtime::save_effect_cache(const std::string &id, const std::string &type, const std::string &data) const
+bool reshade::runtime::load_effect_cache(const std::string &id, const std::string &type, std::string &data) const
 {
-	if (_no_effect_cache)
+	if (_no_effect_cache || _effect_cache == nullptr)
 		return false;
 
-	std::filesystem::path path = g_reshade_base_path / _effect_cache_path;
-	path /= std::filesystem::u8path("reshade-" + id + '.' + type);
-
-	FILE *const file = _wfsopen(path.c_str(), L"wb", SH_DENYNO);
-	if (file == nullptr)
+	return _effect_cache->load(id + '.' + type, data);
+}
+bool reshade::runtime::save_effect_cache(const std::string &id, const std::string &type, const std::string &data) const
+{
+	if (_no_effect_cache || _effect_cache == nullptr)
 		return false;
 
-	const size_t file_size_written = fwrite(data.data(), 1, data.size(), file);
-	fclose(file);
-	return file_size_written == data.size();
+	return _effect_cache->save(id + '.' + type, data);
 }
 void reshade::runtime::clear_effect_cache()
+{
+	if (_effect_cache != nullptr && !_effect_cache->clear())
+		log::message(log::level::error, "Failed to clear effect cache file '%s'!", _effect_cache->path().u8string().c_str());
+
+	clear_effect_cache_files();
+}
+void reshade::runtime::clear_effect_cache_files()
 {
 	std::error_code ec;
 
@@ -3566,7 +4138,10 @@ void reshade::runtime::clear_effect_cache()
 
 		const std::filesystem::path filename = entry.path().filename();
 		const std::filesystem::path extension = entry.path().extension();
-		if (filename.native().compare(0, 8, L"reshade-") != 0 || (extension != L".i" && extension != L".cso" && extension != L".asm"))
+		if (filename.native().compare(0, 8, L"reshade-") != 0 || (extension != L".i" && extension != L".deps" && extension != L".cso" && extension != L".asm" && extension != L".stats"))
+			continue;
+		// Keep the effect load stats, which are not part of the cache
+		if (filename == L"reshade-effects.stats")
 			continue;
 
 		std::filesystem::remove(entry, ec);
@@ -3712,6 +4287,9 @@ void reshade::runtime::update_effects()
 		// Finished loading effects, so apply preset to figure out which ones need compiling
 		load_current_preset();
 
+		// Remember how expensive loading each effect was for the next time
+		save_effect_stats();
+
 #if RESHADE_ADDON
 		invoke_addon_event<addon_event::reshade_set_current_preset_path>(this, _current_preset_path.u8string().c_str());
 #endif
@@ -3719,6 +4297,10 @@ void reshade::runtime::update_effects()
 		_last_reload_time = std::chrono::high_resolution_clock::now();
 		_reload_remaining_effects = std::numeric_limits<size_t>::max();
 
+		size_t include_cache_hits = 0, include_cache_misses = 0;
+		reshadefx::preprocessor::get_shared_file_cache_statistics(include_cache_hits, include_cache_misses);
+		log::message(log::level::debug, "Included files were read from disk %zu times and served from memory %zu times so far.", include_cache_misses, include_cache_hits);
+
 #if RESHADE_GUI
 		// Update all code editors after a reload
 		for (editor_instance &instance : _editors)
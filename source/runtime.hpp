@@ -12,6 +12,9 @@
 #include <memory>
 #include <filesystem>
 #include <atomic>
+#include <deque>
+#include <mutex>
+#include <functional>
 #include <shared_mutex>
 
 #ifdef GAME_MW
@@ -37,11 +40,13 @@ inline bool drawFrontEnd = true;
 #endif
 
 class ini_file;
-namespace reshadefx { struct sampler_desc; }
+class thread_pool;
+namespace reshadefx { struct sampler_desc; class preprocessor; class effect_cache; }
 
 namespace reshade
 {
 	struct effect;
+	struct effect_search_paths_snapshot;
 	struct uniform;
 	struct texture;
 	struct technique;
@@ -208,7 +213,7 @@ namespace reshade
 
 		bool switch_to_next_preset(std::filesystem::path filter_path, bool reversed = false);
 
-		bool load_effect(const std::filesystem::path &source_file, const ini_file &preset, size_t effect_index, bool force_load = false, bool preprocess_required = false);
+		bool load_effect(const std::filesystem::path &source_file, const ini_file &preset, size_t effect_index, const std::shared_ptr<const effect_search_paths_snapshot> &search_paths, bool force_load = false, bool preprocess_required = false);
 		bool create_effect(size_t effect_index);
 		bool create_effect_sampler_state(const reshadefx::sampler_desc &desc, api::sampler &sampler);
 		void destroy_effect(size_t effect_index);
@@ -227,9 +232,17 @@ namespace reshade
 		void reload_effects(bool force_load_all = false);
 		void destroy_effects();
 
+		void submit_effect_loads();
+		void release_effect_load_memory(uint64_t size);
+
+		void load_effect_stats();
+		void save_effect_stats() const;
+
+		void open_effect_cache();
 		bool load_effect_cache(const std::string &id, const std::string &type, std::string &data) const;
 		bool save_effect_cache(const std::string &id, const std::string &type, const std::string &data) const;
 		void clear_effect_cache();
+		void clear_effect_cache_files();
 
 		bool update_effect_color_and_stencil_tex(uint32_t width, uint32_t height, api::format color_format, api::format stencil_format);
 
@@ -313,8 +326,13 @@ namespace reshade
 		bool _no_debug_info = true;
 		bool _no_effect_cache = false;
 		bool _no_reload_on_init = false;
+		bool _optimize_effect_code = false;
 		bool _performance_mode = false;
 		bool _effect_load_skipping = false;
+		// Maximum amount of memory effects that are loaded in parallel may use in total (in megabytes), or zero to derive it from the available memory
+		unsigned int _effect_load_memory_budget = 0;
+		// Size the effect cache file may grow to (in megabytes) before the least recently used entries are evicted, or zero to let it grow without bounds
+		unsigned int _effect_cache_size_limit = 256;
 		unsigned int _reload_key_data[4] = {};
 		unsigned int _performance_mode_key_data[4] = {};
 
@@ -324,6 +342,7 @@ namespace reshade
 		bool _block_effect_reload_this_frame = false;
 
 		std::filesystem::path _effect_cache_path;
+		std::unique_ptr<reshadefx::effect_cache> _effect_cache;
 		std::vector<std::filesystem::path> _effect_search_paths;
 		std::vector<std::filesystem::path> _texture_search_paths;
 
@@ -333,6 +352,39 @@ namespace reshade
 		std::atomic<size_t> _reload_remaining_effects = std::numeric_limits<size_t>::max();
 		void *_d3d_compiler_module = nullptr;
 
+		// Snapshots of the preprocessor state after the predefined macros and the #include directives at the beginning of an effect file, which most effect files share
+		struct effect_prefix
+		{
+			std::shared_ptr<const reshadefx::preprocessor> snapshot;
+			std::vector<std::pair<std::filesystem::path, std::filesystem::file_time_type>> included_files;
+			std::vector<std::pair<std::filesystem::path, bool>> looked_up_files;
+		};
+		std::shared_mutex _effect_prefix_mutex;
+		std::unordered_map<std::string, effect_prefix> _effect_prefixes;
+
+		std::unique_ptr<thread_pool> _effect_load_pool;
+		// Measurements from the last time each effect file was loaded, used to decide the order in which to load them in and how many to load in parallel
+		struct effect_load_stats
+		{
+			std::chrono::high_resolution_clock::duration duration;
+			// Highest commit charge measured across all loads of the effect, since a single measurement may miss the actual peak
+			uint64_t peak_memory_usage;
+		};
+		bool _effect_load_stats_loaded = false;
+		mutable std::shared_mutex _effect_load_stats_mutex;
+		std::unordered_map<std::string, effect_load_stats> _effect_load_stats;
+		// Memory currently claimed by effects that are being loaded, which is kept below the budget determined at the start of a reload
+		// Effects that do not fit into the budget yet wait in the queue until loading another one finishes
+		struct pending_effect_load
+		{
+			uint64_t memory_usage;
+			std::function<void()> load;
+		};
+		std::mutex _effect_load_memory_mutex;
+		std::deque<pending_effect_load> _effect_load_queue;
+		uint64_t _effect_load_memory_in_use = 0;
+		uint64_t _effect_load_memory_limit = 0;
+
 		std::vector<effect> _effects;
 		std::vector<texture> _textures;
 		std::vector<technique> _techniques;
@@ -5,8 +5,11 @@
 
 #pragma once
 
+#include "effect_cache.hpp" // reshadefx::hash128
 #include "effect_module.hpp"
 #include "moving_average.hpp"
+#include <map>
+#include <set>
 
 namespace reshade
 {
@@ -198,6 +201,17 @@ namespace reshade
 		size_t source_hash = 0;
 		std::filesystem::path source_file;
 		std::vector<std::filesystem::path> included_files;
+		// Files the effect was preprocessed from (the source file and all files it included), used to detect whether it has to be preprocessed again
+		struct dependency
+		{
+			std::filesystem::path path;
+			std::filesystem::file_time_type last_write_time;
+			uintmax_t file_size;
+			reshadefx::hash128 content_hash;
+		};
+		std::vector<dependency> dependencies;
+		// Paths that were looked up while resolving #include directives and 'exists' expressions and whether a file existed at them, since a file appearing or disappearing there would change the result too
+		std::vector<std::pair<std::filesystem::path, bool>> looked_up_files;
 		std::vector<std::pair<std::string, std::string>> definitions;
 		std::string generated_code;
 		std::unordered_map<std::string, std::string> assembly;
@@ -223,5 +237,20 @@ namespace reshade
 		};
 		std::vector<binding_data> texture_semantic_to_binding;
 	};
+
+	struct effect_search_paths_snapshot
+	{
+		struct file_info
+		{
+			std::filesystem::file_time_type last_write_time;
+			uintmax_t file_size;
+		};
+
+		// Resolved search paths, including all sub directories of recursive ones
+		std::set<std::filesystem::path> directories;
+		// Files in those directories, in the order they were found in
+		std::vector<std::filesystem::path> files;
+		std::map<std::filesystem::path, file_info> file_infos;
+	};
 #endif
 }
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause OR MIT
+ */
+
+#include "thread_pool.hpp"
+#include <atomic>
+#include <cassert>
+#include <algorithm> // std::min
+
+static thread_local const thread_pool *s_current_pool = nullptr;
+static thread_local size_t s_current_worker_index = 0;
+
+thread_pool::thread_pool(size_t num_threads)
+{
+	assert(num_threads != 0);
+
+	_queues.reserve(num_threads);
+	for (size_t i = 0; i < num_threads; ++i)
+		_queues.push_back(std::make_unique<worker_queue>());
+
+	_threads.reserve(num_threads);
+	for (size_t i = 0; i < num_threads; ++i)
+		_threads.emplace_back(&thread_pool::worker_main, this, i);
+}
+thread_pool::~thread_pool()
+{
+	assert(s_current_pool != this);
+
+	{
+		const std::unique_lock<std::mutex> lock(_mutex);
+		_exit = true;
+	}
+
+	_task_queued.notify_all();
+
+	for (std::thread &thread : _threads)
+		thread.join();
+}
+
+void thread_pool::submit(std::function<void()> task)
+{
+	const std::unique_lock<std::mutex> lock(_mutex);
+
+	if (s_current_pool == this)
+	{
+		worker_queue &queue = *_queues[s_current_worker_index];
+		const std::unique_lock<std::mutex> queue_lock(queue.mutex);
+		queue.tasks.push_front(std::move(task));
+	}
+	else
+	{
+		worker_queue &queue = *_queues[_next_queue];
+		_next_queue = (_next_queue + 1) % _queues.size();
+		const std::unique_lock<std::mutex> queue_lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	_num_queued_tasks++;
+	_num_unfinished_tasks++;
+
+	_task_queued.notify_one();
+}
+
+void thread_pool::parallel_for(size_t count, const std::function<void(size_t)> &func)
+{
+	// State is shared with the helper tasks, since those may only start running after this call returned
+	struct shared_state
+	{
+		std::mutex mutex;
+		std::condition_variable finished;
+		size_t num_running = 0;
+		bool closed = false;
+	};
+
+	const auto state = std::make_shared<shared_state>();
+
+	std::atomic<size_t> next_index = 0;
+	const auto run = [&next_index, count, &func]() {
+		for (size_t i; (i = next_index++) < count;)
+			func(i);
+	};
+
+	for (size_t i = 1; i < std::min(count, _threads.size() + 1); ++i)
+	{
+		submit([state, &run]() {
+			{
+				const std::unique_lock<std::mutex> lock(state->mutex);
+				// Nothing left to do once the calling thread stopped waiting
+				if (state->closed)
+					return;
+				state->num_running++;
+			}
+
+			run();
+
+			const std::unique_lock<std::mutex> lock(state->mutex);
+			if (--state->num_running == 0)
+				state->finished.notify_all();
+		});
+	}
+
+	run();
+
+	// Only wait for helpers that already started, those that did not yet will exit right away once they do
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->closed = true;
+	state->finished.wait(lock, [&state]() { return state->num_running == 0; });
+}
+
+void thread_pool::wait()
+{
+	assert(s_current_pool != this);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_tasks_finished.wait(lock, [this]() { return _num_unfinished_tasks == 0; });
+}
+
+void thread_pool::worker_main(size_t index)
+{
+	s_current_pool = this;
+	s_current_worker_index = index;
+
+	std::function<void()> task;
+
+	while (true)
+	{
+		if (try_pop_task(index, task))
+		{
+			task();
+			task = nullptr;
+
+			const std::unique_lock<std::mutex> lock(_mutex);
+			if (--_num_unfinished_tasks == 0)
+				_tasks_finished.notify_all();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_task_queued.wait(lock, [this]() { return _exit || _num_queued_tasks != 0; });
+
+		// Finish all remaining tasks before exiting
+		if (_exit && _num_queued_tasks == 0)
+			break;
+	}
+
+	s_current_pool = nullptr;
+}
+
+bool thread_pool::try_pop_task(size_t index, std::function<void()> &task)
+{
+	// Check the queue of this worker first, then try to steal from the others
+	for (size_t offset = 0; offset < _queues.size(); ++offset)
+	{
+		worker_queue &queue = *_queues[(index + offset) % _queues.size()];
+
+		{
+			const std::unique_lock<std::mutex> queue_lock(queue.mutex);
+			if (queue.tasks.empty())
+				continue;
+
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+
+		const std::unique_lock<std::mutex> lock(_mutex);
+		_num_queued_tasks--;
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause OR MIT
+ */
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+/// <summary>
+/// A pool of persistent worker threads with a task queue per worker.
+/// Workers take tasks from the front of their own queue and steal from the front of the queues of other workers once their own runs empty.
+/// </summary>
+class thread_pool
+{
+public:
+	/// <summary>
+	/// Starts the specified number of worker threads.
+	/// </summary>
+	explicit thread_pool(size_t num_threads);
+	/// <summary>
+	/// Waits for all queued tasks to finish and then stops the worker threads.
+	/// </summary>
+	~thread_pool();
+
+	thread_pool(const thread_pool &) = delete;
+	thread_pool &operator=(const thread_pool &) = delete;
+
+	size_t num_threads() const { return _threads.size(); }
+
+	/// <summary>
+	/// Queues a task for execution.
+	/// Tasks queued from outside the pool are spread across the workers and run in the order they were queued in (as long as no worker is stealing).
+	/// Tasks queued from within a task of this pool are put in front of the queue of the calling worker, so that idle workers pick them up first.
+	/// </summary>
+	void submit(std::function<void()> task);
+
+	/// <summary>
+	/// Calls the specified function once for every index in the range [0, <paramref name="count"/>) on the calling thread, while letting idle workers of this pool help out.
+	/// Only waits for work that was started, so this can safely be called from within a task of this pool.
+	/// </summary>
+	void parallel_for(size_t count, const std::function<void(size_t)> &func);
+
+	/// <summary>
+	/// Blocks until all queued tasks have finished.
+	/// Must not be called from within a task of this pool.
+	/// </summary>
+	void wait();
+
+private:
+	struct worker_queue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void worker_main(size_t index);
+	bool try_pop_task(size_t index, std::function<void()> &task);
+
+	std::vector<std::unique_ptr<worker_queue>> _queues;
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _task_queued;
+	std::condition_variable _tasks_finished;
+	// Number of tasks that were queued, but not yet taken by a worker
+	size_t _num_queued_tasks = 0;
+	// Number of tasks that were queued, but have not finished yet
+	size_t _num_unfinished_tasks = 0;
+	size_t _next_queue = 0;
+	bool _exit = false;
+};
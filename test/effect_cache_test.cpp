@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "effect_cache.hpp"
+
+using namespace reshadefx;
+
+static size_t count_data_files(const std::filesystem::path &cache_path)
+{
+	std::error_code ec;
+	size_t count = 0;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(cache_path.parent_path(), ec))
+		if (entry.path().filename().u8string().compare(0, cache_path.filename().u8string().size() + 1, cache_path.filename().u8string() + '.') == 0)
+			count++;
+	return count;
+}
+
+TEST_CASE(effect_cache_shares_entries_between_instances)
+{
+	const std::filesystem::path directory = reshadefx::test::create_temp_directory("reshadefx_effect_cache_test");
+	const std::filesystem::path cache_path = directory / "test.cache";
+
+	// Two instances opened on the same file behave like two processes sharing it
+	effect_cache a, b;
+	CHECK(a.open(cache_path, 0));
+	CHECK(b.open(cache_path, 0));
+
+	CHECK(a.save("key1", "data1"));
+	CHECK(a.save("key2", "data2"));
+
+	std::string data;
+	CHECK(b.load("key1", data) && data == "data1");
+	CHECK(b.save("key1", "data3"));
+	CHECK(a.load("key1", data) && data == "data3");
+
+	// Compacting writes a new version of the data file, which the other instance switches to, and the old version is removed once neither has it open anymore
+	CHECK(a.compact(0));
+	CHECK(a.num_entries() == 2);
+	CHECK(b.load("key2", data) && data == "data2");
+	CHECK(b.save("key4", "data4"));
+	CHECK(a.load("key4", data) && data == "data4");
+	CHECK(count_data_files(cache_path) == 1);
+
+	CHECK(b.clear());
+	CHECK(!a.load("key1", data));
+	CHECK(a.num_entries() == 0);
+	CHECK(b.num_entries() == 0);
+	CHECK(count_data_files(cache_path) == 1);
+
+	a.close();
+	b.close();
+
+	// Entries are kept across reopening
+	{
+		effect_cache c;
+		CHECK(c.open(cache_path, 0));
+		CHECK(c.save("key5", "data5"));
+	}
+	{
+		effect_cache c;
+		CHECK(c.open(cache_path, 0));
+		CHECK(c.load("key5", data) && data == "data5");
+	}
+
+	std::error_code ec;
+	std::filesystem::remove_all(directory, ec);
+}
+
+TEST_CASE(effect_cache_evicts_least_recently_used_entries)
+{
+	const std::filesystem::path directory = reshadefx::test::create_temp_directory("reshadefx_effect_cache_test");
+	const std::filesystem::path cache_path = directory / "test.cache";
+
+	constexpr uint64_t max_size = 64 * 1024;
+
+	effect_cache cache;
+	CHECK(cache.open(cache_path, max_size));
+
+	// Entries that would not fit even after evicting everything else are rejected
+	CHECK(!cache.save("large", std::string(max_size, 'x')));
+	CHECK(cache.num_entries() == 0);
+
+	// Growing past the limit evicts entries, rather than failing or growing without bounds
+	for (int i = 0; i < 64; ++i)
+		CHECK(cache.save("key" + std::to_string(i), std::string(4096, static_cast<char>('a' + i % 26))));
+
+	CHECK(cache.file_size() <= max_size);
+	CHECK(count_data_files(cache_path) == 1);
+
+	std::string data;
+	CHECK(cache.load("key63", data) && data == std::string(4096, static_cast<char>('a' + 63 % 26)));
+
+	// An entry too large for the remaining space does not stop smaller ones from being kept
+	CHECK(cache.save("medium", std::string(max_size / 2, 'm')));
+	CHECK(cache.save("small", "s"));
+	CHECK(cache.compact(max_size / 2));
+	CHECK(cache.load("small", data) && data == "s");
+	CHECK(!cache.load("medium", data));
+	CHECK(cache.num_entries() > 1);
+
+	cache.close();
+
+	std::error_code ec;
+	std::filesystem::remove_all(directory, ec);
+}
+
+TEST_CASE(effect_cache_reads_records_appended_past_the_mapped_view)
+{
+	const std::filesystem::path directory = reshadefx::test::create_temp_directory("reshadefx_effect_cache_test");
+	const std::filesystem::path cache_path = directory / "test.cache";
+
+	effect_cache a, b;
+	CHECK(a.open(cache_path, 0));
+	CHECK(b.open(cache_path, 0));
+
+	std::string data;
+	CHECK(a.save("first", "data"));
+	CHECK(b.load("first", data) && data == "data");
+
+	// Grow the file in small steps well past the size the other instance mapped it with, which has to pick up every record in between
+	for (int i = 0; i < 96; ++i)
+	{
+		CHECK(a.save("key" + std::to_string(i), std::string(128 * 1024, static_cast<char>('a' + i % 26))));
+		CHECK(b.load("key" + std::to_string(i), data) && data == std::string(128 * 1024, static_cast<char>('a' + i % 26)));
+	}
+
+	CHECK(b.num_entries() == 97);
+	CHECK(b.load("first", data) && data == "data");
+	CHECK(b.load("key0", data) && data == std::string(128 * 1024, 'a'));
+
+	// Compacting has to copy records regardless of whether they are mapped
+	CHECK(b.compact(0));
+	CHECK(a.load("key95", data) && data == std::string(128 * 1024, static_cast<char>('a' + 95 % 26)));
+
+	a.close();
+	b.close();
+
+	std::error_code ec;
+	std::filesystem::remove_all(directory, ec);
+}
+
+TEST_CASE(effect_cache_hash_string_round_trip)
+{
+	const hash128 hash = compute_hash128("effect_cache_hash_string_round_trip");
+
+	hash128 parsed;
+	CHECK(hash128::from_string(hash.to_string(), parsed) && parsed == hash);
+	CHECK(hash128::from_string("0123456789ABCDEF0123456789abcdef", parsed) && parsed.high == 0x0123456789abcdefull && parsed.low == 0x0123456789abcdefull);
+
+	CHECK(!hash128::from_string(hash.to_string().substr(1), parsed));
+	CHECK(!hash128::from_string(hash.to_string() + '0', parsed));
+	CHECK(!hash128::from_string("0123456789abcdef0123456789abcdeg", parsed));
+}
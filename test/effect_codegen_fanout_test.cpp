@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "effect_parser.hpp"
+#include "effect_preprocessor.hpp"
+#include "effect_codegen.hpp"
+#include <memory>
+#include <iterator> // std::size
+
+struct fanout_variant
+{
+	unsigned int shader_model;
+	bool vulkan_semantics;
+	bool debug_info;
+	bool uniforms_to_spec_constants;
+	bool optimize;
+
+	std::string to_string() const
+	{
+		return "sm" + std::to_string(shader_model) +
+			(vulkan_semantics ? " vulkan" : "") +
+			(debug_info ? " debug" : "") +
+			(uniforms_to_spec_constants ? " spec-constants" : "") +
+			(optimize ? " optimize" : "");
+	}
+};
+
+static std::unique_ptr<reshadefx::codegen> create_target(size_t index, const fanout_variant &variant)
+{
+	if (index == 0)
+		return std::unique_ptr<reshadefx::codegen>(reshadefx::create_codegen_hlsl(variant.shader_model, variant.debug_info, variant.uniforms_to_spec_constants, variant.optimize));
+	else
+		return std::unique_ptr<reshadefx::codegen>(reshadefx::create_codegen_glsl(variant.vulkan_semantics, variant.debug_info, variant.uniforms_to_spec_constants, false, false, variant.optimize));
+}
+
+TEST_CASE(codegen_fanout_matches_separate_targets)
+{
+	const fanout_variant variants[] = {
+		{ 50, false, false, false, false },
+		{ 51, false, false, false, false },
+		{ 50, false, false, false, true },
+		{ 51, true, true, false, false },
+		{ 50, false, false, true, false },
+		{ 51, true, true, true, true },
+	};
+
+	size_t effect_count = 0;
+
+	std::error_code ec;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(reshadefx::test::effects_path(), ec))
+	{
+		if (entry.path().extension() != ".fx")
+			continue;
+
+		effect_count++;
+
+		reshadefx::preprocessor pp;
+		pp.add_macro_definition("__RESHADE__", "50000");
+		pp.add_macro_definition("BUFFER_WIDTH", "800");
+		pp.add_macro_definition("BUFFER_HEIGHT", "600");
+		pp.add_macro_definition("BUFFER_RCP_WIDTH", "(1.0 / BUFFER_WIDTH)");
+		pp.add_macro_definition("BUFFER_RCP_HEIGHT", "(1.0 / BUFFER_HEIGHT)");
+		CHECK_MESSAGE(pp.append_file(entry.path()), pp.errors());
+
+		const std::string effect_name = entry.path().filename().u8string();
+
+		for (const fanout_variant &variant : variants)
+		{
+			const std::string context = effect_name + " (" + variant.to_string() + ")";
+
+			// Generate code for all targets from a single parse
+			std::unique_ptr<reshadefx::codegen> fanout_targets[2];
+			std::vector<reshadefx::codegen *> targets;
+			for (size_t i = 0; i < std::size(fanout_targets); ++i)
+				targets.push_back((fanout_targets[i] = create_target(i, variant)).get());
+
+			const std::unique_ptr<reshadefx::codegen> fanout(reshadefx::create_codegen_fanout(targets));
+			reshadefx::parser fanout_parser;
+			CHECK_MESSAGE(fanout_parser.parse(pp.output(), fanout.get()), context + ": " + fanout_parser.errors());
+
+			// The fan-out itself finalizes code of the first target
+			CHECK_MESSAGE(fanout->finalize_code() == fanout_targets[0]->finalize_code(), context);
+
+			// Every target has to end up with exactly the same code as when it is given a parse of its own
+			for (size_t i = 0; i < std::size(fanout_targets); ++i)
+			{
+				const std::string target_context = context + (i == 0 ? ": HLSL" : ": GLSL");
+
+				const std::unique_ptr<reshadefx::codegen> separate = create_target(i, variant);
+				reshadefx::parser separate_parser;
+				CHECK_MESSAGE(separate_parser.parse(pp.output(), separate.get()), target_context + ": " + separate_parser.errors());
+
+				CHECK_MESSAGE(fanout_targets[i]->finalize_code() == separate->finalize_code(), target_context + ": code differs");
+
+				const std::vector<std::pair<std::string, reshadefx::shader_type>> &entry_points = separate->module().entry_points;
+				CHECK_MESSAGE(fanout_targets[i]->module().entry_points == entry_points, target_context + ": entry points differ");
+
+				for (const std::pair<std::string, reshadefx::shader_type> &entry_point : entry_points)
+				{
+					CHECK_MESSAGE(fanout_targets[i]->finalize_code_for_entry_point(entry_point.first) == separate->finalize_code_for_entry_point(entry_point.first), target_context + ": code for entry point '" + entry_point.first + "' differs");
+
+					if (i == 0)
+						CHECK_MESSAGE(fanout->finalize_code_for_entry_point(entry_point.first) == separate->finalize_code_for_entry_point(entry_point.first), target_context + ": code of the fan-out for entry point '" + entry_point.first + "' differs");
+				}
+			}
+		}
+	}
+
+	CHECK_MESSAGE(effect_count != 0, "no effects found in " + reshadefx::test::effects_path().u8string());
+}
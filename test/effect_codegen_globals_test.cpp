@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "effect_parser.hpp"
+#include "effect_preprocessor.hpp"
+#include "effect_codegen.hpp"
+#include <memory>
+
+static const char s_pruning_effect[] =
+	"struct UnusedStruct { float x; };\n"
+	"struct LocalStruct { float4 c; };\n"
+	"struct GlobalStruct { float v; };\n"
+	"static float unused_global = 3.0;\n"
+	"static float scale_global = 0.5;\n"
+	// Only referenced through the declaration of 'struct_global', never by name from a function
+	"static GlobalStruct struct_global;\n"
+	"texture tex_a { Width = 4; Height = 4; };\n"
+	"sampler samp_a { Texture = tex_a; };\n"
+	// Uses a different sampler state than 'samp_a', so that each gets its own sampler state declaration (only referenced by the sampler block)
+	"texture tex_b { Width = 4; Height = 4; };\n"
+	"sampler samp_b { Texture = tex_b; MinFilter = POINT; MagFilter = POINT; };\n"
+	"float4 vs(uint id : SV_VertexID) : SV_Position { return 0; }\n"
+	"float4 ps_a(float4 pos : SV_Position) : SV_Target\n"
+	"{\n"
+	"	LocalStruct u;\n"
+	"	u.c = tex2D(samp_a, 0.5) * scale_global * struct_global.v;\n"
+	"	return u.c;\n"
+	"}\n"
+	"float4 ps_b(float4 pos : SV_Position) : SV_Target\n"
+	"{\n"
+	"	return tex2D(samp_b, 0.5);\n"
+	"}\n"
+	"technique T\n"
+	"{\n"
+	"	pass { VertexShader = vs; PixelShader = ps_a; }\n"
+	"	pass { VertexShader = vs; PixelShader = ps_b; }\n"
+	"}\n";
+
+static std::string find_entry_point_code(const reshadefx::codegen &backend, const std::string &name)
+{
+	for (const std::pair<std::string, reshadefx::shader_type> &entry_point : backend.module().entry_points)
+		if (entry_point.first.find(name) != std::string::npos)
+			return backend.finalize_code_for_entry_point(entry_point.first);
+	return std::string();
+}
+
+static bool contains(const std::string &code, const char *text)
+{
+	return code.find(text) != std::string::npos;
+}
+
+static void check_pruned_global_block(reshadefx::codegen *backend)
+{
+	reshadefx::preprocessor pp;
+	CHECK(pp.append_string(s_pruning_effect, "pruning.fx"));
+	reshadefx::parser parser;
+	CHECK_MESSAGE(parser.parse(pp.output(), backend), parser.errors());
+
+	const std::string ps_a = find_entry_point_code(*backend, "ps_a");
+	const std::string ps_b = find_entry_point_code(*backend, "ps_b");
+	CHECK(!ps_a.empty() && !ps_b.empty());
+
+	// Declarations no entry point references are dropped
+	CHECK_MESSAGE(!contains(ps_a, "UnusedStruct") && !contains(ps_a, "unused_global"), ps_a);
+	CHECK_MESSAGE(!contains(ps_b, "UnusedStruct") && !contains(ps_b, "unused_global"), ps_b);
+
+	// Declarations referenced directly, or only through the declaration of another global, are kept
+	CHECK_MESSAGE(contains(ps_a, "LocalStruct") && contains(ps_a, "scale_global") && contains(ps_a, "struct_global"), ps_a);
+	CHECK_MESSAGE(contains(ps_a, "GlobalStruct"), ps_a);
+
+	// Declarations of the other entry point are dropped
+	CHECK_MESSAGE(!contains(ps_b, "LocalStruct") && !contains(ps_b, "GlobalStruct") && !contains(ps_b, "scale_global"), ps_b);
+	CHECK_MESSAGE(!contains(ps_a, "samp_b") && !contains(ps_b, "samp_a"), ps_a + ps_b);
+}
+
+TEST_CASE(codegen_hlsl_drops_unreferenced_global_declarations)
+{
+	std::unique_ptr<reshadefx::codegen> backend(reshadefx::create_codegen_hlsl(50, false, false));
+	check_pruned_global_block(backend.get());
+
+	// Sampler state declarations are only referenced through the sampler blocks
+	const std::string ps_a = find_entry_point_code(*backend, "ps_a");
+	const std::string ps_b = find_entry_point_code(*backend, "ps_b");
+	CHECK_MESSAGE(contains(ps_a, "SamplerState __s0") && !contains(ps_a, "__s1"), ps_a);
+	CHECK_MESSAGE(contains(ps_b, "SamplerState __s1") && !contains(ps_b, "__s0"), ps_b);
+}
+
+TEST_CASE(codegen_glsl_drops_unreferenced_global_declarations)
+{
+	std::unique_ptr<reshadefx::codegen> backend(reshadefx::create_codegen_glsl(false, false, false));
+	check_pruned_global_block(backend.get());
+
+	// Struct globals are initialized with a separate global declaration, which is only referenced by that initializer
+	const std::string ps_a = find_entry_point_code(*backend, "ps_a");
+	const size_t initializer_offset = ps_a.find("struct_global = ");
+	CHECK_MESSAGE(initializer_offset != std::string::npos, ps_a);
+	if (initializer_offset != std::string::npos)
+	{
+		const size_t value_offset = initializer_offset + 16;
+		const std::string value = ps_a.substr(value_offset, ps_a.find(';', value_offset) - value_offset);
+		CHECK_MESSAGE(contains(ps_a, ("GlobalStruct " + value + ';').c_str()), ps_a);
+	}
+}
@@ -0,0 +1,1945 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "effect_parser.hpp"
+#include "effect_preprocessor.hpp"
+#include "effect_codegen_optimizer.hpp"
+#include <cmath>
+#include <cassert>
+#include <cstring> // std::memcpy
+#include <deque>
+#include <limits>
+#include <functional>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <unordered_set>
+
+using namespace reshadefx;
+
+// Names of all intrinsics, indexed by the intrinsic ID the parser passes to 'emit_call_intrinsic'
+static const char *const s_intrinsic_names[] = {
+#define IMPLEMENT_INTRINSIC_SPIRV(name, i, code) #name,
+	#include "effect_symbol_table_intrinsics.inl"
+};
+
+static float as_float(uint32_t bits)
+{
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+static uint32_t as_bits(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static uint32_t hash(uint32_t seed, const std::string &data)
+{
+	uint32_t hash = 2166136261u ^ seed;
+	for (const char c : data)
+		hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+	hash ^= hash >> 15;
+	hash *= 0x2c1b3c6du;
+	hash ^= hash >> 12;
+	return hash;
+}
+
+/// <summary>
+/// Code generation back-end that does not generate any code, but instead records the operations it is given, so that functions can be executed afterwards.
+/// Used to compare the results of code generated with and without the optimization layer, since only the shape of the operations passed to a back-end changes between the two.
+/// </summary>
+class codegen_interpreter : public codegen
+{
+public:
+	/// <summary>
+	/// How loads are evaluated, which differs between back-ends.
+	/// </summary>
+	enum class load_semantics
+	{
+		// Loads with an access chain are instanced in code every time they are used and only array constants are reused (like in the HLSL and GLSL back-ends)
+		lazy,
+		// L-value loads copy the current value and all constants are reused (like in the SPIR-V back-end)
+		snapshot,
+	};
+
+	struct value
+	{
+		reshadefx::type type = {};
+		std::vector<uint32_t> data;
+	};
+
+	struct result
+	{
+		// Return value, followed by the final value of all parameters and global variables
+		std::vector<std::pair<std::string, value>> outputs;
+		std::map<std::string, value> storage;
+		bool killed = false;
+		size_t executed_operations = 0;
+		std::string error;
+	};
+
+	explicit codegen_interpreter(load_semantics semantics) : _semantics(semantics) {}
+
+	std::basic_string<char> finalize_code() const override { return std::string(); }
+	std::basic_string<char> finalize_code_for_entry_point(const std::string &) const override { return std::string(); }
+
+	/// <summary>
+	/// Gets the unique names of all functions that can be executed with generated arguments.
+	/// </summary>
+	std::vector<std::string> testable_functions() const
+	{
+		std::vector<std::string> names;
+		for (const std::unique_ptr<function> &func : _functions)
+			if (std::find_if(func->parameter_list.begin(), func->parameter_list.end(),
+					[](const member_type &param) { return param.type.is_object() || param.type.is_unbounded_array(); }) == func->parameter_list.end())
+				names.push_back(func->unique_name);
+		return names;
+	}
+
+	/// <summary>
+	/// Executes the global initializers and then the specified function with arguments, uniform values and texture contents derived from the specified seed.
+	/// </summary>
+	result invoke(const std::string &unique_name, uint32_t seed)
+	{
+		execution e;
+		e.seed = seed;
+		e.frames.emplace_back();
+
+		run(e, _blocks[0]);
+
+		const function *const func = find_function(unique_name);
+		frame callee;
+		for (size_t i = 0; i < func->parameter_list.size(); ++i)
+		{
+			const member_type &param = func->parameter_list[i];
+
+			value arg = { param.type, std::vector<uint32_t>(size_of(param.type)) };
+			if (!param.type.has(type::q_out) || param.type.has(type::q_in))
+				generate(seed, "param" + std::to_string(i), arg);
+
+			e.memory.push_back(std::move(arg));
+			callee.variables[param.id] = e.memory.size() - 1;
+		}
+
+		result res;
+
+		if (e.error.empty())
+		{
+			e.frames.push_back(std::move(callee));
+			run(e, _function_bodies[func->id]);
+
+			if (!func->return_type.is_void() && !e.killed)
+				res.outputs.emplace_back("return", e.frames.back().return_value);
+			for (size_t i = 0; i < func->parameter_list.size(); ++i)
+				res.outputs.emplace_back(func->parameter_list[i].name, e.memory[e.frames.back().variables[func->parameter_list[i].id]]);
+		}
+
+		// Global variables are sorted by name, since IDs differ between code generated with and without the optimizer
+		const size_t first_global = res.outputs.size();
+		for (const auto &[variable, cell] : e.frames.front().variables)
+			if (const auto it = _variable_names.find(variable); it != _variable_names.end())
+				res.outputs.emplace_back(it->second, e.memory[cell]);
+		std::sort(res.outputs.begin() + first_global, res.outputs.end(),
+			[](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+
+		res.storage = std::move(e.storage);
+		res.killed = e.killed;
+		res.executed_operations = e.operations;
+		res.error = std::move(e.error);
+
+		return res;
+	}
+
+	/// <summary>
+	/// Fills a value with deterministic data derived from a seed and a name, with small numbers so that integer arithmetic does not overflow and loops stay short.
+	/// </summary>
+	void generate(uint32_t seed, const std::string &name, value &val) const
+	{
+		std::vector<type::datatype> bases;
+		component_bases(val.type, bases);
+
+		for (size_t i = 0; i < val.data.size(); ++i)
+		{
+			const uint32_t h = hash(seed * 7919u + static_cast<uint32_t>(i), name);
+			switch (bases[i])
+			{
+			case type::t_bool:
+				val.data[i] = h & 1;
+				break;
+			case type::t_min16int:
+			case type::t_int:
+				val.data[i] = static_cast<uint32_t>(static_cast<int32_t>(h % 17) - 8);
+				break;
+			case type::t_min16uint:
+			case type::t_uint:
+				val.data[i] = h % 17;
+				break;
+			default:
+				val.data[i] = as_bits(static_cast<float>(static_cast<int32_t>(h % 65) - 32) / 16.0f);
+				break;
+			}
+		}
+	}
+
+	void component_bases(const type &data_type, std::vector<type::datatype> &bases) const
+	{
+		for (uint32_t element = 0; element < std::max(1u, data_type.is_bounded_array() ? data_type.array_length : 1u); ++element)
+		{
+			if (data_type.is_struct())
+				for (const member_type &member : get_struct(data_type.struct_definition).member_list)
+					component_bases(member.type, bases);
+			else
+				bases.insert(bases.end(), data_type.is_numeric() ? data_type.components() : 1, data_type.base);
+		}
+	}
+
+private:
+	enum class control_flow
+	{
+		none,
+		break_loop,
+		continue_loop,
+		return_function,
+		kill,
+	};
+
+	struct frame
+	{
+		std::unordered_map<id, size_t> variables;
+		std::unordered_map<id, value> values;
+		control_flow flow = control_flow::none;
+		value return_value;
+	};
+
+	struct execution
+	{
+		uint32_t seed = 0;
+		std::deque<value> memory;
+		std::vector<frame> frames;
+		std::map<std::string, value> storage;
+		bool killed = false;
+		size_t operations = 0;
+		std::string error;
+	};
+
+	using instruction = std::function<void(execution &)>;
+
+	struct reference
+	{
+		id base;
+		std::vector<expression::operation> chain;
+	};
+
+	static void fail(execution &e, const std::string &message)
+	{
+		if (e.error.empty())
+			e.error = message;
+	}
+
+	uint32_t size_of(const type &data_type) const
+	{
+		uint32_t size = 1;
+		if (data_type.is_struct())
+		{
+			size = 0;
+			for (const member_type &member : get_struct(data_type.struct_definition).member_list)
+				size += size_of(member.type);
+		}
+		else if (data_type.is_numeric())
+		{
+			size = data_type.components();
+		}
+
+		if (data_type.is_bounded_array())
+			size *= data_type.array_length;
+
+		return size;
+	}
+
+	void append(instruction &&instruction)
+	{
+		// Code after a return or discard statement is unreachable
+		if (_current_function != nullptr && !is_in_block())
+			return;
+
+		_blocks[_current_block].push_back(std::move(instruction));
+	}
+	std::vector<instruction> take_block(id block)
+	{
+		std::vector<instruction> code = std::move(_blocks[block]);
+		_blocks.erase(block);
+		return code;
+	}
+
+	void run(execution &e, const std::vector<instruction> &code)
+	{
+		for (const instruction &instruction : code)
+		{
+			if (e.frames.back().flow != control_flow::none || e.killed || !e.error.empty())
+				return;
+			if (++e.operations > 1000000)
+				return fail(e, "operation limit exceeded");
+
+			instruction(e);
+		}
+	}
+	bool is_running(const execution &e) const
+	{
+		return e.frames.back().flow == control_flow::none && !e.killed && e.error.empty();
+	}
+
+	size_t *find_variable(execution &e, id id)
+	{
+		if (const auto it = e.frames.back().variables.find(id); it != e.frames.back().variables.end())
+			return &it->second;
+		if (const auto it = e.frames.front().variables.find(id); it != e.frames.front().variables.end())
+			return &it->second;
+		return nullptr;
+	}
+
+	value read(execution &e, id id)
+	{
+		if (const size_t *const cell = find_variable(e, id))
+			return e.memory[*cell];
+		if (const auto it = e.frames.back().values.find(id); it != e.frames.back().values.end())
+			return it->second;
+		if (const auto it = e.frames.front().values.find(id); it != e.frames.front().values.end())
+			return it->second;
+		if (const auto it = _constants.find(id); it != _constants.end())
+			return it->second;
+
+		if (const auto it = _references.find(id); it != _references.end())
+			return load(e, it->second.base, it->second.chain);
+
+		if (const auto it = _uniforms.find(id); it != _uniforms.end())
+		{
+			value val = { it->second.type, std::vector<uint32_t>(size_of(it->second.type)) };
+			generate(e.seed, it->second.name, val);
+			return val;
+		}
+		if (const auto it = _objects.find(id); it != _objects.end())
+			return { it->second, { id } };
+
+		fail(e, "read of unknown ID " + std::to_string(id));
+		return {};
+	}
+	value load(execution &e, id base, const std::vector<expression::operation> &chain)
+	{
+		value val = read(e, base);
+		for (const expression::operation &op : chain)
+		{
+			if (op.op == expression::operation::op_cast)
+				val.data = cast(val.data, op.from, op.to);
+			else
+				val.data = select(e, val.data, op);
+			val.type = op.to;
+		}
+		return val;
+	}
+	void bind(execution &e, id id, value &&val)
+	{
+		e.frames.back().values[id] = std::move(val);
+	}
+
+	/// <summary>
+	/// Resolves an l-value to the memory cell and the components in it that it refers to.
+	/// </summary>
+	bool resolve(execution &e, id id, const std::vector<expression::operation> &chain, size_t &cell, std::vector<uint32_t> &components)
+	{
+		if (const auto it = _references.find(id); it != _references.end())
+		{
+			if (!resolve(e, it->second.base, it->second.chain, cell, components))
+				return false;
+		}
+		else if (const size_t *const variable = find_variable(e, id))
+		{
+			cell = *variable;
+			components.resize(e.memory[cell].data.size());
+			for (uint32_t i = 0; i < components.size(); ++i)
+				components[i] = i;
+		}
+		else
+		{
+			fail(e, "access to ID " + std::to_string(id) + " that is not a variable");
+			return false;
+		}
+
+		for (const expression::operation &op : chain)
+		{
+			if (op.op == expression::operation::op_cast)
+			{
+				fail(e, "cast in l-value access chain");
+				return false;
+			}
+
+			components = select(e, components, op);
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Applies a member, index or swizzle operation to the flattened components of a value.
+	/// </summary>
+	std::vector<uint32_t> select(execution &e, const std::vector<uint32_t> &words, const expression::operation &op)
+	{
+		std::vector<uint32_t> result;
+
+		switch (op.op)
+		{
+		case expression::operation::op_member:
+		{
+			uint32_t offset = 0;
+			const std::vector<member_type> &members = get_struct(op.from.struct_definition).member_list;
+			for (uint32_t i = 0; i < op.index; ++i)
+				offset += size_of(members[i].type);
+			result.assign(words.begin() + offset, words.begin() + offset + size_of(op.to));
+			break;
+		}
+		case expression::operation::op_dynamic_index:
+		case expression::operation::op_constant_index:
+		{
+			// Each index operation selects a slice of the size of the resulting type, which works the same for array elements, matrix rows and vector components
+			const uint32_t size = size_of(op.to);
+			const uint32_t count = static_cast<uint32_t>(words.size()) / size;
+
+			int32_t index = static_cast<int32_t>(op.index);
+			if (op.op == expression::operation::op_dynamic_index)
+			{
+				const value index_value = read(e, op.index);
+				index = index_value.data.empty() ? 0 : static_cast<int32_t>(index_value.data[0]);
+			}
+			// Out of bounds accesses are undefined, but need to be deterministic here
+			index = std::min(std::max(index, 0), static_cast<int32_t>(count) - 1);
+
+			result.assign(words.begin() + index * size, words.begin() + (index + 1) * size);
+			break;
+		}
+		case expression::operation::op_swizzle:
+			for (int i = 0; i < 4 && op.swizzle[i] >= 0; ++i)
+				result.push_back(words[op.from.is_matrix() ? (op.swizzle[i] / 4) * op.from.cols + (op.swizzle[i] % 4) : op.swizzle[i]]);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+
+		return result;
+	}
+
+	static uint32_t convert(uint32_t word, type::datatype from, type::datatype to)
+	{
+		const type from_type = { from, 1, 1 };
+		const type to_type = { to, 1, 1 };
+
+		if (to_type.is_boolean())
+			return from_type.is_floating_point() ? as_float(word) != 0.0f : word != 0;
+
+		if (to_type.is_floating_point())
+		{
+			if (from_type.is_floating_point())
+				return word;
+			if (from_type.is_signed())
+				return as_bits(static_cast<float>(static_cast<int32_t>(word)));
+			return as_bits(static_cast<float>(word));
+		}
+
+		if (from_type.is_floating_point())
+		{
+			// Float to integer conversion of values that are not representable is undefined
+			const float value = as_float(word);
+			if (!(value > -2147483648.0f && value < 2147483648.0f))
+				return 0;
+			return static_cast<uint32_t>(static_cast<int32_t>(value));
+		}
+
+		return word;
+	}
+	static std::vector<uint32_t> cast(const std::vector<uint32_t> &words, const type &from, const type &to)
+	{
+		std::vector<uint32_t> result(to.components());
+		for (uint32_t i = 0; i < result.size(); ++i)
+		{
+			uint32_t source = i;
+			if (words.size() == 1)
+				source = 0;
+			else if (from.is_matrix() && to.is_matrix())
+				source = (i / to.cols) * from.cols + (i % to.cols); // Truncation of a matrix keeps the upper left part
+
+			result[i] = convert(source < words.size() ? words[source] : 0, from.base, to.base);
+		}
+		return result;
+	}
+
+	static uint32_t binary(execution &e, tokenid op, const type &operand_type, uint32_t lhs, uint32_t rhs)
+	{
+		// Increments and compound assignments are passed on with their own operator
+		switch (op)
+		{
+		case tokenid::percent_equal: op = tokenid::percent; break;
+		case tokenid::ampersand_equal: op = tokenid::ampersand; break;
+		case tokenid::star_equal: op = tokenid::star; break;
+		case tokenid::plus_plus:
+		case tokenid::plus_equal: op = tokenid::plus; break;
+		case tokenid::minus_minus:
+		case tokenid::minus_equal: op = tokenid::minus; break;
+		case tokenid::slash_equal: op = tokenid::slash; break;
+		case tokenid::less_less_equal: op = tokenid::less_less; break;
+		case tokenid::greater_greater_equal: op = tokenid::greater_greater; break;
+		case tokenid::caret_equal: op = tokenid::caret; break;
+		case tokenid::pipe_equal: op = tokenid::pipe; break;
+		default: break;
+		}
+
+		if (operand_type.is_floating_point())
+		{
+			const float x = as_float(lhs), y = as_float(rhs);
+			switch (op)
+			{
+			case tokenid::plus:
+				return as_bits(x + y);
+			case tokenid::minus:
+				return as_bits(x - y);
+			case tokenid::star:
+				return as_bits(x * y);
+			case tokenid::slash:
+				return as_bits(x / y);
+			case tokenid::percent:
+				return as_bits(std::fmod(x, y));
+			case tokenid::less:
+				return x < y;
+			case tokenid::less_equal:
+				return x <= y;
+			case tokenid::greater:
+				return x > y;
+			case tokenid::greater_equal:
+				return x >= y;
+			case tokenid::equal_equal:
+				return x == y;
+			case tokenid::exclaim_equal:
+				return x != y;
+			case tokenid::ampersand_ampersand:
+				return x != 0.0f && y != 0.0f;
+			case tokenid::pipe_pipe:
+				return x != 0.0f || y != 0.0f;
+			default:
+				break;
+			}
+		}
+		else
+		{
+			const bool is_signed = operand_type.is_signed();
+			const int32_t x = static_cast<int32_t>(lhs), y = static_cast<int32_t>(rhs);
+			switch (op)
+			{
+			case tokenid::plus:
+				return lhs + rhs;
+			case tokenid::minus:
+				return lhs - rhs;
+			case tokenid::star:
+				return lhs * rhs;
+			case tokenid::slash:
+				// Integer division by zero is undefined, but needs to be deterministic here
+				if (rhs == 0 || (is_signed && x == INT32_MIN && y == -1))
+					return 0xFFFFFFFF;
+				return is_signed ? static_cast<uint32_t>(x / y) : lhs / rhs;
+			case tokenid::percent:
+				if (rhs == 0 || (is_signed && x == INT32_MIN && y == -1))
+					return 0xFFFFFFFF;
+				return is_signed ? static_cast<uint32_t>(x % y) : lhs % rhs;
+			case tokenid::ampersand:
+				return lhs & rhs;
+			case tokenid::pipe:
+				return lhs | rhs;
+			case tokenid::caret:
+				return lhs ^ rhs;
+			case tokenid::less_less:
+				return lhs << (rhs & 31);
+			case tokenid::greater_greater:
+				return is_signed ? static_cast<uint32_t>(x >> (rhs & 31)) : lhs >> (rhs & 31);
+			case tokenid::less:
+				return is_signed ? x < y : lhs < rhs;
+			case tokenid::less_equal:
+				return is_signed ? x <= y : lhs <= rhs;
+			case tokenid::greater:
+				return is_signed ? x > y : lhs > rhs;
+			case tokenid::greater_equal:
+				return is_signed ? x >= y : lhs >= rhs;
+			case tokenid::equal_equal:
+				return lhs == rhs;
+			case tokenid::exclaim_equal:
+				return lhs != rhs;
+			case tokenid::ampersand_ampersand:
+				return lhs != 0 && rhs != 0;
+			case tokenid::pipe_pipe:
+				return lhs != 0 || rhs != 0;
+			default:
+				break;
+			}
+		}
+
+		fail(e, "unsupported binary operator " + token::id_to_name(op));
+		return 0;
+	}
+
+	static bool is_true(const value &val)
+	{
+		return !val.data.empty() && (val.type.is_floating_point() ? as_float(val.data[0]) != 0.0f : val.data[0] != 0);
+	}
+
+	float texel(const std::string &texture_name, const float coords[3], float lod, uint32_t channel) const
+	{
+		// Smooth function of the coordinates, so that the result of sampling is only slightly affected by rounding differences in the coordinates
+		const uint32_t h = hash(channel, texture_name);
+		return 0.5f + 0.5f * std::sin(coords[0] * (1 + h % 7) + coords[1] * (1 + (h >> 3) % 5) + coords[2] * 2.0f + lod * 0.25f + (h % 101) * 0.1f);
+	}
+	static uint32_t encode(float value, const type &data_type)
+	{
+		if (data_type.is_floating_point())
+			return as_bits(value);
+		if (data_type.is_boolean())
+			return value > 0.5f;
+		return static_cast<uint32_t>(static_cast<int32_t>(value * 255.0f));
+	}
+
+	const texture &texture_of(const value &object)
+	{
+		const std::string &texture_name = object.type.is_sampler() ? get_sampler(object.data[0]).texture_name : get_storage(object.data[0]).texture_name;
+		return *std::find_if(_module.textures.begin(), _module.textures.end(),
+			[&texture_name](const texture &info) { return info.unique_name == texture_name; });
+	}
+	value &storage_texel(execution &e, const value &object, const value &coords, const type &texel_type)
+	{
+		const texture &tex = texture_of(object);
+		const uint16_t level = get_storage(object.data[0]).level;
+
+		std::string key = tex.unique_name + '[' + std::to_string(level) + ']';
+		float position[3] = {};
+		for (size_t i = 0; i < coords.data.size(); ++i)
+		{
+			key += ',' + std::to_string(static_cast<int32_t>(coords.data[i]));
+			position[i] = static_cast<float>(static_cast<int32_t>(coords.data[i]));
+		}
+
+		const auto it = e.storage.find(key);
+		if (it != e.storage.end())
+			return it->second;
+
+		// Initial contents of the texture
+		value &texel_value = e.storage[key];
+		texel_value.type = texel_type;
+		for (uint32_t c = 0; c < texel_type.components(); ++c)
+			texel_value.data.push_back(encode(texel(tex.unique_name, position, level, c), texel_type));
+		return texel_value;
+	}
+
+	value call_intrinsic(execution &e, const std::string &name, const type &res_type, const std::vector<expression> &args)
+	{
+		std::vector<value> a;
+		for (const expression &arg : args)
+			a.push_back(read(e, arg.base));
+
+		value r = { res_type, std::vector<uint32_t>(res_type.is_void() ? 0 : size_of(res_type)) };
+
+		// Gets a component of an argument as float, broadcasting scalars
+		const auto f = [&a](size_t arg, size_t i) {
+			return as_float(a[arg].data[a[arg].data.size() == 1 ? 0 : i]);
+		};
+		const auto u = [&a](size_t arg, size_t i) {
+			return a[arg].data[a[arg].data.size() == 1 ? 0 : i];
+		};
+		const auto store_out = [this, &e, &args](size_t arg, const std::vector<uint32_t> &data) {
+			size_t cell = 0;
+			std::vector<uint32_t> components;
+			if (resolve(e, args[arg].base, {}, cell, components))
+				for (size_t i = 0; i < components.size() && i < data.size(); ++i)
+					e.memory[cell].data[components[i]] = data[i];
+		};
+
+		static const std::unordered_map<std::string, float(*)(float)> s_float_functions = {
+			{ "sin", [](float x) { return std::sin(x); } },
+			{ "cos", [](float x) { return std::cos(x); } },
+			{ "tan", [](float x) { return std::tan(x); } },
+			{ "asin", [](float x) { return std::asin(x); } },
+			{ "acos", [](float x) { return std::acos(x); } },
+			{ "atan", [](float x) { return std::atan(x); } },
+			{ "sinh", [](float x) { return std::sinh(x); } },
+			{ "cosh", [](float x) { return std::cosh(x); } },
+			{ "tanh", [](float x) { return std::tanh(x); } },
+			{ "exp", [](float x) { return std::exp(x); } },
+			{ "exp2", [](float x) { return std::exp2(x); } },
+			{ "log", [](float x) { return std::log(x); } },
+			{ "log2", [](float x) { return std::log2(x); } },
+			{ "log10", [](float x) { return std::log10(x); } },
+			{ "sqrt", [](float x) { return std::sqrt(x); } },
+			{ "rsqrt", [](float x) { return 1.0f / std::sqrt(x); } },
+			{ "rcp", [](float x) { return 1.0f / x; } },
+			{ "ceil", [](float x) { return std::ceil(x); } },
+			{ "floor", [](float x) { return std::floor(x); } },
+			{ "frac", [](float x) { return x - std::floor(x); } },
+			{ "trunc", [](float x) { return std::trunc(x); } },
+			{ "round", [](float x) { return std::nearbyint(x); } },
+			{ "saturate", [](float x) { return std::min(std::max(x, 0.0f), 1.0f); } },
+			{ "degrees", [](float x) { return x * 57.29577951f; } },
+			{ "radians", [](float x) { return x * 0.01745329252f; } },
+			// Derivatives are zero, since there are no neighboring invocations
+			{ "ddx", [](float) { return 0.0f; } },
+			{ "ddx_coarse", [](float) { return 0.0f; } },
+			{ "ddx_fine", [](float) { return 0.0f; } },
+			{ "ddy", [](float) { return 0.0f; } },
+			{ "ddy_coarse", [](float) { return 0.0f; } },
+			{ "ddy_fine", [](float) { return 0.0f; } },
+			{ "fwidth", [](float) { return 0.0f; } },
+		};
+		static const std::unordered_map<std::string, float(*)(float, float)> s_float_functions2 = {
+			{ "atan2", [](float y, float x) { return std::atan2(y, x); } },
+			{ "pow", [](float x, float y) { return std::pow(x, y); } },
+			{ "step", [](float y, float x) { return x >= y ? 1.0f : 0.0f; } },
+			{ "ldexp", [](float x, float exp) { return x * std::exp2(exp); } },
+		};
+
+		if (const auto it = s_float_functions.find(name); it != s_float_functions.end())
+		{
+			for (size_t i = 0; i < r.data.size(); ++i)
+				r.data[i] = as_bits(it->second(f(0, i)));
+		}
+		else if (const auto it2 = s_float_functions2.find(name); it2 != s_float_functions2.end())
+		{
+			for (size_t i = 0; i < r.data.size(); ++i)
+				r.data[i] = as_bits(it2->second(f(0, i), f(1, i)));
+		}
+		else if (name == "abs" || name == "sign" || name == "min" || name == "max" || name == "clamp")
+		{
+			const bool is_float = a[0].type.is_floating_point();
+			const bool is_signed = a[0].type.is_signed();
+			// Compares two components, returning negative, zero or positive
+			const auto compare = [&](uint32_t x, uint32_t y) {
+				if (is_float)
+					return as_float(x) < as_float(y) ? -1 : as_float(x) > as_float(y) ? 1 : 0;
+				if (is_signed)
+					return static_cast<int32_t>(x) < static_cast<int32_t>(y) ? -1 : static_cast<int32_t>(x) > static_cast<int32_t>(y) ? 1 : 0;
+				return x < y ? -1 : x > y ? 1 : 0;
+			};
+			const uint32_t zero = is_float ? as_bits(0.0f) : 0;
+
+			for (size_t i = 0; i < r.data.size(); ++i)
+			{
+				if (name == "abs")
+					r.data[i] = is_float ? as_bits(std::abs(f(0, i))) : compare(u(0, i), zero) < 0 ? 0 - u(0, i) : u(0, i);
+				else if (name == "sign")
+					r.data[i] = res_type.is_floating_point() ? as_bits(static_cast<float>(compare(u(0, i), zero))) : static_cast<uint32_t>(compare(u(0, i), zero));
+				else if (name == "min")
+					r.data[i] = compare(u(0, i), u(1, i)) <= 0 ? u(0, i) : u(1, i);
+				else if (name == "max")
+					r.data[i] = compare(u(0, i), u(1, i)) >= 0 ? u(0, i) : u(1, i);
+				else
+				{
+					const uint32_t lower = compare(u(0, i), u(1, i)) >= 0 ? u(0, i) : u(1, i);
+					r.data[i] = compare(lower, u(2, i)) <= 0 ? lower : u(2, i);
+				}
+			}
+		}
+		else if (name == "lerp" || name == "mad" || name == "smoothstep")
+		{
+			for (size_t i = 0; i < r.data.size(); ++i)
+			{
+				const float x = f(0, i), y = f(1, i), s = f(2, i);
+				if (name == "lerp")
+					r.data[i] = as_bits(x + s * (y - x));
+				else if (name == "mad")
+					r.data[i] = as_bits(x * y + s);
+				else
+				{
+					const float t = std::min(std::max((s - x) / (y - x), 0.0f), 1.0f);
+					r.data[i] = as_bits(t * t * (3.0f - 2.0f * t));
+				}
+			}
+		}
+		else if (name == "all" || name == "any")
+		{
+			bool all = true, any = false;
+			for (size_t i = 0; i < a[0].data.size(); ++i)
+			{
+				const bool component = a[0].type.is_floating_point() ? f(0, i) != 0.0f : u(0, i) != 0;
+				all &= component;
+				any |= component;
+			}
+			r.data[0] = name == "all" ? all : any;
+		}
+		else if (name == "dot" || name == "length" || name == "distance" || name == "normalize" || name == "reflect" || name == "refract" || name == "faceforward")
+		{
+			const auto dot = [&](size_t lhs, size_t rhs) {
+				float sum = 0.0f;
+				for (size_t i = 0; i < a[lhs].data.size(); ++i)
+					sum += f(lhs, i) * f(rhs, i);
+				return sum;
+			};
+
+			if (name == "dot")
+			{
+				if (a[0].type.is_floating_point())
+					r.data[0] = as_bits(dot(0, 1));
+				else
+					for (size_t i = 0; i < a[0].data.size(); ++i)
+						r.data[0] += u(0, i) * u(1, i);
+			}
+			else if (name == "length")
+				r.data[0] = as_bits(std::sqrt(dot(0, 0)));
+			else if (name == "distance")
+			{
+				float sum = 0.0f;
+				for (size_t i = 0; i < a[0].data.size(); ++i)
+					sum += (f(0, i) - f(1, i)) * (f(0, i) - f(1, i));
+				r.data[0] = as_bits(std::sqrt(sum));
+			}
+			else if (name == "normalize")
+			{
+				const float length = std::sqrt(dot(0, 0));
+				for (size_t i = 0; i < r.data.size(); ++i)
+					r.data[i] = as_bits(f(0, i) / length);
+			}
+			else if (name == "reflect")
+			{
+				const float d = dot(1, 0);
+				for (size_t i = 0; i < r.data.size(); ++i)
+					r.data[i] = as_bits(f(0, i) - 2.0f * d * f(1, i));
+			}
+			else if (name == "refract")
+			{
+				const float d = dot(1, 0), eta = f(2, 0);
+				const float k = 1.0f - eta * eta * (1.0f - d * d);
+				for (size_t i = 0; i < r.data.size(); ++i)
+					r.data[i] = as_bits(k < 0.0f ? 0.0f : eta * f(0, i) - (eta * d + std::sqrt(k)) * f(1, i));
+			}
+			else
+			{
+				const float d = dot(1, 2);
+				for (size_t i = 0; i < r.data.size(); ++i)
+					r.data[i] = as_bits(d < 0.0f ? f(0, i) : -f(0, i));
+			}
+		}
+		else if (name == "cross")
+		{
+			r.data[0] = as_bits(f(0, 1) * f(1, 2) - f(0, 2) * f(1, 1));
+			r.data[1] = as_bits(f(0, 2) * f(1, 0) - f(0, 0) * f(1, 2));
+			r.data[2] = as_bits(f(0, 0) * f(1, 1) - f(0, 1) * f(1, 0));
+		}
+		else if (name == "mul")
+		{
+			const type &lhs = a[0].type, &rhs = a[1].type;
+			const auto multiply_add = [&](uint32_t sum, uint32_t x, uint32_t y) {
+				return res_type.is_floating_point() ? as_bits(as_float(sum) + as_float(x) * as_float(y)) : sum + x * y;
+			};
+
+			if (lhs.is_scalar() || rhs.is_scalar())
+			{
+				for (size_t i = 0; i < r.data.size(); ++i)
+					r.data[i] = multiply_add(0, u(0, i), u(1, i));
+			}
+			else if (lhs.is_vector() && rhs.is_matrix())
+			{
+				for (uint32_t c = 0; c < rhs.cols; ++c)
+					for (uint32_t k = 0; k < rhs.rows; ++k)
+						r.data[c] = multiply_add(r.data[c], a[0].data[k], a[1].data[k * rhs.cols + c]);
+			}
+			else if (lhs.is_matrix() && rhs.is_vector())
+			{
+				for (uint32_t row = 0; row < lhs.rows; ++row)
+					for (uint32_t k = 0; k < lhs.cols; ++k)
+						r.data[row] = multiply_add(r.data[row], a[0].data[row * lhs.cols + k], a[1].data[k]);
+			}
+			else
+			{
+				for (uint32_t row = 0; row < lhs.rows; ++row)
+					for (uint32_t c = 0; c < rhs.cols; ++c)
+						for (uint32_t k = 0; k < lhs.cols; ++k)
+							r.data[row * rhs.cols + c] = multiply_add(r.data[row * rhs.cols + c], a[0].data[row * lhs.cols + k], a[1].data[k * rhs.cols + c]);
+			}
+		}
+		else if (name == "transpose")
+		{
+			for (uint32_t row = 0; row < a[0].type.rows; ++row)
+				for (uint32_t c = 0; c < a[0].type.cols; ++c)
+					r.data[c * a[0].type.rows + row] = a[0].data[row * a[0].type.cols + c];
+		}
+		else if (name == "determinant")
+		{
+			const std::function<float(const std::vector<float> &, uint32_t)> determinant = [&determinant](const std::vector<float> &m, uint32_t n) {
+				if (n == 1)
+					return m[0];
+				float sum = 0.0f;
+				for (uint32_t k = 0; k < n; ++k)
+				{
+					std::vector<float> minor;
+					for (uint32_t row = 1; row < n; ++row)
+						for (uint32_t c = 0; c < n; ++c)
+							if (c != k)
+								minor.push_back(m[row * n + c]);
+					sum += (k % 2 == 0 ? 1.0f : -1.0f) * m[k] * determinant(minor, n - 1);
+				}
+				return sum;
+			};
+
+			std::vector<float> m;
+			for (size_t i = 0; i < a[0].data.size(); ++i)
+				m.push_back(f(0, i));
+			r.data[0] = as_bits(determinant(m, a[0].type.rows));
+		}
+		else if (name == "isinf" || name == "isnan")
+		{
+			for (size_t i = 0; i < r.data.size(); ++i)
+				r.data[i] = name == "isinf" ? std::isinf(f(0, i)) : std::isnan(f(0, i));
+		}
+		else if (name == "asint" || name == "asuint" || name == "asfloat")
+		{
+			r.data = a[0].data;
+		}
+		else if (name == "countbits" || name == "reversebits" || name == "firstbitlow" || name == "firstbithigh")
+		{
+			for (size_t i = 0; i < r.data.size(); ++i)
+			{
+				uint32_t x = u(0, i), result = 0;
+				if (name == "countbits")
+					for (; x != 0; x &= x - 1)
+						++result;
+				else if (name == "reversebits")
+					for (int bit = 0; bit < 32; ++bit)
+						result |= ((x >> bit) & 1) << (31 - bit);
+				else if (name == "firstbitlow")
+				{
+					result = 0xFFFFFFFF;
+					for (uint32_t bit = 0; bit < 32 && result == 0xFFFFFFFF; ++bit)
+						if (x & (1u << bit))
+							result = bit;
+				}
+				else
+				{
+					// For negative signed integers this finds the first zero bit instead
+					if (a[0].type.is_signed() && static_cast<int32_t>(x) < 0)
+						x = ~x;
+					result = 0xFFFFFFFF;
+					for (int bit = 31; bit >= 0 && result == 0xFFFFFFFF; --bit)
+						if (x & (1u << bit))
+							result = bit;
+				}
+				r.data[i] = result;
+			}
+		}
+		else if (name == "sincos")
+		{
+			std::vector<uint32_t> s(a[0].data.size()), c(a[0].data.size());
+			for (size_t i = 0; i < s.size(); ++i)
+				s[i] = as_bits(std::sin(f(0, i))),
+				c[i] = as_bits(std::cos(f(0, i)));
+			store_out(1, s);
+			store_out(2, c);
+		}
+		else if (name == "modf")
+		{
+			std::vector<uint32_t> integral_part(r.data.size());
+			for (size_t i = 0; i < r.data.size(); ++i)
+			{
+				float ip = 0.0f;
+				r.data[i] = as_bits(std::modf(f(0, i), &ip));
+				integral_part[i] = as_bits(ip);
+			}
+			store_out(1, integral_part);
+		}
+		else if (name == "frexp")
+		{
+			std::vector<uint32_t> exponent(r.data.size());
+			for (size_t i = 0; i < r.data.size(); ++i)
+			{
+				int exp = 0;
+				r.data[i] = as_bits(std::frexp(f(0, i), &exp));
+				exponent[i] = static_cast<uint32_t>(exp);
+			}
+			store_out(1, exponent);
+		}
+		else if (name == "barrier" || name == "memoryBarrier" || name == "groupMemoryBarrier")
+		{
+			// There is only a single invocation, so nothing to synchronize
+		}
+		else if (name.compare(0, 6, "atomic") == 0)
+		{
+			// Atomic operations either operate on a groupshared variable or on a storage texel
+			const bool on_storage = a[0].type.is_storage();
+			const size_t value_arg = on_storage ? 2 : 1;
+
+			uint32_t *target = nullptr;
+			if (on_storage)
+			{
+				target = &storage_texel(e, a[0], a[1], res_type).data[0];
+			}
+			else
+			{
+				size_t cell = 0;
+				std::vector<uint32_t> components;
+				if (!resolve(e, args[0].base, {}, cell, components))
+					return r;
+				target = &e.memory[cell].data[components[0]];
+			}
+
+			const uint32_t original = *target, operand = a[value_arg].data[0];
+			const bool is_signed = res_type.is_signed();
+
+			if (name == "atomicAdd")
+				*target = original + operand;
+			else if (name == "atomicAnd")
+				*target = original & operand;
+			else if (name == "atomicOr")
+				*target = original | operand;
+			else if (name == "atomicXor")
+				*target = original ^ operand;
+			else if (name == "atomicMin")
+				*target = is_signed ? static_cast<uint32_t>(std::min(static_cast<int32_t>(original), static_cast<int32_t>(operand))) : std::min(original, operand);
+			else if (name == "atomicMax")
+				*target = is_signed ? static_cast<uint32_t>(std::max(static_cast<int32_t>(original), static_cast<int32_t>(operand))) : std::max(original, operand);
+			else if (name == "atomicExchange")
+				*target = operand;
+			else if (name == "atomicCompareExchange")
+				*target = original == operand ? a[value_arg + 1].data[0] : original;
+
+			r.data[0] = original;
+		}
+		else if (name.compare(0, 3, "tex") == 0)
+		{
+			const uint32_t dimension = name[3] - '0';
+			const std::string function = name.substr(5);
+
+			const texture &tex = texture_of(a[0]);
+			const uint32_t size[3] = { tex.width, tex.height, tex.depth };
+
+			if (function == "store")
+			{
+				storage_texel(e, a[0], a[1], a[2].type).data = a[2].data;
+				return r;
+			}
+			if (function == "size")
+			{
+				const uint32_t level = a[0].type.is_storage() ? get_storage(a[0].data[0]).level : a.size() > 1 ? a[1].data[0] : 0;
+				for (uint32_t i = 0; i < dimension; ++i)
+					r.data[i] = std::max(1u, size[i] >> std::min(level, 31u));
+				return r;
+			}
+			if (function == "fetch" && a[0].type.is_storage())
+				return { res_type, storage_texel(e, a[0], a[1], res_type).data };
+
+			float coords[3] = {}, lod = 0.0f;
+			size_t offset_arg = 2;
+
+			if (function == "fetch")
+			{
+				if (a.size() > 2)
+					lod = static_cast<float>(static_cast<int32_t>(a[2].data[0]));
+				for (uint32_t i = 0; i < dimension; ++i)
+					coords[i] = (static_cast<int32_t>(a[1].data[i]) + 0.5f) / size[i];
+				offset_arg = a.size();
+			}
+			else
+			{
+				for (uint32_t i = 0; i < dimension; ++i)
+					coords[i] = f(1, i);
+
+				if (function == "lod")
+					lod = f(1, 3);
+				else if (function == "grad")
+					lod = std::abs(f(2, 0)) + std::abs(f(3, 0)), offset_arg = 4;
+			}
+
+			if (function.compare(0, 6, "gather") == 0)
+			{
+				const uint32_t channel = static_cast<uint32_t>(std::string("RGBA").find(function[6]));
+				for (uint32_t k = 0; k < 4; ++k)
+				{
+					float position[3] = { coords[0] + ((k == 0 || k == 3) ? -0.5f : 0.5f) / size[0], coords[1] + (k < 2 ? 0.5f : -0.5f) / size[1], 0.0f };
+					// Either a single offset for all texels or one offset per texel
+					if (const size_t offset = a.size() == 6 ? 2 + k : 2; offset < a.size())
+						for (uint32_t i = 0; i < 2; ++i)
+							position[i] += static_cast<int32_t>(a[offset].data[i]) / static_cast<float>(size[i]);
+					r.data[k] = as_bits(texel(tex.unique_name, position, 0.0f, channel));
+				}
+				return r;
+			}
+
+			if (offset_arg < a.size())
+				for (uint32_t i = 0; i < dimension; ++i)
+					coords[i] += static_cast<int32_t>(a[offset_arg].data[i]) / static_cast<float>(size[i]);
+
+			for (uint32_t c = 0; c < r.data.size(); ++c)
+				r.data[c] = encode(texel(tex.unique_name, coords, lod, c), res_type);
+		}
+		else
+		{
+			fail(e, "intrinsic '" + name + "' is not implemented in the test interpreter");
+		}
+
+		return r;
+	}
+
+protected:
+	id   define_struct(const location &, struct_type &info) override
+	{
+		const id res = info.id = make_id();
+		_structs.push_back(info);
+		return res;
+	}
+	id   define_texture(const location &, texture &info) override
+	{
+		const id res = info.id = make_id();
+		_module.textures.push_back(info);
+		return res;
+	}
+	id   define_sampler(const location &, const texture &, sampler &info) override
+	{
+		const id res = info.id = make_id();
+		_module.samplers.push_back(info);
+		_objects[res] = info.type;
+		return res;
+	}
+	id   define_storage(const location &, const texture &, storage &info) override
+	{
+		const id res = info.id = make_id();
+		_module.storages.push_back(info);
+		_objects[res] = info.type;
+		return res;
+	}
+	id   define_uniform(const location &, uniform &info) override
+	{
+		const id res = make_id();
+		_module.uniforms.push_back(info);
+		_uniforms[res] = info;
+		return res;
+	}
+	id   define_variable(const location &, const type &data_type, std::string name, bool global, id initializer_value) override
+	{
+		// Constant variables with a constant array initializer refer to the initializer directly, like in the other back-ends
+		if (initializer_value != 0 && data_type.has(type::q_const) && _array_constants.count(initializer_value) != 0)
+			return initializer_value;
+
+		const id res = make_id();
+
+		if (global && _current_function == nullptr && !name.empty())
+			_variable_names[res] = name;
+
+		append([this, res, data_type, initializer_value](execution &e) {
+			value val = { data_type, std::vector<uint32_t>(size_of(data_type)) };
+			if (initializer_value != 0)
+				val.data = read(e, initializer_value).data;
+
+			e.memory.push_back(std::move(val));
+			e.frames.back().variables[res] = e.memory.size() - 1;
+		});
+
+		return res;
+	}
+	id   define_function(const location &, function &info) override
+	{
+		const id res = info.id = make_id();
+		for (member_type &param : info.parameter_list)
+			param.id = make_id();
+
+		_functions.push_back(std::make_unique<function>(info));
+		_current_function = _functions.back().get();
+
+		return res;
+	}
+
+	void define_entry_point(function &func) override
+	{
+		if (std::find_if(_module.entry_points.begin(), _module.entry_points.end(),
+				[&func](const std::pair<std::string, shader_type> &entry_point) {
+					return entry_point.first == func.unique_name;
+				}) == _module.entry_points.end())
+			_module.entry_points.emplace_back(func.unique_name, func.type);
+	}
+
+	id   emit_load(const expression &exp, bool force_new_id) override
+	{
+		if (exp.is_constant)
+			return emit_constant(exp.type, exp.constant);
+		if (exp.chain.empty() && !force_new_id && (_semantics == load_semantics::lazy || !exp.is_lvalue))
+			return exp.base;
+
+		const id res = make_id();
+
+		if (_semantics == load_semantics::lazy && !force_new_id)
+		{
+			_references[res] = { exp.base, exp.chain };
+			return res;
+		}
+
+		append([this, res, base = exp.base, chain = exp.chain](execution &e) { bind(e, res, load(e, base, chain)); });
+
+		return res;
+	}
+	void emit_store(const expression &exp, id value_id) override
+	{
+		append([this, exp, value_id](execution &e) {
+			const value val = read(e, value_id);
+
+			size_t cell = 0;
+			std::vector<uint32_t> components;
+			if (!resolve(e, exp.base, exp.chain, cell, components))
+				return;
+			if (components.size() != val.data.size())
+				return fail(e, "size mismatch in store to ID " + std::to_string(exp.base));
+
+			for (size_t i = 0; i < components.size(); ++i)
+				e.memory[cell].data[components[i]] = val.data[i];
+		});
+	}
+	id   emit_access_chain(const expression &exp, size_t &chain_index) override
+	{
+		if (_semantics == load_semantics::lazy)
+			return codegen::emit_access_chain(exp, chain_index);
+
+		// Pointers to the accessed element, like in the SPIR-V back-end
+		chain_index = exp.chain.size();
+		if (exp.chain.empty())
+			return exp.base;
+
+		const id res = make_id();
+		_references[res] = { exp.base, exp.chain };
+		return res;
+	}
+
+	id   emit_constant(const type &data_type, const constant &data) override
+	{
+		value val = { data_type };
+		flatten(data_type, data, val.data);
+
+		// The SPIR-V back-end reuses all constants, the other back-ends only array constants
+		if (data_type.is_array() || _semantics == load_semantics::snapshot)
+		{
+			for (const auto &[existing, existing_value] : _constants)
+				if (existing_value.type == data_type && existing_value.data == val.data)
+					return existing;
+		}
+
+		const id res = make_id();
+		if (data_type.is_array())
+			_array_constants.insert(res);
+		_constants[res] = std::move(val);
+
+		return res;
+	}
+	void flatten(const type &data_type, const constant &data, std::vector<uint32_t> &words) const
+	{
+		if (data_type.is_array())
+		{
+			type element_type = data_type;
+			element_type.array_length = 0;
+			for (uint32_t i = 0; i < data_type.array_length; ++i)
+				flatten(element_type, i < data.array_data.size() ? data.array_data[i] : constant {}, words);
+		}
+		else if (data_type.is_numeric())
+		{
+			words.insert(words.end(), data.as_uint, data.as_uint + data_type.components());
+		}
+		else
+		{
+			words.resize(words.size() + size_of(data_type));
+		}
+	}
+
+	id   emit_unary_op(const location &, tokenid op, const type &res_type, id val) override
+	{
+		const id res = make_id();
+
+		append([this, res, op, res_type, val](execution &e) {
+			value operand = read(e, val);
+			for (uint32_t &word : operand.data)
+			{
+				switch (op)
+				{
+				case tokenid::minus:
+					word = res_type.is_floating_point() ? as_bits(-as_float(word)) : 0 - word;
+					break;
+				case tokenid::exclaim:
+					word = operand.type.is_floating_point() ? as_float(word) == 0.0f : word == 0;
+					break;
+				case tokenid::tilde:
+					word = ~word;
+					break;
+				default:
+					return fail(e, "unsupported unary operator " + token::id_to_name(op));
+				}
+			}
+
+			operand.type = res_type;
+			bind(e, res, std::move(operand));
+		});
+
+		return res;
+	}
+	id   emit_binary_op(const location &, tokenid op, const type &res_type, const type &operand_type, id lhs, id rhs) override
+	{
+		const id res = make_id();
+
+		append([this, res, op, res_type, operand_type, lhs, rhs](execution &e) {
+			const value x = read(e, lhs), y = read(e, rhs);
+			if (x.data.empty() || y.data.empty())
+				return;
+
+			value result = { res_type, std::vector<uint32_t>(res_type.components()) };
+			for (size_t i = 0; i < result.data.size(); ++i)
+				result.data[i] = binary(e, op, operand_type, x.data[std::min(i, x.data.size() - 1)], y.data[std::min(i, y.data.size() - 1)]);
+			bind(e, res, std::move(result));
+		});
+
+		return res;
+	}
+	id   emit_ternary_op(const location &, tokenid, const type &res_type, id condition, id true_value, id false_value) override
+	{
+		const id res = make_id();
+
+		append([this, res, res_type, condition, true_value, false_value](execution &e) {
+			const value c = read(e, condition), x = read(e, true_value), y = read(e, false_value);
+
+			value result = { res_type, y.data };
+			for (size_t i = 0; i < result.data.size() && !c.data.empty(); ++i)
+				if (c.data[c.data.size() == 1 ? 0 : i] != 0)
+					result.data[i] = x.data[i];
+			bind(e, res, std::move(result));
+		});
+
+		return res;
+	}
+	id   emit_call(const location &, id function_id, const type &res_type, const std::vector<expression> &args) override
+	{
+		const id res = make_id();
+
+		append([this, res, function_id, res_type, args](execution &e) {
+			const function &func = get_function(function_id);
+
+			frame callee;
+			for (size_t i = 0; i < args.size(); ++i)
+			{
+				size_t cell = 0;
+				std::vector<uint32_t> components;
+				// Parameters are passed by reference to a temporary variable the parser copies in and out, except for objects
+				if (args[i].is_lvalue && resolve(e, args[i].base, args[i].chain, cell, components) && components.size() == e.memory[cell].data.size())
+				{
+					callee.variables[func.parameter_list[i].id] = cell;
+				}
+				else
+				{
+					e.memory.push_back(read(e, args[i].base));
+					callee.variables[func.parameter_list[i].id] = e.memory.size() - 1;
+				}
+			}
+
+			e.frames.push_back(std::move(callee));
+			run(e, _function_bodies[function_id]);
+			value return_value = std::move(e.frames.back().return_value);
+			e.frames.pop_back();
+
+			if (!res_type.is_void())
+				bind(e, res, std::move(return_value));
+		});
+
+		return res;
+	}
+	id   emit_call_intrinsic(const location &, id intrinsic, const type &res_type, const std::vector<expression> &args) override
+	{
+		const id res = make_id();
+
+		append([this, res, intrinsic, res_type, args](execution &e) {
+			value result = call_intrinsic(e, s_intrinsic_names[intrinsic], res_type, args);
+			if (!res_type.is_void())
+				bind(e, res, std::move(result));
+		});
+
+		return res;
+	}
+	id   emit_construct(const location &, const type &res_type, const std::vector<expression> &args) override
+	{
+		const id res = make_id();
+
+		append([this, res, res_type, args](execution &e) {
+			value result = { res_type };
+			for (const expression &arg : args)
+			{
+				const value element = read(e, arg.base);
+				result.data.insert(result.data.end(), element.data.begin(), element.data.end());
+			}
+			bind(e, res, std::move(result));
+		});
+
+		return res;
+	}
+
+	void emit_if(const location &, id condition_value, id condition_block, id true_statement_block, id false_statement_block, unsigned int) override
+	{
+		std::vector<instruction> condition_code = take_block(condition_block);
+		for (instruction &instruction : condition_code)
+			append(std::move(instruction));
+
+		append([this, condition_value, true_code = take_block(true_statement_block), false_code = take_block(false_statement_block)](execution &e) {
+			run(e, is_true(read(e, condition_value)) ? true_code : false_code);
+		});
+	}
+	id   emit_phi(const location &, id condition_value, id condition_block, id true_value, id true_statement_block, id false_value, id false_statement_block, const type &) override
+	{
+		const id res = make_id();
+
+		std::vector<instruction> condition_code = take_block(condition_block);
+		for (instruction &instruction : condition_code)
+			append(std::move(instruction));
+
+		std::vector<instruction> true_code = true_statement_block != condition_block ? take_block(true_statement_block) : std::vector<instruction>();
+		std::vector<instruction> false_code = false_statement_block != condition_block ? take_block(false_statement_block) : std::vector<instruction>();
+
+		append([this, res, condition_value, true_value, false_value, true_code = std::move(true_code), false_code = std::move(false_code)](execution &e) {
+			const bool condition = is_true(read(e, condition_value));
+			run(e, condition ? true_code : false_code);
+			if (is_running(e))
+				bind(e, res, read(e, condition ? true_value : false_value));
+		});
+
+		return res;
+	}
+	void emit_loop(const location &, id condition_value, id prev_block, id header_block, id condition_block, id loop_block, id continue_block, unsigned int) override
+	{
+		std::vector<instruction> prev_code = take_block(prev_block);
+		for (instruction &instruction : prev_code)
+			append(std::move(instruction));
+
+		take_block(header_block);
+
+		std::vector<instruction> condition_code = condition_block != 0 ? take_block(condition_block) : std::vector<instruction>();
+
+		append([this, condition_value, is_do_while = condition_block == 0, condition_code = std::move(condition_code), loop_code = take_block(loop_block), continue_code = take_block(continue_block)](execution &e) {
+			const auto condition = [&]() {
+				return condition_value == 0 || is_true(read(e, condition_value));
+			};
+
+			if (!is_do_while)
+			{
+				run(e, condition_code);
+				if (!is_running(e) || !condition())
+					return;
+			}
+
+			while (++e.operations <= 1000000)
+			{
+				run(e, loop_code);
+
+				if (e.frames.back().flow == control_flow::break_loop)
+				{
+					e.frames.back().flow = control_flow::none;
+					break;
+				}
+				if (e.frames.back().flow == control_flow::continue_loop)
+					e.frames.back().flow = control_flow::none;
+
+				// The continue block contains the condition of do-while loops
+				run(e, continue_code);
+				run(e, condition_code);
+				if (!is_running(e) || !condition())
+					break;
+			}
+		});
+	}
+	void emit_switch(const location &, id selector_value, id selector_block, id default_label, id default_block, const std::vector<id> &case_literal_and_labels, const std::vector<id> &case_blocks, unsigned int) override
+	{
+		std::vector<instruction> selector_code = take_block(selector_block);
+		for (instruction &instruction : selector_code)
+			append(std::move(instruction));
+
+		// Cases are laid out in order like in the other back-ends, so that execution falls through to the next case
+		std::vector<std::vector<instruction>> case_code;
+		std::vector<std::pair<uint32_t, size_t>> case_targets;
+		std::unordered_map<id, size_t> case_indices;
+		for (size_t i = 0; i < case_blocks.size(); ++i)
+		{
+			if (case_indices.find(case_blocks[i]) == case_indices.end())
+			{
+				case_indices[case_blocks[i]] = case_code.size();
+				case_code.push_back(take_block(case_blocks[i]));
+			}
+			case_targets.emplace_back(case_literal_and_labels[2 * i], case_indices[case_blocks[i]]);
+		}
+
+		size_t default_index = case_code.size();
+		if (case_indices.find(default_block) != case_indices.end())
+			default_index = case_indices[default_block];
+		else if (default_block != _current_block)
+			case_code.push_back(take_block(default_block));
+		else
+			default_index = std::numeric_limits<size_t>::max();
+
+		append([this, selector_value, case_code = std::move(case_code), case_targets = std::move(case_targets), default_index](execution &e) {
+			const value selector = read(e, selector_value);
+
+			size_t start = default_index;
+			for (const auto &[literal, index] : case_targets)
+				if (!selector.data.empty() && selector.data[0] == literal)
+					start = index;
+
+			for (size_t i = start; i < case_code.size() && is_running(e); ++i)
+				run(e, case_code[i]);
+
+			if (e.frames.back().flow == control_flow::break_loop)
+				e.frames.back().flow = control_flow::none;
+		});
+	}
+
+	id   set_block(id id) override
+	{
+		_last_block = _current_block;
+		_current_block = id;
+
+		return _last_block;
+	}
+	void enter_block(id id) override
+	{
+		_current_block = id;
+	}
+	id   leave_block_and_kill() override
+	{
+		if (!is_in_block())
+			return 0;
+
+		append([](execution &e) {
+			e.killed = true;
+			e.frames.back().flow = control_flow::kill;
+		});
+
+		return set_block(0);
+	}
+	id   leave_block_and_return(id value_id) override
+	{
+		if (!is_in_block())
+			return 0;
+
+		// Skip implicit return statement
+		if (!_current_function->return_type.is_void() && value_id == 0)
+			return set_block(0);
+
+		append([this, value_id](execution &e) {
+			if (value_id != 0)
+				e.frames.back().return_value = read(e, value_id);
+			e.frames.back().flow = control_flow::return_function;
+		});
+
+		return set_block(0);
+	}
+	id   leave_block_and_switch(id, id) override
+	{
+		if (!is_in_block())
+			return _last_block;
+
+		return set_block(0);
+	}
+	id   leave_block_and_branch(id, unsigned int loop_flow) override
+	{
+		if (!is_in_block())
+			return _last_block;
+
+		if (loop_flow != 0)
+			append([loop_flow](execution &e) {
+				e.frames.back().flow = loop_flow == 1 ? control_flow::break_loop : control_flow::continue_loop;
+			});
+
+		return set_block(0);
+	}
+	id   leave_block_and_branch_conditional(id, id, id) override
+	{
+		if (!is_in_block())
+			return _last_block;
+
+		return set_block(0);
+	}
+	void leave_function() override
+	{
+		_function_bodies[_current_function->id] = take_block(_last_block);
+
+		_current_function = nullptr;
+	}
+
+private:
+	const load_semantics _semantics;
+	std::unordered_map<id, std::vector<instruction>> _blocks;
+	std::unordered_map<id, std::vector<instruction>> _function_bodies;
+	std::unordered_map<id, value> _constants;
+	std::unordered_set<id> _array_constants;
+	std::unordered_map<id, reference> _references;
+	std::unordered_map<id, uniform> _uniforms;
+	std::unordered_map<id, reshadefx::type> _objects;
+	std::unordered_map<id, std::string> _variable_names;
+};
+
+static bool equal(const codegen_interpreter &backend, const codegen_interpreter::value &lhs, const codegen_interpreter::value &rhs)
+{
+	if (lhs.data.size() != rhs.data.size())
+		return false;
+
+	std::vector<type::datatype> bases;
+	backend.component_bases(lhs.type, bases);
+
+	for (size_t i = 0; i < lhs.data.size(); ++i)
+	{
+		if (lhs.data[i] == rhs.data[i])
+			continue;
+		if (i >= bases.size() || (bases[i] != type::t_float && bases[i] != type::t_min16float))
+			return false;
+
+		// Allow for rounding differences, since the optimizer evaluates constant operations on the host
+		const float x = as_float(lhs.data[i]), y = as_float(rhs.data[i]);
+		if (!(std::isnan(x) && std::isnan(y)) && !(std::abs(x - y) <= 1e-4f * std::max(1.0f, std::max(std::abs(x), std::abs(y)))))
+			return false;
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Compiles the effect code with and without the optimizer and checks that executing each function gives the same results.
+/// </summary>
+/// <returns>Number of operations executed without and with the optimizer.</returns>
+static std::pair<size_t, size_t> check_equivalence(const std::string &name, const std::string &source, unsigned int seeds = 8)
+{
+	std::pair<size_t, size_t> executed_operations = {};
+
+	for (const codegen_interpreter::load_semantics semantics : { codegen_interpreter::load_semantics::lazy, codegen_interpreter::load_semantics::snapshot })
+	{
+		const std::string semantics_name = semantics == codegen_interpreter::load_semantics::lazy ? " (lazy loads)" : " (snapshot loads)";
+
+		codegen_interpreter reference(semantics);
+		codegen_optimizer<codegen_interpreter> optimized(semantics);
+
+		for (codegen_interpreter *const backend : { &reference, static_cast<codegen_interpreter *>(&optimized) })
+		{
+			parser parser;
+			CHECK_MESSAGE(parser.parse(source, backend), name + ": " + parser.errors());
+		}
+
+		const std::vector<std::string> functions = reference.testable_functions();
+		CHECK_MESSAGE(!functions.empty(), name);
+		CHECK_MESSAGE(functions == optimized.testable_functions(), name);
+
+		for (const std::string &function : functions)
+		{
+			for (uint32_t seed = 0; seed < seeds; ++seed)
+			{
+				const codegen_interpreter::result expected = reference.invoke(function, seed);
+				const codegen_interpreter::result actual = optimized.invoke(function, seed);
+
+				const std::string message = name + semantics_name + ", function '" + function + "', seed " + std::to_string(seed);
+				CHECK_MESSAGE(expected.error.empty(), message + ": " + expected.error);
+				CHECK_MESSAGE(actual.error.empty(), message + ": " + actual.error);
+				CHECK_MESSAGE(expected.killed == actual.killed, message);
+
+				CHECK_MESSAGE(expected.outputs.size() == actual.outputs.size(), message);
+				for (size_t i = 0; i < expected.outputs.size() && i < actual.outputs.size(); ++i)
+					CHECK_MESSAGE(expected.outputs[i].first == actual.outputs[i].first && equal(reference, expected.outputs[i].second, actual.outputs[i].second),
+						message + ", output '" + expected.outputs[i].first + "'");
+
+				CHECK_MESSAGE(expected.storage.size() == actual.storage.size(), message);
+				for (const auto &[texel, value] : expected.storage)
+					CHECK_MESSAGE(actual.storage.count(texel) != 0 && equal(reference, value, actual.storage.at(texel)), message + ", storage texel " + texel);
+
+				executed_operations.first += expected.executed_operations;
+				executed_operations.second += actual.executed_operations;
+			}
+		}
+	}
+
+	// The optimizer only ever removes operations
+	CHECK_MESSAGE(executed_operations.second <= executed_operations.first, name);
+
+	return executed_operations;
+}
+
+TEST_CASE(codegen_optimizer_matches_unoptimized_output_on_test_effects)
+{
+	size_t effect_count = 0;
+	std::pair<size_t, size_t> executed_operations = {};
+
+	std::error_code ec;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(reshadefx::test::effects_path(), ec))
+	{
+		if (entry.path().extension() != ".fx")
+			continue;
+
+		effect_count++;
+
+		preprocessor pp;
+		pp.add_macro_definition("__RESHADE__", "50000");
+		pp.add_macro_definition("BUFFER_WIDTH", "800");
+		pp.add_macro_definition("BUFFER_HEIGHT", "600");
+		pp.add_macro_definition("BUFFER_RCP_WIDTH", "(1.0 / BUFFER_WIDTH)");
+		pp.add_macro_definition("BUFFER_RCP_HEIGHT", "(1.0 / BUFFER_HEIGHT)");
+		CHECK_MESSAGE(pp.append_file(entry.path()), pp.errors());
+
+		const std::pair<size_t, size_t> effect_operations = check_equivalence(entry.path().filename().u8string(), pp.output(), 4);
+		executed_operations.first += effect_operations.first;
+		executed_operations.second += effect_operations.second;
+	}
+
+	CHECK_MESSAGE(effect_count != 0, "no effects found in " + reshadefx::test::effects_path().u8string());
+	CHECK(executed_operations.second < executed_operations.first);
+}
+
+TEST_CASE(codegen_optimizer_invalidates_values_on_store)
+{
+	// Operations use parameters instead of literals where they should be reused, since not all back-ends reuse constants
+	const std::pair<size_t, size_t> executed_operations = check_equivalence("stores", R"(
+struct S { float3 v; float a[3]; };
+
+float4 stores(float4 x, float k, int i)
+{
+	float4 r = x * k;
+	float4 a = x * k;
+	r.y = r.x + k;
+	float4 b = r * k;
+	r.zw = b.xy;
+	float4 c = r * k;
+
+	float arr[4] = { x.x, x.y, x.z, x.w };
+	float s0 = arr[i & 3] + k;
+	arr[(i + 1) & 3] = s0 * k;
+	arr[i & 3] += k;
+	float s1 = arr[i & 3] + k;
+
+	S s;
+	s.v = x.xyz;
+	s.a[0] = x.w; s.a[1] = k; s.a[2] = -k;
+	float3 t0 = s.v * k + s.a[i & 1];
+	s.v.y = t0.x;
+	s.a[i & 1] = t0.z;
+	float3 t1 = s.v * k + s.a[i & 1];
+
+	float2x2 m = float2x2(x.xy, x.zw);
+	float2 m0 = m[0] * k;
+	m[0][1] = k;
+	float2 m1 = m[0] * k;
+	m._m10 = s0;
+	float2 m2 = m._m10_m11 * k;
+
+	return a + b + c + float4(s0 + s1, t0.x + t1.y, t0.z + t1.z, m0.y + m1.y + m2.x);
+}
+
+int loops(int n, int k)
+{
+	int i = 0;
+	int sum = 0;
+	for (int j = 0; j < 4; ++j)
+	{
+		sum += i * k;
+		i++;
+		sum += i * k;
+		if (sum > 20)
+			continue;
+		sum += i * k;
+	}
+	while (n > 0)
+	{
+		n--;
+		sum += n * k;
+		if (n == 3)
+			break;
+	}
+	int guard = 0;
+	do
+	{
+		sum += sum * k + 1;
+	}
+	while (sum < 100 && sum > -100 && ++guard < 8);
+	return sum;
+}
+)");
+	CHECK(executed_operations.second < executed_operations.first);
+}
+
+TEST_CASE(codegen_optimizer_invalidates_values_on_call)
+{
+	const std::pair<size_t, size_t> executed_operations = check_equivalence("calls", R"(
+static float g = 1.0;
+
+void bump()
+{
+	g += 1.0;
+}
+float bump_and_get()
+{
+	g *= 2.0;
+	return g;
+}
+void modify(inout float v)
+{
+	v = v * 3.0 + g;
+	g += 1.0;
+}
+void outputs(float v, out float a, out float2 b)
+{
+	a = v + 1.0;
+	b = float2(v, v * 2.0);
+}
+
+float4 calls(float x, float k)
+{
+	float y = x;
+	float p = y * k + g * k;
+	modify(y);
+	float q = y * k + g * k;
+
+	float a;
+	float2 b;
+	outputs(q, a, b);
+	float r = a * k + b.y * k;
+	outputs(p, a, b);
+	float s = a * k + b.y * k;
+
+	// A call without any parameters, so nothing but the call itself can invalidate values
+	float t = g * k;
+	bump();
+	float u = g * k;
+
+	// Selecting a variable with a constant condition must not defer reading it past the call
+	float w = (true ? g : 0.0) + bump_and_get();
+
+	return float4(p + q, r + s, t + u, w);
+}
+)");
+	CHECK(executed_operations.second < executed_operations.first);
+}
+
+TEST_CASE(codegen_optimizer_invalidates_values_on_side_effect_intrinsics)
+{
+	const std::pair<size_t, size_t> executed_operations = check_equivalence("intrinsics", R"(
+texture2D FloatTex { Width = 4; Height = 4; Format = RGBA32F; };
+storage2D FloatStorage { Texture = FloatTex; };
+texture2D IntTex { Width = 4; Height = 4; Format = R32I; };
+storage2D<int> IntStorage { Texture = IntTex; };
+
+groupshared int shared_value;
+groupshared uint shared_array[4];
+
+int4 atomics(int v, uint w, int k)
+{
+	shared_value = v;
+	int a0 = shared_value * k;
+	int original = atomicAdd(shared_value, 3);
+	int a1 = shared_value * k;
+	int exchanged = atomicCompareExchange(shared_value, v + 3, 9);
+	int a2 = shared_value * k;
+
+	uint index = w & 3;
+	shared_array[index] = w;
+	uint b0 = shared_array[index] * w;
+	atomicMax(shared_array[index], 7u);
+	uint b1 = shared_array[index] * w;
+	barrier();
+	atomicExchange(shared_array[index], 2u);
+	uint b2 = shared_array[index] * w;
+
+	return int4(a0 + a1 + a2, original + exchanged, b0 + b1, b2);
+}
+
+float4 storage_access(int2 pos, int v, float4 x)
+{
+	int2 p = pos & 3;
+	float4 f0 = tex2Dfetch(FloatStorage, p) * x;
+	float4 c0 = tex2Dfetch(FloatStorage, int2(1, 2)) * x;
+	tex2Dstore(FloatStorage, p, x);
+	float4 f1 = tex2Dfetch(FloatStorage, p) * x;
+	tex2Dstore(FloatStorage, int2(1, 2), x.wzyx);
+	float4 c1 = tex2Dfetch(FloatStorage, int2(1, 2)) * x;
+
+	int i0 = tex2Dfetch(IntStorage, p) * v;
+	int i1 = atomicAdd(IntStorage, p, v);
+	int i2 = tex2Dfetch(IntStorage, p) * v;
+
+	return f0 + f1 + c0 + c1 + float(i0 + i1 + i2);
+}
+
+float4 output_parameters(float x, float k)
+{
+	float s, c;
+	sincos(x, s, c);
+	float s0 = s * k;
+	sincos(x * k, s, c);
+	float s1 = s * k;
+
+	float ip;
+	float fr = modf(x * k, ip);
+	float ip0 = ip * k;
+	modf(x * k + k, ip);
+	float ip1 = ip * k;
+
+	int e;
+	float m = frexp(x, e);
+	int e0 = e * e;
+	frexp(x * 64.0, e);
+	int e1 = e * e;
+
+	return float4(s0 + s1 + c, fr + ip0 + ip1, m + e0 + e1, s * k + s * k);
+}
+)");
+	CHECK(executed_operations.second < executed_operations.first);
+}
+
+TEST_CASE(codegen_optimizer_folds_constants)
+{
+	const std::pair<size_t, size_t> executed_operations = check_equivalence("constants", R"(
+static const float table[4] = { 1.0, 2.0, 3.0, 4.0 };
+static const int zero = 0;
+
+float4 constants(float x, float k, int i, uint u)
+{
+	int d = (7 / zero) + (7 % zero) + (-7 / 2) + (-7 % 2);
+	uint s = (1u << 33) + (0x80000000u >> 31) + (u << 33);
+	int sh = (-16 >> 2) + (i >> 33);
+	bool b0 = (bool)2.5;
+	bool b1 = (bool)0.0 || (bool)-0.0;
+	bool b2 = (bool)(true ? 0.25 : x);
+	int c = (int)-2.75 + (int)2.75 + (uint)3.5;
+	float f = (float)-3 + (float)7u;
+	float2 v = float2(1.0, 2.0).yx * float2(3.0, 4.0).xx;
+	float3 w = (float4(1.0, 2.0, 3.0, 4.0) * 2.0).zyx;
+	float2x2 m = float2x2(1.0, 2.0, 3.0, 4.0);
+	float2 mv = mul(m, float2(1.0, 0.5)) + m[1] + m._m01_m10;
+	float sel = (true ? x : 0.0) + (false ? 1.0 : x * k);
+	float tv = table[i & 3] + table[2];
+	x = x + k;
+	float after = (true ? x : 0.0) * k;
+
+	return float4(d + sh + c + f + (b0 ? 1.0 : 0.0) + (b1 ? 2.0 : 0.0) + (b2 ? 4.0 : 0.0), s, v.x + w.y + mv.y, sel + tv + after + x * k + x * k);
+}
+
+float branches(float x, float k, int i)
+{
+	float y = 0.0;
+	if (x > 0.0 && (y = x * k) > 1.0)
+		y += x * k;
+	if (x < 0.0 || (y = x * k) > 1.0)
+		y -= x * k;
+	switch (i & 3)
+	{
+	case 0:
+	case 1:
+		y *= x * k;
+		break;
+	case 2:
+		if (x > 0.5)
+			break;
+		y -= x * k;
+		break;
+	default:
+		y = -y;
+		break;
+	}
+	return (x > 0.0 ? y : x) + y * k;
+}
+)");
+	CHECK(executed_operations.second < executed_operations.first);
+}
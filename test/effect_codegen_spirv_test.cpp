@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "effect_parser.hpp"
+#include "effect_codegen.hpp"
+#include "effect_preprocessor.hpp"
+#include <spirv.hpp>
+#include <cstring> // std::memcpy
+#include <map>
+#include <memory>
+#include <algorithm>
+
+struct spirv_instruction
+{
+	spv::Op op = spv::OpNop;
+	uint32_t type = 0;
+	uint32_t result = 0;
+	std::vector<uint32_t> operands;
+
+	std::string string_operand(size_t index) const
+	{
+		return std::string(reinterpret_cast<const char *>(operands.data() + index), strnlen(reinterpret_cast<const char *>(operands.data() + index), (operands.size() - index) * sizeof(uint32_t)));
+	}
+	size_t string_operand_length(size_t index) const
+	{
+		// Literal strings are null-terminated and padded to a whole number of words
+		return (string_operand(index).size() + 4) / 4;
+	}
+};
+
+/// <summary>
+/// Determines whether an instruction has a result type and a result, as listed in the SPIR-V specification for all instructions the code generator emits.
+/// This is kept separate from the code generator on purpose, so that the test does not share a mistake with it.
+/// </summary>
+static void get_spirv_instruction_layout(spv::Op op, bool &has_type, bool &has_result)
+{
+	switch (op)
+	{
+	case spv::OpNop:
+	case spv::OpSource:
+	case spv::OpName:
+	case spv::OpMemberName:
+	case spv::OpLine:
+	case spv::OpDecorate:
+	case spv::OpMemberDecorate:
+	case spv::OpMemoryModel:
+	case spv::OpEntryPoint:
+	case spv::OpExecutionMode:
+	case spv::OpCapability:
+	case spv::OpFunctionEnd:
+	case spv::OpStore:
+	case spv::OpImageWrite:
+	case spv::OpControlBarrier:
+	case spv::OpMemoryBarrier:
+	case spv::OpLoopMerge:
+	case spv::OpSelectionMerge:
+	case spv::OpBranch:
+	case spv::OpBranchConditional:
+	case spv::OpSwitch:
+	case spv::OpKill:
+	case spv::OpReturn:
+	case spv::OpReturnValue:
+		has_type = false;
+		has_result = false;
+		break;
+	case spv::OpString:
+	case spv::OpExtInstImport:
+	case spv::OpTypeVoid:
+	case spv::OpTypeBool:
+	case spv::OpTypeInt:
+	case spv::OpTypeFloat:
+	case spv::OpTypeVector:
+	case spv::OpTypeMatrix:
+	case spv::OpTypeImage:
+	case spv::OpTypeSampledImage:
+	case spv::OpTypeArray:
+	case spv::OpTypeStruct:
+	case spv::OpTypePointer:
+	case spv::OpTypeFunction:
+	case spv::OpLabel:
+		has_type = false;
+		has_result = true;
+		break;
+	default:
+		has_type = true;
+		has_result = true;
+		break;
+	}
+}
+
+/// <summary>
+/// Gets the indices of all operands of an instruction that are <id>s, by listing where the literal operands are for each instruction.
+/// </summary>
+static std::vector<size_t> get_spirv_id_operands(const spirv_instruction &inst)
+{
+	const size_t count = inst.operands.size();
+
+	std::vector<size_t> ids;
+	const auto add_range = [&ids, count](size_t first, size_t last) {
+		for (size_t i = first; i < std::min(last, count); ++i)
+			ids.push_back(i);
+	};
+
+	switch (inst.op)
+	{
+	case spv::OpSource:
+	case spv::OpString:
+	case spv::OpExtInstImport:
+	case spv::OpMemoryModel:
+	case spv::OpCapability:
+	case spv::OpTypeInt:
+	case spv::OpTypeFloat:
+	case spv::OpConstant:
+	case spv::OpSpecConstant:
+		// Only literals
+		break;
+	case spv::OpName: // Target and name string
+	case spv::OpMemberName: // Type, member index and name string
+	case spv::OpLine: // File, line and column
+	case spv::OpDecorate: // Target, decoration and its literals
+	case spv::OpMemberDecorate: // Type, member index, decoration and its literals
+	case spv::OpExecutionMode: // Entry point, mode and its literals
+	case spv::OpTypeVector: // Component type and count
+	case spv::OpTypeMatrix: // Column type and count
+	case spv::OpTypeImage: // Sampled type and image properties
+	case spv::OpLoad: // Pointer and optional memory access
+	case spv::OpCompositeExtract: // Composite and indices
+	case spv::OpSelectionMerge: // Merge block and selection control
+		add_range(0, 1);
+		break;
+	case spv::OpStore: // Pointer, object and optional memory access
+	case spv::OpCompositeInsert: // Object, composite and indices
+	case spv::OpVectorShuffle: // Two vectors and component indices
+	case spv::OpLoopMerge: // Merge block, continue target and loop control
+		add_range(0, 2);
+		break;
+	case spv::OpBranchConditional: // Condition, true label, false label and optional branch weights
+		add_range(0, 3);
+		break;
+	case spv::OpTypePointer: // Storage class and type
+	case spv::OpVariable: // Storage class and optional initializer
+	case spv::OpFunction: // Function control and function type
+		add_range(1, count);
+		break;
+	case spv::OpEntryPoint: // Execution model, entry point, name string and interface variables
+		add_range(1, 2);
+		add_range(2 + inst.string_operand_length(2), count);
+		break;
+	case spv::OpExtInst: // Instruction set, instruction number and operands
+		add_range(0, 1);
+		add_range(2, count);
+		break;
+	case spv::OpSwitch: // Selector, default label and pairs of a literal and a label
+		add_range(0, 2);
+		for (size_t i = 3; i < count; i += 2)
+			ids.push_back(i);
+		break;
+	case spv::OpImageSampleImplicitLod:
+	case spv::OpImageSampleExplicitLod:
+	case spv::OpImageFetch:
+	case spv::OpImageRead:
+		// Image, coordinate, optional image operands mask and the operands it lists
+		add_range(0, 2);
+		add_range(3, count);
+		break;
+	case spv::OpImageGather:
+	case spv::OpImageWrite:
+		// Image, coordinate, component or texel, optional image operands mask and the operands it lists
+		add_range(0, 3);
+		add_range(4, count);
+		break;
+	default:
+		add_range(0, count);
+		break;
+	}
+
+	return ids;
+}
+
+static bool parse_spirv_module(const std::basic_string<char> &code, uint32_t &bound, std::vector<spirv_instruction> &instructions)
+{
+	if (code.size() % sizeof(uint32_t) != 0 || code.size() < 5 * sizeof(uint32_t))
+		return false;
+
+	std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+	std::memcpy(words.data(), code.data(), code.size());
+
+	if (words[0] != spv::MagicNumber)
+		return false;
+	bound = words[3];
+
+	for (size_t offset = 5; offset < words.size();)
+	{
+		const size_t word_count = words[offset] >> spv::WordCountShift;
+		if (word_count == 0 || offset + word_count > words.size())
+			return false;
+
+		spirv_instruction &inst = instructions.emplace_back();
+		inst.op = static_cast<spv::Op>(words[offset] & spv::OpCodeMask);
+
+		bool has_type, has_result;
+		get_spirv_instruction_layout(inst.op, has_type, has_result);
+		if (1 + has_type + has_result > word_count)
+			return false;
+
+		size_t index = offset + 1;
+		if (has_type)
+			inst.type = words[index++];
+		if (has_result)
+			inst.result = words[index++];
+		inst.operands.assign(words.begin() + index, words.begin() + offset + word_count);
+
+		offset += word_count;
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Checks that a compacted module only references <id>s it defines, that these are numbered densely, that declarations kept their names and that interface and resource variables carry the decorations Vulkan requires.
+/// </summary>
+static void check_compact_spirv_module(const std::vector<spirv_instruction> &instructions, uint32_t bound, const std::string &context)
+{
+	std::vector<const spirv_instruction *> definitions(bound);
+
+	for (const spirv_instruction &inst : instructions)
+	{
+		if (inst.result == 0 && inst.op != spv::OpNop)
+		{
+			bool has_type, has_result;
+			get_spirv_instruction_layout(inst.op, has_type, has_result);
+			CHECK_MESSAGE(!has_result, context + ": result <id> is zero");
+			continue;
+		}
+
+		if (inst.result >= bound)
+		{
+			CHECK_MESSAGE(inst.result < bound, context + ": result <id> " + std::to_string(inst.result) + " is not below the bound " + std::to_string(bound));
+			continue;
+		}
+
+		CHECK_MESSAGE(definitions[inst.result] == nullptr, context + ": <id> " + std::to_string(inst.result) + " is defined more than once");
+		definitions[inst.result] = &inst;
+	}
+
+	// Renumbering leaves no gaps, so every <id> below the bound is defined
+	for (uint32_t id = 1; id < bound; ++id)
+		CHECK_MESSAGE(definitions[id] != nullptr, context + ": <id> " + std::to_string(id) + " below the bound is not defined");
+
+	for (const spirv_instruction &inst : instructions)
+	{
+		std::vector<uint32_t> referenced_ids = { inst.type };
+		if (inst.type == 0)
+			referenced_ids.clear();
+		for (const size_t index : get_spirv_id_operands(inst))
+			referenced_ids.push_back(inst.operands[index]);
+
+		for (const uint32_t id : referenced_ids)
+			CHECK_MESSAGE(id != 0 && id < bound && definitions[id] != nullptr,
+				context + ": instruction " + std::to_string(inst.op) + " references undefined <id> " + std::to_string(id));
+	}
+
+	std::map<uint32_t, std::vector<uint32_t>> decorations;
+	for (const spirv_instruction &inst : instructions)
+		if (inst.op == spv::OpDecorate && !inst.operands.empty())
+			decorations[inst.operands[0]].push_back(inst.operands.size() > 1 ? inst.operands[1] : spv::DecorationMax);
+
+	const auto has_decoration = [&decorations](uint32_t id, spv::Decoration decoration) {
+		const auto it = decorations.find(id);
+		return it != decorations.end() && std::find(it->second.begin(), it->second.end(), static_cast<uint32_t>(decoration)) != it->second.end();
+	};
+
+	for (const spirv_instruction &inst : instructions)
+	{
+		if (inst.op != spv::OpEntryPoint)
+			continue;
+
+		for (size_t i = 2 + inst.string_operand_length(2); i < inst.operands.size(); ++i)
+		{
+			const uint32_t id = inst.operands[i];
+			if (id >= bound || definitions[id] == nullptr)
+				continue; // Already reported above
+
+			CHECK_MESSAGE(definitions[id]->op == spv::OpVariable, context + ": interface <id> " + std::to_string(id) + " is not a variable");
+			CHECK_MESSAGE(has_decoration(id, spv::DecorationBuiltIn) || has_decoration(id, spv::DecorationLocation),
+				context + ": interface variable " + std::to_string(id) + " has neither a built-in nor a location decoration");
+		}
+	}
+
+	// Debug information is enabled, so all functions and global variables are named
+	std::vector<bool> named(bound);
+	for (const spirv_instruction &inst : instructions)
+		if (inst.op == spv::OpName && !inst.operands.empty() && inst.operands[0] < bound)
+			named[inst.operands[0]] = true;
+
+	bool is_global = true;
+	for (const spirv_instruction &inst : instructions)
+	{
+		if (inst.op == spv::OpFunction)
+			is_global = false;
+		if ((inst.op == spv::OpFunction || (is_global && inst.op == spv::OpVariable)) && inst.result < bound)
+			CHECK_MESSAGE(named[inst.result], context + ": declaration " + std::to_string(inst.result) + " lost its name");
+		if (inst.op == spv::OpFunctionEnd)
+			is_global = true;
+	}
+
+	for (const spirv_instruction &inst : instructions)
+	{
+		if (inst.op != spv::OpVariable || inst.operands.empty() || (inst.operands[0] != spv::StorageClassUniform && inst.operands[0] != spv::StorageClassUniformConstant))
+			continue;
+
+		CHECK_MESSAGE(has_decoration(inst.result, spv::DecorationBinding) && has_decoration(inst.result, spv::DecorationDescriptorSet),
+			context + ": resource variable " + std::to_string(inst.result) + " is missing its binding decorations");
+	}
+}
+
+/// <summary>
+/// Builds a description of every named variable, function and structure in a module, made up of its name, kind and decorations (with binding indices left out, since those are reassigned per entry point).
+/// </summary>
+static std::vector<std::string> describe_named_spirv_declarations(const std::vector<spirv_instruction> &instructions)
+{
+	std::map<uint32_t, spv::Op> kinds;
+	std::map<uint32_t, std::string> names;
+	std::map<uint32_t, std::vector<std::string>> decorations;
+
+	bool is_global = true;
+	for (const spirv_instruction &inst : instructions)
+	{
+		if (inst.op == spv::OpFunction)
+			is_global = false;
+		if (inst.op == spv::OpFunction || (is_global && (inst.op == spv::OpVariable || inst.op == spv::OpTypeStruct)))
+			kinds[inst.result] = inst.op;
+		if (inst.op == spv::OpFunctionEnd)
+			is_global = true;
+
+		if (inst.op == spv::OpName)
+			names[inst.operands[0]] = inst.string_operand(1);
+
+		if (inst.op == spv::OpDecorate || inst.op == spv::OpMemberDecorate)
+		{
+			std::string decoration = inst.op == spv::OpMemberDecorate ? "member" : "";
+			for (size_t i = 1; i < inst.operands.size(); ++i)
+				decoration += ' ' + std::to_string(inst.operands[i]);
+
+			const size_t decoration_index = inst.op == spv::OpMemberDecorate ? 2 : 1;
+			if (inst.operands.size() > decoration_index + 1 && inst.operands[decoration_index] == spv::DecorationBinding)
+				decoration = decoration.substr(0, decoration.rfind(' '));
+
+			decorations[inst.operands[0]].push_back(std::move(decoration));
+		}
+	}
+
+	std::vector<std::string> descriptions;
+	for (const std::pair<const uint32_t, spv::Op> &kind : kinds)
+	{
+		const auto name_it = names.find(kind.first);
+		if (name_it == names.end())
+			continue;
+
+		std::vector<std::string> &kind_decorations = decorations[kind.first];
+		std::sort(kind_decorations.begin(), kind_decorations.end());
+
+		std::string description = std::to_string(kind.second) + ' ' + name_it->second + ':';
+		for (const std::string &decoration : kind_decorations)
+			description += " [" + decoration + ']';
+		descriptions.push_back(std::move(description));
+	}
+
+	std::sort(descriptions.begin(), descriptions.end());
+	return descriptions;
+}
+
+TEST_CASE(codegen_spirv_compact_modules_are_valid)
+{
+	size_t effect_count = 0;
+
+	std::error_code ec;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(reshadefx::test::effects_path(), ec))
+	{
+		if (entry.path().extension() != ".fx")
+			continue;
+
+		effect_count++;
+
+		reshadefx::preprocessor pp;
+		pp.add_macro_definition("__RESHADE__", "50000");
+		pp.add_macro_definition("BUFFER_WIDTH", "800");
+		pp.add_macro_definition("BUFFER_HEIGHT", "600");
+		pp.add_macro_definition("BUFFER_RCP_WIDTH", "(1.0 / BUFFER_WIDTH)");
+		pp.add_macro_definition("BUFFER_RCP_HEIGHT", "(1.0 / BUFFER_HEIGHT)");
+		CHECK_MESSAGE(pp.append_file(entry.path()), pp.errors());
+
+		const std::unique_ptr<reshadefx::codegen> backend(reshadefx::create_codegen_spirv(true, true, false, false, false, false));
+
+		reshadefx::parser parser;
+		CHECK_MESSAGE(parser.parse(pp.output(), backend.get()), entry.path().u8string() + ": " + parser.errors());
+
+		const std::string effect_name = entry.path().filename().u8string();
+
+		uint32_t module_bound = 0;
+		std::vector<spirv_instruction> module_instructions;
+		if (!parse_spirv_module(backend->finalize_code(), module_bound, module_instructions))
+		{
+			CHECK_MESSAGE(false, effect_name + ": module is not well-formed");
+			continue;
+		}
+
+		check_compact_spirv_module(module_instructions, module_bound, effect_name);
+
+		const std::vector<std::string> module_declarations = describe_named_spirv_declarations(module_instructions);
+
+		size_t module_entry_point_count = 0;
+		for (const spirv_instruction &inst : module_instructions)
+			if (inst.op == spv::OpEntryPoint)
+				module_entry_point_count++;
+		CHECK_MESSAGE(module_entry_point_count == backend->module().entry_points.size(), effect_name + ": entry points were removed from the module");
+
+		for (const std::pair<std::string, reshadefx::shader_type> &entry_point : backend->module().entry_points)
+		{
+			const std::string context = effect_name + ": " + entry_point.first;
+
+			uint32_t bound = 0;
+			std::vector<spirv_instruction> instructions;
+			if (!parse_spirv_module(backend->finalize_code_for_entry_point(entry_point.first), bound, instructions))
+			{
+				CHECK_MESSAGE(false, context + ": module is not well-formed");
+				continue;
+			}
+
+			check_compact_spirv_module(instructions, bound, context);
+
+			// The entry point has to be the only one left and still list the same interface variables as in the whole module
+			const auto find_entry_point = [&entry_point](const std::vector<spirv_instruction> &instructions) -> const spirv_instruction * {
+				for (const spirv_instruction &inst : instructions)
+					if (inst.op == spv::OpEntryPoint && inst.string_operand(2) == entry_point.first)
+						return &inst;
+				return nullptr;
+			};
+
+			const spirv_instruction *const entry_point_inst = find_entry_point(instructions);
+			const spirv_instruction *const module_entry_point_inst = find_entry_point(module_instructions);
+			CHECK_MESSAGE(entry_point_inst != nullptr && module_entry_point_inst != nullptr, context + ": entry point declaration is missing");
+			if (entry_point_inst == nullptr || module_entry_point_inst == nullptr)
+				continue;
+
+			CHECK(std::count_if(instructions.begin(), instructions.end(), [](const spirv_instruction &inst) { return inst.op == spv::OpEntryPoint; }) == 1);
+			CHECK_MESSAGE(entry_point_inst->operands.size() == module_entry_point_inst->operands.size(), context + ": interface variables were removed from the entry point");
+
+			// Every named declaration that is kept has to have the same name and decorations as in the whole module
+			for (const std::string &declaration : describe_named_spirv_declarations(instructions))
+				CHECK_MESSAGE(std::binary_search(module_declarations.begin(), module_declarations.end(), declaration), context + ": declaration differs from the whole module: " + declaration);
+		}
+	}
+
+	CHECK_MESSAGE(effect_count != 0, "no effects found in " + reshadefx::test::effects_path().u8string());
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "effect_parser.hpp"
+#include "effect_codegen.hpp"
+#include "effect_preprocessor.hpp"
+#include <memory>
+
+static void add_default_macro_definitions(reshadefx::preprocessor &pp)
+{
+	pp.add_macro_definition("__RESHADE__", "50000");
+	pp.add_macro_definition("BUFFER_WIDTH", "800");
+	pp.add_macro_definition("BUFFER_HEIGHT", "600");
+	pp.add_macro_definition("BUFFER_RCP_WIDTH", "(1.0 / BUFFER_WIDTH)");
+	pp.add_macro_definition("BUFFER_RCP_HEIGHT", "(1.0 / BUFFER_HEIGHT)");
+}
+
+TEST_CASE(parser_compile_test_effects)
+{
+	size_t effect_count = 0;
+
+	std::error_code ec;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(reshadefx::test::effects_path(), ec))
+	{
+		if (entry.path().extension() != ".fx")
+			continue;
+
+		effect_count++;
+
+		reshadefx::preprocessor pp;
+		add_default_macro_definitions(pp);
+		CHECK_MESSAGE(pp.append_file(entry.path()), pp.errors());
+
+		for (int target = 0; target < 3; ++target)
+		{
+			std::unique_ptr<reshadefx::codegen> backend(
+				target == 0 ? reshadefx::create_codegen_hlsl(50, true, false) :
+				target == 1 ? reshadefx::create_codegen_glsl(false, true, false) :
+				              reshadefx::create_codegen_spirv(true, true, false));
+
+			reshadefx::parser parser;
+			CHECK_MESSAGE(parser.parse(pp.output(), backend.get()), entry.path().u8string() + ": " + parser.errors());
+			CHECK(parser.errors().find("error") == std::string::npos);
+			CHECK(!backend->module().entry_points.empty());
+		}
+	}
+
+	CHECK_MESSAGE(effect_count != 0, "no effects found in " + reshadefx::test::effects_path().u8string());
+}
+
+TEST_CASE(parser_error_locations_reference_included_files)
+{
+	reshadefx::preprocessor pp;
+	add_default_macro_definitions(pp);
+	pp.add_include_path(reshadefx::test::effects_path());
+	// Make code in the included file reference an undeclared identifier
+	pp.add_macro_definition("RESHADE_DEPTH_LINEARIZATION_FAR_PLANE", "undeclared_a");
+	CHECK(pp.append_string(
+		"#include \"ReShade.fxh\"\n"
+		"float4 b = undeclared_b;\n", "main.fx"));
+
+	std::unique_ptr<reshadefx::codegen> backend(reshadefx::create_codegen_hlsl(50, false, false));
+
+	reshadefx::parser parser;
+	CHECK(!parser.parse(pp.output(), backend.get()));
+
+	// Errors have to be reported with the file name that was active at their location, including after switching back from an included file
+	const std::string &errors = parser.errors();
+	CHECK_MESSAGE(errors.find((reshadefx::test::effects_path() / "ReShade.fxh").u8string() + "(48, ") != std::string::npos, errors);
+	CHECK_MESSAGE(errors.find("main.fx(2, ") != std::string::npos, errors);
+}
+
+TEST_CASE(preprocessor_error_locations_reference_included_files)
+{
+	reshadefx::preprocessor pp;
+	add_default_macro_definitions(pp);
+	pp.add_include_path(reshadefx::test::effects_path());
+	// Make a conditional in the included file fail to evaluate
+	pp.add_macro_definition("RESHADE_DEPTH_INPUT_IS_REVERSED", "(");
+	CHECK(!pp.append_string(
+		"#include \"ReShade.fxh\"\n"
+		"#if\n"
+		"#endif\n", "main.fx"));
+
+	const std::string &errors = pp.errors();
+	CHECK_MESSAGE(errors.find((reshadefx::test::effects_path() / "ReShade.fxh").u8string() + '(') != std::string::npos, errors);
+	CHECK_MESSAGE(errors.find("main.fx(2, ") != std::string::npos, errors);
+}
+
+TEST_CASE(parser_constructor_arguments_are_flattened_to_scalars)
+{
+	reshadefx::preprocessor pp;
+	CHECK(pp.append_string(
+		"uniform float2x2 m;\n"
+		"uniform float3 v;\n"
+		"uniform float s;\n"
+		"float4 main() : SV_Target\n"
+		"{\n"
+		"	float4x4 a = float4x4(m, s, s, s, s, s, s, s, s, s, s, s, s);\n"
+		"	float4 b = float4(v, s);\n"
+		"	float3x3 c = float3x3(v, m, s, s);\n"
+		"	return a[0] + b + c[0].xyzz;\n"
+		"}\n", "test.fx"));
+
+	std::unique_ptr<reshadefx::codegen> backend(reshadefx::create_codegen_hlsl(50, false, false));
+
+	reshadefx::parser parser;
+	CHECK_MESSAGE(parser.parse(pp.output(), backend.get()), parser.errors());
+
+	// Matrix arguments are indexed by row and then by column, so that each contributes exactly as many scalars as it has components
+	const std::string code = backend->finalize_code();
+	CHECK_MESSAGE(code.find("float4x4(m[0].x, m[0].y, m[1].x, m[1].y, s, s, s, s, s, s, s, s, s, s, s, s)") != std::string::npos, code);
+	CHECK_MESSAGE(code.find("float4(v.x, v.y, v.z, s)") != std::string::npos, code);
+	CHECK_MESSAGE(code.find("float3x3(v.x, v.y, v.z, m[0].x, m[0].y, m[1].x, m[1].y, s, s)") != std::string::npos, code);
+	CHECK_MESSAGE(code.find("m[2]") == std::string::npos, code);
+}
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "effect_lexer.hpp"
+#include "effect_preprocessor.hpp"
+#include <fstream>
+#include <algorithm>
+
+static void write_file(const std::filesystem::path &path, const std::string &data)
+{
+	std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+}
+
+static bool preprocess(const std::string &source_code, std::string &output, std::string &errors)
+{
+	reshadefx::preprocessor pp;
+	const bool success = pp.append_string(source_code, "test.fx");
+	output = pp.output();
+	errors = pp.errors();
+	return success;
+}
+
+TEST_CASE(preprocessor_function_like_macro_without_arguments_in_condition)
+{
+	std::string output, errors;
+
+	// A function-like macro name that is not followed by arguments is an identifier that evaluates to zero
+	CHECK(preprocess(
+		"#define F(a) a\n"
+		"#if F > 2\n"
+		"fail\n"
+		"#elif F == 0\n"
+		"pass\n"
+		"#endif\n", output, errors));
+	CHECK_MESSAGE(errors.empty(), errors);
+	CHECK(output.find("pass") != std::string::npos);
+	CHECK(output.find("fail") == std::string::npos);
+
+	// The whitespace token following the macro name must not be mistaken for the 'defined' or 'exists' operators either
+	CHECK(preprocess(
+		"#define F(a) a\n"
+		"#if !F && !(F)\n"
+		"pass\n"
+		"#endif\n", output, errors));
+	CHECK_MESSAGE(errors.empty(), errors);
+	CHECK(output.find("pass") != std::string::npos);
+}
+
+TEST_CASE(preprocessor_defined_operator)
+{
+	std::string output, errors;
+
+	CHECK(preprocess(
+		"#define A\n"
+		"#define F(a) a\n"
+		"#if defined A && defined(F) && !defined(B) && F(3) == 3\n"
+		"pass\n"
+		"#endif\n", output, errors));
+	CHECK_MESSAGE(errors.empty(), errors);
+	CHECK(output.find("pass") != std::string::npos);
+}
+
+TEST_CASE(preprocessor_records_looked_up_files)
+{
+	const std::filesystem::path &effects_path = reshadefx::test::effects_path();
+
+	reshadefx::preprocessor pp;
+	pp.add_include_path(effects_path / "missing");
+	pp.add_include_path(effects_path);
+	CHECK(pp.append_string(
+		"#include \"ReShade.fxh\"\n"
+		"#if exists(\"Missing.fxh\")\n"
+		"fail\n"
+		"#endif\n", effects_path / "sub" / "test.fx"));
+	CHECK_MESSAGE(pp.errors().empty(), pp.errors());
+
+	// Every candidate path has to be recorded, including those where no file existed, since a file appearing there would be found first
+	const std::vector<std::pair<std::filesystem::path, bool>> looked_up_files = pp.looked_up_files();
+	const auto was_looked_up = [&looked_up_files](const std::filesystem::path &path, bool exists) {
+		return std::find(looked_up_files.begin(), looked_up_files.end(), std::make_pair(path, exists)) != looked_up_files.end();
+	};
+
+	CHECK(was_looked_up(effects_path / "sub" / "ReShade.fxh", false));
+	CHECK(was_looked_up(effects_path / "missing" / "ReShade.fxh", false));
+	CHECK(was_looked_up(effects_path / "ReShade.fxh", true));
+	CHECK(was_looked_up(effects_path / "sub" / "Missing.fxh", false));
+	CHECK(was_looked_up(effects_path / "missing" / "Missing.fxh", false));
+	CHECK(was_looked_up(effects_path / "Missing.fxh", false));
+}
+
+TEST_CASE(preprocessor_shares_included_files_between_instances)
+{
+	const std::filesystem::path directory = reshadefx::test::create_temp_directory("reshadefx_preprocessor_test");
+	write_file(directory / "Shared.fxh", "shared_before\n");
+
+	const auto preprocess_including_shared = [&directory](std::string &output) {
+		reshadefx::preprocessor pp;
+		const bool success = pp.append_string("#include \"Shared.fxh\"\n", directory / "test.fx");
+		CHECK_MESSAGE(pp.errors().empty(), pp.errors());
+		output = pp.output();
+		return success;
+	};
+
+	size_t hits_started = 0, misses_started = 0, hits = 0, misses = 0;
+	reshadefx::preprocessor::get_shared_file_cache_statistics(hits_started, misses_started);
+
+	std::string output;
+	CHECK(preprocess_including_shared(output));
+	CHECK(output.find("shared_before") != std::string::npos);
+	reshadefx::preprocessor::get_shared_file_cache_statistics(hits, misses);
+	CHECK(hits == hits_started && misses == misses_started + 1);
+
+	// Another preprocessor instance including the same unchanged file reuses the data read by the first one
+	CHECK(preprocess_including_shared(output));
+	CHECK(output.find("shared_before") != std::string::npos);
+	reshadefx::preprocessor::get_shared_file_cache_statistics(hits, misses);
+	CHECK(hits == hits_started + 1 && misses == misses_started + 1);
+
+	// Changing the file has to read it again (the size changes too, so this is detected even if the modification time has a coarse resolution)
+	write_file(directory / "Shared.fxh", "shared_after_change\n");
+
+	CHECK(preprocess_including_shared(output));
+	CHECK(output.find("shared_after_change") != std::string::npos);
+	CHECK(output.find("shared_before") == std::string::npos);
+	reshadefx::preprocessor::get_shared_file_cache_statistics(hits, misses);
+	CHECK(hits == hits_started + 1 && misses == misses_started + 2);
+
+	std::error_code ec;
+	std::filesystem::remove_all(directory, ec);
+}
+
+static size_t count_occurrences(const std::string &output, const std::string &text)
+{
+	size_t count = 0;
+	for (size_t offset = 0; (offset = output.find(text, offset)) != std::string::npos; offset += text.size())
+		count++;
+	return count;
+}
+
+TEST_CASE(preprocessor_skips_files_with_include_guard)
+{
+	const std::filesystem::path directory = reshadefx::test::create_temp_directory("reshadefx_preprocessor_test");
+	write_file(directory / "Guarded.fxh",
+		"#ifndef GUARDED_FXH\n"
+		"#define GUARDED_FXH\n"
+		"guarded_content\n"
+		"#endif\n");
+	write_file(directory / "NotGuarded.fxh",
+		"#ifndef NOT_GUARDED_FXH\n"
+		"#define NOT_GUARDED_FXH\n"
+		"guarded_content\n"
+		"#endif\n"
+		"trailing_content\n");
+	write_file(directory / "Once.fxh",
+		"#pragma once\n"
+		"once_content\n");
+
+	// Including a file protected by an include guard a second time skips it
+	{
+		reshadefx::preprocessor pp;
+		CHECK(pp.append_string(
+			"#include \"Guarded.fxh\"\n"
+			"#include \"Guarded.fxh\"\n", directory / "test.fx"));
+		CHECK_MESSAGE(pp.errors().empty(), pp.errors());
+		CHECK(count_occurrences(pp.output(), "guarded_content") == 1);
+		CHECK(pp.skipped_include_count() == 1);
+	}
+
+	// Undefining the guard macro has to process the file again
+	{
+		reshadefx::preprocessor pp;
+		CHECK(pp.append_string(
+			"#include \"Guarded.fxh\"\n"
+			"#include \"Guarded.fxh\"\n"
+			"#undef GUARDED_FXH\n"
+			"#include \"Guarded.fxh\"\n", directory / "test.fx"));
+		CHECK_MESSAGE(pp.errors().empty(), pp.errors());
+		CHECK(count_occurrences(pp.output(), "guarded_content") == 2);
+		CHECK(pp.skipped_include_count() == 1);
+	}
+
+	// Tokens following the '#endif' mean the whole file is not guarded, so it cannot be skipped
+	{
+		reshadefx::preprocessor pp;
+		CHECK(pp.append_string(
+			"#include \"NotGuarded.fxh\"\n"
+			"#include \"NotGuarded.fxh\"\n", directory / "test.fx"));
+		CHECK_MESSAGE(pp.errors().empty(), pp.errors());
+		CHECK(count_occurrences(pp.output(), "guarded_content") == 1);
+		CHECK(count_occurrences(pp.output(), "trailing_content") == 2);
+		CHECK(pp.skipped_include_count() == 0);
+	}
+
+	// Files marked with '#pragma once' are only included once
+	{
+		reshadefx::preprocessor pp;
+		CHECK(pp.append_string(
+			"#include \"Once.fxh\"\n"
+			"#include \"Once.fxh\"\n", directory / "test.fx"));
+		CHECK_MESSAGE(pp.errors().empty(), pp.errors());
+		CHECK(count_occurrences(pp.output(), "once_content") == 1);
+		CHECK(pp.skipped_include_count() == 1);
+	}
+
+	std::error_code ec;
+	std::filesystem::remove_all(directory, ec);
+}
+
+TEST_CASE(preprocessor_line_numbers_after_skipped_block)
+{
+	std::string output, errors;
+
+	// Directives inside comments, string literals and continued lines of a skipped block must not be mistaken for directives, and all lines have to be counted
+	CHECK(!preprocess(
+		"#if 0\n"
+		"/* comment\n"
+		"#endif inside comment\n"
+		"*/\n"
+		"int a; /* comment\n"
+		"#endif inside comment\n"
+		"*/\n"
+		"\"string #endif\" // comment #endif\n"
+		"\"string continued \\\n"
+		"#endif inside string\"\n"
+		"#define X 1 \\\n"
+		"  + 2\n"
+		"#if 1\n"
+		"#elif 2\n"
+		"#else\n"
+		"#endif\n"
+		"'c'\n"
+		"\"unterminated string\n"
+		"#elif 0\n"
+		"#elif 1\n"
+		"#error \"here\"\n"
+		"#endif\n", output, errors));
+	CHECK_MESSAGE(errors.find("test.fx(21, 1): preprocessor error: here") != std::string::npos, errors);
+	// Unterminated string literals in a skipped block are not reported, like a C preprocessor does too
+	CHECK_MESSAGE(errors.find("unterminated") == std::string::npos, errors);
+
+	CHECK(!preprocess(
+		"#ifdef X\n"
+		"#if 1 /* comment\n"
+		"   */\n"
+		"#endif\n"
+		"#elif 0\n"
+		"#endif\n"
+		"\n"
+		"#error \"here\"\n", output, errors));
+	CHECK_MESSAGE(errors.find("test.fx(8, 1): preprocessor error: here") != std::string::npos, errors);
+}
+
+TEST_CASE(preprocessor_macro_expansion_matches_lexing_expanded_text)
+{
+	std::string output, errors;
+
+	// Expansions are pushed as the tokens stored with the macro definition instead of lexing the expanded text again, which has to result in the same output
+	// The expected output is what the preprocessor produced when it still lexed every expansion again (debug builds additionally compare each token input against lexing it)
+	CHECK(preprocess(
+		"#define ONE 1\n"
+		"#define TWO ONE + ONE\n"
+		"#define ADD(a, b) ((a) + (b))\n"
+		"#define MUL(a, b) ((a) * (b))\n"
+		"#define MAD(a, b, c) ADD(MUL(a, b), c)\n"
+		"#define STR(x) #x\n"
+		"#define XSTR(x) STR(x)\n"
+		"#define CAT(a, b) a##b\n"
+		"#define XCAT(a, b) CAT(a, b)\n"
+		"#define VEC(...) float4(__VA_ARGS__)\n"
+		"#define CALL(f, ...) f(__VA_ARGS__)\n"
+		"#define NEG(x) -x\n"
+		"#define EMPTY\n"
+		"float a = MAD(TWO, ONE, ADD(1, 2));\n"
+		"float b = CAT(ON, E) + XCAT(T, WO);\n"
+		"float4 c = VEC(1, ADD(2, 3), MUL(4, 5), ONE);\n"
+		"float d = CALL(ADD, ONE, CALL(MUL, 2, TWO));\n"
+		"string e = STR(ADD(1, 2)) XSTR(ADD(1, 2)) STR(\"quoted \\\"string\\\"\");\n"
+		"float f = -NEG(ONE) - -NEG(-1);\n"
+		"float g = CAT(1, 2)CAT(3,.5) EMPTY ONE EMPTY;\n"
+		"float h = XCAT(CAT(a, b), c)ONE;\n"
+		"float i = VEC() VEC(ONE) CALL(VEC, 1, 2);\n"
+		"float j = ADD( ONE ,\n"
+		"  TWO );\n", output, errors));
+	CHECK_MESSAGE(errors.empty(), errors);
+	CHECK_MESSAGE(output ==
+		"#line 1 \"test.fx\"\n"
+		"#line 14\n"
+		"float a = ((((1 + 1) * (1))) + (((1) + (2))));\n"
+		"float b = 1 + 1 + 1;\n"
+		"float4 c = float4(1, ((2) + (3)), ((4) * (5)), 1);\n"
+		"float d = ((1) + (((2) * (1 + 1))));\n"
+		"string e = \"ADD(1, 2)\" \"((1) + (2))\" \"\\\"quoted \\\\\"string\\\\\"\\\"\";\n"
+		"float f = - -1 - - --1;\n"
+		"float g = 123.5  1 ;\n"
+		"float h = abc1;\n"
+		"float i = float4() float4(1) float4(1, 2);\n"
+		"#line 25\n"
+		"float j = ((1) + (\n"
+		"#line 24\n"
+		"1 + 1));\n"
+		"\n", output);
+}
+
+// Lexes preprocessed output the same way the parser does and describes every token with its location, so that outputs which only differ in line directives and empty lines compare equal
+static std::vector<std::string> lex_like_parser(const std::string &output)
+{
+	reshadefx::string_table source_files;
+	source_files.intern({});
+	reshadefx::lexer lexer(std::make_shared<const std::string>(output), nullptr, &source_files);
+
+	std::vector<std::string> tokens;
+	for (reshadefx::token tok = lexer.lex(); tok != reshadefx::tokenid::end_of_file; tok = lexer.lex())
+		tokens.push_back(std::string(source_files.name(tok.location.source)) + '(' + std::to_string(tok.location.line) + ", " + std::to_string(tok.location.column) + "): " + std::to_string(static_cast<int>(tok.id)) + ' ' + std::string(lexer.token_string(tok)));
+	return tokens;
+}
+
+TEST_CASE(preprocessor_prefix_snapshot_matches_full_preprocess)
+{
+	size_t effect_count = 0;
+
+	std::error_code ec;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(reshadefx::test::effects_path(), ec))
+	{
+		if (entry.path().extension() != ".fx")
+			continue;
+
+		effect_count++;
+
+		reshadefx::preprocessor pp;
+		pp.add_macro_definition("BUFFER_WIDTH", "800");
+		pp.add_macro_definition("BUFFER_HEIGHT", "600");
+
+		reshadefx::preprocessor full(pp);
+		CHECK_MESSAGE(full.append_file(entry.path()), full.errors());
+
+		// Process the leading includes in a copy and continue with the rest of the file from a snapshot of that, like the runtime does to share the prefix between effects
+		std::string effect_source, leading_includes;
+		CHECK(reshadefx::preprocessor::read_file_split_leading_includes(entry.path(), effect_source, leading_includes));
+		CHECK(!leading_includes.empty());
+
+		reshadefx::preprocessor prefix(pp);
+		CHECK_MESSAGE(prefix.append_string(leading_includes, entry.path().parent_path() / std::filesystem::path()), prefix.errors());
+		const reshadefx::preprocessor snapshot(prefix);
+
+		reshadefx::preprocessor split(snapshot);
+		CHECK_MESSAGE(split.append_string(std::move(effect_source), entry.path()), split.errors());
+
+		// The output text differs in the line directives around the prefix, but the parser has to see the same tokens at the same locations
+		CHECK_MESSAGE(lex_like_parser(split.output()) == lex_like_parser(full.output()), entry.path().u8string());
+		CHECK_MESSAGE(split.errors() == full.errors(), entry.path().u8string() + ": " + split.errors());
+		CHECK(split.used_macro_definitions() == full.used_macro_definitions());
+		CHECK(split.used_pragma_directives() == full.used_pragma_directives());
+
+		// The runtime records the included files as dependencies of the effect, so they have to be the same too (and never contain the effect file itself)
+		std::vector<std::filesystem::path> split_included_files = split.included_files(), full_included_files = full.included_files();
+		std::sort(split_included_files.begin(), split_included_files.end());
+		std::sort(full_included_files.begin(), full_included_files.end());
+		CHECK(!full_included_files.empty());
+		CHECK(split_included_files == full_included_files);
+		CHECK(std::find(full_included_files.begin(), full_included_files.end(), entry.path()) == full_included_files.end());
+
+		std::vector<std::pair<std::filesystem::path, bool>> split_looked_up_files = split.looked_up_files(), full_looked_up_files = full.looked_up_files();
+		std::sort(split_looked_up_files.begin(), split_looked_up_files.end());
+		std::sort(full_looked_up_files.begin(), full_looked_up_files.end());
+		CHECK(split_looked_up_files == full_looked_up_files);
+	}
+
+	CHECK_MESSAGE(effect_count != 0, "no effects found in " + reshadefx::test::effects_path().u8string());
+}
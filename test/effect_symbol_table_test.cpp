@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "effect_symbol_table.hpp"
+#include <deque>
+#include <functional>
+
+using namespace reshadefx;
+
+static const type t_float = { type::t_float, 1, 1 };
+static const type t_float2 = { type::t_float, 2, 1 };
+static const type t_int = { type::t_int, 1, 1 };
+static const type t_uint = { type::t_uint, 1, 1 };
+static const type t_bool = { type::t_bool, 1, 1 };
+
+static std::vector<expression> make_arguments(std::initializer_list<type> types)
+{
+	std::vector<expression> arguments;
+	for (const type &type : types)
+		arguments.emplace_back().reset_to_rvalue({}, 0, type);
+	return arguments;
+}
+
+TEST_CASE(symbol_table_cached_overload_resolution_matches_full_resolution)
+{
+	// Functions need stable addresses, since the symbol table only references them
+	std::deque<function> functions;
+	const auto insert_function = [&functions](const char *name, type return_type, std::initializer_list<type> parameter_types, bool last_has_default_value = false) {
+		function &info = functions.emplace_back();
+		info.name = name;
+		info.return_type = return_type;
+		for (const type &type : parameter_types)
+			info.parameter_list.emplace_back().type = type;
+		if (last_has_default_value)
+			info.parameter_list.back().has_default_value = true;
+		const uint32_t id = static_cast<uint32_t>(functions.size());
+		return [&info, name, id](symbol_table &table) {
+			symbol symbol = { symbol_type::function, id, { type::t_function } };
+			symbol.function = &info;
+			table.insert_symbol(name, symbol, true);
+		};
+	};
+
+	struct query
+	{
+		const char *name;
+		std::vector<expression> arguments;
+	};
+	const std::vector<query> queries = {
+		{ "f", make_arguments({ t_float }) },
+		{ "f", make_arguments({ t_int }) },
+		{ "f", make_arguments({ t_uint }) },
+		{ "f", make_arguments({ t_bool }) },
+		{ "f", make_arguments({ t_float2 }) },
+		{ "f", make_arguments({ t_float, t_float }) },
+		{ "f", make_arguments({}) },
+		{ "g", make_arguments({ t_float }) },
+		{ "abs", make_arguments({ t_float2 }) },
+		{ "abs", make_arguments({ t_int }) },
+		{ "max", make_arguments({ t_float, t_int }) },
+		{ "lerp", make_arguments({ t_float2, t_float2, t_float }) },
+	};
+
+	// Sequence of changes to the symbol table, between which every query is checked
+	const std::vector<std::function<void(symbol_table &)>> steps = {
+		[](symbol_table &) {},
+		insert_function("f", t_float, { t_float }),
+		insert_function("f", t_int, { t_int }),
+		// Overload that is as viable as the previous ones for some argument types, making those calls ambiguous
+		insert_function("f", t_uint, { t_uint }),
+		insert_function("g", t_float, { t_float }),
+		[](symbol_table &table) { table.enter_namespace("ns"); },
+		insert_function("f", t_float2, { t_float2 }),
+		insert_function("f", t_float, { t_float, t_float }, true),
+		// A function shadowing an intrinsic in a namespace
+		insert_function("abs", t_float2, { t_float2 }),
+		[](symbol_table &table) { table.enter_scope(); },
+		[](symbol_table &table) { table.leave_scope(); },
+		[](symbol_table &table) { table.leave_namespace(); },
+		insert_function("f", t_bool, {}),
+		insert_function("abs", t_int, { t_int }),
+		[](symbol_table &table) { table.enter_namespace("other"); },
+		insert_function("g", t_int, { t_float }),
+		[](symbol_table &table) { table.leave_namespace(); },
+		[](symbol_table &table) { table.enter_namespace("ns"); },
+	};
+
+	symbol_table cached_table;
+
+	for (size_t step = 0; step < steps.size(); ++step)
+	{
+		steps[step](cached_table);
+
+		// Build a new symbol table from scratch that has not seen any previous calls, so its results are those of a full overload resolution
+		symbol_table reference_table;
+		for (size_t i = 0; i <= step; ++i)
+			steps[i](reference_table);
+
+		for (const query &query : queries)
+		{
+			symbol reference_data = {};
+			bool reference_ambiguous = false;
+			const bool reference_result = reference_table.resolve_function_call(query.name, query.arguments, reference_table.current_scope(), reference_data, reference_ambiguous);
+
+			// Resolve twice, so that the second call is guaranteed to be answered from the cache
+			for (int repeat = 0; repeat < 2; ++repeat)
+			{
+				symbol data = {};
+				bool ambiguous = false;
+				const bool result = cached_table.resolve_function_call(query.name, query.arguments, cached_table.current_scope(), data, ambiguous);
+
+				const std::string message = "step " + std::to_string(step) + ", call to '" + query.name + "' with " + std::to_string(query.arguments.size()) + " argument(s)";
+				CHECK_MESSAGE(result == reference_result, message);
+				CHECK_MESSAGE(ambiguous == reference_ambiguous, message);
+				CHECK_MESSAGE(data.op == reference_data.op, message);
+				CHECK_MESSAGE(data.id == reference_data.id, message);
+				CHECK_MESSAGE(data.type == reference_data.type, message);
+				CHECK_MESSAGE(data.function == reference_data.function, message);
+			}
+		}
+	}
+}
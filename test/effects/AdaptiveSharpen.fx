@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Contrast adaptive sharpening on a 3x3 neighborhood
+
+#include "ReShade.fxh"
+
+uniform float Contrast <
+	ui_type = "slider";
+	ui_label = "Contrast adaptation";
+	ui_min = 0.0; ui_max = 1.0;
+> = 0.0;
+uniform float Sharpening <
+	ui_type = "slider";
+	ui_label = "Sharpening intensity";
+	ui_min = 0.0; ui_max = 1.0;
+> = 1.0;
+uniform bool ShowMask <
+	ui_label = "Show sharpening mask";
+> = false;
+
+float3 Min3(float3 a, float3 b, float3 c) { return min(a, min(b, c)); }
+float3 Max3(float3 a, float3 b, float3 c) { return max(a, max(b, c)); }
+
+float4 SharpenPS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	// a b c
+	// d e f
+	// g h i
+	const float2 px = BUFFER_PIXEL_SIZE;
+	const float3 a = tex2D(ReShade::BackBuffer, texcoord + float2(-px.x, -px.y)).rgb;
+	const float3 b = tex2D(ReShade::BackBuffer, texcoord + float2(0.0, -px.y)).rgb;
+	const float3 c = tex2D(ReShade::BackBuffer, texcoord + float2(px.x, -px.y)).rgb;
+	const float3 d = tex2D(ReShade::BackBuffer, texcoord + float2(-px.x, 0.0)).rgb;
+	const float3 e = tex2D(ReShade::BackBuffer, texcoord).rgb;
+	const float3 f = tex2D(ReShade::BackBuffer, texcoord + float2(px.x, 0.0)).rgb;
+	const float3 g = tex2D(ReShade::BackBuffer, texcoord + float2(-px.x, px.y)).rgb;
+	const float3 h = tex2D(ReShade::BackBuffer, texcoord + float2(0.0, px.y)).rgb;
+	const float3 i = tex2D(ReShade::BackBuffer, texcoord + float2(px.x, px.y)).rgb;
+
+	// Soft min and max, the diagonals are added to the cross to smooth the result
+	float3 mn = Min3(Min3(d, e, f), b, h);
+	const float3 mn2 = Min3(mn, a, Min3(c, g, i));
+	mn += mn2;
+
+	float3 mx = Max3(Max3(d, e, f), b, h);
+	const float3 mx2 = Max3(mx, a, Max3(c, g, i));
+	mx += mx2;
+
+	// Smooth minimum distance to signal limit divided by smooth max
+	const float3 rcp_mx = rcp(mx);
+	float3 amp = saturate(min(mn, 2.0 - mx) * rcp_mx);
+
+	// Shaping amount of sharpening
+	amp = rsqrt(amp);
+
+	const float peak = -3.0 * Contrast + 8.0;
+	const float3 w = -rcp(amp * peak);
+	const float3 rcp_weight = rcp(1.0 + 4.0 * w);
+
+	const float3 window = (b + d) + (f + h);
+	const float3 output = saturate((window * w + e) * rcp_weight);
+
+	if (ShowMask)
+		return float4(abs(output - e) * 8.0, 1.0);
+
+	return float4(lerp(e, output, Sharpening), 1.0);
+}
+
+technique AdaptiveSharpen
+{
+	pass
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = SharpenPS;
+	}
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Simple depth of field: computes the circle of confusion, gathers a ring-shaped bokeh on a downscaled image and composites it
+
+#include "ReShade.fxh"
+
+#ifndef DOF_RING_COUNT
+	#define DOF_RING_COUNT 4
+#endif
+
+uniform float FocusDepth <
+	ui_type = "slider";
+	ui_min = 0.0; ui_max = 1.0;
+> = 0.02;
+uniform float FocusRange <
+	ui_type = "slider";
+	ui_min = 0.0; ui_max = 0.5;
+> = 0.05;
+uniform float BokehRadius <
+	ui_type = "slider";
+	ui_min = 1.0; ui_max = 20.0;
+> = 8.0;
+uniform int DebugView <
+	ui_type = "combo";
+	ui_items = "Off\0Circle of confusion\0Depth\0";
+> = 0;
+uniform bool AutoFocus = true;
+uniform float2 AutoFocusPoint = float2(0.5, 0.5);
+
+texture CoCTex { Width = BUFFER_WIDTH; Height = BUFFER_HEIGHT; Format = R16F; };
+texture BokehTex { Width = BUFFER_WIDTH / 2; Height = BUFFER_HEIGHT / 2; Format = RGBA16F; MipLevels = 2; };
+sampler CoCSampler { Texture = CoCTex; };
+sampler BokehSampler { Texture = BokehTex; MinFilter = LINEAR; MagFilter = LINEAR; };
+
+struct BokehSample
+{
+	float3 color;
+	float weight;
+};
+
+float GetFocusDepth()
+{
+	if (!AutoFocus)
+		return FocusDepth;
+
+	// Average the depth at a few points around the focus point
+	float depth = 0.0;
+	for (int y = -1; y <= 1; y++)
+		for (int x = -1; x <= 1; x++)
+			depth += ReShade::GetLinearizedDepth(AutoFocusPoint + float2(x, y) * BUFFER_PIXEL_SIZE * 4.0);
+	return depth / 9.0;
+}
+
+float CircleOfConfusionPS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	const float depth = ReShade::GetLinearizedDepth(texcoord);
+	const float focus = GetFocusDepth();
+
+	float coc = (depth - focus) / max(FocusRange, 1e-5);
+	coc = clamp(coc, -1.0, 1.0);
+	return coc;
+}
+
+void AccumulateSample(inout BokehSample result, float2 texcoord, float center_coc, float ring_radius)
+{
+	const float3 color = tex2Dlod(ReShade::BackBuffer, float4(texcoord, 0, 0)).rgb;
+	const float coc = tex2Dlod(CoCSampler, float4(texcoord, 0, 0)).x;
+
+	// Samples behind the center may only contribute with at most the center blur size
+	const float size = abs(coc) < abs(center_coc) && coc > 0.0 ? abs(coc) : abs(center_coc);
+	const float weight = saturate(size * BokehRadius - ring_radius + 1.0);
+
+	result.color += color * weight;
+	result.weight += weight;
+}
+
+float4 BokehPS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	const float center_coc = tex2D(CoCSampler, texcoord).x;
+
+	BokehSample result;
+	result.color = tex2D(ReShade::BackBuffer, texcoord).rgb;
+	result.weight = 1.0;
+
+	int ring = 1;
+	while (ring <= DOF_RING_COUNT)
+	{
+		const int sample_count = ring * 6;
+		const float ring_radius = float(ring) / DOF_RING_COUNT;
+
+		for (int i = 0; i < sample_count; ++i)
+		{
+			float s, c;
+			sincos(6.2831853 * i / sample_count, s, c);
+
+			const float2 offset = float2(c, s) * ring_radius * BokehRadius * BUFFER_PIXEL_SIZE * 2.0;
+			AccumulateSample(result, texcoord + offset, center_coc, ring_radius * BokehRadius);
+		}
+
+		ring++;
+	}
+
+	return float4(result.color / result.weight, abs(center_coc));
+}
+
+float4 CompositePS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	const float3 color = tex2D(ReShade::BackBuffer, texcoord).rgb;
+	const float4 bokeh = tex2Dlod(BokehSampler, float4(texcoord, 0, 1));
+	const float coc = tex2D(CoCSampler, texcoord).x;
+
+	[branch]
+	switch (DebugView)
+	{
+	case 1:
+		return float4(saturate(-coc), saturate(coc), 0.0, 1.0);
+	case 2:
+		return ReShade::GetLinearizedDepth(texcoord).xxxx;
+	}
+
+	return float4(lerp(color, bokeh.rgb, smoothstep(0.0, 0.25, abs(coc))), 1.0);
+}
+
+technique DepthOfField
+{
+	pass CircleOfConfusion
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = CircleOfConfusionPS;
+		RenderTarget = CoCTex;
+	}
+	pass Bokeh
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = BokehPS;
+		RenderTarget = BokehTex;
+	}
+	pass Composite
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = CompositePS;
+	}
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Luma and color edge detection with local contrast adaptation, followed by a simple directional edge blend
+
+#include "ReShade.fxh"
+
+#define EDGE_THRESHOLD 0.1
+#define LOCAL_CONTRAST_ADAPTATION_FACTOR 2.0
+#define LUMA(c) dot(c, float3(0.2126, 0.7152, 0.0722))
+#define OFFSET(x, y) (texcoord + float2(x, y) * BUFFER_PIXEL_SIZE)
+
+uniform int EdgeDetectionMode <
+	ui_type = "combo";
+	ui_items = "Luma\0Color\0";
+> = 0;
+uniform float Threshold <
+	ui_type = "slider";
+	ui_min = 0.05; ui_max = 0.2;
+> = EDGE_THRESHOLD;
+uniform bool ShowEdges = false;
+
+texture EdgesTex { Width = BUFFER_WIDTH; Height = BUFFER_HEIGHT; Format = RG8; };
+sampler EdgesSampler { Texture = EdgesTex; MinFilter = POINT; MagFilter = POINT; };
+
+float2 LumaEdges(float2 texcoord)
+{
+	const float L = LUMA(tex2D(ReShade::BackBuffer, texcoord).rgb);
+	const float Lleft = LUMA(tex2D(ReShade::BackBuffer, OFFSET(-1, 0)).rgb);
+	const float Ltop = LUMA(tex2D(ReShade::BackBuffer, OFFSET(0, -1)).rgb);
+
+	float4 delta;
+	delta.xy = abs(L - float2(Lleft, Ltop));
+	float2 edges = step(Threshold, delta.xy);
+
+	if (dot(edges, 1.0) == 0.0)
+		discard;
+
+	const float Lright = LUMA(tex2D(ReShade::BackBuffer, OFFSET(1, 0)).rgb);
+	const float Lbottom = LUMA(tex2D(ReShade::BackBuffer, OFFSET(0, 1)).rgb);
+	delta.zw = abs(L - float2(Lright, Lbottom));
+
+	float2 max_delta = max(delta.xy, delta.zw);
+
+	const float Lleftleft = LUMA(tex2D(ReShade::BackBuffer, OFFSET(-2, 0)).rgb);
+	const float Ltoptop = LUMA(tex2D(ReShade::BackBuffer, OFFSET(0, -2)).rgb);
+	delta.zw = abs(float2(Lleft, Ltop) - float2(Lleftleft, Ltoptop));
+
+	max_delta = max(max_delta.xy, delta.zw);
+	const float final_delta = max(max_delta.x, max_delta.y);
+
+	// Local contrast adaptation
+	edges.xy *= step(final_delta, LOCAL_CONTRAST_ADAPTATION_FACTOR * delta.xy);
+
+	return edges;
+}
+
+float2 ColorEdges(float2 texcoord)
+{
+	const float3 C = tex2D(ReShade::BackBuffer, texcoord).rgb;
+
+	float4 delta;
+	float3 t = abs(C - tex2D(ReShade::BackBuffer, OFFSET(-1, 0)).rgb);
+	delta.x = max(max(t.r, t.g), t.b);
+	t = abs(C - tex2D(ReShade::BackBuffer, OFFSET(0, -1)).rgb);
+	delta.y = max(max(t.r, t.g), t.b);
+
+	float2 edges = step(Threshold, delta.xy);
+	if (dot(edges, 1.0) == 0.0)
+		discard;
+
+	t = abs(C - tex2D(ReShade::BackBuffer, OFFSET(1, 0)).rgb);
+	delta.z = max(max(t.r, t.g), t.b);
+	t = abs(C - tex2D(ReShade::BackBuffer, OFFSET(0, 1)).rgb);
+	delta.w = max(max(t.r, t.g), t.b);
+
+	const float2 max_delta = max(delta.xy, delta.zw);
+	edges.xy *= step(max(max_delta.x, max_delta.y), LOCAL_CONTRAST_ADAPTATION_FACTOR * delta.xy);
+
+	return edges;
+}
+
+float2 EdgeDetectionPS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	return EdgeDetectionMode == 0 ? LumaEdges(texcoord) : ColorEdges(texcoord);
+}
+
+float4 BlendPS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	const float2 edges = tex2D(EdgesSampler, texcoord).rg;
+	const float4 color = tex2D(ReShade::BackBuffer, texcoord);
+
+	if (ShowEdges)
+		return float4(edges, 0.0, 1.0);
+	if (!any(edges))
+		return color;
+
+	float4 blended = color;
+	if (edges.x > 0.0)
+		blended += tex2D(ReShade::BackBuffer, OFFSET(-1, 0));
+	if (edges.y > 0.0)
+		blended += tex2D(ReShade::BackBuffer, OFFSET(0, -1));
+
+	return blended / (1.0 + edges.x + edges.y);
+}
+
+technique EdgeDetection
+{
+	pass
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = EdgeDetectionPS;
+		RenderTarget = EdgesTex;
+		ClearRenderTargets = true;
+	}
+	pass
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = BlendPS;
+	}
+}
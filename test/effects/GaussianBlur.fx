@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Separable gaussian blur with a configurable radius, applied in two passes at half resolution
+
+#include "ReShade.fxh"
+#include "ReShadeUI.fxh"
+
+#ifndef BLUR_SAMPLE_COUNT
+	#define BLUR_SAMPLE_COUNT 9
+#endif
+
+uniform float BlurStrength < __UNIFORM_SLIDER_FLOAT1
+	ui_label = "Strength";
+	ui_min = 0.0; ui_max = 1.0;
+> = 0.75;
+uniform float BlurRadius < __UNIFORM_SLIDER_FLOAT1
+	ui_label = "Radius";
+	ui_min = 0.5; ui_max = 4.0;
+> = 1.0;
+uniform int BlurMode < __UNIFORM_COMBO_INT1
+	ui_items = "Horizontal + Vertical\0Horizontal only\0Vertical only\0";
+> = 0;
+
+texture BlurTex { Width = BUFFER_WIDTH / 2; Height = BUFFER_HEIGHT / 2; Format = RGBA16F; };
+sampler BlurSampler { Texture = BlurTex; AddressU = CLAMP; AddressV = CLAMP; };
+
+static const float Offsets[BLUR_SAMPLE_COUNT] = { 0.0, 1.4584295168, 3.40398480678, 5.3518057801, 7.302940716, 9.2581597095, 11.2195383454, 13.1875535585, 15.1627356071 };
+static const float Weights[BLUR_SAMPLE_COUNT] = { 0.13298, 0.23227575, 0.1353261595, 0.0511557427, 0.01253922, 0.0019913644, 0.0002052387, 0.0000137203, 0.0000005933 };
+
+float3 BlurAxis(sampler s, float2 texcoord, float2 axis)
+{
+	float3 color = tex2D(s, texcoord).rgb * Weights[0];
+
+	[unroll]
+	for (int i = 1; i < BLUR_SAMPLE_COUNT; ++i)
+	{
+		const float2 offset = axis * Offsets[i] * BlurRadius;
+		color += tex2D(s, texcoord + offset).rgb * Weights[i];
+		color += tex2D(s, texcoord - offset).rgb * Weights[i];
+	}
+
+	return color;
+}
+
+float4 BlurHorizontalPS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	if (BlurMode == 2)
+		return tex2D(ReShade::BackBuffer, texcoord);
+
+	return float4(BlurAxis(ReShade::BackBuffer, texcoord, float2(BUFFER_PIXEL_SIZE.x * 2.0, 0.0)), 1.0);
+}
+
+float4 BlurVerticalPS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	const float3 original = tex2D(ReShade::BackBuffer, texcoord).rgb;
+	float3 blurred = tex2D(BlurSampler, texcoord).rgb;
+
+	if (BlurMode != 1)
+		blurred = BlurAxis(BlurSampler, texcoord, float2(0.0, BUFFER_PIXEL_SIZE.y * 2.0));
+
+	return float4(lerp(original, blurred, BlurStrength), 1.0);
+}
+
+technique GaussianBlur < ui_tooltip = "Blurs the image with a separable gaussian filter."; >
+{
+	pass Horizontal
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = BlurHorizontalPS;
+		RenderTarget = BlurTex;
+	}
+	pass Vertical
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = BlurVerticalPS;
+	}
+}
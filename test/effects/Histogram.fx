@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Computes a luminance histogram with a compute shader and uses it for auto exposure
+
+#include "ReShade.fxh"
+
+#define HISTOGRAM_BINS 64
+#define GROUP_SIZE 16
+
+uniform float AdaptationSpeed <
+	ui_type = "slider";
+	ui_min = 0.1; ui_max = 5.0;
+> = 1.0;
+uniform float FrameTime < source = "frametime"; >;
+
+texture HistogramTex { Width = HISTOGRAM_BINS; Height = 1; Format = R32U; };
+texture ExposureTex { Width = 1; Height = 1; Format = R32F; };
+storage<uint> HistogramStorage { Texture = HistogramTex; };
+storage<float> ExposureStorage { Texture = ExposureTex; };
+sampler<uint> HistogramSampler { Texture = HistogramTex; };
+sampler<float> ExposureSampler { Texture = ExposureTex; };
+
+groupshared uint LocalHistogram[HISTOGRAM_BINS];
+
+uint LuminanceToBin(float3 color)
+{
+	const float luma = dot(color, float3(0.2126, 0.7152, 0.0722));
+	if (luma < 0.0001)
+		return 0;
+
+	const float log_luma = saturate((log2(luma) + 10.0) / 12.0);
+	return uint(log_luma * (HISTOGRAM_BINS - 2) + 1.0);
+}
+
+void ClearCS(uint3 id : SV_DispatchThreadID)
+{
+	tex2Dstore(HistogramStorage, int2(id.x, 0), 0u);
+}
+
+void BuildHistogramCS(uint3 id : SV_DispatchThreadID, uint3 tid : SV_GroupThreadID)
+{
+	const uint local_index = tid.y * GROUP_SIZE + tid.x;
+	if (local_index < HISTOGRAM_BINS)
+		LocalHistogram[local_index] = 0;
+
+	barrier();
+
+	if (id.x < BUFFER_WIDTH && id.y < BUFFER_HEIGHT)
+	{
+		const float3 color = tex2Dfetch(ReShade::BackBuffer, int2(id.xy)).rgb;
+		atomicAdd(LocalHistogram[LuminanceToBin(color)], 1u);
+	}
+
+	barrier();
+
+	if (local_index < HISTOGRAM_BINS)
+		atomicAdd(HistogramStorage, int2(local_index, 0), LocalHistogram[local_index]);
+}
+
+void AverageCS(uint3 id : SV_DispatchThreadID)
+{
+	uint total = 0;
+	float weighted = 0.0;
+
+	// Skip the first bin, which contains all black pixels
+	for (int i = 1; i < HISTOGRAM_BINS; ++i)
+	{
+		const uint count = tex2Dfetch(HistogramSampler, int2(i, 0));
+		total += count;
+		weighted += float(count) * i;
+	}
+
+	const float average_bin = total > 0 ? weighted / total : HISTOGRAM_BINS / 2;
+	const float average_luma = exp2((average_bin - 1.0) / (HISTOGRAM_BINS - 2) * 12.0 - 10.0);
+
+	const float previous = tex2Dfetch(ExposureStorage, int2(0, 0));
+	const float adapted = previous + (average_luma - previous) * (1.0 - exp(-FrameTime * 0.001 * AdaptationSpeed));
+	tex2Dstore(ExposureStorage, int2(0, 0), adapted);
+}
+
+float4 ApplyExposurePS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	const float exposure = 0.18 / max(tex2Dfetch(ExposureSampler, int2(0, 0)), 0.0001);
+	return float4(tex2D(ReShade::BackBuffer, texcoord).rgb * exposure, 1.0);
+}
+
+technique AutoExposure
+{
+	pass Clear
+	{
+		ComputeShader = ClearCS<HISTOGRAM_BINS, 1>;
+		DispatchSizeX = 1;
+		DispatchSizeY = 1;
+	}
+	pass Build
+	{
+		ComputeShader = BuildHistogramCS<GROUP_SIZE, GROUP_SIZE>;
+		DispatchSizeX = (BUFFER_WIDTH + GROUP_SIZE - 1) / GROUP_SIZE;
+		DispatchSizeY = (BUFFER_HEIGHT + GROUP_SIZE - 1) / GROUP_SIZE;
+	}
+	pass Average
+	{
+		ComputeShader = AverageCS<1, 1>;
+		DispatchSizeX = 1;
+		DispatchSizeY = 1;
+	}
+	pass
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = ApplyExposurePS;
+	}
+}
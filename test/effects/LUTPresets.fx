@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Color grading presets generated with the preprocessor, to exercise function-like macros, token pasting, stringizing and conditional blocks
+
+#include "ReShade.fxh"
+#include "ReShadeUI.fxh"
+
+#ifndef PRESET_COUNT
+	#define PRESET_COUNT 6
+#endif
+#ifndef USE_FILM_GRAIN
+	#define USE_FILM_GRAIN 1
+#endif
+
+#define STRINGIZE_(x) #x
+#define STRINGIZE(x) STRINGIZE_(x)
+#define CONCAT_(a, b) a##b
+#define CONCAT(a, b) CONCAT_(a, b)
+#define SQR(x) ((x) * (x))
+#define LERP3(a, b, c, t) lerp(lerp(a, b, saturate(t * 2.0)), c, saturate(t * 2.0 - 1.0))
+
+// Preset definitions: name, lift, gamma, gain, saturation
+#define PRESETS(X) \
+	X(Neutral,  float3(0.00, 0.00, 0.00), float3(1.00, 1.00, 1.00), float3(1.00, 1.00, 1.00), 1.00) \
+	X(Warm,     float3(0.02, 0.01, 0.00), float3(0.95, 1.00, 1.05), float3(1.10, 1.02, 0.92), 1.05) \
+	X(Cold,     float3(0.00, 0.01, 0.03), float3(1.05, 1.00, 0.95), float3(0.92, 1.00, 1.10), 0.95) \
+	X(Bleak,    float3(0.03, 0.03, 0.03), float3(1.10, 1.10, 1.10), float3(0.95, 0.95, 0.95), 0.60) \
+	X(Vivid,    float3(0.00, 0.00, 0.00), float3(0.90, 0.90, 0.90), float3(1.05, 1.05, 1.05), 1.40) \
+	X(Sepia,    float3(0.05, 0.02, 0.00), float3(0.95, 1.00, 1.15), float3(1.08, 0.98, 0.80), 0.30)
+
+#define DECLARE_PRESET(name, lift, gamma, gain, sat) \
+	static const float3 CONCAT(name, _Lift) = lift; \
+	static const float3 CONCAT(name, _Gamma) = gamma; \
+	static const float3 CONCAT(name, _Gain) = gain; \
+	static const float CONCAT(name, _Saturation) = sat;
+PRESETS(DECLARE_PRESET)
+
+#define PRESET_NAME(name, lift, gamma, gain, sat) STRINGIZE(name) "\0"
+
+uniform int Preset < __UNIFORM_COMBO_INT1
+	ui_items = PRESETS(PRESET_NAME);
+> = 1;
+UI_SLIDER(Intensity, "Intensity", float, 0.0, 1.0, 1.0)
+UI_SLIDER(Vignette, "Vignette", float, 0.0, 1.0, 0.3)
+#if USE_FILM_GRAIN
+UI_SLIDER(GrainAmount, "Film grain", float, 0.0, 0.2, 0.02)
+uniform int FrameCount < source = "framecount"; >;
+#endif
+
+float3 LiftGammaGain(float3 color, float3 lift, float3 gamma, float3 gain)
+{
+	color = color * (1.5 - 0.5 * lift) + 0.5 * lift - 0.5;
+	color = saturate(color * gain);
+	return pow(abs(color), 1.0 / gamma);
+}
+
+float3 AdjustSaturation(float3 color, float saturation)
+{
+	const float luma = dot(color, float3(0.299, 0.587, 0.114));
+	return lerp(luma.xxx, color, saturation);
+}
+
+#define APPLY_PRESET(name, lift, gamma, gain, sat) \
+	if (index == 0) \
+		return AdjustSaturation(LiftGammaGain(color, CONCAT(name, _Lift), CONCAT(name, _Gamma), CONCAT(name, _Gain)), CONCAT(name, _Saturation)); \
+	index--;
+
+float3 ApplyPreset(float3 color, int index)
+{
+	PRESETS(APPLY_PRESET)
+	return color;
+}
+
+#if USE_FILM_GRAIN
+float Grain(float2 texcoord, int seed)
+{
+	const float2 p = texcoord * BUFFER_SCREEN_SIZE + float2(seed % 64, (seed / 64) % 64);
+	return frac(sin(dot(p, float2(12.9898, 78.233))) * 43758.5453) * 2.0 - 1.0;
+}
+#endif
+
+float4 GradePS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	const float3 original = tex2D(ReShade::BackBuffer, texcoord).rgb;
+	float3 color = ApplyPreset(original, clamp(Preset, 0, PRESET_COUNT - 1));
+	color = lerp(original, color, Intensity);
+
+	const float2 center = texcoord - 0.5;
+	color *= 1.0 - Vignette * SQR(length(center * float2(BUFFER_ASPECT_RATIO, 1.0)));
+
+#if USE_FILM_GRAIN && defined(GrainAmount)
+	#error "GrainAmount is a uniform, not a macro"
+#elif USE_FILM_GRAIN
+	color += Grain(texcoord, FrameCount) * GrainAmount;
+#endif
+
+	return float4(LERP3(0.0.xxx, color, 1.0.xxx, 0.5), 1.0);
+}
+
+technique LUTPresets < ui_label = "Color presets (" STRINGIZE(PRESET_COUNT) ")"; >
+{
+	pass
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = GradePS;
+	}
+}
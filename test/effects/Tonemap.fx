@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Exposure, white balance and filmic tone mapping with a few selectable curves
+
+#include "ReShade.fxh"
+#include "ReShadeUI.fxh"
+
+UI_SLIDER(Exposure, "Exposure", float, -3.0, 3.0, 0.0)
+UI_SLIDER(Gamma, "Gamma", float, 0.5, 2.0, 1.0)
+UI_SLIDER(Saturation, "Saturation", float, 0.0, 2.0, 1.1)
+UI_SLIDER(Bleach, "Bleach", float, 0.0, 1.0, 0.0)
+UI_SLIDER(Defog, "Defog", float, 0.0, 1.0, 0.05)
+
+uniform float3 FogColor < __UNIFORM_COLOR_FLOAT3
+	ui_label = "Defog color";
+> = float3(0.0, 0.0, 1.0);
+uniform int Curve < __UNIFORM_COMBO_INT1
+	ui_items = "Reinhard\0Hable\0ACES\0None\0";
+> = 2;
+uniform float Timer < source = "timer"; >;
+
+static const float3 LumaCoefficients = float3(0.2126, 0.7152, 0.0722);
+static const float ShoulderStrength = 0.22;
+static const float LinearStrength = 0.30;
+static const float LinearAngle = 0.10;
+static const float ToeStrength = 0.20;
+static const float ToeNumerator = 0.01;
+static const float ToeDenominator = 0.30;
+static const float LinearWhite = 11.2;
+
+// sRGB to ACES AP1 and back, pre-multiplied with the RRT saturation matrix
+static const float3x3 ACESInputMatrix = float3x3(
+	0.59719, 0.35458, 0.04823,
+	0.07600, 0.90834, 0.01566,
+	0.02840, 0.13383, 0.83777);
+static const float3x3 ACESOutputMatrix = float3x3(
+	 1.60475, -0.53108, -0.07367,
+	-0.10208,  1.10813, -0.00605,
+	-0.00327, -0.07276,  1.07602);
+
+float3 Hable(float3 x)
+{
+	const float A = ShoulderStrength, B = LinearStrength, C = LinearAngle, D = ToeStrength, E = ToeNumerator, F = ToeDenominator;
+	return ((x * (A * x + C * B) + D * E) / (x * (A * x + B) + D * F)) - E / F;
+}
+
+float3 RRTAndODTFit(float3 v)
+{
+	const float3 a = v * (v + 0.0245786) - 0.000090537;
+	const float3 b = v * (0.983729 * v + 0.4329510) + 0.238081;
+	return a / b;
+}
+
+float3 ApplyCurve(float3 color, int curve)
+{
+	switch (curve)
+	{
+	case 0:
+		return color / (1.0 + color);
+	case 1:
+		return Hable(color * 2.0) / Hable(LinearWhite);
+	case 2:
+		color = mul(ACESInputMatrix, color);
+		color = RRTAndODTFit(color);
+		return saturate(mul(ACESOutputMatrix, color));
+	default:
+		return saturate(color);
+	}
+}
+
+float4 TonemapPS(float4 position : SV_Position, float2 texcoord : TEXCOORD) : SV_Target
+{
+	float3 color = tex2D(ReShade::BackBuffer, texcoord).rgb;
+
+	// Remove tint
+	color = saturate(color - Defog * FogColor * 2.55);
+
+	color *= exp2(Exposure);
+	color = pow(abs(color), Gamma);
+
+	const float luma = dot(color, LumaCoefficients);
+
+	// Bleach bypass
+	const float3 blend = luma.rrr;
+	const float l = saturate(10.0 * (luma - 0.45));
+	const float3 result1 = 2.0 * color * blend;
+	const float3 result2 = 1.0 - 2.0 * (1.0 - blend) * (1.0 - color);
+	const float3 bleached = lerp(result1, result2, l) * blend;
+	color = lerp(color, bleached, Bleach);
+
+	color = lerp(dot(color, LumaCoefficients).xxx, color, Saturation);
+	color = ApplyCurve(color, Curve);
+
+	// Tiny amount of animated dither to hide banding
+	const float noise = frac(sin(dot(texcoord + (Timer * 0.001).xx, float2(12.9898, 78.233))) * 43758.5453);
+	color += (noise - 0.5) / 255.0;
+
+	return float4(color, 1.0);
+}
+
+technique Tonemap
+{
+	pass
+	{
+		VertexShader = PostProcessVS;
+		PixelShader = TonemapPS;
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include <cstdio>
+#include <cstring> // std::strcmp, std::strstr
+
+static std::filesystem::path s_effects_path = "test/effects";
+static unsigned int s_failure_count = 0;
+
+std::vector<reshadefx::test::test_case> &reshadefx::test::test_cases()
+{
+	static std::vector<test_case> cases;
+	return cases;
+}
+
+const std::filesystem::path &reshadefx::test::effects_path()
+{
+	return s_effects_path;
+}
+
+std::filesystem::path reshadefx::test::create_temp_directory(const char *name)
+{
+	std::error_code ec;
+	const std::filesystem::path path = std::filesystem::temp_directory_path(ec) / name;
+	std::filesystem::remove_all(path, ec);
+	std::filesystem::create_directories(path, ec);
+	return path;
+}
+
+void reshadefx::test::report_failure(const char *file, int line, const std::string &message)
+{
+	fprintf(stderr, "%s(%d): check failed: %s\n", file, line, message.c_str());
+	s_failure_count++;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filter = nullptr;
+
+	// Parse command-line arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		if (0 == std::strcmp(argv[i], "--effects") && i + 1 < argc)
+			s_effects_path = std::filesystem::u8path(argv[++i]);
+		else
+			filter = argv[i];
+	}
+
+	unsigned int failed_test_count = 0;
+	unsigned int executed_test_count = 0;
+
+	for (const reshadefx::test::test_case &test : reshadefx::test::test_cases())
+	{
+		if (filter != nullptr && std::strstr(test.name, filter) == nullptr)
+			continue;
+
+		const unsigned int previous_failure_count = s_failure_count;
+		test.function();
+		executed_test_count++;
+
+		if (s_failure_count != previous_failure_count)
+		{
+			failed_test_count++;
+			fprintf(stderr, "[FAILED] %s\n", test.name);
+		}
+		else
+		{
+			printf("[PASSED] %s\n", test.name);
+		}
+	}
+
+	printf("%u of %u test cases passed\n", executed_test_count - failed_test_count, executed_test_count);
+
+	return failed_test_count != 0 ? 1 : 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <filesystem>
+
+namespace reshadefx::test
+{
+	struct test_case
+	{
+		const char *name;
+		void(*function)();
+	};
+
+	/// <summary>
+	/// Gets the list of all test cases defined with <see cref="TEST_CASE"/>.
+	/// </summary>
+	std::vector<test_case> &test_cases();
+
+	/// <summary>
+	/// Gets the directory containing the test effects (set with the "--effects" command-line option).
+	/// </summary>
+	const std::filesystem::path &effects_path();
+
+	/// <summary>
+	/// Creates an empty directory with the specified <paramref name="name"/> in the temporary directory, removing anything that was left in it by a previous run.
+	/// </summary>
+	std::filesystem::path create_temp_directory(const char *name);
+
+	/// <summary>
+	/// Records a failed check in the currently running test case.
+	/// </summary>
+	void report_failure(const char *file, int line, const std::string &message);
+
+	struct test_case_registration
+	{
+		test_case_registration(const char *name, void(*function)()) { test_cases().push_back({ name, function }); }
+	};
+}
+
+#define TEST_CASE(name) \
+	static void test_##name(); \
+	static const reshadefx::test::test_case_registration test_##name##_registration(#name, &test_##name); \
+	static void test_##name()
+
+#define CHECK(expression) \
+	((expression) ? (void)0 : reshadefx::test::report_failure(__FILE__, __LINE__, #expression))
+#define CHECK_MESSAGE(expression, message) \
+	((expression) ? (void)0 : reshadefx::test::report_failure(__FILE__, __LINE__, std::string(#expression) + ": " + (message)))
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2014 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "test.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+
+static bool all_ran_once(const std::vector<std::atomic<uint32_t>> &counts)
+{
+	for (const std::atomic<uint32_t> &count : counts)
+		if (count != 1)
+			return false;
+	return true;
+}
+
+TEST_CASE(thread_pool_parallel_for_runs_every_index_exactly_once)
+{
+	for (const size_t num_threads : { 1, 2, 8 })
+	{
+		thread_pool pool(num_threads);
+
+		for (const size_t count : { 0, 1, 3, 1000 })
+		{
+			std::vector<std::atomic<uint32_t>> counts(count);
+			pool.parallel_for(count, [&counts](size_t i) { counts[i]++; });
+			CHECK_MESSAGE(all_ran_once(counts), std::to_string(count) + " indices on " + std::to_string(num_threads) + " threads");
+		}
+	}
+}
+
+TEST_CASE(thread_pool_parallel_for_can_be_nested_in_tasks)
+{
+	constexpr size_t num_tasks = 16;
+	constexpr size_t num_outer_indices = 8;
+	constexpr size_t num_inner_indices = 64;
+
+	for (const size_t num_threads : { 1, 4 })
+	{
+		thread_pool pool(num_threads);
+
+		// Every task calls 'parallel_for' from a worker, which in turn calls 'parallel_for' again, so that helpers are queued while all workers may be busy
+		std::vector<std::atomic<uint32_t>> counts(num_tasks * num_outer_indices * num_inner_indices);
+		for (size_t task = 0; task < num_tasks; ++task)
+		{
+			pool.submit([&pool, &counts, task]() {
+				pool.parallel_for(num_outer_indices, [&pool, &counts, task](size_t outer) {
+					pool.parallel_for(num_inner_indices, [&counts, task, outer](size_t inner) {
+						counts[(task * num_outer_indices + outer) * num_inner_indices + inner]++;
+					});
+				});
+			});
+		}
+
+		pool.wait();
+
+		CHECK_MESSAGE(all_ran_once(counts), std::to_string(num_threads) + " threads");
+	}
+}
+
+TEST_CASE(thread_pool_wait_drains_tasks_submitted_from_workers)
+{
+	constexpr uint32_t depth = 6;
+	constexpr uint32_t num_children = 3;
+
+	for (const size_t num_threads : { 1, 4 })
+	{
+		std::atomic<uint32_t> num_finished = 0;
+
+		thread_pool pool(num_threads);
+
+		// Each task queues more tasks from within the pool, so 'wait' has to cover work that did not exist yet when it was called
+		std::function<void(uint32_t)> spawn;
+		spawn = [&pool, &spawn, &num_finished](uint32_t level) {
+			if (level < depth)
+				for (uint32_t i = 0; i < num_children; ++i)
+					pool.submit([&spawn, level]() { spawn(level + 1); });
+			num_finished++;
+		};
+
+		pool.submit([&spawn]() { spawn(0); });
+		pool.wait();
+
+		// Sum of the geometric series 1 + 3 + 9 + ... for every level of the tree
+		uint32_t num_expected = 0;
+		for (uint32_t level = 0, num_tasks = 1; level <= depth; ++level, num_tasks *= num_children)
+			num_expected += num_tasks;
+
+		CHECK_MESSAGE(num_finished == num_expected, std::to_string(num_finished) + " of " + std::to_string(num_expected) + " tasks finished on " + std::to_string(num_threads) + " threads");
+
+		// The pool has to be reusable after waiting
+		pool.submit([&num_finished]() { num_finished++; });
+		pool.wait();
+		CHECK(num_finished == num_expected + 1);
+	}
+}
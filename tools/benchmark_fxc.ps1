@@ -0,0 +1,167 @@
+Param(
+	[string]
+	$fxc = "..\bin\x64\Release\fxc.exe",
+	# Another build of fxc to compare against (like one built from the commit before a change), or empty to only measure the one above
+	[string]
+	$baseline = "",
+	[string]
+	$effects = "..\test\effects",
+	[int]
+	$iterations = 10,
+	# Number of distinct constants in the generated constant stress effect, or zero to skip it
+	[int]
+	$stress_constants = 8000,
+	# Number of lines in the generated lexer stress effect (the others are scaled from it), or zero to skip them
+	[int]
+	$stress_lines = 20000,
+	# Additional arguments passed to fxc, like "--hlsl" or "--optimize" (by default SPIR-V is generated), or "--d3dcompile" to measure the time D3DCompile takes on the generated HLSL code too
+	[string[]]
+	$arguments = @()
+)
+
+$files = @(Get-ChildItem -Path $effects -Filter "*.fx" | ForEach-Object { $_.FullName })
+
+# Entry points and technique shared by all generated effects, which only differ in the pixel shader body and the declarations in front of it
+function Write-StressEffect([string]$name, [string]$declarations, [string]$body) {
+	$file = Join-Path ([System.IO.Path]::GetTempPath()) "fxc_stress_$name.fx"
+
+	@"
+$declarations
+
+void StressVS(in uint id : SV_VertexID, out float4 position : SV_Position)
+{
+	position = float4((id == 2) ? 3.0 : -1.0, (id == 1) ? -3.0 : 1.0, 0.0, 1.0);
+}
+float4 StressPS(float4 position : SV_Position) : SV_Target
+{
+	float4 result = 0.0;
+$body
+	return result;
+}
+
+technique Stress
+{
+	pass
+	{
+		VertexShader = StressVS;
+		PixelShader = StressPS;
+	}
+}
+"@ | Out-File -FilePath $file -Encoding ASCII
+
+	return $file
+}
+
+# Generate an effect with a large constant lookup table and many lines of distinct vector constants, which stresses the constant and type lookups of the code generation backends
+if ($stress_constants -gt 0) {
+	$table = [string]::Join(", ", (0..($stress_constants - 1) | ForEach-Object { "$_.5" }))
+	$lines = 0..([int]($stress_constants * 3 / 8) - 1) | ForEach-Object { "`tresult += float4($_.0, $_.25, $_.5, $_.75) * table[$($_ % $stress_constants)];" }
+
+	$files += Write-StressEffect "constants" "static const float table[$stress_constants] = { $table };" ([string]::Join("`n", $lines))
+}
+
+if ($stress_lines -gt 0) {
+	# Generate an effect made mostly of long comments, runs of whitespace, long identifiers and string literals, which stresses the character scans of the lexer
+	$comment = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua"
+	$indent = " " * 48
+	$groups = 0..([int]($stress_lines / 16) - 1) | ForEach-Object {
+		$index = $_
+		$block_comment = [string]::Join("`n", (1..8 | ForEach-Object { " * $comment" }))
+		$line_comments = [string]::Join("`n", (1..4 | ForEach-Object { "$indent// $comment" }))
+		"/*`n$block_comment`n */`n$line_comments`nuniform float stress_uniform_with_a_rather_long_identifier_name_$index < ui_label = ""$comment $index""; > = $index.0;"
+	}
+
+	$files += Write-StressEffect "lexer" ([string]::Join("`n", $groups)) "`tresult += stress_uniform_with_a_rather_long_identifier_name_0;"
+
+	# Generate an effect with many intrinsic calls, keywords and preprocessor directives, which stresses the keyword, directive and intrinsic lookups
+	# This uses fewer lines, since each of them generates a lot more code than the lines of the other effects
+	$lines = 0..([int]($stress_lines / 16) - 1) | ForEach-Object {
+		"#if $($_ % 3)`n`t{ const float4 value = saturate(abs(sin(float4($_.0, $_.25, $_.5, $_.75)))); result += lerp(value, sqrt(value), frac($_.5)) * dot(normalize(value.xyz), float3(1.0, 0.5, 0.25)); }`n#else`n`tresult.x += max(min(cos($_.0), 1.0), exp2(-$_.0));`n#endif"
+	}
+
+	$files += Write-StressEffect "keywords" "" ([string]::Join("`n", $lines))
+
+	# Generate effects with many uses of object-like and nested function-like macros (including '#', '##' and '__VA_ARGS__'), which stress macro expansion in the preprocessor
+	$lines = 0..($stress_lines - 1) | ForEach-Object { "`tresult += STRESS_VECTOR * STRESS_HALF + STRESS_ONE - STRESS_ZERO * $_.0;" }
+
+	$files += Write-StressEffect "object_macros" @"
+#define STRESS_ZERO 0.0
+#define STRESS_ONE 1.0
+#define STRESS_HALF (STRESS_ONE * 0.5)
+#define STRESS_VECTOR float4(STRESS_HALF, STRESS_ONE, STRESS_ZERO, STRESS_HALF)
+"@ ([string]::Join("`n", $lines))
+
+	$lines = 0..([int]($stress_lines / 8) - 1) | ForEach-Object { "`tresult += STRESS_MAD(STRESS_VECTOR($_.0, $_.25, STRESS_SCALE, STRESS_ADD($_.5, STRESS_SCALE)), STRESS_SCALE, STRESS_OFFSET($($_ % 4)));" }
+	$uniforms = 0..([int]($stress_lines / 64) - 1) | ForEach-Object { "STRESS_UNIFORM($_)" }
+
+	$files += Write-StressEffect "function_macros" @"
+#define STRESS_SCALE 0.5
+#define STRESS_ADD(a, b) ((a) + (b))
+#define STRESS_MUL(a, b) ((a) * (b))
+#define STRESS_MAD(a, b, c) STRESS_ADD(STRESS_MUL(a, b), c)
+#define STRESS_VECTOR(...) float4(__VA_ARGS__)
+#define STRESS_CAT(a, b) a##b
+#define STRESS_OFFSET(i) STRESS_CAT(stress_offset_, i)
+#define STRESS_UNIFORM(i) uniform float STRESS_CAT(stress_uniform_, i) < ui_label = #i; > = i;
+static const float4 stress_offset_0 = 0.0;
+static const float4 stress_offset_1 = 1.0;
+static const float4 stress_offset_2 = 2.0;
+static const float4 stress_offset_3 = 3.0;
+$([string]::Join("`n", $uniforms))
+"@ ([string]::Join("`n", $lines))
+}
+
+$output_file = [System.IO.Path]::GetTempFileName()
+
+# Run the compiler on an effect several times and keep the best time of each compilation stage
+# The time of the whole process is kept too, so that builds which do not support '--timings' yet can be compared as well
+function Measure-Effect([string]$compiler, [string]$file) {
+	$best = [ordered]@{}
+
+	for ($i = 0; $i -lt $iterations; $i++) {
+		$stopwatch = [System.Diagnostics.Stopwatch]::StartNew()
+		$timings = @(& $compiler --timings @arguments -Fo $output_file $file 2>&1 | ForEach-Object { "$_" })
+		$stopwatch.Stop()
+
+		if ($LASTEXITCODE -ne 0) {
+			Write-Error "Failed to compile '$file' with '$compiler':`n$([string]::Join("`n", $timings))"
+			break
+		}
+
+		$timings += "total: $($stopwatch.Elapsed.TotalMilliseconds.ToString([System.Globalization.CultureInfo]::InvariantCulture)) ms"
+
+		foreach ($line in $timings) {
+			if ($line -match "^(\w+(\.\w+)?).*: ([0-9.]+) ms") {
+				$time = [double]::Parse($matches[3], [System.Globalization.CultureInfo]::InvariantCulture)
+				if (-not $best.Contains($matches[1]) -or $time -lt $best[$matches[1]]) {
+					$best[$matches[1]] = $time
+				}
+			}
+		}
+	}
+
+	return $best
+}
+
+$results = foreach ($file in $files) {
+	$best = Measure-Effect $fxc $file
+
+	$result = [ordered]@{ Effect = [System.IO.Path]::GetFileName($file) }
+	foreach ($stage in $best.Keys) {
+		$result["$stage (ms)"] = $best[$stage]
+	}
+
+	if ($baseline -ne "") {
+		$best_baseline = Measure-Effect $baseline $file
+
+		foreach ($stage in $best_baseline.Keys) {
+			$result["$stage baseline (ms)"] = $best_baseline[$stage]
+		}
+	}
+
+	[PSCustomObject]$result
+}
+
+Remove-Item $output_file
+
+$results | Format-Table -AutoSize
@@ -6,9 +6,15 @@
 #include "effect_parser.hpp"
 #include "effect_codegen.hpp"
 #include "effect_preprocessor.hpp"
+#include "effect_cache.hpp"
 #include "version.h"
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#ifdef _WIN32
+#include <Windows.h>
+#include <d3dcompiler.h>
+#endif
 
 static void print_usage(const char *path)
 {
@@ -24,6 +30,7 @@ Options:
 
   -Fo <file>                Output SPIR-V binary to the given file.
   -Fe <file>                Output warnings and errors to the given file.
+  --all-targets <path>      Generate HLSL, GLSL and SPIR-V code from a single parse and write it to "<path>.hlsl", "<path>.glsl" and "<path>.spv".
 
   --glsl                    Print GLSL code for the previously specified entry point.
   --hlsl                    Print HLSL code for the previously specified entry point.
@@ -34,8 +41,14 @@ Options:
   --invert-y                Insert code to invert the Y component of the output position in vertex shaders (only applies to SPIR-V).
   --spec-constants          Convert uniform variables to specialization constants.
   --vulkan-semantics        Generate GLSL/SPIR-V code under Vulkan semantics, instead of OpenGL semantics.
+  --optimize                Fold constant operations and eliminate common subexpressions before generating code.
 
   -Zi                       Enable debug information.
+  --timings                 Print the time spent in each compilation stage to standard error.
+  --d3dcompile              Generate HLSL code and compile every entry point of it with D3DCompile (only available on Windows), to include its time in the timings.
+
+  --compact-cache <file>    Compact the given effect cache file (usually "reshade-effects.cache" in the intermediate cache path) instead of compiling, dropping outdated data.
+  --cache-size <value>      Size in MB to shrink the effect cache file to when compacting, by evicting the least recently used entries. Defaults to 0, which keeps all entries.
 	)", path);
 }
 
@@ -45,6 +58,9 @@ int main(int argc, char *argv[])
 	const char *preprocess = nullptr;
 	const char *errorfile = nullptr;
 	const char *objectfile = nullptr;
+	const char *all_targets_path = nullptr;
+	const char *compact_cache_path = nullptr;
+	uint64_t cache_size = 0;
 	const char *buffer_width = "800";
 	const char *buffer_height = "600";
 	bool print_glsl = false;
@@ -53,6 +69,9 @@ int main(int argc, char *argv[])
 	bool invert_y_axis = false;
 	bool spec_constants = false;
 	bool vulkan_semantics = false;
+	bool optimize = false;
+	bool print_timings = false;
+	bool d3d_compile = false;
 	unsigned int shader_model = 50;
 
 	reshadefx::preprocessor pp;
@@ -102,6 +121,12 @@ int main(int argc, char *argv[])
 				spec_constants = true;
 			else if (0 == std::strcmp(arg, "--vulkan-semantics"))
 				vulkan_semantics = true;
+			else if (0 == std::strcmp(arg, "--optimize"))
+				optimize = true;
+			else if (0 == std::strcmp(arg, "--timings"))
+				print_timings = true;
+			else if (0 == std::strcmp(arg, "--d3dcompile"))
+				d3d_compile = print_hlsl = true;
 
 			if (i + 1 >= argc)
 				continue;
@@ -111,8 +136,14 @@ int main(int argc, char *argv[])
 				errorfile = argv[++i];
 			else if (0 == std::strcmp(arg, "-Fo"))
 				objectfile = argv[++i];
+			else if (0 == std::strcmp(arg, "--all-targets"))
+				all_targets_path = argv[++i];
 			else if (0 == std::strcmp(arg, "--shader-model"))
 				shader_model = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+			else if (0 == std::strcmp(arg, "--compact-cache"))
+				compact_cache_path = argv[++i];
+			else if (0 == std::strcmp(arg, "--cache-size"))
+				cache_size = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
 			else if (0 == std::strcmp(arg, "--width"))
 				buffer_width = argv[++i];
 			else if (0 == std::strcmp(arg, "--height"))
@@ -130,6 +161,30 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (compact_cache_path != nullptr)
+	{
+		reshadefx::effect_cache cache;
+		if (!cache.open(compact_cache_path, 0))
+		{
+			std::cout << "error: Failed to open effect cache file " << compact_cache_path << std::endl;
+			return 1;
+		}
+
+		const size_t num_entries_before = cache.num_entries();
+		const uint64_t file_size_before = cache.file_size();
+
+		if (!cache.compact(cache_size))
+		{
+			std::cout << "error: Failed to compact effect cache file " << compact_cache_path << std::endl;
+			return 1;
+		}
+
+		printf("%zu entries (%llu bytes) -> %zu entries (%llu bytes)\n",
+			num_entries_before, static_cast<unsigned long long>(file_size_before),
+			cache.num_entries(), static_cast<unsigned long long>(cache.file_size()));
+		return 0;
+	}
+
 	if (filename == nullptr)
 	{
 		print_usage(argv[0]);
@@ -141,7 +196,15 @@ int main(int argc, char *argv[])
 	pp.add_macro_definition("BUFFER_RCP_WIDTH", "(1.0 / BUFFER_WIDTH)");
 	pp.add_macro_definition("BUFFER_RCP_HEIGHT", "(1.0 / BUFFER_HEIGHT)");
 
-	if (!pp.append_file(filename))
+	const auto time_preprocess_started = std::chrono::high_resolution_clock::now();
+	const bool preprocess_success = pp.append_file(filename);
+	const auto time_preprocess_finished = std::chrono::high_resolution_clock::now();
+
+	if (print_timings)
+		fprintf(stderr, "preprocess: %.3f ms (%zu redundant includes skipped)\n",
+			std::chrono::duration<double, std::milli>(time_preprocess_finished - time_preprocess_started).count(), pp.skipped_include_count());
+
+	if (!preprocess_success)
 	{
 		if (errorfile == nullptr)
 			std::cout << pp.errors() << std::endl;
@@ -159,16 +222,40 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
+	// Generating code for all targets shares a single parse between the back-ends, which are fed through a fan-out code generator
+	std::vector<std::unique_ptr<reshadefx::codegen>> all_targets;
+	if (all_targets_path != nullptr)
+	{
+		all_targets.emplace_back(reshadefx::create_codegen_hlsl(shader_model, debug_info, spec_constants, optimize));
+		all_targets.emplace_back(reshadefx::create_codegen_glsl(vulkan_semantics, debug_info, spec_constants, false, invert_y_axis, optimize));
+		all_targets.emplace_back(reshadefx::create_codegen_spirv(vulkan_semantics, debug_info, spec_constants, false, invert_y_axis, optimize));
+	}
+
 	std::unique_ptr<reshadefx::codegen> backend;
-	if (print_glsl)
-		backend.reset(reshadefx::create_codegen_glsl(vulkan_semantics, debug_info, spec_constants, invert_y_axis));
+	if (!all_targets.empty())
+	{
+		std::vector<reshadefx::codegen *> targets;
+		for (const std::unique_ptr<reshadefx::codegen> &target : all_targets)
+			targets.push_back(target.get());
+		backend.reset(reshadefx::create_codegen_fanout(targets));
+	}
+	else if (print_glsl)
+		backend.reset(reshadefx::create_codegen_glsl(vulkan_semantics, debug_info, spec_constants, false, invert_y_axis, optimize));
 	else if (print_hlsl)
-		backend.reset(reshadefx::create_codegen_hlsl(shader_model, debug_info, spec_constants));
+		backend.reset(reshadefx::create_codegen_hlsl(shader_model, debug_info, spec_constants, optimize));
 	else
-		backend.reset(reshadefx::create_codegen_spirv(vulkan_semantics, debug_info, spec_constants, invert_y_axis));
+		backend.reset(reshadefx::create_codegen_spirv(vulkan_semantics, debug_info, spec_constants, false, invert_y_axis, optimize));
 
+	const auto time_parse_started = std::chrono::high_resolution_clock::now();
 	reshadefx::parser parser;
-	if (!parser.parse(pp.output(), backend.get()))
+	const bool parse_success = parser.parse(pp.output(), backend.get());
+	const auto time_parse_finished = std::chrono::high_resolution_clock::now();
+
+	if (print_timings)
+		fprintf(stderr, "parse: %.3f ms\n",
+			std::chrono::duration<double, std::milli>(time_parse_finished - time_parse_started).count());
+
+	if (!parse_success)
 	{
 		if (errorfile == nullptr)
 			std::cout << pp.errors() << parser.errors() << std::endl;
@@ -177,7 +264,114 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (!all_targets.empty())
+	{
+		const char *const extensions[] = { ".hlsl", ".glsl", ".spv" };
+
+		for (size_t i = 0; i < all_targets.size(); ++i)
+		{
+			const auto time_finalize_started = std::chrono::high_resolution_clock::now();
+			const std::basic_string<char> code = all_targets[i]->finalize_code();
+			const auto time_finalize_finished = std::chrono::high_resolution_clock::now();
+
+			if (print_timings)
+				fprintf(stderr, "finalize%s: %.3f ms (%zu bytes)\n", extensions[i],
+					std::chrono::duration<double, std::milli>(time_finalize_finished - time_finalize_started).count(), code.size());
+
+			std::ofstream(std::string(all_targets_path) + extensions[i], std::ios::binary).write(code.data(), code.size());
+		}
+
+		return 0;
+	}
+
+	const auto time_finalize_started = std::chrono::high_resolution_clock::now();
 	std::basic_string<char> code = backend->finalize_code();
+	const auto time_finalize_finished = std::chrono::high_resolution_clock::now();
+
+	if (print_timings)
+		fprintf(stderr, "finalize: %.3f ms (%zu bytes)\n",
+			std::chrono::duration<double, std::milli>(time_finalize_finished - time_finalize_started).count(), code.size());
+
+	if (d3d_compile)
+	{
+#ifdef _WIN32
+		const HMODULE d3d_compiler_module = LoadLibraryW(L"d3dcompiler_47.dll");
+		if (d3d_compiler_module == nullptr)
+		{
+			std::cout << "error: Unable to load HLSL compiler (\"d3dcompiler_47.dll\")" << std::endl;
+			return 1;
+		}
+
+		const auto D3DCompile = reinterpret_cast<pD3DCompile>(GetProcAddress(d3d_compiler_module, "D3DCompile"));
+
+		std::string profile_suffix;
+		if (shader_model >= 50)
+			profile_suffix = shader_model >= 51 ? "_5_1" : "_5_0";
+		else if (shader_model >= 40)
+			profile_suffix = shader_model >= 41 ? "_4_1" : "_4_0";
+		else
+			profile_suffix = "_3_0";
+
+		// Compile each entry point on its own, the same way the runtime does, so that the time includes all the work the HLSL compiler has to do on the generated code
+		double d3d_compile_duration = 0.0;
+		for (const std::pair<std::string, reshadefx::shader_type> &entry_point : backend->module().entry_points)
+		{
+			const std::basic_string<char> entry_point_code = backend->finalize_code_for_entry_point(entry_point.first);
+
+			std::string profile;
+			switch (entry_point.second)
+			{
+			case reshadefx::shader_type::vertex:
+				profile = "vs";
+				break;
+			case reshadefx::shader_type::pixel:
+				profile = "ps";
+				break;
+			case reshadefx::shader_type::compute:
+				profile = "cs";
+				break;
+			}
+			profile += profile_suffix;
+
+			ID3DBlob *d3d_compiled = nullptr, *d3d_errors = nullptr;
+
+			const auto time_d3d_compile_started = std::chrono::high_resolution_clock::now();
+			const HRESULT hr = D3DCompile(
+				entry_point_code.data(), entry_point_code.size(),
+				nullptr, nullptr, nullptr,
+				entry_point.first.c_str(),
+				profile.c_str(),
+				shader_model >= 40 ? D3DCOMPILE_ENABLE_STRICTNESS : 0, 0,
+				&d3d_compiled, &d3d_errors);
+			const auto time_d3d_compile_finished = std::chrono::high_resolution_clock::now();
+
+			d3d_compile_duration += std::chrono::duration<double, std::milli>(time_d3d_compile_finished - time_d3d_compile_started).count();
+
+			if (d3d_compiled != nullptr)
+				d3d_compiled->Release();
+
+			if (FAILED(hr))
+			{
+				std::cout << "error: " << entry_point.first << ": ";
+				if (d3d_errors != nullptr)
+					std::cout.write(static_cast<const char *>(d3d_errors->GetBufferPointer()), d3d_errors->GetBufferSize() - 1);
+				std::cout << std::endl;
+			}
+
+			if (d3d_errors != nullptr)
+				d3d_errors->Release();
+
+			if (FAILED(hr))
+				return 1;
+		}
+
+		if (print_timings)
+			fprintf(stderr, "d3dcompile: %.3f ms (%zu entry points)\n", d3d_compile_duration, backend->module().entry_points.size());
+#else
+		std::cout << "error: D3DCompile is only available on Windows" << std::endl;
+		return 1;
+#endif
+	}
 
 	if (print_glsl || print_hlsl)
 	{